@@ -0,0 +1,260 @@
+/*
+Allocation bounds on the hot paths: stage, status, commit and merge
+
+Counts the calls to the global operator new made by each operation on a generated repository of
+2000 files, or as many as given, run against memory object stores so the filesystem does not blur
+the counts, and fails if any exceeds its bound. Stage, commit and merge run on a fresh Repository,
+and status through its command, as vms would run them.
+Bounds are a fixed allowance plus an allowance per hundred tracked files, so they hold at other
+repository sizes, with about a tenth to spare: one more allocation per file exceeds them. Raise
+them only together with an explanation of the allocations added.
+
+Build and run with make allocs, or run bin/allocs [files] once built.
+*/
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <new>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "objectstore.hpp"
+#include "repository.hpp"
+#include "vms.hpp"
+
+using namespace std;
+
+static atomic<unsigned long> n_allocations(0);
+
+void* operator new(size_t size) {
+    n_allocations++;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == NULL) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+const size_t DEFAULT_FILES = 2000;
+const size_t FILES_PER_DIRECTORY = 100;
+const size_t LINES_PER_FILE = 12;
+
+static size_t n_files = DEFAULT_FILES;
+
+// Every Repository of the benchmark, and the one the commands run through, works on these instead of .vms/objects and .vms/cache
+static MemoryObjectStore objects;
+static MemoryObjectStore staging;
+
+struct Bound {
+    const char* operation;
+    unsigned long fixed;
+    unsigned long per_hundred_files;
+};
+
+// Measured at 2000 and 8000 files: stage 16 allocations whatever the size, status 1 per hundred files, and commit 2 and merge 8 per file
+const Bound BOUNDS[] = {
+    {"stage", 40, 0},
+    {"status", 200, 20},
+    {"commit", 300, 220},
+    {"merge", 600, 850},
+};
+
+/** Path of the i-th generated file **/
+static string file_path(size_t i) {
+    char path[64];
+    snprintf(path, sizeof(path), "d%03zu/nested/path/file_%05zu.txt", i / FILES_PER_DIRECTORY, i);
+    return path;
+}
+
+/** Writes the i-th generated file, with the given line replaced by text unless text is NULL **/
+static void write_file(size_t i, size_t line, const char* text) {
+    ofstream ofs(file_path(i));
+    for (size_t l = 0; l < LINES_PER_FILE; l++) {
+        if (l == line && text != NULL) {
+            ofs << text << "\n";
+        } else {
+            ofs << "line " << l << " of file " << i << "\n";
+        }
+    }
+}
+
+/** Stages the i-th generated file with a fresh repository handle, exiting on failure **/
+static void stage_or_exit(size_t i) {
+    Repository repository;
+    repository.use_object_stores(&objects, &staging);
+    if (repository.stage(file_path(i)) != REPO_OK) {
+        cerr << "Unable to stage " << file_path(i) << endl;
+        exit(2);
+    }
+}
+
+static void commit_or_exit(const char* message) {
+    Repository repository;
+    repository.use_object_stores(&objects, &staging);
+    string commit_id;
+    if (repository.commit(message, commit_id) != REPO_OK) {
+        cerr << "Unable to commit " << message << endl;
+        exit(2);
+    }
+}
+
+static void checkout_or_exit(const char* branch) {
+    Repository repository;
+    repository.use_object_stores(&objects, &staging);
+    if (repository.checkout_branch(branch) != REPO_OK) {
+        cerr << "Unable to check out " << branch << endl;
+        exit(2);
+    }
+}
+
+/** Checks the allocations counted since start against the bound of operation, printing both. Returns false if it is exceeded. **/
+static bool check(const char* operation, unsigned long start) {
+    unsigned long n = n_allocations - start;
+    for (size_t i = 0; i < sizeof(BOUNDS) / sizeof(BOUNDS[0]); i++) {
+        if (string(BOUNDS[i].operation) != operation) {
+            continue;
+        }
+        unsigned long bound = BOUNDS[i].fixed + BOUNDS[i].per_hundred_files * n_files / 100;
+        printf("%-8s %8lu allocations (bound %lu)\n", operation, n, bound);
+        if (n > bound) {
+            printf("%-8s exceeds its bound by %lu allocations\n", operation, n - bound);
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        n_files = strtoul(argv[1], NULL, 10);
+        if (n_files < 2) {
+            fprintf(stderr, "usage: %s [files]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    char directory[] = "/tmp/vms-allocs.XXXXXX";
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        perror("Unable to create a scratch directory");
+        return 2;
+    }
+
+    vms_repository().use_object_stores(&objects, &staging);
+
+    // Output of the commands run is of no interest, only their allocations
+    ostringstream discarded;
+    streambuf* cout_buf = cout.rdbuf(discarded.rdbuf());
+
+    if (vms_init("loose") != 0) {
+        cout.rdbuf(cout_buf);
+        cerr << "Unable to initialize a repository in " << directory << endl;
+        return 2;
+    }
+
+    for (size_t i = 0; i < n_files; i += FILES_PER_DIRECTORY) {
+        string dir = file_path(i);
+        for (size_t slash = dir.find('/'); slash != string::npos; slash = dir.find('/', slash + 1)) {
+            mkdir(dir.substr(0, slash).c_str(), 0755);
+        }
+    }
+    for (size_t i = 0; i < n_files; i++) {
+        write_file(i, 0, NULL);
+        stage_or_exit(i);
+    }
+    commit_or_exit("base");
+
+    // A side branch changing every 89th file, and the first line of a file master changes the last line of
+    {
+        Repository repository;
+        repository.use_object_stores(&objects, &staging);
+        if (repository.create_branch("side") != REPO_OK) {
+            cerr << "Unable to create branch side" << endl;
+            return 2;
+        }
+    }
+    checkout_or_exit("side");
+    for (size_t i = 1; i < n_files; i += 89) {
+        write_file(i, 0, "changed on side");
+        stage_or_exit(i);
+    }
+    commit_or_exit("side");
+    checkout_or_exit("master");
+    for (size_t i = 1; i < n_files; i += 97) {
+        write_file(i, LINES_PER_FILE - 1, "changed on master");
+        stage_or_exit(i);
+    }
+    commit_or_exit("master");
+
+    bool ok = true;
+
+    write_file(0, 0, "staged change");
+    unsigned long start = n_allocations;
+    {
+        Repository repository;
+        repository.use_object_stores(&objects, &staging);
+        if (repository.stage(file_path(0)) != REPO_OK) {
+            cerr << "Unable to stage " << file_path(0) << endl;
+            ok = false;
+        }
+    }
+    ok = check("stage", start) && ok;
+
+    start = n_allocations;
+    if (vms_status("vms", 0, NULL) != 0) {
+        cerr << "Unable to show the status" << endl;
+        ok = false;
+    }
+    ok = check("status", start) && ok;
+
+    start = n_allocations;
+    {
+        Repository repository;
+        repository.use_object_stores(&objects, &staging);
+        string commit_id;
+        if (repository.commit("staged change", commit_id) != REPO_OK) {
+            cerr << "Unable to commit the staged change" << endl;
+            ok = false;
+        }
+    }
+    ok = check("commit", start) && ok;
+
+    start = n_allocations;
+    {
+        Repository repository;
+        repository.use_object_stores(&objects, &staging);
+        MergeResult result;
+        if (repository.merge("side", false, result) != REPO_OK) {
+            cerr << "Unable to merge side" << endl;
+            ok = false;
+        }
+    }
+    ok = check("merge", start) && ok;
+
+    cout.rdbuf(cout_buf);
+    vms_repository().use_object_stores(NULL, NULL);
+
+    string command = string("rm -rf ") + directory;
+    if (system(command.c_str()) != 0) {
+        cerr << "Unable to remove " << directory << endl;
+    }
+
+    return ok ? 0 : 1;
+}
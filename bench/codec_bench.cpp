@@ -0,0 +1,321 @@
+/*
+Benchmark of the compact encoding of codec.hpp against the boost archives objects were stored in before
+
+For a commit tracking n files, a text blob and a log of n entries, reports the size of the payload
+and of the object file holding it, and the time taken to encode and decode each, both ways:
+
+    payload   the bare encoding: codec.hpp's payload, or an uncompressed boost binary archive
+    file      the object file written to disk: by write_object_file, or a zlib-compressed
+              archive by save_archive, and reading it back into the object
+
+Files are written to a scratch directory, so their times include the filesystem's. Build and run
+with make bench, or run bin/codec_bench [files [iterations]] once built. Timings depend on the build
+flags, which are unoptimized by default, so compare them with each other only.
+*/
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <stack>
+#include <string>
+
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/deque.hpp>
+#include <boost/serialization/stack.hpp>
+
+#include "archive.hpp"
+#include "blob.hpp"
+#include "codec.hpp"
+#include "commit.hpp"
+
+using namespace std;
+
+const size_t DEFAULT_FILES = 10000;
+const size_t DEFAULT_ITERATIONS = 20;
+const size_t BLOB_SIZE = 1 << 20;
+
+static uint64_t random_state = 88172645463325252ULL;
+
+/** Deterministic xorshift generator, so every run encodes the same objects **/
+static uint64_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static ObjectId random_id() {
+    unsigned char raw[OBJECT_ID_SIZE];
+    for (size_t i = 0; i < OBJECT_ID_SIZE; i++) {
+        raw[i] = next_random();
+    }
+    return ObjectId::from_bytes(raw);
+}
+
+/** Milliseconds per call of fn, averaged over iterations calls **/
+static double time_ms(size_t iterations, const function<void()>& fn) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        fn();
+    }
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / iterations;
+}
+
+template <class T>
+static void save_boost_payload(const T& obj, string& out) {
+    ostringstream oss;
+    {
+        boost::archive::binary_oarchive boa(oss);
+        boa << obj;
+    }
+    out = oss.str();
+}
+
+template <class T>
+static void restore_boost_payload(T& obj, const string& in) {
+    istringstream iss(in);
+    boost::archive::binary_iarchive bia(iss);
+    bia >> obj;
+}
+
+/** Size of the file at filepath **/
+static size_t file_size(const char* filepath) {
+    struct stat s;
+    return stat(filepath, &s) == 0 ? s.st_size : 0;
+}
+
+/** Reads back an object file of the given kind, exiting if it is unreadable, as nothing else can be measured then **/
+static void read_or_exit(const char* filepath, char kind, string& buffer, const char*& data, size_t& length) {
+    bool checksummed;
+    if (read_object_file(filepath, kind, buffer, data, length, checksummed) != 0) {
+        fprintf(stderr, "Unable to read the object file %s\n", filepath);
+        exit(1);
+    }
+}
+
+/** Exits unless a decoded object matched the one encoded, as timings of broken decoding mean nothing **/
+static void check_round_trip(bool matched, const char* kind) {
+    if (!matched) {
+        fprintf(stderr, "Decoding the encoded %s did not restore it\n", kind);
+        exit(1);
+    }
+}
+
+/** Measurements of one kind of object, in bytes and milliseconds, compact first and boost second **/
+struct Result {
+    size_t payload_bytes[2];
+    size_t file_bytes[2];
+    double encode_payload_ms[2];
+    double decode_payload_ms[2];
+    double encode_file_ms[2];
+    double decode_file_ms[2];
+};
+
+static void print_row(const char* what, const char* unit, const double values[2]) {
+    printf("  %-16s %12.2f %12.2f %-3s", what, values[0], values[1], unit);
+    if (values[0] > 0) {
+        printf(" %6.1fx\n", values[1] / values[0]);
+    } else {
+        printf(" %7s\n", "-");
+    }
+}
+
+static void print_result(const char* name, const Result& result) {
+    double payload_kb[2] = {result.payload_bytes[0] / 1024.0, result.payload_bytes[1] / 1024.0};
+    double file_kb[2] = {result.file_bytes[0] / 1024.0, result.file_bytes[1] / 1024.0};
+
+    printf("%s\n  %-16s %12s %12s %-3s %7s\n", name, "", "compact", "boost", "", "ratio");
+    print_row("payload size", "KiB", payload_kb);
+    print_row("file size", "KiB", file_kb);
+    print_row("encode payload", "ms", result.encode_payload_ms);
+    print_row("decode payload", "ms", result.decode_payload_ms);
+    print_row("write file", "ms", result.encode_file_ms);
+    print_row("read file", "ms", result.decode_file_ms);
+}
+
+static Result bench_commit(size_t n_files, size_t iterations) {
+    Commit commit;
+    char path[64];
+    for (size_t i = 0; i < n_files; i++) {
+        snprintf(path, sizeof(path), "src/module%03zu/sub/file%05zu.cpp", i / 100, i);
+        commit.put_to_map(path, random_id());
+    }
+    commit.set_second_parent(random_id());
+
+    const char* file = ".vms/commit";
+    const char* boost_file = ".vms/commit.boost";
+
+    Result result;
+    string payload, archive;
+    result.encode_payload_ms[0] = time_ms(iterations, [&]() { payload.clear(); encode_commit(commit, payload); });
+    result.encode_payload_ms[1] = time_ms(iterations, [&]() { save_boost_payload(commit, archive); });
+    result.encode_file_ms[0] = time_ms(iterations, [&]() {
+        payload.clear();
+        encode_commit(commit, payload);
+        write_object_file(file, CODEC_KIND_COMMIT, payload);
+    });
+    result.encode_file_ms[1] = time_ms(iterations, [&]() { save_archive(commit, boost_file); });
+
+    result.decode_payload_ms[0] = time_ms(iterations, [&]() { Commit decoded; decode_commit(payload.data(), payload.length(), decoded); });
+    result.decode_payload_ms[1] = time_ms(iterations, [&]() { Commit decoded; restore_boost_payload(decoded, archive); });
+    result.decode_file_ms[0] = time_ms(iterations, [&]() {
+        string buffer;
+        const char* data;
+        size_t length;
+        read_or_exit(file, CODEC_KIND_COMMIT, buffer, data, length);
+        Commit decoded;
+        decode_commit(data, length, decoded);
+    });
+    result.decode_file_ms[1] = time_ms(iterations, [&]() { Commit decoded; restore_archive(decoded, boost_file); });
+
+    string buffer;
+    const char* data;
+    size_t length;
+    Commit decoded, restored;
+    read_or_exit(file, CODEC_KIND_COMMIT, buffer, data, length);
+    restore_archive(restored, boost_file);
+    check_round_trip(decode_commit(data, length, decoded) == 0 && decoded.id() == commit.id() && restored.id() == commit.id(), "commit");
+
+    result.payload_bytes[0] = payload.length();
+    result.payload_bytes[1] = archive.length();
+    result.file_bytes[0] = file_size(file);
+    result.file_bytes[1] = file_size(boost_file);
+    return result;
+}
+
+static Result bench_blob(size_t iterations) {
+    // Text of words drawn from a small vocabulary, compressible as source files are
+    const char* words[] = {"int", "return", "const", "std::string", "if", "else", "for", "while", "(", ")", "{", "}", ";", "\n    "};
+    string content;
+    while (content.length() < BLOB_SIZE) {
+        content += words[next_random() % (sizeof(words) / sizeof(words[0]))];
+        content += ' ';
+    }
+    Blob blob;
+    blob.set_content(string(content));
+
+    const char* file = ".vms/blob";
+    const char* boost_file = ".vms/blob.boost";
+
+    Result result;
+    string archive;
+    result.encode_payload_ms[0] = 0;    // a blob's payload is its bare content
+    result.encode_payload_ms[1] = time_ms(iterations, [&]() { save_boost_payload(blob, archive); });
+    result.encode_file_ms[0] = time_ms(iterations, [&]() { write_object_file(file, CODEC_KIND_BLOB, blob.get_content()); });
+    result.encode_file_ms[1] = time_ms(iterations, [&]() { save_archive(blob, boost_file); });
+
+    result.decode_payload_ms[0] = time_ms(iterations, [&]() { Blob decoded; decoded.set_content(string(content)); });
+    result.decode_payload_ms[1] = time_ms(iterations, [&]() { Blob decoded; restore_boost_payload(decoded, archive); });
+    result.decode_file_ms[0] = time_ms(iterations, [&]() {
+        string buffer;
+        const char* data;
+        size_t length;
+        read_or_exit(file, CODEC_KIND_BLOB, buffer, data, length);
+        Blob decoded;
+        decoded.set_content(string(data, length));
+    });
+    result.decode_file_ms[1] = time_ms(iterations, [&]() { Blob decoded; restore_archive(decoded, boost_file); });
+
+    string buffer;
+    const char* data;
+    size_t length;
+    Blob restored;
+    read_or_exit(file, CODEC_KIND_BLOB, buffer, data, length);
+    restore_archive(restored, boost_file);
+    check_round_trip(string(data, length) == content && restored.get_content() == content, "blob");
+
+    result.payload_bytes[0] = content.length();
+    result.payload_bytes[1] = archive.length();
+    result.file_bytes[0] = file_size(file);
+    result.file_bytes[1] = file_size(boost_file);
+    return result;
+}
+
+static Result bench_log(size_t n_entries, size_t iterations) {
+    stack<string> log;
+    for (size_t i = 0; i < n_entries; i++) {
+        log.push("commit " + random_id().hex() + "\nDate: Mon Oct 19 11:16:17 2026\n\n    Change number " + to_string(i) + "\n");
+    }
+
+    const char* file = ".vms/log";
+    const char* boost_file = ".vms/log.boost";
+
+    Result result;
+    string payload, archive;
+    result.encode_payload_ms[0] = time_ms(iterations, [&]() { payload.clear(); encode_log(log, payload); });
+    result.encode_payload_ms[1] = time_ms(iterations, [&]() { save_boost_payload(log, archive); });
+    result.encode_file_ms[0] = time_ms(iterations, [&]() {
+        payload.clear();
+        encode_log(log, payload);
+        write_object_file(file, CODEC_KIND_LOG, payload);
+    });
+    result.encode_file_ms[1] = time_ms(iterations, [&]() { save_archive(log, boost_file); });
+
+    result.decode_payload_ms[0] = time_ms(iterations, [&]() { stack<string> decoded; decode_log(payload.data(), payload.length(), decoded); });
+    result.decode_payload_ms[1] = time_ms(iterations, [&]() { stack<string> decoded; restore_boost_payload(decoded, archive); });
+    result.decode_file_ms[0] = time_ms(iterations, [&]() {
+        string buffer;
+        const char* data;
+        size_t length;
+        read_or_exit(file, CODEC_KIND_LOG, buffer, data, length);
+        stack<string> decoded;
+        decode_log(data, length, decoded);
+    });
+    result.decode_file_ms[1] = time_ms(iterations, [&]() { stack<string> decoded; restore_archive(decoded, boost_file); });
+
+    string buffer;
+    const char* data;
+    size_t length;
+    stack<string> decoded, restored;
+    read_or_exit(file, CODEC_KIND_LOG, buffer, data, length);
+    restore_archive(restored, boost_file);
+    check_round_trip(decode_log(data, length, decoded) == 0 && decoded == log && restored == log, "log");
+
+    result.payload_bytes[0] = payload.length();
+    result.payload_bytes[1] = archive.length();
+    result.file_bytes[0] = file_size(file);
+    result.file_bytes[1] = file_size(boost_file);
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    size_t n_files = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_FILES;
+    size_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : DEFAULT_ITERATIONS;
+    if (n_files == 0 || iterations == 0) {
+        fprintf(stderr, "usage: %s [files [iterations]]\n", argv[0]);
+        return 2;
+    }
+
+    // Object files can only be written within a .vms directory
+    char directory[] = "/tmp/vms-codec-bench.XXXXXX";
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0 || mkdir(".vms", 0755) != 0) {
+        perror("Unable to create a scratch directory");
+        return 2;
+    }
+
+    printf("Times per object, averaged over %zu iterations; ratio is boost over compact\n\n", iterations);
+
+    char name[64];
+    snprintf(name, sizeof(name), "commit tracking %zu files", n_files);
+    print_result(name, bench_commit(n_files, iterations));
+
+    snprintf(name, sizeof(name), "blob of %zu KiB of text", BLOB_SIZE / 1024);
+    print_result(name, bench_blob(iterations));
+
+    snprintf(name, sizeof(name), "log of %zu entries", n_files);
+    print_result(name, bench_log(n_files, iterations));
+
+    string command = string("rm -rf ") + directory;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "Unable to remove %s\n", directory);
+    }
+
+    return 0;
+}
@@ -2,10 +2,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/dir.h>
-
+#include <string.h>
+#include <errno.h>
 
 #include <map>
+#include <vector>
 #include <boost/serialization/map.hpp>
 
 #include <iostream>
@@ -15,100 +18,247 @@
 #include "access.hpp"
 #include "archive.hpp"
 #include "blob.hpp"
+#include "codec.hpp"
 #include "commit.hpp"
+#include "crc32c.hpp"
+#include "index.hpp"
+#include "objectstore.hpp"
+#include "refs.hpp"
+#include "utils.h"
 
 using namespace std;
 
-int restore_parent_commit(Commit& commit) {
-    string parent_id;
+static VerifyPolicy verify_policy = VERIFY_CHECKSUM;
 
-    if (get_parent_ref(parent_id) != 0) {
-        return -1;
-    }
+void set_verify_policy(VerifyPolicy policy) {
+    verify_policy = policy;
+}
 
-    ostringstream parent_path;
+VerifyPolicy get_verify_policy() {
+    return verify_policy;
+}
 
-    string parent_id_prefix;
-    string parent_id_suffix;
-    split_prefix_suffix(parent_id, parent_id_prefix, parent_id_suffix, PREFIX_LENGTH);
+/** Helper deciding whether an object needs its id recomputed after being read **/
+static bool needs_rehash(bool checksummed) {
+    return !checksummed || verify_policy == VERIFY_HASH;
+}
 
-    parent_path << ".vms/objects/" << parent_id_prefix << "/" << parent_id_suffix;
+int restore_commit_from_full_id(ObjectStore& objects, const ObjectId& commit_id, Commit& commit) {
+    bool checksummed;
+    int ret = load_commit(objects, commit_id, commit, checksummed);
+    if (ret != 0) {
+        return ret;
+    }
 
-    restore<Commit>(commit, parent_path.str());
+    // verify no tampering or corruption of restored object
+    return needs_rehash(checksummed) && commit.id() != commit_id ? -2 : 0;
+}
 
-    if (commit.hash() != parent_id) {
-        std::cerr << "Fatal error has occurred in retrieval of commit: uuid mismatch. Archived object may have been corrupted. Exiting..." << std::endl;
-        return -1;
+int restore_tree_from_full_id(ObjectStore& objects, const ObjectId& commit_id, FlatTree& tree) {
+    string buffer;
+    const char* data;
+    size_t length;
+    bool checksummed;
+    int ret = read_object(objects, commit_id, CODEC_KIND_COMMIT, buffer, data, length, checksummed);
+
+    if (ret == 1) { // legacy archives can only be read as a whole commit
+        Commit commit;
+        ret = restore_commit_from_full_id(objects, commit_id, commit);
+        if (ret != 0) {
+            return ret;
+        }
+        commit.load_tree(tree);
+        return 0;
+    } else if (ret != 0) {
+        return ret;
+    }
+
+    ObjectId restored_id;
+    bool rehash = needs_rehash(checksummed);
+    if (decode_commit_tree(data, length, tree, rehash ? &restored_id : NULL) != 0 || (rehash && restored_id != commit_id)) {
+        return -2;
     }
 
     return 0;
 }
 
-bool is_initialized() {
-    struct stat s;
-    int ret = stat(".vms", &s);
-    if (ret == -1 || !S_ISDIR(s.st_mode)) {
-        return false;
+int restore_blob_from_full_id(ObjectStore& objects, ObjectStore& staging, const ObjectId& blob_id, Blob& blob) {
+    ObjectStore* store = &objects;
+    if (!store->has(blob_id)) { // staged but not yet committed, so still in the staging store
+        store = &staging;
+    }
+
+    bool checksummed;
+    int ret = load_blob(*store, blob_id, blob, checksummed);
+    if (ret != 0) {
+        return ret;
+    }
+
+    // verify no tampering or corruption of restored object
+    return needs_rehash(checksummed) && blob.id() != blob_id ? -2 : 0;
+}
+
+/** Helper computing the CRC-32C of the first length bytes of the file open as fd **/
+static bool file_crc32c(int fd, uint64_t length, uint32_t& crc) {
+    char buf[64 * 1024];
+    crc = 0;
+    for (uint64_t offset = 0; offset < length; ) {
+        ssize_t nread = pread(fd, buf, length - offset < sizeof(buf) ? length - offset : sizeof(buf), offset);
+        if (nread <= 0) {
+            return false;
+        }
+        crc = crc32c(buf, nread, crc);
+        offset += nread;
     }
     return true;
 }
 
-bool is_staged_file(const char* filepath) {
-    if (filepath == NULL) {
-        return false;
+int materialize_raw_blob(ObjectStore& objects, ObjectStore& staging, const ObjectId& blob_id, const string& filepath) {
+    ObjectStore* store = &objects;
+    if (!store->has(blob_id)) {
+        store = &staging;
     }
 
-    map<string, string> index;  
-    restore< map<string, string> >(index, ".vms/index");
+    string path;
+    uint64_t offset;
+    uint64_t length;
+    if (!store->locate(blob_id, path, offset, length) || length < RAW_BODY_OFFSET) {
+        return 1;
+    }
 
-    map<string, string>::iterator it;
-    it = index.find(string(filepath));
+    int src_fd = open(path.c_str(), O_RDONLY);
+    if (src_fd == -1) {
+        return 1;
+    }
 
-    return it != index.end();
+    // Anything wrong with the header is left for the usual restore to report
+    char head[64];
+    const char* problem;
+    ObjectHeader header;
+    if (pread(src_fd, head, sizeof(head), offset) != (ssize_t) sizeof(head) || parse_object_header(head, sizeof(head), header, problem) != 0
+            || header.compression != COMPRESSION_RAW || header.kind != CODEC_KIND_BLOB || header.body_offset + header.payload_length != length) {
+        close(src_fd);
+        return 1;
+    }
 
-}
+    int dst_fd = open(filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (dst_fd == -1) {
+        close(src_fd);
+        return -1;
+    }
 
-bool is_tracked_file(const char* filepath) {
-    if (filepath == NULL) {
-        return false;
+    int ret = copy_file_data(src_fd, offset + header.body_offset, header.payload_length, dst_fd);
+    close(src_fd);
+    if (ret != 0) {
+        close(dst_fd);
+        unlink(filepath.c_str());
+        return -1;
+    }
+
+    // The payload never passed through memory, so check the copy rather than the object
+    bool intact;
+    if (verify_policy == VERIFY_HASH) {
+        intact = file_hash_equal_to_working_copy(filepath.c_str(), blob_id);
+    } else {
+        uint32_t crc;
+        intact = file_crc32c(dst_fd, header.payload_length, crc) && crc == header.crc;
+    }
+    close(dst_fd);
+
+    if (!intact) {
+        unlink(filepath.c_str());   // rather than leave damaged contents behind
+        return -2;
     }
 
-    Commit parent_commit;
+    return 0;
+}
 
-    restore_parent_commit(parent_commit);
+int checkout_blob(ObjectStore& objects, ObjectStore& staging, const ObjectId& blob_id, const string& filepath) {
+    int ret = materialize_raw_blob(objects, staging, blob_id, filepath);
+    if (ret != 1) {
+        return ret;
+    }
 
-    return parent_commit.map_contains(string(filepath));
+    Blob file;
+    ret = restore_blob_from_full_id(objects, staging, blob_id, file);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ofstream ofs(filepath, ios::binary);
+    ofs << file.get_content();
+    ofs.close();
 
+    return ofs.fail() ? -1 : 0;
 }
 
-bool is_modified_tracked_file(const char* filepath) {
+int move_from_cache_to_objects(ObjectStore& objects, ObjectStore& staging, const ObjectId& id) {
+    return objects.adopt(staging, id);
+}
 
-    if (filepath == NULL) {
-        return false;
+/** Creates directory path to file if it doesn't already exist and returns position of the end slash, or 0 if given file is not in a subdirectory.
+ * Input: .vms/objects/de/<file> 
+ * Output: 15
+ * 
+ * Input: foo
+ * Output: 0 **/
+int create_directory_path(string filepath) {
+    int pos = 0;
+    size_t ret = 0;
+    while(ret != string::npos) {
+        pos = ret;
+        ret = filepath.find("/", pos+1);
+        if (pos != 0) {
+            mkdir(filepath.substr(0, pos+1).c_str(), 0755);
+        }
     }
+    return pos;
+}
+
 
-    Commit parent_commit;
+int save_commit_object(ObjectStore& objects, const Commit& commit, const ObjectId& commit_id) {
+    string payload;
+    encode_commit(commit, payload);
 
-    restore_parent_commit(parent_commit);
+    return store_object(objects, commit_id, CODEC_KIND_COMMIT, payload);
+}
 
-    map<string, string> parent_map = parent_commit.get_map();
+bool is_initialized() {
+    struct stat s;
+    int ret = stat(".vms", &s);
+    if (ret == -1 || !S_ISDIR(s.st_mode)) {
+        return false;
+    }
+    return true;
+}
 
-    map<string, string>::iterator it;
-    it = parent_map.find(string(filepath));
+bool is_staged_file(const char* filepath) {
+    if (filepath == NULL) {
+        return false;
+    }
 
-    if (it == parent_map.end()) {
-        return true;    // Not being tracked, so by definition is modified relative to "tracked version"
-    } 
+    ObjectId id;
+    return find_staged(filepath, id) == 0;
 
-    // get its hash and compare it with hash of file of same name in working directory. If it is not equal, then is modified
-    return !file_hash_equal_to_working_copy(string(filepath), it->second);
 }
 
-bool file_hash_equal_to_working_copy(const std::string& filename, const std::string& hash) {
-    ifstream file_ifs(filename);
-    Blob file_contents(file_ifs);
+bool file_hash_equal_to_working_copy(const char* filename, const ObjectId& hash) {
+    // Hash the file in fixed-size pieces instead of loading it into a blob, so checking many files allocates nothing
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return ObjectHasher::hash("", 0) == hash;   // unreadable files compare as empty, as an empty blob would
+    }
+
+    ObjectHasher hasher;
+    char buf[64 * 1024];
+    ssize_t nread;
+
+    while ((nread = read(fd, buf, sizeof(buf))) > 0) {
+        hasher.update(buf, nread);
+    }
+    close(fd);
 
-    return file_contents.hash() == hash;
+    return nread == 0 && hasher.digest() == hash;
 }
 
 bool is_valid_file(const char* filepath) {
@@ -136,65 +286,7 @@ bool is_valid_dir(const char* dirpath) {
 }
 
 bool is_valid_branch(const char* branchname) {
-    DIR *dirptr = opendir(".vms/branches");
-    struct dirent *entry = readdir(dirptr);
-
-    while (entry != NULL) {
-        if (strcmp(".", entry->d_name) != 0 && strcmp("..", entry->d_name) != 0) {
-            if (strcmp(branchname, entry->d_name) == 0) {
-
-                return true;
-
-            }
-        }
-        entry = readdir(dirptr);
-
-    }
-
-    return false;
-
-}
-
-bool is_valid_commit_id(const char* commit_id) {
-
-    if (strlen(commit_id) <= PREFIX_LENGTH) {
-        return false;
-    }
-
-    std::string id_prefix;
-    std::string id_suffix;
-    split_prefix_suffix(std::string(commit_id), id_prefix, id_suffix, PREFIX_LENGTH);
-
-    ostringstream oss;
-    oss << ".vms/objects/" << id_prefix;
-
-    const char* obj_subdir = oss.str().c_str();
-    
-    
-    if (is_valid_dir(obj_subdir)) {
-    
-        DIR *dirptr = opendir(obj_subdir);
-        struct dirent *entry = readdir(dirptr);
-
-        int n_matches = 0;
-
-        while (entry != NULL) {
-            if (strcmp(".", entry->d_name) != 0 && strcmp("..", entry->d_name) != 0) {
-                if (strncmp(id_suffix.c_str(), entry->d_name, id_suffix.length()) == 0) {
-
-                    n_matches++;
-
-                }
-            }
-            entry = readdir(dirptr);
-        }
-
-        // must be exactly one match; else false
-        return n_matches == 1;
-
-    } // if not a valid dir, then cannot possibly exist, so return 0
-
-    return false;
+    return ref_exists(branchname);
 }
 
 int get_branch(string& strbuf) {
@@ -227,47 +319,24 @@ int get_branch_path(string& strbuf) {
 
 int get_parent_ref(string& strbuf) {
 
-    string branch_path;
-    
-    if (get_branch_path(branch_path) != 0) {
+    string branch_name;
+    if (get_branch(branch_name) != 0) {
         return -1;
     }
 
-    std::ifstream branch_ifs(branch_path);
-    if (!branch_ifs.is_open()) {
-        std::cerr << "Error occurred in retrieving parent commit id: unable to open file " << branch_path << std::endl;
+    if (read_ref(branch_name, strbuf) != 0) {
+        cerr << "Error occurred in retrieving parent commit id: unable to read branch " << branch_name << endl;
         return -1;
     }
 
-    getline(branch_ifs, strbuf);
-    branch_ifs.close();
-
     return 0;
 }
 
 int get_id_from_branch(const string& branchname, string& strbuf) {
-    ostringstream branch_path;
-    branch_path << ".vms/branches/" << branchname;
-
-    ifstream branch_ifs(branch_path.str());
-
-    if (!branch_ifs.is_open()) {
-        cerr << "Error occurred in retrieving commit pointed to by branch: unable to open file " << branch_path.str() << endl;
+    if (read_ref(branchname, strbuf) != 0) {
+        cerr << "Error occurred in retrieving commit pointed to by branch: unable to read branch " << branchname << endl;
         return -1;
     }
 
-    getline(branch_ifs, strbuf);
-    branch_ifs.close();
-
     return 0;
 }
-
-
-int split_prefix_suffix(const std::string& str, std::string& prefix, std::string& suffix, unsigned int n) {
-    if (n > str.length() - 1) {
-        return -1;
-    }
-    prefix = str.substr(0, n);
-    suffix = str.substr(n);
-    return 0;
-}
\ No newline at end of file
@@ -6,15 +6,66 @@ Collection of various file and directory access helper functions for vms
 
 #include <string>
 
-bool is_initialized();
+#include "objectid.hpp"
 
-bool is_staged_file(const char* filepath);
+class Commit;
+class Blob;
+class FlatTree;
+class ObjectStore;
+
+/*
+    How objects are checked when restored from the object or staging store.
+
+    VERIFY_CHECKSUM trusts an object whose stored CRC-32C matches its contents, which catches
+    damaged files at a fraction of the cost of hashing large blobs. Objects without a checksum
+    (written before checksums existed) are of unknown provenance and are always rehashed.
+    VERIFY_HASH recomputes the SHA-1 id of every object read, as vms fsck does.
+*/
+enum VerifyPolicy {
+    VERIFY_CHECKSUM,
+    VERIFY_HASH
+};
 
-bool is_tracked_file(const char* filepath);
+void set_verify_policy(VerifyPolicy policy);
+VerifyPolicy get_verify_policy();
 
-bool is_modified_tracked_file(const char* filepath);
+/*
+    Restoring objects: commits and trees are read from the object store objects, and blobs from the staging store staging
+    when they are staged but not yet committed. Nothing is printed; these return 0 on success, -1 if an object could not
+    be read or a file not written, or -2 if an object is missing or damaged, its contents not matching its id.
+*/
+int restore_commit_from_full_id(ObjectStore& objects, const ObjectId& commit_id, Commit& commit);
+
+int restore_blob_from_full_id(ObjectStore& objects, ObjectStore& staging, const ObjectId& blob_id, Blob& blob);
 
-bool file_hash_equal_to_working_copy(const std::string& filename, const std::string& hash);
+/* Loads only the files tracked by the given commit into tree, verifying the commit's id, without building a Commit */
+int restore_tree_from_full_id(ObjectStore& objects, const ObjectId& commit_id, FlatTree& tree);
+
+/*
+    Writes the content of the blob with the given id to filepath when the blob is stored raw (see codec.hpp),
+    cloning or copying it straight out of the store. The copy is checked against the blob's checksum, or its id
+    under VERIFY_HASH, and removed if it does not match. Returns 1 if the blob is not stored raw, so the caller
+    must restore it as usual, and otherwise as above.
+*/
+int materialize_raw_blob(ObjectStore& objects, ObjectStore& staging, const ObjectId& blob_id, const std::string& filepath);
+
+/* Writes the content of the blob with the given id to filepath, raw or not. Returns as above. */
+int checkout_blob(ObjectStore& objects, ObjectStore& staging, const ObjectId& blob_id, const std::string& filepath);
+
+/* Moves the staged blob with the given id from the staging store into the object store (see objectstore.hpp) */
+int move_from_cache_to_objects(ObjectStore& objects, ObjectStore& staging, const ObjectId& id);
+
+/* Saves commit into the object store under commit_id */
+int save_commit_object(ObjectStore& objects, const Commit& commit, const ObjectId& commit_id);
+
+/* Creates the directories leading to filepath if they don't already exist, returning the position of the last slash (0 if none) */
+int create_directory_path(std::string filepath);
+
+bool is_initialized();
+
+bool is_staged_file(const char* filepath);
+
+bool file_hash_equal_to_working_copy(const char* filename, const ObjectId& hash);
 
 bool is_valid_file(const char* filepath);
 
@@ -22,8 +73,6 @@ bool is_valid_dir(const char* dirpath);
 
 bool is_valid_branch(const char* branchname);
 
-bool is_valid_commit_id(const char* commit_id);
-
 int get_branch(std::string& strbuf);
 
 int get_branch_path(std::string& strbuf);
@@ -32,8 +81,6 @@ int get_parent_ref(std::string& strbuf);
 
 int get_id_from_branch(const std::string& branchname, std::string& strbuf);
 
-int split_prefix_suffix(const std::string& str, std::string& prefix, std::string& suffix, unsigned int n);
-
 const unsigned int PREFIX_LENGTH = 2;
 
 #endif // ACCESS_HPP
\ No newline at end of file
@@ -4,6 +4,10 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <stack>
+#include <unistd.h>
 
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
@@ -12,9 +16,17 @@
 #include <boost/iostreams/filtering_streambuf.hpp>
 
 
+/*
+    Boost archives, the format every object was stored in before the compact encoding of codec.hpp.
+    Still used to read objects written by earlier versions, and for any type without a compact encoding.
+    Archive is written to a temporary file that is renamed into place, so readers never observe a partially written file
+*/
 template <class T>
-void save(const T& obj, const std::string& filepath) {
-    std::ofstream ofs(filepath);
+void save_archive(const T& obj, const std::string& filepath) {
+    std::ostringstream tmp_filepath;
+    tmp_filepath << filepath << ".tmp." << getpid();
+
+    std::ofstream ofs(tmp_filepath.str());
     if (!ofs.is_open()) {
         std::cerr << "ERROR: File could not be opened." << std::endl;
         return;
@@ -29,25 +41,49 @@ void save(const T& obj, const std::string& filepath) {
         boost::archive::binary_oarchive boa(fos_buf);
         boa << obj;
     }
+
+    ofs.close();
+    if (ofs.fail() || std::rename(tmp_filepath.str().c_str(), filepath.c_str()) != 0) {
+        std::cerr << "ERROR: File could not be written." << std::endl;
+        std::remove(tmp_filepath.str().c_str());
+    }
 }
 
+/* Restores obj from an archive read from is, throwing boost exceptions if it is malformed */
 template <class T>
-void restore(T& obj, const std::string& filepath) {
+void restore_archive(T& obj, std::istream& is) {
+    boost::iostreams::filtering_istreambuf fis_buf;
+
+    fis_buf.push(boost::iostreams::zlib_decompressor());
+    fis_buf.push(is);
+
+    boost::archive::binary_iarchive bia(fis_buf);
+    bia >> obj;
+}
+
+template <class T>
+void restore_archive(T& obj, const std::string& filepath) {
     std::ifstream ifs(filepath);
     if (!ifs.is_open()) {
         std::cerr << "ERROR: File could not be opened." << std::endl;
         return;
     }
 
-    {
-        boost::iostreams::filtering_istreambuf fis_buf;
+    restore_archive<T>(obj, ifs);
+}
 
-        fis_buf.push(boost::iostreams::zlib_decompressor());
-        fis_buf.push(ifs);
+template <class T>
+void save(const T& obj, const std::string& filepath) {
+    save_archive<T>(obj, filepath);
+}
 
-        boost::archive::binary_iarchive bia(fis_buf);
-        bia >> obj;
-    }
+template <class T>
+void restore(T& obj, const std::string& filepath) {
+    restore_archive<T>(obj, filepath);
 }
 
+/* The commit log is written in the compact encoding, and read in either format (see codec.cpp). Commits and blobs go through object stores instead. */
+template <> void save< std::stack<std::string> >(const std::stack<std::string>& obj, const std::string& filepath);
+template <> void restore< std::stack<std::string> >(std::stack<std::string>& obj, const std::string& filepath);
+
 #endif // ARCHIVE_HPP
\ No newline at end of file
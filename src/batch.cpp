@@ -0,0 +1,188 @@
+#include <limits.h>
+#include <stdio.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "batch.hpp"
+#include "repository.hpp"
+#include "access.hpp"
+#include "utils.h"
+
+using namespace std;
+
+namespace {
+
+class BatchSession {
+    public:
+        /** Serves requests from in until end of input, returning 0 **/
+        int run(istream& in, FILE* out) {
+            string line;
+            string payload;
+
+            while (getline(in, line)) {
+                if (line.empty()) {
+                    continue;
+                }
+
+                string command;
+                string args;
+                size_t space = line.find(' ');
+                if (space == string::npos) {
+                    command = line;
+                } else {
+                    command = line.substr(0, space);
+                    args = line.substr(space + 1);
+                }
+
+                payload.clear();
+                int ret;
+
+                if (command == "info") {
+                    ret = info(args, payload);
+                } else if (command == "cat") {
+                    ret = cat(args, payload);
+                } else if (command == "resolve-id") {
+                    ret = resolve(args, payload);
+                } else if (command == "stage") {
+                    ret = stage(args, payload);
+                } else if (command == "unstage") {
+                    ret = unstage(args, payload);
+                } else if (command == "commit") {
+                    ret = commit(args, payload);
+                } else {
+                    payload = "Unknown command: '" + command + "'";
+                    ret = -1;
+                }
+
+                fprintf(out, "%s %lu\n", ret == 0 ? "ok" : "error", (unsigned long) payload.length());
+                fwrite(payload.data(), 1, payload.length(), out);
+                fputc('\n', out);
+                fflush(out);
+            }
+
+            return 0;
+        }
+
+    private:
+        Repository repository;
+
+        /** Sets payload to a description of the given repository error, returning -1 **/
+        static int fail(int error, const string& subject, string& payload) {
+            payload = subject + ": " + repo_strerror(error);
+            return -1;
+        }
+
+        int info(const string& args, string& payload) {
+            size_t space = args.find(' ');
+            string commit_id = args.substr(0, space);
+
+            if (space == string::npos) {
+                const Commit* commit;
+                int ret = repository.get_commit(commit_id, commit);
+                if (ret != REPO_OK) {
+                    return fail(ret, commit_id, payload);
+                }
+
+                payload = commit->log_string() + "\n" + commit->tracked_files_string() + "\n";
+                return 0;
+            }
+
+            string filename = args.substr(space + 1);
+            const string* content;
+            int ret = repository.file_at(commit_id, filename, content);
+
+            if (ret == REPO_NOT_FOUND) {
+                payload = "File not found in commit " + commit_id;
+                return -1;
+            } else if (ret != REPO_OK) {
+                return fail(ret, commit_id, payload);
+            }
+
+            payload = *content;
+            return 0;
+        }
+
+        int cat(const string& args, string& payload) {
+            string full_id;
+            const string* content;
+            int ret = repository.resolve_id(args, full_id);
+            if (ret == REPO_OK) {
+                ret = repository.get_blob(ObjectId::from_hex(full_id), content);
+            }
+
+            if (ret != REPO_OK) {
+                return fail(ret, args, payload);
+            }
+
+            payload = *content;
+            return 0;
+        }
+
+        int resolve(const string& args, string& payload) {
+            int ret = repository.resolve_id(args, payload);
+            if (ret != REPO_OK) {
+                return fail(ret, args, payload);
+            }
+
+            return 0;
+        }
+
+        /** Normalizes filename relative to the repository root the way the stage and unstage commands do **/
+        static string normalize(const string& filename) {
+            char norm_filepath[PATH_MAX];
+            if (is_valid_file(filename.c_str()) && normalize_relative_filepath(filename.c_str(), norm_filepath) == 0) {
+                return string(norm_filepath);
+            }
+            return filename;
+        }
+
+        int stage(const string& args, string& payload) {
+            string filename = normalize(args);
+
+            int ret = repository.stage(filename);
+            if (ret != REPO_OK) {
+                return fail(ret, filename, payload);
+            }
+
+            payload = filename;
+            return 0;
+        }
+
+        int unstage(const string& args, string& payload) {
+            string filename = normalize(args);
+
+            int ret = repository.unstage(filename);
+            if (ret != REPO_OK && ret != REPO_NOT_FOUND) {
+                return fail(ret, filename, payload);
+            }
+
+            payload = filename;
+            return 0;
+        }
+
+        int commit(const string& args, string& payload) {
+            if (args.empty()) {
+                payload = "Must provide a message with your commit";
+                return -1;
+            }
+
+            int ret = repository.commit(args, payload);
+            if (ret != REPO_OK) {
+                return fail(ret, "Unable to commit staged changes", payload);
+            }
+
+            return 0;
+        }
+};
+
+} // namespace
+
+int vms_batch() {
+    ios::sync_with_stdio(false);
+
+    BatchSession session;
+    return session.run(cin, stdout);
+}
@@ -0,0 +1,21 @@
+/*
+Persistent batch mode: serves many requests from one process, keeping repository state cached between them
+
+Requests are read from standard input, one per line:
+
+    info <commitid> [<filename>]    commit information, or contents of a file as of that commit
+    cat <blobid>                    contents of a blob
+    resolve-id <id>                 full id of the single object matching a shortened id
+    stage <filename>                stage a file
+    unstage <filename>              unstage a file
+    commit <message>                commit staged changes, responding with the new commit id
+
+Each response is written to standard output as a header line "ok <length>" or "error <length>",
+followed by exactly <length> bytes of payload and a newline.
+*/
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+int vms_batch();
+
+#endif // BATCH_HPP
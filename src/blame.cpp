@@ -0,0 +1,222 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+
+#include "blame.hpp"
+#include "crc32c.hpp"
+#include "diff.hpp"
+#include "utils.h"
+
+using namespace std;
+
+const char BLAME_MAGIC[6] = {'v', 'm', 's', 'b', 'l', 'm'};
+const unsigned char BLAME_VERSION = 2;     // 1 credited merges with every line brought in by their second parent
+
+// Magic, version, a reserved byte, and the numbers of commits and lines
+const size_t BLAME_HEADER_SIZE = 16;
+
+static void put_le32(unsigned char* out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const unsigned char* in) {
+    return (uint32_t) in[0] | ((uint32_t) in[1] << 8) | ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+/** Helper for the path of the cache entry of a version of a file, named by the hash of the commit, blob and path **/
+static string cache_path(const ObjectId& commit_id, const ObjectId& blob_id, const string& path) {
+    ObjectHasher hasher;
+    hasher.update(commit_id.data(), OBJECT_ID_SIZE);
+    hasher.update(blob_id.data(), OBJECT_ID_SIZE);
+    hasher.update(path);
+    return string(BLAME_CACHE_DIR) + "/" + hasher.digest().hex();
+}
+
+void start_blame(const string& content, const ObjectId& commit_id, Blame& blame) {
+    vector<LineRef> lines;
+    split_lines(content, lines);
+
+    blame.commits.assign(1, commit_id);
+    blame.lines.assign(lines.size(), 0);
+}
+
+void advance_blame(const string& old_content, const string& new_content, const ObjectId& commit_id, Blame& blame) {
+    vector<LineRef> old_lines;
+    vector<LineRef> new_lines;
+    split_lines(old_content, old_lines);
+    split_lines(new_content, new_lines);
+
+    vector<DiffChange> changes;
+    diff_lines(old_lines, new_lines, changes);
+
+    // Commits no longer credited with any line are dropped from the table, so it does not grow with the history
+    vector<uint32_t> lines;
+    lines.reserve(new_lines.size());
+    vector<long> renumbered(blame.commits.size() + 1, -1);
+    vector<ObjectId> commits;
+    uint32_t added = blame.commits.size();
+
+    size_t a = 0;
+    for (size_t i = 0; i <= changes.size(); i++) {
+        size_t unchanged_end = i < changes.size() ? changes[i].a_begin : old_lines.size();
+        for (; a < unchanged_end; a++) {
+            lines.push_back(blame.lines[a]);
+        }
+
+        if (i < changes.size()) {
+            lines.insert(lines.end(), changes[i].b_end - changes[i].b_begin, added);
+            a = changes[i].a_end;
+        }
+    }
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (renumbered[lines[i]] == -1) {
+            renumbered[lines[i]] = commits.size();
+            commits.push_back(lines[i] == added ? commit_id : blame.commits[lines[i]]);
+        }
+        lines[i] = renumbered[lines[i]];
+    }
+
+    blame.commits.swap(commits);
+    blame.lines.swap(lines);
+}
+
+void merge_blame(const string& other_content, const Blame& other, const string& content, const ObjectId& commit_id, Blame& blame) {
+    vector<LineRef> other_lines;
+    vector<LineRef> lines;
+    split_lines(other_content, other_lines);
+    split_lines(content, lines);
+
+    uint32_t merge = 0;
+    while (merge < blame.commits.size() && blame.commits[merge] != commit_id) {
+        merge++;
+    }
+    if (merge == blame.commits.size()) {
+        return;     // the merge wrote no line of its own
+    }
+
+    vector<DiffChange> changes;
+    diff_lines(other_lines, lines, changes);
+
+    // Commits of other join the table as they are first credited, unless already in it, and the merge is dropped if it keeps no line
+    vector<long> taken(other.commits.size(), -1);
+    vector<ObjectId> commits(blame.commits);
+
+    size_t a = 0;
+    size_t b = 0;
+    for (size_t i = 0; i <= changes.size(); i++) {
+        size_t unchanged_end = i < changes.size() ? changes[i].a_begin : other_lines.size();
+        for (; a < unchanged_end; a++, b++) {
+            if (blame.lines[b] != merge) {
+                continue;
+            }
+            uint32_t credited = other.lines[a];
+            if (taken[credited] == -1) {
+                size_t j = 0;
+                while (j < commits.size() && commits[j] != other.commits[credited]) {
+                    j++;
+                }
+                if (j == commits.size()) {
+                    commits.push_back(other.commits[credited]);
+                }
+                taken[credited] = j;
+            }
+            blame.lines[b] = taken[credited];
+        }
+
+        if (i < changes.size()) {
+            a = changes[i].a_end;
+            b = changes[i].b_end;
+        }
+    }
+
+    vector<long> renumbered(commits.size(), -1);
+    blame.commits.clear();
+    for (size_t i = 0; i < blame.lines.size(); i++) {
+        if (renumbered[blame.lines[i]] == -1) {
+            renumbered[blame.lines[i]] = blame.commits.size();
+            blame.commits.push_back(commits[blame.lines[i]]);
+        }
+        blame.lines[i] = renumbered[blame.lines[i]];
+    }
+}
+
+int load_cached_blame(const ObjectId& commit_id, const ObjectId& blob_id, const string& path, Blame& blame) {
+    ifstream ifs(cache_path(commit_id, blob_id, path), ios::binary);
+    if (!ifs.is_open()) {
+        return -1;
+    }
+
+    stringstream buffer;
+    buffer << ifs.rdbuf();
+    string data = buffer.str();
+
+    const unsigned char* bytes = (const unsigned char*) data.data();
+    if (data.length() < BLAME_HEADER_SIZE + 4 || memcmp(bytes, BLAME_MAGIC, sizeof(BLAME_MAGIC)) != 0
+            || bytes[sizeof(BLAME_MAGIC)] != BLAME_VERSION) {
+        return -1;
+    }
+
+    uint64_t n_commits = get_le32(bytes + 8);
+    uint64_t n_lines = get_le32(bytes + 12);
+    if (data.length() != BLAME_HEADER_SIZE + n_commits * OBJECT_ID_SIZE + n_lines * 4 + 4
+            || crc32c(bytes, data.length() - 4) != get_le32(bytes + data.length() - 4)) {
+        return -1;
+    }
+
+    const unsigned char* commits = bytes + BLAME_HEADER_SIZE;
+    const unsigned char* lines = commits + n_commits * OBJECT_ID_SIZE;
+
+    blame.commits.resize(n_commits);
+    for (size_t i = 0; i < n_commits; i++) {
+        blame.commits[i] = ObjectId::from_bytes(commits + i * OBJECT_ID_SIZE);
+    }
+
+    blame.lines.resize(n_lines);
+    for (size_t i = 0; i < n_lines; i++) {
+        blame.lines[i] = get_le32(lines + i * 4);
+        if (blame.lines[i] >= n_commits) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int save_cached_blame(const ObjectId& commit_id, const ObjectId& blob_id, const string& path, const Blame& blame) {
+    string data(BLAME_HEADER_SIZE + blame.commits.size() * OBJECT_ID_SIZE + blame.lines.size() * 4 + 4, '\0');
+    unsigned char* bytes = (unsigned char*) &data[0];
+
+    memcpy(bytes, BLAME_MAGIC, sizeof(BLAME_MAGIC));
+    bytes[sizeof(BLAME_MAGIC)] = BLAME_VERSION;
+    put_le32(bytes + 8, blame.commits.size());
+    put_le32(bytes + 12, blame.lines.size());
+
+    unsigned char* commits = bytes + BLAME_HEADER_SIZE;
+    for (size_t i = 0; i < blame.commits.size(); i++) {
+        memcpy(commits + i * OBJECT_ID_SIZE, blame.commits[i].data(), OBJECT_ID_SIZE);
+    }
+
+    unsigned char* lines = commits + blame.commits.size() * OBJECT_ID_SIZE;
+    for (size_t i = 0; i < blame.lines.size(); i++) {
+        put_le32(lines + i * 4, blame.lines[i]);
+    }
+    put_le32(bytes + data.length() - 4, crc32c(bytes, data.length() - 4));
+
+    // The cache directory is made on first use, and losing a race to make it is harmless
+    struct stat s;
+    if (stat(BLAME_CACHE_DIR, &s) != 0) {
+        make_dir(BLAME_CACHE_DIR);
+    }
+
+    string filepath = cache_path(commit_id, blob_id, path);
+    if (replace_file_atomically(filepath.c_str(), data.data(), data.length(), 0644) != 0) {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+Line authorship for vms blame, and its cache in .vms/blame
+
+A blame attributes each line of a version of a file to the commit that introduced it. It is built
+from the file's history along first parents, oldest version first: every line of the version that
+added the file is attributed to the commit that added it, and each later version keeps the
+attribution of the lines it shares with the version before (found by line diff, see diff.hpp) and
+attributes the lines it adds or changes to the commit that made it. A merge that took its version
+of the file from its second parent is passed along that parent instead, and lines a merge brings
+in from its second parent keep their attribution in the blame of that parent's version, so a
+merge is only credited with the lines it wrote itself.
+
+The blame of the version a commit gave a file depends only on history, which never changes, so it
+is cached under the commit, the blob and the path. Blaming the file again after later commits
+walks back to the newest cached version and replays only the versions made since.
+
+Each cache entry holds the distinct commits credited, the index of every line's commit among them
+and a CRC-32C of the whole. Entries are written atomically and never modified, so they are written
+without the repository lock.
+*/
+#ifndef BLAME_HPP
+#define BLAME_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "objectid.hpp"
+
+const char* const BLAME_CACHE_DIR = ".vms/blame";
+
+struct Blame {
+    std::vector<ObjectId> commits;  // each commit credited with some line, once
+    std::vector<uint32_t> lines;    // for each line, the index of its commit in commits
+};
+
+/* Attributes every line of content to commit_id, as for the version that added a file */
+void start_blame(const std::string& content, const ObjectId& commit_id, Blame& blame);
+
+/* Carries blame over from the lines of old_content to those of new_content, attributing the lines new_content adds or changes to commit_id */
+void advance_blame(const std::string& old_content, const std::string& new_content, const ObjectId& commit_id, Blame& blame);
+
+/*
+    Gives the lines of content that blame credits to commit_id, and that other_content has unchanged, the credit other gives
+    them, as for a merge commit_id whose second parent holds other_content
+*/
+void merge_blame(const std::string& other_content, const Blame& other, const std::string& content, const ObjectId& commit_id, Blame& blame);
+
+/* Reads the cached blame of the version blob_id of path made by commit_id. Returns 0 on success, or -1 if it is not cached or damaged. */
+int load_cached_blame(const ObjectId& commit_id, const ObjectId& blob_id, const std::string& path, Blame& blame);
+
+/* Caches the blame of the version blob_id of path made by commit_id. Returns 0 on success, or -1 on failure. */
+int save_cached_blame(const ObjectId& commit_id, const ObjectId& blob_id, const std::string& path, const Blame& blame);
+
+#endif // BLAME_HPP
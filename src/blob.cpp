@@ -1,5 +1,4 @@
 #include <iostream>
-#include <boost/compute/detail/sha1.hpp>
 
 #include "blob.hpp"
 
@@ -15,14 +14,39 @@ Blob::Blob(ifstream& filestream) {
 }
 
 string Blob::hash() const {
-    boost::compute::detail::sha1 hash(content);
-    return string(hash);
+    return id().hex();
 }
 
-string Blob::get_content() const {
+ObjectId Blob::id() const {
+    return ObjectHasher::hash(content.data(), content.length());
+}
+
+const string& Blob::get_content() const {
     return content;
 }
 
+string Blob::release_content() {
+    string released;
+    released.swap(content);
+    return released;
+}
+
 void Blob::set_content(ifstream& filestream) {
-    content.assign(istreambuf_iterator<char>(filestream), istreambuf_iterator<char>());
+    // Size the buffer once up front when the stream is seekable, rather than growing it a character at a time
+    filestream.seekg(0, ios::end);
+    streampos size = filestream.tellg();
+    filestream.seekg(0, ios::beg);
+
+    if (size > 0) {
+        content.resize(size);
+        filestream.read(&content[0], size);
+        content.resize(filestream.gcount());
+    } else {
+        filestream.clear();
+        content.assign(istreambuf_iterator<char>(filestream), istreambuf_iterator<char>());
+    }
+}
+
+void Blob::set_content(string&& data) {
+    content = std::move(data);
 }
\ No newline at end of file
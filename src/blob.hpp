@@ -4,6 +4,8 @@
 #include <string>
 #include <fstream>
 
+#include "objectid.hpp"
+
 namespace boost {
     namespace serialization {
         class access;
@@ -17,9 +19,13 @@ class Blob {
         Blob(std::ifstream& filestream);
         
         std::string hash() const;
-        std::string get_content() const;
+        ObjectId id() const;
+        const std::string& get_content() const;
+        /* Moves the content out of the blob, leaving it empty */
+        std::string release_content();
 
         void set_content(std::ifstream& filestream);
+        void set_content(std::string&& data);
 
     private:
         std::string content;
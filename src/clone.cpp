@@ -0,0 +1,251 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/dir.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <iostream>
+#include <string>
+#include <map>
+
+#include "clone.hpp"
+#include "access.hpp"
+#include "commitindex.hpp"
+#include "config.hpp"
+#include "index.hpp"
+#include "lock.hpp"
+#include "refs.hpp"
+#include "repository.hpp"
+#include "utils.h"
+
+using namespace std;
+
+struct CloneStats {
+    size_t n_linked;
+    size_t n_copied;
+    unsigned long long n_copied_bytes;
+};
+
+/** Helper for copying the file at src to the new file dst with the given permissions, sharing blocks where possible. Returns 0 on success, or -1 with errno set. **/
+static int copy_file(const string& src, const string& dst, mode_t mode, unsigned long long& bytes) {
+    int src_fd = open(src.c_str(), O_RDONLY);
+    if (src_fd == -1) {
+        return -1;
+    }
+
+    struct stat s;
+    if (fstat(src_fd, &s) == -1) {
+        close(src_fd);
+        return -1;
+    }
+
+    int dst_fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL, mode);
+    if (dst_fd == -1) {
+        close(src_fd);
+        return -1;
+    }
+
+    int ret = copy_file_data(src_fd, 0, s.st_size, dst_fd);
+    int saved_errno = errno;
+    close(src_fd);
+    if (close(dst_fd) != 0 && ret == 0) {
+        return -1;
+    }
+
+    if (ret != 0) {
+        unlink(dst.c_str());
+        errno = saved_errno;
+        return -1;
+    }
+
+    bytes += s.st_size;
+    return 0;
+}
+
+/** Copies the repository file at path within source's .vms into the clone, if the source has it **/
+static int copy_repository_file(const string& source_root, const char* path, unsigned long long& bytes) {
+    string src = source_root + "/" + path;
+    if (copy_file(src, path, 0644, bytes) != 0 && errno != ENOENT) {
+        cerr << "Error occurred in cloning " << src << ": " << strerror(errno) << endl;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Clones the object files in src_dir into dst_dir, descending into the subdirectories of a fanned out store, by hard link
+ * if link_objects and the filesystem allows, else by copy. Leftovers of interrupted writes are skipped.
+ **/
+static int clone_object_files(const string& src_dir, const string& dst_dir, bool link_objects, CloneStats& stats) {
+    DIR* dirptr = opendir(src_dir.c_str());
+    if (dirptr == NULL) {
+        cerr << "Error occurred in cloning objects: unable to open directory " << src_dir << endl;
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent* entry;
+    while (ret == 0 && (entry = readdir(dirptr)) != NULL) {
+        if (entry->d_name[0] == '.' || strstr(entry->d_name, ".tmp.") != NULL) {
+            continue;
+        }
+
+        string src = src_dir + "/" + entry->d_name;
+        string dst = dst_dir + "/" + entry->d_name;
+        struct stat s;
+        if (lstat(src.c_str(), &s) != 0) {
+            continue;   // removed by a concurrent gc in the source, so unreachable from the refs cloned
+        }
+
+        if (S_ISDIR(s.st_mode)) {
+            if (mkdir(dst.c_str(), 0755) != 0 && errno != EEXIST) {
+                cerr << "Error occurred in cloning objects: unable to create directory " << dst << ": " << strerror(errno) << endl;
+                ret = -1;
+            } else {
+                ret = clone_object_files(src, dst, link_objects, stats);
+            }
+            continue;
+        }
+
+        if (!S_ISREG(s.st_mode)) {
+            continue;
+        }
+
+        if (link_objects && link(src.c_str(), dst.c_str()) == 0) {
+            stats.n_linked++;
+        } else if (copy_file(src, dst, s.st_mode & 0777, stats.n_copied_bytes) == 0) {
+            stats.n_copied++;
+        } else if (errno != ENOENT) {
+            cerr << "Error occurred in cloning object " << src << ": " << strerror(errno) << endl;
+            ret = -1;
+        }
+    }
+    closedir(dirptr);
+
+    return ret;
+}
+
+/** Helper for checking that dest can be cloned into, creating it if it does not exist **/
+static bool prepare_destination(const char* dest) {
+    if (mkdir(dest, 0755) == 0) {
+        return true;
+    }
+
+    if (errno != EEXIST) {
+        cerr << "Error occurred in creating directory " << dest << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    DIR* dirptr = opendir(dest);
+    if (dirptr == NULL) {
+        cerr << "Error occurred in cloning: " << dest << " exists and is not a directory" << endl;
+        return false;
+    }
+
+    bool empty = true;
+    struct dirent* entry;
+    while (empty && (entry = readdir(dirptr)) != NULL) {
+        empty = strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0;
+    }
+    closedir(dirptr);
+
+    if (!empty) {
+        cerr << "Error occurred in cloning: directory " << dest << " is not empty" << endl;
+    }
+    return empty;
+}
+
+int vms_clone(const char* source, const char* dest) {
+    // The source is named by absolute path, as the rest of the clone runs inside dest
+    char source_buf[PATH_MAX];
+    struct stat s;
+    if (realpath(source, source_buf) == NULL || stat((string(source_buf) + "/.vms/HEAD").c_str(), &s) != 0) {
+        cerr << "No repository at " << source << endl;
+        return -1;
+    }
+    string source_root(source_buf);
+
+    if (!prepare_destination(dest) || chdir(dest) != 0) {
+        return -1;
+    }
+
+    if (make_dir(".vms") != 0 || make_dir(".vms/objects") != 0 || make_dir(BRANCHES_DIR) != 0 || make_dir(".vms/cache") != 0) {
+        cerr << "Error occurred in cloning: unable to create .vms in " << dest << endl;
+        return -1;
+    }
+
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return -1;
+    }
+
+    // Everything naming objects first, so that every object they name is among those cloned next
+    unsigned long long n_bytes = 0;
+    if (copy_repository_file(source_root, CONFIG_PATH, n_bytes) != 0 || copy_repository_file(source_root, ".vms/HEAD", n_bytes) != 0) {
+        return -1;
+    }
+
+    DIR* dirptr = opendir((source_root + "/" + BRANCHES_DIR).c_str());
+    if (dirptr == NULL) {
+        cerr << "Error occurred in cloning: unable to open directory " << source_root << "/" << BRANCHES_DIR << endl;
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent* entry;
+    while (ret == 0 && (entry = readdir(dirptr)) != NULL) {
+        if (entry->d_name[0] != '.' && strstr(entry->d_name, ".tmp.") == NULL) {
+            ret = copy_repository_file(source_root, loose_ref_path(entry->d_name).c_str(), n_bytes);
+        }
+    }
+    closedir(dirptr);
+    if (ret != 0) {
+        return -1;
+    }
+
+    // Packed refs after loose ones: packing writes them before removing the loose files they replace, so no branch is missed
+    const char* files[] = {PACKED_REFS_PATH, ".vms/log", COMMIT_INDEX_PATH};
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        if (copy_repository_file(source_root, files[i], n_bytes) != 0) {
+            return -1;
+        }
+    }
+
+    string store;
+    if (get_config("store", "loose", store) != 0) {
+        cerr << "Error occurred in reading " << CONFIG_PATH << endl;
+        return -1;
+    }
+
+    // The data file and index of a log store may be copied out of step if the source is written meanwhile, in which case the index is rebuilt (see logstore.hpp)
+    CloneStats stats = {0, 0, 0};
+    if (clone_object_files(source_root + "/.vms/objects", ".vms/objects", store != "log", stats) != 0) {
+        return -1;
+    }
+
+    map<string, ObjectId> index;
+    if (save_index(index) != 0) {
+        cerr << "Error occurred in cloning: unable to write .vms/index" << endl;
+        return -1;
+    }
+
+    Repository repository;
+    const string* head_id;
+    ret = repository.head_id(head_id);
+    if (ret == REPO_OK) {
+        ret = repository.checkout_files(*head_id);
+    }
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in checking out the files of the clone: " << repo_strerror(ret) << endl;
+        return -1;
+    }
+
+    cout << "Repository at " << source_root << " cloned into " << dest << "\n";
+    cout << "Linked " << stats.n_linked << " object files and copied " << stats.n_copied << " (" << stats.n_copied_bytes << " bytes)" << endl;
+
+    return 0;
+}
@@ -0,0 +1,23 @@
+/*
+Local clone of a repository: a new repository sharing the history of an existing one on this machine
+
+Objects are immutable once written, and only ever replaced by renaming a new file over them (see
+objectstore.hpp), so the files of a loose object store are hard-linked into the clone: each costs
+one directory entry and no data, and either repository may later remove its link without touching
+the other. Objects are copied instead where a link is impossible, e.g. across filesystems. The
+data file of a log store is appended to in place, so it is never linked but copied with
+copy_file_data, which shares its blocks by reflink where the filesystem supports it.
+
+HEAD, the branch refs, the log, the commit index and the configuration are copied before any
+object. Writers store objects before moving a ref to them, so every commit a copied ref names is
+among the objects cloned afterwards, even while the source is being written to. The clone then
+checks out its HEAD (see Repository::checkout_files), writing files on a pool of worker threads.
+The staging area of the clone starts empty.
+*/
+#ifndef CLONE_HPP
+#define CLONE_HPP
+
+/* Clones the repository in the directory source into the directory dest, which must not exist or be empty. Returns 0 on success, or -1 on failure. */
+int vms_clone(const char* source, const char* dest);
+
+#endif // CLONE_HPP
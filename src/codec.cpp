@@ -0,0 +1,647 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <vector>
+#include <sstream>
+#include <utility>
+#include <mutex>
+
+#include <zlib.h>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/deque.hpp>
+#include <boost/serialization/stack.hpp>
+
+#include "codec.hpp"
+#include "archive.hpp"
+#include "blob.hpp"
+#include "commit.hpp"
+#include "crc32c.hpp"
+#include "objectstore.hpp"
+#include "pathtable.hpp"
+#include "utils.h"
+
+using namespace std;
+
+const unsigned char COMMIT_HAS_FIRST_PARENT = 0x1;
+const unsigned char COMMIT_HAS_SECOND_PARENT = 0x2;
+
+// Incompressible payloads at least this large are laid out raw even when not asked to be
+const size_t RAW_AUTO_SIZE = 64 * 1024;
+
+// Magic, kind, version and compression, followed by at most 10 bytes of varint length and the checksum
+const size_t MAX_HEADER_SIZE = sizeof(CODEC_MAGIC) + 3 + 10 + 4;
+
+Encoder::Encoder(string& out) : out(out) {}
+
+void Encoder::put_byte(unsigned char value) {
+    out.push_back((char) value);
+}
+
+void Encoder::put_varint(uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char) value);
+}
+
+void Encoder::put_bytes(const char* data, size_t length) {
+    out.append(data, length);
+}
+
+void Encoder::put_string(const char* data, size_t length) {
+    put_varint(length);
+    put_bytes(data, length);
+}
+
+void Encoder::put_string(const string& data) {
+    put_string(data.data(), data.length());
+}
+
+void Encoder::put_id(const ObjectId& id) {
+    put_bytes((const char*) id.data(), OBJECT_ID_SIZE);
+}
+
+Decoder::Decoder(const char* data, size_t length) : cursor(data), end(data + length) {}
+
+bool Decoder::get_byte(unsigned char& value) {
+    if (cursor == end) {
+        return false;
+    }
+    value = (unsigned char) *cursor++;
+    return true;
+}
+
+bool Decoder::get_varint(uint64_t& value) {
+    value = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        unsigned char byte;
+        if (!get_byte(byte)) {
+            return false;
+        }
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Decoder::get_bytes(size_t length, const char*& data) {
+    if ((size_t) (end - cursor) < length) {
+        return false;
+    }
+    data = cursor;
+    cursor += length;
+    return true;
+}
+
+bool Decoder::get_string(const char*& data, size_t& length) {
+    uint64_t n;
+    if (!get_varint(n) || n > (uint64_t) (end - cursor)) {
+        return false;
+    }
+    length = n;
+    return get_bytes(length, data);
+}
+
+bool Decoder::get_id(ObjectId& id) {
+    const char* raw;
+    if (!get_bytes(OBJECT_ID_SIZE, raw)) {
+        return false;
+    }
+    id = ObjectId::from_bytes((const unsigned char*) raw);
+    return true;
+}
+
+/** Helpers for storing signed dates as varints, keeping small magnitudes of either sign short **/
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+/** Helper for the number of leading bytes two paths share **/
+static size_t shared_prefix(const string& a, const string& b) {
+    size_t n = a.length() < b.length() ? a.length() : b.length();
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+void encode_commit(const Commit& commit, string& payload) {
+    Encoder enc(payload);
+
+    enc.put_varint(zigzag(commit.datetime));
+    enc.put_string(commit.message);
+
+    unsigned char flags = 0;
+    if (!commit.first_parent_ref.is_null()) {
+        flags |= COMMIT_HAS_FIRST_PARENT;
+    }
+    if (!commit.second_parent_ref.is_null()) {
+        flags |= COMMIT_HAS_SECOND_PARENT;
+    }
+    enc.put_byte(flags);
+    if (flags & COMMIT_HAS_FIRST_PARENT) {
+        enc.put_id(commit.first_parent_ref);
+    }
+    if (flags & COMMIT_HAS_SECOND_PARENT) {
+        enc.put_id(commit.second_parent_ref);
+    }
+
+    // Paths are in sorted order, so each is stored as the part that differs from the one before it
+    enc.put_varint(commit.name_id_map.size());
+    const string* previous = NULL;
+    map<string, ObjectId>::const_iterator it;
+    for (it = commit.name_id_map.begin(); it != commit.name_id_map.end(); ++it) {
+        size_t shared = previous == NULL ? 0 : shared_prefix(*previous, it->first);
+        enc.put_varint(shared);
+        enc.put_string(it->first.data() + shared, it->first.length() - shared);
+        enc.put_id(it->second);
+        previous = &it->first;
+    }
+}
+
+/** Helper for decoding the fields of a commit that precede its files **/
+static bool decode_commit_header(Decoder& dec, time_t& datetime, const char*& message, size_t& message_length, ObjectId& first_parent, ObjectId& second_parent, uint64_t& n_files) {
+    uint64_t date;
+    unsigned char flags;
+    if (!dec.get_varint(date) || !dec.get_string(message, message_length) || !dec.get_byte(flags)) {
+        return false;
+    }
+    datetime = (time_t) unzigzag(date);
+
+    first_parent = ObjectId();
+    second_parent = ObjectId();
+    if ((flags & COMMIT_HAS_FIRST_PARENT) && !dec.get_id(first_parent)) {
+        return false;
+    }
+    if ((flags & COMMIT_HAS_SECOND_PARENT) && !dec.get_id(second_parent)) {
+        return false;
+    }
+
+    return dec.get_varint(n_files);
+}
+
+/** Helper for decoding the next file of a commit, rebuilding its path in place from the previous one **/
+static bool decode_commit_file(Decoder& dec, string& path, ObjectId& id) {
+    uint64_t shared;
+    const char* rest;
+    size_t rest_length;
+    if (!dec.get_varint(shared) || shared > path.length() || !dec.get_string(rest, rest_length) || !dec.get_id(id)) {
+        return false;
+    }
+    path.resize(shared);
+    path.append(rest, rest_length);
+    return true;
+}
+
+int decode_commit(const char* data, size_t length, Commit& commit) {
+    Decoder dec(data, length);
+    const char* message;
+    size_t message_length;
+    uint64_t n_files;
+
+    if (!decode_commit_header(dec, commit.datetime, message, message_length, commit.first_parent_ref, commit.second_parent_ref, n_files)) {
+        return -1;
+    }
+    commit.message.assign(message, message_length);
+
+    commit.name_id_map.clear();
+    map<string, ObjectId>::iterator hint = commit.name_id_map.end();
+    string path;
+    ObjectId id;
+    for (uint64_t i = 0; i < n_files; i++) {
+        if (!decode_commit_file(dec, path, id)) {
+            return -1;
+        }
+        hint = commit.name_id_map.insert(hint, make_pair(path, id));
+    }
+
+    return dec.at_end() ? 0 : -1;
+}
+
+int decode_commit_tree(const char* data, size_t length, FlatTree& tree, ObjectId* id) {
+    Decoder dec(data, length);
+    time_t datetime;
+    const char* message;
+    size_t message_length;
+    ObjectId first_parent;
+    ObjectId second_parent;
+    uint64_t n_files;
+
+    if (!decode_commit_header(dec, datetime, message, message_length, first_parent, second_parent, n_files)) {
+        return -1;
+    }
+
+    // Hash the fields in the same order as Commit::id
+    ObjectHasher hasher;
+    if (id != NULL) {
+        char date[32];
+        ctime_r(&datetime, date);
+        hasher.update(date, strlen(date));
+        hasher.update(message, message_length);
+        hash_commit_id(hasher, first_parent);
+        hash_commit_id(hasher, second_parent);
+    }
+
+    tree.clear();
+    if (n_files <= length / (OBJECT_ID_SIZE + 2)) {  // every file takes at least this many bytes, so a larger count is corrupt
+        tree.reserve(n_files);
+    }
+
+    string path;
+    ObjectId file_id;
+    for (uint64_t i = 0; i < n_files; i++) {
+        if (!decode_commit_file(dec, path, file_id)) {
+            return -1;
+        }
+        tree.push_back(path.data(), path.length(), file_id);
+        if (id != NULL) {
+            hasher.update(path);
+            hash_commit_id(hasher, file_id);
+        }
+    }
+
+    if (id != NULL) {
+        *id = hasher.digest();
+    }
+    return dec.at_end() ? 0 : -1;
+}
+
+void encode_log(const stack<string>& log, string& payload) {
+    Encoder enc(payload);
+
+    // A stack only exposes its top, so take the entries off a copy and write them oldest first
+    stack<string> rest(log);
+    vector<string> entries;
+    entries.reserve(rest.size());
+    while (!rest.empty()) {
+        entries.push_back(std::move(rest.top()));
+        rest.pop();
+    }
+
+    enc.put_varint(entries.size());
+    vector<string>::reverse_iterator it;
+    for (it = entries.rbegin(); it != entries.rend(); ++it) {
+        enc.put_string(*it);
+    }
+}
+
+int decode_log(const char* data, size_t length, stack<string>& log) {
+    Decoder dec(data, length);
+    uint64_t n_entries;
+    if (!dec.get_varint(n_entries)) {
+        return -1;
+    }
+
+    log = stack<string>();
+    for (uint64_t i = 0; i < n_entries; i++) {
+        const char* entry;
+        size_t entry_length;
+        if (!dec.get_string(entry, entry_length)) {
+            return -1;
+        }
+        log.push(string(entry, entry_length));
+    }
+
+    return dec.at_end() ? 0 : -1;
+}
+
+/** Helpers for storing the checksum least significant byte first, whatever the host byte order **/
+static void put_crc(Encoder& enc, uint32_t crc) {
+    for (int i = 0; i < 4; i++) {
+        enc.put_byte((unsigned char) (crc >> (8 * i)));
+    }
+}
+
+static bool get_crc(Decoder& dec, uint32_t& crc) {
+    crc = 0;
+    for (int i = 0; i < 4; i++) {
+        unsigned char byte;
+        if (!dec.get_byte(byte)) {
+            return false;
+        }
+        crc |= (uint32_t) byte << (8 * i);
+    }
+    return true;
+}
+
+/** Lays out payload raw: the header padded with zeros to RAW_BODY_OFFSET, then the payload **/
+static void encode_raw_object_file(char kind, const string& payload, uint32_t crc, string& file) {
+    file.clear();
+    file.reserve(RAW_BODY_OFFSET + payload.length());
+    Encoder enc(file);
+    enc.put_bytes(CODEC_MAGIC, sizeof(CODEC_MAGIC));
+    enc.put_byte(kind);
+    enc.put_byte(CODEC_VERSION);
+    enc.put_byte(COMPRESSION_RAW);
+    enc.put_varint(payload.length());
+    put_crc(enc, crc);
+
+    file.resize(RAW_BODY_OFFSET, '\0');
+    file.append(payload);
+}
+
+void encode_object_file(char kind, const string& payload, string& file, bool raw) {
+    uint32_t crc = crc32c(payload.data(), payload.length());
+    if (raw) {
+        encode_raw_object_file(kind, payload, crc, file);
+        return;
+    }
+
+    file.clear();
+    file.reserve(MAX_HEADER_SIZE + payload.length());
+    Encoder enc(file);
+    enc.put_bytes(CODEC_MAGIC, sizeof(CODEC_MAGIC));
+    enc.put_byte(kind);
+    enc.put_byte(CODEC_VERSION);
+
+    // Reserve room for the rest of the header, then deflate straight into the file image
+    size_t header_length = file.length();
+    uLongf compressed_length = compressBound(payload.length());
+    file.resize(MAX_HEADER_SIZE + compressed_length);
+
+    int ret = compress2((Bytef*) &file[MAX_HEADER_SIZE], &compressed_length, (const Bytef*) payload.data(), payload.length(), Z_BEST_COMPRESSION);
+
+    if (ret == Z_OK && compressed_length < payload.length()) {
+        string header;
+        Encoder header_enc(header);
+        header_enc.put_byte(COMPRESSION_ZLIB);
+        header_enc.put_varint(payload.length());
+        put_crc(header_enc, crc);
+
+        // Slide the compressed body up against the header
+        memcpy(&file[header_length], header.data(), header.length());
+        memmove(&file[header_length + header.length()], &file[MAX_HEADER_SIZE], compressed_length);
+        file.resize(header_length + header.length() + compressed_length);
+    } else if (payload.length() >= RAW_AUTO_SIZE) {
+        // Large incompressible content, e.g. already compressed files, can be cloned straight out of the object at checkout
+        encode_raw_object_file(kind, payload, crc, file);
+    } else {
+        // Incompressible content is stored as is
+        file.resize(header_length);
+        enc.put_byte(COMPRESSION_STORED);
+        enc.put_varint(payload.length());
+        put_crc(enc, crc);
+        enc.put_bytes(payload.data(), payload.length());
+    }
+}
+
+int write_object_file(const string& filepath, char kind, const string& payload) {
+    string file;
+    encode_object_file(kind, payload, file);
+
+    if (replace_file_atomically(filepath.c_str(), file.data(), file.length(), 0644) != 0) {
+        cerr << "Error occurred in writing object file " << filepath << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int store_object(ObjectStore& store, const ObjectId& id, char kind, const string& payload) {
+    string file;
+    encode_object_file(kind, payload, file);
+
+    return store.put(id, file);
+}
+
+int read_whole_file(const string& filepath, string& buffer) {
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    buffer.resize(s.st_size);
+    size_t total = 0;
+    while (total < buffer.length()) {
+        ssize_t nread = read(fd, &buffer[total], buffer.length() - total);
+        if (nread <= 0) {
+            close(fd);
+            return -1;
+        }
+        total += nread;
+    }
+    close(fd);
+
+    return 0;
+}
+
+int parse_object_header(const char* data, size_t length, ObjectHeader& header, const char*& problem) {
+    if (length < sizeof(CODEC_MAGIC) || memcmp(data, CODEC_MAGIC, sizeof(CODEC_MAGIC)) != 0) {
+        return 1;
+    }
+
+    Decoder dec(data + sizeof(CODEC_MAGIC), length - sizeof(CODEC_MAGIC));
+    unsigned char kind;
+
+    if (!dec.get_byte(kind) || !dec.get_byte(header.version) || !dec.get_byte(header.compression) || !dec.get_varint(header.payload_length)) {
+        problem = "truncated header";
+        return -1;
+    }
+
+    // version 1 predates checksums
+    header.crc = 0;
+    if (header.version < 1 || header.version > CODEC_VERSION) {
+        problem = "unknown format version";
+        return -1;
+    }
+    if (header.version >= 2 && !get_crc(dec, header.crc)) {
+        problem = "truncated header";
+        return -1;
+    }
+
+    header.kind = (char) kind;
+    header.body_offset = header.compression == COMPRESSION_RAW ? RAW_BODY_OFFSET : length - dec.remaining();
+    return 0;
+}
+
+int parse_object_file(string& buffer, char& kind, const char*& data, size_t& length, bool& checksummed, const char*& problem) {
+    checksummed = false;
+
+    ObjectHeader header;
+    int ret = parse_object_header(buffer.data(), buffer.length(), header, problem);
+    if (ret != 0) {
+        return ret;
+    }
+
+    unsigned char version = header.version;
+    unsigned char compression = header.compression;
+    uint64_t payload_length = header.payload_length;
+    uint32_t crc = header.crc;
+    kind = header.kind;
+
+    if (header.body_offset > buffer.length()) {
+        problem = "truncated header";
+        return -1;
+    }
+    size_t body_length = buffer.length() - header.body_offset;
+    const char* body = buffer.data() + header.body_offset;
+
+    if (compression == COMPRESSION_STORED || compression == COMPRESSION_RAW) {
+        if (body_length != payload_length) {
+            problem = "truncated contents";
+            return -1;
+        }
+        data = body;
+        length = body_length;
+    } else if (compression == COMPRESSION_ZLIB) {
+        // deflate cannot shrink data by more than about 1032:1, so a larger claimed length is corrupt
+        if (payload_length / 1032 > body_length) {
+            problem = "corrupt contents";
+            return -1;
+        }
+
+        string raw(payload_length, '\0');
+        uLongf raw_length = payload_length;
+        if (uncompress((Bytef*) &raw[0], &raw_length, (const Bytef*) body, body_length) != Z_OK || raw_length != payload_length) {
+            problem = "corrupt contents";
+            return -1;
+        }
+
+        buffer.swap(raw);
+        data = buffer.data();
+        length = buffer.length();
+    } else {
+        problem = "unknown compression";
+        return -1;
+    }
+
+    if (version >= 2) {
+        if (crc32c(data, length) != crc) {
+            problem = "checksum mismatch";
+            return -1;
+        }
+        checksummed = true;
+    }
+
+    return 0;
+}
+
+/** Parses an object image, which must hold an object of the given kind, without printing anything **/
+static int parse_object_of_kind(char kind, string& buffer, const char*& data, size_t& length, bool& checksummed, const char*& problem) {
+    char file_kind;
+    int ret = parse_object_file(buffer, file_kind, data, length, checksummed, problem);
+
+    if (ret == 0 && file_kind != kind) {
+        problem = "unexpected kind of object";
+        ret = -1;
+    }
+    return ret;
+}
+
+int read_object_file(const string& filepath, char kind, string& buffer, const char*& data, size_t& length, bool& checksummed) {
+    if (read_whole_file(filepath, buffer) != 0) {
+        cerr << "Error occurred in reading object file " << filepath << ": unable to open file" << endl;
+        return -1;
+    }
+
+    const char* problem;
+    int ret = parse_object_of_kind(kind, buffer, data, length, checksummed, problem);
+    if (ret == -1) {
+        cerr << "Error occurred in reading object file " << filepath << ": " << problem << endl;
+    }
+    return ret;
+}
+
+int read_object(ObjectStore& store, const ObjectId& id, char kind, string& buffer, const char*& data, size_t& length, bool& checksummed) {
+    if (store.get(id, buffer) != 0) {
+        return store.has(id) ? -1 : -2;
+    }
+
+    const char* problem;
+    int ret = parse_object_of_kind(kind, buffer, data, length, checksummed, problem);
+    return ret == -1 ? -2 : ret;
+}
+
+// Boost sets up its serializers lazily, so legacy archives are restored one at a time even when objects are loaded from several threads
+static mutex legacy_mutex;
+
+/** Restores obj from a legacy boost archive held in buffer, returning -2 if it is malformed **/
+template <class T>
+static int restore_legacy_object(const string& buffer, T& obj) {
+    lock_guard<mutex> guard(legacy_mutex);
+    try {
+        istringstream iss(buffer);
+        restore_archive<T>(obj, iss);
+    } catch (exception&) {
+        return -2;
+    }
+    return 0;
+}
+
+int load_commit(ObjectStore& store, const ObjectId& id, Commit& commit, bool& checksummed) {
+    string buffer;
+    const char* data;
+    size_t length;
+
+    int ret = read_object(store, id, CODEC_KIND_COMMIT, buffer, data, length, checksummed);
+    if (ret == 1) {
+        return restore_legacy_object(buffer, commit);
+    }
+
+    if (ret == 0 && decode_commit(data, length, commit) != 0) {
+        return -2;
+    }
+    return ret;
+}
+
+int load_blob(ObjectStore& store, const ObjectId& id, Blob& blob, bool& checksummed) {
+    string buffer;
+    const char* data;
+    size_t length;
+
+    int ret = read_object(store, id, CODEC_KIND_BLOB, buffer, data, length, checksummed);
+    if (ret == 1) {
+        return restore_legacy_object(buffer, blob);
+    }
+
+    if (ret == 0) {
+        // hand over the buffer itself when it holds exactly the content, instead of copying it
+        if (data == buffer.data() && length == buffer.length()) {
+            blob.set_content(std::move(buffer));
+        } else {
+            blob.set_content(string(data, length));
+        }
+    }
+    return ret;
+}
+
+template <>
+void save< stack<string> >(const stack<string>& obj, const string& filepath) {
+    string payload;
+    encode_log(obj, payload);
+    write_object_file(filepath, CODEC_KIND_LOG, payload);
+}
+
+template <>
+void restore< stack<string> >(stack<string>& obj, const string& filepath) {
+    string buffer;
+    const char* data;
+    size_t length;
+    bool checksummed;
+
+    int ret = read_object_file(filepath, CODEC_KIND_LOG, buffer, data, length, checksummed);
+    if (ret == 1) {
+        restore_archive< stack<string> >(obj, filepath);
+    } else if (ret == 0 && decode_log(data, length, obj) != 0) {
+        cerr << "Error occurred in reading object file " << filepath << ": malformed log" << endl;
+    }
+}
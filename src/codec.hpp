@@ -0,0 +1,164 @@
+/*
+Compact binary encoding of commits, blobs and the commit log
+
+On-disk layout of an object file:
+
+    header        magic "vms", kind of object ('c' commit, 'b' blob, 'l' log), format version,
+                  compression (0 stored, 1 zlib, 2 raw), the length of the payload as a varint,
+                  and the CRC-32C of the payload (least significant byte first)
+    body          the payload, deflated with zlib when that makes it smaller
+
+Raw objects pad the header with zeros so the payload starts RAW_BODY_OFFSET bytes into the file,
+on a filesystem block boundary. Checkout can then clone or copy the payload straight into the
+working copy (see materialize_raw_blob in access.hpp) instead of reading and writing it.
+
+The checksum lets ordinary reads detect damaged files without recomputing the SHA-1 id of the
+object (see the verification policy in access.hpp). Version 1 files lack it and are always rehashed.
+
+Payloads are built from unsigned LEB128 varints, length-prefixed strings and raw 20-byte ids.
+A commit is its date (zigzag varint), message, a flags byte saying which parents follow, the
+parent ids, and a count of tracked files followed by (shared prefix length with the previous
+path, rest of path, id) for each file in path order. A blob is its bare content. A log is a
+count of entries followed by the entries, oldest first.
+
+Files written by earlier versions are boost archives, which begin with a zlib header instead of
+the magic. The readers below report those as legacy so callers can fall back to boost.
+*/
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <stack>
+
+#include "objectid.hpp"
+
+class Commit;
+class Blob;
+class FlatTree;
+class ObjectStore;
+
+const char CODEC_MAGIC[3] = {'v', 'm', 's'};
+const unsigned char CODEC_VERSION = 2;
+
+const char CODEC_KIND_COMMIT = 'c';
+const char CODEC_KIND_BLOB = 'b';
+const char CODEC_KIND_LOG = 'l';
+
+const unsigned char COMPRESSION_STORED = 0;
+const unsigned char COMPRESSION_ZLIB = 1;
+const unsigned char COMPRESSION_RAW = 2;
+
+const size_t RAW_BODY_OFFSET = 4096;
+
+/* Appends encoded values to a string */
+class Encoder {
+    public:
+        Encoder(std::string& out);
+
+        void put_byte(unsigned char value);
+        void put_varint(uint64_t value);
+        void put_bytes(const char* data, size_t length);
+        /* Writes the length of the string as a varint followed by its bytes */
+        void put_string(const char* data, size_t length);
+        void put_string(const std::string& data);
+        void put_id(const ObjectId& id);
+
+    private:
+        std::string& out;
+};
+
+/* Reads encoded values from a buffer without copying. Every getter returns false once the input is exhausted or malformed. */
+class Decoder {
+    public:
+        Decoder(const char* data, size_t length);
+
+        bool get_byte(unsigned char& value);
+        bool get_varint(uint64_t& value);
+        /* Points data at the next length bytes of the buffer */
+        bool get_bytes(size_t length, const char*& data);
+        bool get_string(const char*& data, size_t& length);
+        bool get_id(ObjectId& id);
+
+        size_t remaining() const { return end - cursor; }
+        bool at_end() const { return cursor == end; }
+
+    private:
+        const char* cursor;
+        const char* end;
+};
+
+void encode_commit(const Commit& commit, std::string& payload);
+void encode_log(const std::stack<std::string>& log, std::string& payload);
+
+/* Each decoder returns 0 on success, or -1 if the payload is malformed */
+int decode_commit(const char* data, size_t length, Commit& commit);
+int decode_log(const char* data, size_t length, std::stack<std::string>& log);
+
+/*
+    Decodes only the tracked files of a commit into tree, interning paths straight from the
+    payload instead of building the commit's map. Unless id is NULL, it receives the id of the
+    whole commit so the caller can verify it.
+*/
+int decode_commit_tree(const char* data, size_t length, FlatTree& tree, ObjectId* id);
+
+/*
+    Builds in file the image of an object file of the given kind holding payload, compressing it when that pays off.
+    With raw set, the payload is laid out raw instead, as are large payloads that do not compress.
+*/
+void encode_object_file(char kind, const std::string& payload, std::string& file, bool raw = false);
+
+/* Writes payload as an object file of the given kind, replacing the file atomically. Returns 0 on success, or -1 on failure. */
+int write_object_file(const std::string& filepath, char kind, const std::string& payload);
+
+/* Encodes payload as an object of the given kind and puts it in store under id. Returns 0 on success, or -1 on failure, printing nothing. */
+int store_object(ObjectStore& store, const ObjectId& id, char kind, const std::string& payload);
+
+/* Reads the whole file at filepath into buffer. Returns 0 on success, or -1 on failure. */
+int read_whole_file(const std::string& filepath, std::string& buffer);
+
+/* Fields of an object file header. body_offset is where the body starts in the file. */
+struct ObjectHeader {
+    char kind;
+    unsigned char version;
+    unsigned char compression;
+    uint64_t payload_length;
+    uint32_t crc;
+    size_t body_offset;
+};
+
+/*
+    Parses the header at the start of an object file, of which length bytes are in data. Returns 0 on
+    success, 1 if the file is a legacy boost archive, or -1 with problem describing what is wrong.
+*/
+int parse_object_header(const char* data, size_t length, ObjectHeader& header, const char*& problem);
+
+/*
+    Parses the object file image held in buffer, without printing anything. On success, kind is
+    the kind of object, and data and length delimit the payload, which either points into buffer
+    or is buffer itself once decompressed. checksummed is set when the payload matched its checksum.
+    Returns 0 on success, 1 if the file is a legacy boost archive, or -1 with problem describing
+    what is wrong with the file.
+*/
+int parse_object_file(std::string& buffer, char& kind, const char*& data, size_t& length, bool& checksummed, const char*& problem);
+
+/* Reads and parses the object file at filepath, which must hold an object of the given kind, reporting problems on stderr */
+int read_object_file(const std::string& filepath, char kind, std::string& buffer, const char*& data, size_t& length, bool& checksummed);
+
+/*
+    As read_object_file, for the object with the given id in store, without printing anything. Returns -1 if the object
+    could not be read, or -2 if it is missing or malformed. buffer is left holding the legacy archive when 1 is returned.
+*/
+int read_object(ObjectStore& store, const ObjectId& id, char kind, std::string& buffer, const char*& data, size_t& length, bool& checksummed);
+
+/*
+    Restore the commit or blob with the given id from store, in either format. checksummed is set when the object's
+    checksum was verified, and left false for legacy archives, whose contents can only be checked against their id.
+    Return 0 on success, -1 if the object could not be read, or -2 if it is missing or malformed, printing nothing.
+*/
+int load_commit(ObjectStore& store, const ObjectId& id, Commit& commit, bool& checksummed);
+int load_blob(ObjectStore& store, const ObjectId& id, Blob& blob, bool& checksummed);
+
+#endif // CODEC_HPP
@@ -1,12 +1,12 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <boost/compute/detail/sha1.hpp>
+#include <string.h>
 #include <chrono>
 
 #include "commit.hpp"
 #include "archive.hpp"
-#include "access.hpp"
+#include "pathtable.hpp"
 
 using namespace std;
 
@@ -15,62 +15,66 @@ Commit::Commit() {
     datetime = chrono::system_clock::to_time_t(sys_epoch);
 }
 
-Commit::Commit(const string& msg) {
-    // Load parent commit
-    Commit parent_commit;
-    string parent_id;
-    if (get_parent_ref(parent_id) != 0) {
-        cerr << "Fatal error occurred in constructing new commit: unable to retrieve parent commit id. .vms directory contents likely corrupted. Exiting..." << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    ostringstream parent_path;
-
-    string parent_id_prefix;
-    string parent_id_suffix;
-    split_prefix_suffix(parent_id, parent_id_prefix, parent_id_suffix, PREFIX_LENGTH);
+Commit::Commit(const string& msg, const ObjectId& parent_id, const Commit& parent) {
+    // copy parent's map to current object
+    name_id_map = parent.name_id_map;
 
-    parent_path << ".vms/objects/" << parent_id_prefix << "/" << parent_id_suffix;
+    datetime = time(0);
+    message = msg;
+    first_parent_ref = parent_id;
+}
 
-    restore<Commit>(parent_commit, parent_path.str());
-    if (parent_commit.hash() != parent_id) {
-        cerr << "Fatal error has occurred in retrieval of commit: uuid mismatch. Archived object may have been corrupted. Exiting..." << endl;
-        exit(EXIT_FAILURE);
-    }
+Commit::Commit(const string& msg, const ObjectId& parent_id, Commit&& parent) {
+    // take over parent's map, leaving parent without files
+    name_id_map.swap(parent.name_id_map);
 
-    
-    // copy parent's map to current object
-    name_id_map = parent_commit.get_map();
-    
-    // set remaining fields
     datetime = time(0);
     message = msg;
     first_parent_ref = parent_id;
 }
 
+// The null id is fed as nothing, keeping the ids of existing commits unchanged
+void hash_commit_id(ObjectHasher& hasher, const ObjectId& id) {
+    if (!id.is_null()) {
+        char hex[OBJECT_ID_HEX_LENGTH];
+        id.write_hex(hex);
+        hasher.update(hex, OBJECT_ID_HEX_LENGTH);
+    }
+}
+
 string Commit::hash() const{
-    ostringstream oss;
-    oss << ctime(&datetime) << message << first_parent_ref << second_parent_ref;
-    map<string,string>::const_iterator it;
+    return id().hex();
+}
+
+ObjectId Commit::id() const {
+    // Feed the fields to the hash piece by piece rather than formatting the whole commit into one string
+    ObjectHasher hasher;
+    char date[32];  // ctime_r rather than ctime, so commits may be hashed on several threads at once
+    ctime_r(&datetime, date);
+    hasher.update(date, strlen(date));
+    hasher.update(message);
+    hash_commit_id(hasher, first_parent_ref);
+    hash_commit_id(hasher, second_parent_ref);
+
+    map<string,ObjectId>::const_iterator it;
     for (it=name_id_map.begin(); it!=name_id_map.end(); ++it) {
-        oss << it->first << it->second;
+        hasher.update(it->first);
+        hash_commit_id(hasher, it->second);
     }
 
-    boost::compute::detail::sha1 hash(oss.str());
-
-    return string(hash);
+    return hasher.digest();
 }
 
 string Commit::log_string() const {
     ostringstream oss;
     oss << "commit  " << hash() << "\n";
     oss << "Date    " << ctime(&datetime);
-    if (second_parent_ref != "") {
-        oss << "parents " << first_parent_ref << "\n";
-        oss << "        " << second_parent_ref << "\n";
+    if (!second_parent_ref.is_null()) {
+        oss << "parents " << first_parent_ref.hex() << "\n";
+        oss << "        " << second_parent_ref.hex() << "\n";
 
     } else {
-        oss << "parent  " << first_parent_ref << "\n";
+        oss << "parent  " << (first_parent_ref.is_null() ? "" : first_parent_ref.hex()) << "\n";
     }
     oss << "\n    " << message << endl;
 
@@ -80,7 +84,7 @@ string Commit::log_string() const {
 string Commit::tracked_files_string() const {
     ostringstream oss;
 
-    map<string,string>::const_iterator it;
+    map<string,ObjectId>::const_iterator it;
     oss << "Files tracked in this commit\n\n";
     for (it=name_id_map.begin(); it!=name_id_map.end(); ++it) {
         oss << "    " << it->first << "\n";
@@ -89,8 +93,8 @@ string Commit::tracked_files_string() const {
     return oss.str();
 }
 
-pair<string, string> Commit::parent_ids() const {
-    pair<string, string> parents;
+pair<ObjectId, ObjectId> Commit::parent_ids() const {
+    pair<ObjectId, ObjectId> parents;
 
     parents.first = first_parent_ref;
     parents.second = second_parent_ref;
@@ -98,26 +102,34 @@ pair<string, string> Commit::parent_ids() const {
     return parents;
 }
 
-map<string, string> Commit::get_map() const {
+time_t Commit::get_datetime() const {
+    return datetime;
+}
+
+const map<string, ObjectId>& Commit::get_map() const {
     return name_id_map;
 }
 
+void Commit::load_tree(FlatTree& tree) const {
+    tree.assign(name_id_map);
+}
+
 bool Commit::map_contains(const string& key) const {
     if (name_id_map.empty()) {
         return false;
     }
-    map<string, string>::const_iterator it;
+    map<string, ObjectId>::const_iterator it;
     it = name_id_map.find(key);
 
     return it != name_id_map.end();
 }
 
-bool Commit::find_in_map_and_get_iter(const string& key, map<string, string>::iterator& it) {
+bool Commit::find_in_map_and_get_iter(const string& key, map<string, ObjectId>::iterator& it) {
     it = name_id_map.find(key);
     return it != name_id_map.end();
 }
 
-void Commit::put_to_map(const string& key, const string& value) {
+void Commit::put_to_map(const string& key, const ObjectId& value) {
     name_id_map[key] = value;
 }
 
@@ -125,6 +137,6 @@ void Commit::remove_from_map(const string& key) {
     name_id_map.erase(key);
 }
 
-void Commit::set_second_parent(const string& commit_id) {
+void Commit::set_second_parent(const ObjectId& commit_id) {
     second_parent_ref = commit_id;
 }
\ No newline at end of file
@@ -5,6 +5,20 @@
 #include <ctime>
 #include <map>
 #include <boost/serialization/map.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/version.hpp>
+
+#include "objectid.hpp"
+
+class FlatTree;
+class Commit;
+
+void encode_commit(const Commit& commit, std::string& payload);
+int decode_commit(const char* data, size_t length, Commit& commit);
+
+/* Feeds an id to the hash of a commit: in hex, as ids were originally stored, and as nothing for the null id */
+void hash_commit_id(ObjectHasher& hasher, const ObjectId& id);
 
 namespace boost {
     namespace serialization {
@@ -15,34 +29,69 @@ namespace boost {
 class Commit {
     public:
         Commit();
-        Commit(const std::string& msg);
+        Commit(const std::string& msg, const ObjectId& parent_id, const Commit& parent);
+        Commit(const std::string& msg, const ObjectId& parent_id, Commit&& parent);
 
         std::string hash() const;
+        ObjectId id() const;
         std::string log_string() const;
         std::string tracked_files_string() const;
-        std::pair<std::string, std::string> parent_ids() const;
-        std::map<std::string, std::string> get_map() const;
+        std::pair<ObjectId, ObjectId> parent_ids() const;
+        std::time_t get_datetime() const;
+        const std::map<std::string, ObjectId>& get_map() const;
+        /* Replaces the contents of tree with the files tracked in this commit, without copying the map */
+        void load_tree(FlatTree& tree) const;
         bool map_contains(const std::string& key) const;
         
-        bool find_in_map_and_get_iter(const std::string& key, std::map<std::string, std::string>::iterator& it);
-        void put_to_map(const std::string& key, const std::string& value);
+        bool find_in_map_and_get_iter(const std::string& key, std::map<std::string, ObjectId>::iterator& it);
+        void put_to_map(const std::string& key, const ObjectId& value);
         void remove_from_map(const std::string& key);
-        void set_second_parent(const std::string& commit_id);
+        void set_second_parent(const ObjectId& commit_id);
         
     private:
         std::time_t datetime;
         std::string message;
-        std::string first_parent_ref;
-        std::string second_parent_ref; // for merges
-        std::map<std::string, std::string> name_id_map;
+        ObjectId first_parent_ref;
+        ObjectId second_parent_ref; // for merges
+        std::map<std::string, ObjectId> name_id_map;
 
+        friend void encode_commit(const Commit& commit, std::string& payload);
+        friend int decode_commit(const char* data, size_t length, Commit& commit);
         friend class boost::serialization::access;
 
         template<class Archive>
-        void serialize(Archive& ar, const unsigned int version) {
+        void save(Archive& ar, const unsigned int version) const {
             ar & datetime & message & first_parent_ref & second_parent_ref & name_id_map;
         }
 
+        template<class Archive>
+        void load(Archive& ar, const unsigned int version) {
+            if (version > 0) {
+                ar & datetime & message & first_parent_ref & second_parent_ref & name_id_map;
+                return;
+            }
+
+            // version 0 stored ids as hex strings, with an empty string for a missing parent
+            std::string first_parent_hex;
+            std::string second_parent_hex;
+            std::map<std::string, std::string> name_hex_map;
+            ar & datetime & message & first_parent_hex & second_parent_hex & name_hex_map;
+
+            first_parent_ref = ObjectId::from_hex(first_parent_hex);
+            second_parent_ref = ObjectId::from_hex(second_parent_hex);
+
+            name_id_map.clear();
+            std::map<std::string, ObjectId>::iterator hint = name_id_map.end();
+            std::map<std::string, std::string>::const_iterator it;
+            for (it = name_hex_map.begin(); it != name_hex_map.end(); ++it) {
+                hint = name_id_map.insert(hint, std::make_pair(it->first, ObjectId::from_hex(it->second)));
+            }
+        }
+
+        BOOST_SERIALIZATION_SPLIT_MEMBER()
+
 };
 
+BOOST_CLASS_VERSION(Commit, 1)
+
 #endif // COMMIT_HPP
\ No newline at end of file
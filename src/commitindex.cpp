@@ -0,0 +1,278 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+
+#include "commitindex.hpp"
+#include "crc32c.hpp"
+#include "utils.h"
+
+using namespace std;
+
+const char COMMIT_INDEX_MAGIC[6] = {'v', 'm', 's', 'c', 'i', 'x'};
+const unsigned char COMMIT_INDEX_VERSION = 2;
+
+// Magic, version and a reserved byte
+const size_t COMMIT_INDEX_HEADER_SIZE = 8;
+
+// Id, first parent id, number of filter words and checksum
+const size_t RECORD_HEADER_SIZE = 2 * OBJECT_ID_SIZE + 4 + 4;
+const size_t RECORD_COUNT_OFFSET = 2 * OBJECT_ID_SIZE;
+const size_t RECORD_CRC_OFFSET = RECORD_COUNT_OFFSET + 4;
+
+const unsigned int BITS_PER_PATH = 10;
+const unsigned int BITS_SET_PER_PATH = 7;
+
+/** Helper for writing v as 8 bytes, least significant first **/
+static void put_le64(unsigned char* out, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+static uint64_t get_le64(const unsigned char* in) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | in[i];
+    }
+    return v;
+}
+
+static void put_le32(unsigned char* out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const unsigned char* in) {
+    return (uint32_t) in[0] | ((uint32_t) in[1] << 8) | ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+/** Helper for the n-th of the bits a path with the given hash sets in a filter of n_bits **/
+static uint64_t filter_bit(uint64_t hash, unsigned int n, uint64_t n_bits) {
+    uint64_t h1 = hash & 0xffffffff;
+    uint64_t h2 = hash >> 32;
+    return (h1 + n * h2) % n_bits;
+}
+
+CommitIndex::CommitIndex() {}
+
+uint64_t CommitIndex::path_hash(const char* path, size_t length) {
+    // FNV-1a, finished with the MurmurHash3 mixer so both halves used for double hashing are well distributed
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char) path[i];
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+void CommitIndex::clear() {
+    ids.clear();
+    parent_ids.clear();
+    filter_ends.clear();
+    words.clear();
+    records.clear();
+}
+
+long CommitIndex::find(const ObjectId& id) {
+    if (records.empty()) {
+        records.reserve(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            records[ids[i]] = i;
+        }
+    }
+
+    unordered_map<ObjectId, size_t, ObjectIdHash>::const_iterator it = records.find(id);
+    return it == records.end() ? -1 : (long) it->second;
+}
+
+void CommitIndex::add(const ObjectId& id, const ObjectId& parent_id, const vector<string>& changed_paths) {
+    // Every changed path and the directories leading to it, so history of a directory can be filtered too
+    unordered_set<uint64_t> hashes;
+    for (size_t i = 0; i < changed_paths.size() && hashes.size() <= MAX_FILTERED_PATHS; i++) {
+        const string& path = changed_paths[i];
+        for (size_t end = path.length(); end != string::npos && end > 0; end = path.rfind('/', end - 1)) {
+            if (!hashes.insert(path_hash(path.data(), end)).second) {
+                break;  // the leading directories were added with an earlier path
+            }
+        }
+    }
+
+    size_t begin = words.size();
+    if (hashes.size() > MAX_FILTERED_PATHS) {
+        words.push_back(~(uint64_t) 0);
+    } else if (!hashes.empty()) {
+        size_t n_words = (hashes.size() * BITS_PER_PATH + 63) / 64;
+        words.resize(begin + n_words, 0);
+
+        uint64_t n_bits = n_words * 64;
+        unordered_set<uint64_t>::const_iterator it;
+        for (it = hashes.begin(); it != hashes.end(); ++it) {
+            for (unsigned int n = 0; n < BITS_SET_PER_PATH; n++) {
+                uint64_t bit = filter_bit(*it, n, n_bits);
+                words[begin + bit / 64] |= (uint64_t) 1 << (bit % 64);
+            }
+        }
+    }
+
+    if (!records.empty()) {
+        records[id] = ids.size();
+    }
+    ids.push_back(id);
+    parent_ids.push_back(parent_id);
+    filter_ends.push_back(words.size());
+}
+
+bool CommitIndex::may_change(size_t i, uint64_t hash) const {
+    size_t begin = i == 0 ? 0 : filter_ends[i - 1];
+    uint64_t n_bits = (filter_ends[i] - begin) * 64;
+    if (n_bits == 0) {
+        return false;
+    }
+
+    for (unsigned int n = 0; n < BITS_SET_PER_PATH; n++) {
+        uint64_t bit = filter_bit(hash, n, n_bits);
+        if ((words[begin + bit / 64] & ((uint64_t) 1 << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CommitIndex::encode_record(size_t i, string& out) const {
+    size_t begin = i == 0 ? 0 : filter_ends[i - 1];
+    size_t n_words = filter_ends[i] - begin;
+
+    size_t start = out.length();
+    out.resize(start + RECORD_HEADER_SIZE + n_words * 8);
+    unsigned char* record = (unsigned char*) &out[start];
+
+    memcpy(record, ids[i].data(), OBJECT_ID_SIZE);
+    memcpy(record + OBJECT_ID_SIZE, parent_ids[i].data(), OBJECT_ID_SIZE);
+    put_le32(record + RECORD_COUNT_OFFSET, n_words);
+    for (size_t w = 0; w < n_words; w++) {
+        put_le64(record + RECORD_HEADER_SIZE + w * 8, words[begin + w]);
+    }
+
+    // The checksum covers the ids, the word count and the filter
+    uint32_t crc = crc32c(record, RECORD_CRC_OFFSET);
+    crc = crc32c(record + RECORD_HEADER_SIZE, n_words * 8, crc);
+    put_le32(record + RECORD_CRC_OFFSET, crc);
+}
+
+int CommitIndex::load() {
+    clear();
+
+    struct stat s;
+    if (stat(COMMIT_INDEX_PATH, &s) != 0) {
+        return errno == ENOENT ? 1 : -1;
+    }
+
+    ifstream ifs(COMMIT_INDEX_PATH, ios::binary);
+    if (!ifs.is_open()) {
+        return -1;
+    }
+
+    stringstream buffer;
+    buffer << ifs.rdbuf();
+    string data = buffer.str();
+
+    const unsigned char* bytes = (const unsigned char*) data.data();
+    size_t length = data.length();
+    if (length < COMMIT_INDEX_HEADER_SIZE || memcmp(bytes, COMMIT_INDEX_MAGIC, sizeof(COMMIT_INDEX_MAGIC)) != 0
+            || bytes[sizeof(COMMIT_INDEX_MAGIC)] != COMMIT_INDEX_VERSION) {
+        return -1;
+    }
+
+    size_t offset = COMMIT_INDEX_HEADER_SIZE;
+    while (offset < length) {
+        const unsigned char* record = bytes + offset;
+        if (length - offset < RECORD_HEADER_SIZE) {
+            clear();
+            return -1;
+        }
+
+        size_t n_words = get_le32(record + RECORD_COUNT_OFFSET);
+        if ((length - offset - RECORD_HEADER_SIZE) / 8 < n_words) {
+            clear();
+            return -1;
+        }
+
+        uint32_t crc = crc32c(record, RECORD_CRC_OFFSET);
+        crc = crc32c(record + RECORD_HEADER_SIZE, n_words * 8, crc);
+        if (crc != get_le32(record + RECORD_CRC_OFFSET)) {
+            clear();
+            return -1;
+        }
+
+        ids.push_back(ObjectId::from_bytes(record));
+        parent_ids.push_back(ObjectId::from_bytes(record + OBJECT_ID_SIZE));
+        for (size_t w = 0; w < n_words; w++) {
+            words.push_back(get_le64(record + RECORD_HEADER_SIZE + w * 8));
+        }
+        filter_ends.push_back(words.size());
+
+        offset += RECORD_HEADER_SIZE + n_words * 8;
+    }
+
+    return 0;
+}
+
+int CommitIndex::save() const {
+    string data(COMMIT_INDEX_HEADER_SIZE, '\0');
+    memcpy(&data[0], COMMIT_INDEX_MAGIC, sizeof(COMMIT_INDEX_MAGIC));
+    data[sizeof(COMMIT_INDEX_MAGIC)] = COMMIT_INDEX_VERSION;
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        encode_record(i, data);
+    }
+
+    if (replace_file_atomically(COMMIT_INDEX_PATH, data.data(), data.length(), 0644) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int CommitIndex::append(const ObjectId& id, const ObjectId& parent_id, const vector<string>& changed_paths) {
+    add(id, parent_id, changed_paths);
+
+    string record;
+    encode_record(ids.size() - 1, record);
+
+    int fd = open(COMMIT_INDEX_PATH, O_WRONLY | O_APPEND);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // A single write, so readers find either the whole record or a short tail they reject
+    ssize_t n = write(fd, record.data(), record.length());
+    if (n != (ssize_t) record.length()) {
+        // Drop the torn record, or else the whole index, which is rebuilt when next read
+        if (n > 0 && ftruncate(fd, s.st_size) != 0) {
+            remove_file(COMMIT_INDEX_PATH);
+        }
+        close(fd);
+        return -1;
+    }
+
+    return close(fd) == 0 ? 0 : -1;
+}
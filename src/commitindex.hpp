@@ -0,0 +1,83 @@
+/*
+Commit index with changed-path Bloom filters, stored at .vms/commit-index
+
+The index holds one record per entry of the commit log (.vms/log), in the same order: the id of
+the commit, the id of its first parent, and a Bloom filter of the paths it changes relative to
+that parent, along with every directory leading to them. Path-limited history tests each commit's
+filter and only reads the commits whose filter may contain the path, so a commit that certainly
+does not touch it costs a few bit tests rather than restoring it and its parent and comparing
+their files. Walks along first parents (see Repository::blame) pass such commits without reading
+them either.
+
+On-disk layout (little-endian):
+
+    header      magic "vmscix", format version, a reserved byte
+    records     id, first parent id, number of 64-bit filter words, CRC-32C of the record, then
+                the filter words
+
+Filters take 10 bits per changed path, rounded up to whole words, and set 7 bits per path derived
+from one 64-bit hash by double hashing, for about 1% false positives. A commit that changes no
+path has an empty filter, which contains nothing. One that changes more than MAX_FILTERED_PATHS
+paths has a single word with every bit set, which may contain anything.
+
+Records are only ever appended, each in a single write, under the repository lock. The index is
+derived from the log and the commits it names, so one that is missing, damaged or out of step
+with the log is rebuilt from them (see Repository::file_history).
+*/
+#ifndef COMMITINDEX_HPP
+#define COMMITINDEX_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "objectid.hpp"
+
+const char* const COMMIT_INDEX_PATH = ".vms/commit-index";
+
+const size_t MAX_FILTERED_PATHS = 512;
+
+class CommitIndex {
+    public:
+        CommitIndex();
+
+        /* Reads the index file. Returns 0 on success, 1 if there is none, or -1 if it is damaged or could not be read. */
+        int load();
+
+        /* Replaces the index file with the records held. Returns 0 on success, or -1 on failure. */
+        int save() const;
+
+        /* Adds a record for the commit id, which changes the given paths relative to its first parent */
+        void add(const ObjectId& id, const ObjectId& parent_id, const std::vector<std::string>& changed_paths);
+
+        /* Adds a record as above and appends it to the index file, which must hold the same records. Returns 0 on success, or -1 on failure. */
+        int append(const ObjectId& id, const ObjectId& parent_id, const std::vector<std::string>& changed_paths);
+
+        void clear();
+        size_t size() const { return ids.size(); }
+        const ObjectId& id(size_t i) const { return ids[i]; }
+        const ObjectId& parent_id(size_t i) const { return parent_ids[i]; }
+
+        /* Returns the record of the commit id, or -1 if it has none */
+        long find(const ObjectId& id);
+
+        /* Whether the commit of record i may change the path with the given hash; false means it certainly does not */
+        bool may_change(size_t i, uint64_t hash) const;
+
+        /* Hash of a path, or of a directory without a trailing '/', as tested by may_change */
+        static uint64_t path_hash(const char* path, size_t length);
+
+    private:
+        std::vector<ObjectId> ids;
+        std::vector<ObjectId> parent_ids;
+        std::vector<size_t> filter_ends;    // the filter of record i is words[filter_ends[i - 1], filter_ends[i])
+        std::vector<uint64_t> words;
+        std::unordered_map<ObjectId, size_t, ObjectIdHash> records;   // built on the first find
+
+        void encode_record(size_t i, std::string& out) const;
+};
+
+#endif // COMMITINDEX_HPP
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <errno.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include "config.hpp"
+#include "codec.hpp"
+#include "utils.h"
+
+using namespace std;
+
+/** Helper for removing leading and trailing whitespace **/
+static string trim(const string& s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+int load_config(map<string, string>& config) {
+    config.clear();
+
+    ifstream ifs(CONFIG_PATH);
+    if (!ifs.is_open()) {
+        return 0;
+    }
+
+    string line;
+    unsigned int line_number = 0;
+    while (getline(ifs, line)) {
+        line_number++;
+        line = trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        string key = equals == string::npos ? "" : trim(line.substr(0, equals));
+        if (key.empty()) {
+            cerr << "Error occurred in reading " << CONFIG_PATH << ": expected \"<key> = <value>\" on line " << line_number << endl;
+            return -1;
+        }
+        config[key] = trim(line.substr(equals + 1));
+    }
+
+    return 0;
+}
+
+int save_config(const map<string, string>& config) {
+    ostringstream contents;
+    map<string, string>::const_iterator it;
+    for (it = config.begin(); it != config.end(); ++it) {
+        contents << it->first << " = " << it->second << "\n";
+    }
+
+    string data = contents.str();
+    if (replace_file_atomically(CONFIG_PATH, data.data(), data.length(), 0644) != 0) {
+        cerr << "Error occurred in writing " << CONFIG_PATH << endl;
+        return -1;
+    }
+
+    return 0;
+}
+
+int get_config(const string& key, const string& fallback, string& value) {
+    map<string, string> config;
+    if (load_config(config) != 0) {
+        return -1;
+    }
+
+    map<string, string>::const_iterator it = config.find(key);
+    value = it == config.end() ? fallback : it->second;
+    return 0;
+}
+
+// Formats that are already compressed, so gain nothing from zlib
+const char* const DEFAULT_RAW_PATHS = "*.png *.jpg *.jpeg *.gif *.webp *.zip *.gz *.tgz *.bz2 *.xz *.zst *.7z *.mp3 *.mp4 *.mov";
+
+bool RawBlobPolicy::applies(const string& path, uint64_t size) const {
+    if (min_size > 0 && size >= min_size) {
+        return true;
+    }
+
+    // Padding the header out to a block would cost more than cloning saves on small files
+    if (size < RAW_BODY_OFFSET) {
+        return false;
+    }
+
+    for (size_t i = 0; i < patterns.size(); i++) {
+        if (glob_matches(patterns[i], path)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int load_raw_blob_policy(RawBlobPolicy& policy) {
+    map<string, string> config;
+    if (load_config(config) != 0) {
+        return -1;
+    }
+
+    map<string, string>::const_iterator it = config.find("raw.paths");
+    istringstream patterns(it == config.end() ? DEFAULT_RAW_PATHS : it->second);
+    string pattern;
+    policy.patterns.clear();
+    while (patterns >> pattern) {
+        policy.patterns.push_back(pattern);
+    }
+
+    policy.min_size = 0;
+    it = config.find("raw.min_size");
+    if (it != config.end()) {
+        char* end;
+        errno = 0;
+        unsigned long long min_size = strtoull(it->second.c_str(), &end, 10);
+        if (it->second.empty() || *end != '\0' || errno != 0) {
+            cerr << "Error occurred in reading " << CONFIG_PATH << ": raw.min_size must be a number of bytes" << endl;
+            return -1;
+        }
+        policy.min_size = min_size;
+    }
+
+    return 0;
+}
+
+int load_alternates(vector<string>& alternates) {
+    map<string, string> config;
+    if (load_config(config) != 0) {
+        return -1;
+    }
+
+    alternates.clear();
+
+    map<string, string>::const_iterator it = config.find("alternates");
+    if (it == config.end()) {
+        return 0;
+    }
+
+    // A relative path would name another directory from a clone of the repository
+    istringstream paths(it->second);
+    string path;
+    while (paths >> path) {
+        if (path[0] != '/') {
+            cerr << "Error occurred in reading " << CONFIG_PATH << ": alternates must be absolute paths, not " << path << endl;
+            return -1;
+        }
+        alternates.push_back(path);
+    }
+
+    return 0;
+}
+
+int load_sparse_checkout(SparseCheckout& sparse) {
+    map<string, string> config;
+    if (load_config(config) != 0) {
+        return -1;
+    }
+
+    sparse.paths = Pathspec();
+
+    map<string, string>::const_iterator it = config.find("sparse.paths");
+    if (it == config.end()) {
+        return 0;
+    }
+
+    istringstream paths(it->second);
+    string path;
+    while (paths >> path) {
+        sparse.paths.add(path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+Repository configuration in .vms/config
+
+One setting per line, written as "<key> = <value>". Blank lines and lines starting with '#' are
+ignored. This setting is fixed when the repository is created by vms init:
+
+    store       object store backend: "loose" (one file per object, the default) or "log"
+                (a single append-only data file with a hash index, see logstore.hpp)
+
+These may be edited at any time, and apply to files staged afterwards:
+
+    raw.paths       space-separated glob patterns of files to store raw rather than compressed, so
+                    checkout can clone them (see codec.hpp). Patterns without a '/' match the file
+                    name, others the whole path. Defaults to common already compressed formats.
+    raw.min_size    files of at least this many bytes are stored raw whatever their path; 0, the
+                    default, turns this off
+
+this one applies to every command:
+
+    alternates      space-separated absolute paths of the object directories of other repositories
+                    on this machine, or of the repositories themselves, read for objects missing
+                    from .vms/objects (see objectstore.hpp)
+
+and this one applies to checkouts made afterwards:
+
+    sparse.paths    space-separated pathspec of the files checkout writes into the working
+                    directory (see pathspec.hpp and Repository::checkout_files): directory cones,
+                    glob patterns and '!' exclusions. Unset, every file is checked out.
+*/
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "pathspec.hpp"
+
+const char* const CONFIG_PATH = ".vms/config";
+
+/* Reads every setting into config. A missing file holds no settings. Returns 0 on success, or -1 if the file is malformed. */
+int load_config(std::map<std::string, std::string>& config);
+
+/* Replaces .vms/config with the given settings. Returns 0 on success, or -1 on failure. */
+int save_config(const std::map<std::string, std::string>& config);
+
+/* Sets value to the setting named key, or to fallback if it is not set. Returns 0 on success, or -1 if the file is malformed. */
+int get_config(const std::string& key, const std::string& fallback, std::string& value);
+
+/* Which staged files are stored raw, from the raw.* settings */
+struct RawBlobPolicy {
+    std::vector<std::string> patterns;
+    uint64_t min_size;
+
+    RawBlobPolicy() : min_size(0) {}
+
+    /* Whether the file at path with the given size should be stored raw */
+    bool applies(const std::string& path, uint64_t size) const;
+};
+
+/* Reads the raw.* settings into policy. Returns 0 on success, or -1 if the file or a setting is malformed. */
+int load_raw_blob_policy(RawBlobPolicy& policy);
+
+/* Reads the paths of the alternates setting into alternates. Returns 0 on success, or -1 if the file is malformed or a path is not absolute. */
+int load_alternates(std::vector<std::string>& alternates);
+
+/* Which files checkouts write, from the sparse.paths setting */
+struct SparseCheckout {
+    Pathspec paths;
+
+    /* Whether any paths are set, so that checkouts are limited to them */
+    bool is_sparse() const { return !paths.empty(); }
+
+    /* Whether the file at path is checked out */
+    bool selects(const std::string& path) const { return paths.matches(path); }
+};
+
+/* Reads the sparse.paths setting into sparse. Returns 0 on success, or -1 if the file is malformed. */
+int load_sparse_checkout(SparseCheckout& sparse);
+
+#endif // CONFIG_HPP
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include "crc32c.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  include <nmmintrin.h>
+#  define CRC32C_X86
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#  define CRC32C_ARM
+#endif
+
+static const uint32_t CRC32C_POLY = 0x82f63b78; // reversed Castagnoli polynomial
+
+/** Lookup tables for slicing-by-8: entries[k][b] is the CRC of byte b followed by k zero bytes **/
+struct Crc32cTable {
+    uint32_t entries[8][256];
+
+    Crc32cTable() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int j = 0; j < 8; j++) {
+                crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            entries[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                entries[k][i] = entries[0][entries[k - 1][i] & 0xff] ^ (entries[k - 1][i] >> 8);
+            }
+        }
+    }
+};
+
+/** Portable implementation, consuming eight bytes per step **/
+static uint32_t crc32c_software(const unsigned char* p, size_t len, uint32_t crc) {
+    static const Crc32cTable table;
+
+    while (len >= 8) {
+        uint32_t lo = crc ^ ((uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24);
+        crc = table.entries[7][lo & 0xff] ^ table.entries[6][(lo >> 8) & 0xff]
+            ^ table.entries[5][(lo >> 16) & 0xff] ^ table.entries[4][lo >> 24]
+            ^ table.entries[3][p[4]] ^ table.entries[2][p[5]]
+            ^ table.entries[1][p[6]] ^ table.entries[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = table.entries[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(CRC32C_X86)
+
+/** SSE4.2 implementation, compiled for that instruction set only and selected when the processor supports it **/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(const unsigned char* p, size_t len, uint32_t crc) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t) crc64;
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+static bool has_hardware_crc32c() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#elif defined(CRC32C_ARM)
+
+/** ARMv8 CRC32 extension, which the compiler was told is always present **/
+static uint32_t crc32c_hardware(const unsigned char* p, size_t len, uint32_t crc) {
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+
+static bool has_hardware_crc32c() {
+    return true;
+}
+
+#endif
+
+uint32_t crc32c(const void* data, size_t len, uint32_t crc) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+    static const bool hardware = has_hardware_crc32c();
+    if (hardware) {
+        return ~crc32c_hardware(p, len, ~crc);
+    }
+#endif
+
+    return ~crc32c_software(p, len, ~crc);
+}
@@ -0,0 +1,13 @@
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* 
+    Computes the CRC-32C (Castagnoli) checksum of len bytes starting at data.
+    May be chained across buffers by passing the previously returned value as crc.
+*/
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+#endif // CRC32C_HPP
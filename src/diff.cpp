@@ -0,0 +1,432 @@
+#include <string.h>
+
+#include <unordered_map>
+#include <algorithm>
+
+#include "diff.hpp"
+
+using namespace std;
+
+uint64_t hash_line(const char* data, size_t length) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char) data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void split_lines(const string& text, vector<LineRef>& lines) {
+    lines.clear();
+
+    const char* p = text.data();
+    const char* end = p + text.length();
+
+    while (p < end) {
+        const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* line_end = (nl == NULL) ? end : nl + 1;
+
+        LineRef line = {p, static_cast<size_t>(line_end - p)};
+        lines.push_back(line);
+
+        p = line_end;
+    }
+}
+
+bool is_binary_content(const string& text) {
+    size_t n = min(text.length(), static_cast<size_t>(8000));
+    return memchr(text.data(), '\0', n) != NULL;
+}
+
+namespace {
+
+struct LineKey {
+    const char* data;
+    size_t length;
+    uint64_t hash;
+
+    bool operator==(const LineKey& other) const {
+        return hash == other.hash && length == other.length && memcmp(data, other.data, length) == 0;
+    }
+};
+
+struct LineKeyHash {
+    size_t operator()(const LineKey& key) const {
+        return static_cast<size_t>(key.hash);
+    }
+};
+
+/** Replaces each line by a small integer shared by all identical lines, so the diff compares integers **/
+void assign_line_ids(const vector<LineRef>& a, const vector<LineRef>& b, vector<uint32_t>& a_ids, vector<uint32_t>& b_ids) {
+    unordered_map<LineKey, uint32_t, LineKeyHash> ids;
+    ids.reserve(a.size() + b.size());
+
+    a_ids.resize(a.size());
+    b_ids.resize(b.size());
+
+    for (size_t i = 0; i < a.size(); i++) {
+        LineKey key = {a[i].data, a[i].length, hash_line(a[i].data, a[i].length)};
+        a_ids[i] = ids.insert(make_pair(key, static_cast<uint32_t>(ids.size()))).first->second;
+    }
+
+    for (size_t i = 0; i < b.size(); i++) {
+        LineKey key = {b[i].data, b[i].length, hash_line(b[i].data, b[i].length)};
+        b_ids[i] = ids.insert(make_pair(key, static_cast<uint32_t>(ids.size()))).first->second;
+    }
+}
+
+/** Linear space Myers diff marking lines of a that were removed and lines of b that were inserted **/
+class MyersDiff {
+    public:
+        MyersDiff(const vector<uint32_t>& a, const vector<uint32_t>& b) : a(a), b(b), a_changed(a.size(), false), b_changed(b.size(), false) {}
+
+        void run() {
+            compare(0, a.size(), 0, b.size());
+        }
+
+        const vector<uint32_t>& a;
+        const vector<uint32_t>& b;
+        vector<bool> a_changed;
+        vector<bool> b_changed;
+
+    private:
+        vector<long> v_forward;
+        vector<long> v_backward;
+
+        void compare(size_t a_lo, size_t a_hi, size_t b_lo, size_t b_hi) {
+            // Strip common prefix and suffix
+            while (a_lo < a_hi && b_lo < b_hi && a[a_lo] == b[b_lo]) {
+                a_lo++;
+                b_lo++;
+            }
+            while (a_lo < a_hi && b_lo < b_hi && a[a_hi - 1] == b[b_hi - 1]) {
+                a_hi--;
+                b_hi--;
+            }
+
+            if (a_lo == a_hi) {
+                for (size_t j = b_lo; j < b_hi; j++) {
+                    b_changed[j] = true;
+                }
+                return;
+            }
+
+            if (b_lo == b_hi) {
+                for (size_t i = a_lo; i < a_hi; i++) {
+                    a_changed[i] = true;
+                }
+                return;
+            }
+
+            size_t a_mid;
+            size_t b_mid;
+
+            if (!bisect(a_lo, a_hi, b_lo, b_hi, a_mid, b_mid)) {
+                // No common subsequence: everything was replaced
+                for (size_t i = a_lo; i < a_hi; i++) {
+                    a_changed[i] = true;
+                }
+                for (size_t j = b_lo; j < b_hi; j++) {
+                    b_changed[j] = true;
+                }
+                return;
+            }
+
+            compare(a_lo, a_mid, b_lo, b_mid);
+            compare(a_mid, a_hi, b_mid, b_hi);
+        }
+
+        /** Finds the middle snake of the shortest edit script by searching forwards and backwards simultaneously **/
+        bool bisect(size_t a_lo, size_t a_hi, size_t b_lo, size_t b_hi, size_t& a_mid, size_t& b_mid) {
+            const long n = a_hi - a_lo;
+            const long m = b_hi - b_lo;
+            const long max_d = (n + m + 1) / 2;
+            const long v_offset = max_d;
+            const long v_length = 2 * max_d + 2;
+
+            v_forward.assign(v_length, -1);
+            v_backward.assign(v_length, -1);
+            v_forward[v_offset + 1] = 0;
+            v_backward[v_offset + 1] = 0;
+
+            const long delta = n - m;
+            const bool front = (delta % 2 != 0);
+
+            long k1_start = 0;
+            long k1_end = 0;
+            long k2_start = 0;
+            long k2_end = 0;
+
+            for (long d = 0; d < max_d; d++) {
+                for (long k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+                    long k1_offset = v_offset + k1;
+                    long x1;
+                    if (k1 == -d || (k1 != d && v_forward[k1_offset - 1] < v_forward[k1_offset + 1])) {
+                        x1 = v_forward[k1_offset + 1];
+                    } else {
+                        x1 = v_forward[k1_offset - 1] + 1;
+                    }
+                    long y1 = x1 - k1;
+                    while (x1 < n && y1 < m && a[a_lo + x1] == b[b_lo + y1]) {
+                        x1++;
+                        y1++;
+                    }
+                    v_forward[k1_offset] = x1;
+
+                    if (x1 > n) {
+                        k1_end += 2;
+                    } else if (y1 > m) {
+                        k1_start += 2;
+                    } else if (front) {
+                        long k2_offset = v_offset + delta - k1;
+                        if (k2_offset >= 0 && k2_offset < v_length && v_backward[k2_offset] != -1) {
+                            long x2 = n - v_backward[k2_offset];
+                            if (x1 >= x2) {
+                                a_mid = a_lo + x1;
+                                b_mid = b_lo + y1;
+                                return true;
+                            }
+                        }
+                    }
+                }
+
+                for (long k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+                    long k2_offset = v_offset + k2;
+                    long x2;
+                    if (k2 == -d || (k2 != d && v_backward[k2_offset - 1] < v_backward[k2_offset + 1])) {
+                        x2 = v_backward[k2_offset + 1];
+                    } else {
+                        x2 = v_backward[k2_offset - 1] + 1;
+                    }
+                    long y2 = x2 - k2;
+                    while (x2 < n && y2 < m && a[a_hi - x2 - 1] == b[b_hi - y2 - 1]) {
+                        x2++;
+                        y2++;
+                    }
+                    v_backward[k2_offset] = x2;
+
+                    if (x2 > n) {
+                        k2_end += 2;
+                    } else if (y2 > m) {
+                        k2_start += 2;
+                    } else if (!front) {
+                        long k1_offset = v_offset + delta - k2;
+                        if (k1_offset >= 0 && k1_offset < v_length && v_forward[k1_offset] != -1) {
+                            long x1 = v_forward[k1_offset];
+                            long y1 = v_offset + x1 - k1_offset;
+                            if (x1 >= n - x2) {
+                                a_mid = a_lo + x1;
+                                b_mid = b_lo + y1;
+                                return true;
+                            }
+                        }
+                    }
+                }
+            }
+
+            return false;
+        }
+};
+
+/** Appends a line to os as part of a hunk, flagging a missing newline at end of file **/
+void write_hunk_line(ostream& os, char marker, const LineRef& line) {
+    os << marker;
+    os.write(line.data, line.length);
+    if (line.length == 0 || line.data[line.length - 1] != '\n') {
+        os << "\n\\ No newline at end of file\n";
+    }
+}
+
+/** Writes a hunk range in unified diff format, e.g. "3,4", "3" for a single line, or "2,0" for an empty range after line 2 **/
+void write_hunk_range(ostream& os, size_t begin, size_t end) {
+    size_t length = end - begin;
+    if (length == 0) {
+        os << begin << ",0";
+    } else if (length == 1) {
+        os << begin + 1;
+    } else {
+        os << begin + 1 << "," << length;
+    }
+}
+
+} // namespace
+
+void diff_lines(const vector<LineRef>& a, const vector<LineRef>& b, vector<DiffChange>& changes) {
+    changes.clear();
+
+    vector<uint32_t> a_ids;
+    vector<uint32_t> b_ids;
+    assign_line_ids(a, b, a_ids, b_ids);
+
+    MyersDiff myers(a_ids, b_ids);
+    myers.run();
+
+    // Collect runs of changed lines; unchanged lines of a and b pair up one to one between runs
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.size() || j < b.size()) {
+        if (i < a.size() && j < b.size() && !myers.a_changed[i] && !myers.b_changed[j]) {
+            i++;
+            j++;
+            continue;
+        }
+
+        DiffChange change;
+        change.a_begin = i;
+        change.b_begin = j;
+        while (i < a.size() && myers.a_changed[i]) {
+            i++;
+        }
+        while (j < b.size() && myers.b_changed[j]) {
+            j++;
+        }
+        change.a_end = i;
+        change.b_end = j;
+        changes.push_back(change);
+    }
+}
+
+void write_unified_hunks(ostream& os, const vector<LineRef>& a, const vector<LineRef>& b, const vector<DiffChange>& changes, size_t context) {
+    size_t first = 0;
+
+    while (first < changes.size()) {
+        // Extend the hunk over following changes whose context would overlap
+        size_t last = first;
+        while (last + 1 < changes.size() && changes[last + 1].a_begin - changes[last].a_end <= 2 * context) {
+            last++;
+        }
+
+        size_t lead = min(context, changes[first].a_begin);
+        size_t a_begin = changes[first].a_begin - lead;
+        size_t b_begin = changes[first].b_begin - lead;
+        size_t trail = min(context, a.size() - changes[last].a_end);
+        size_t a_end = changes[last].a_end + trail;
+        size_t b_end = changes[last].b_end + trail;
+
+        os << "@@ -";
+        write_hunk_range(os, a_begin, a_end);
+        os << " +";
+        write_hunk_range(os, b_begin, b_end);
+        os << " @@\n";
+
+        size_t pos = a_begin;
+        for (size_t c = first; c <= last; c++) {
+            for (; pos < changes[c].a_begin; pos++) {
+                write_hunk_line(os, ' ', a[pos]);
+            }
+            for (size_t i = changes[c].a_begin; i < changes[c].a_end; i++) {
+                write_hunk_line(os, '-', a[i]);
+            }
+            for (size_t j = changes[c].b_begin; j < changes[c].b_end; j++) {
+                write_hunk_line(os, '+', b[j]);
+            }
+            pos = changes[c].a_end;
+        }
+        for (; pos < a_end; pos++) {
+            write_hunk_line(os, ' ', a[pos]);
+        }
+
+        first = last + 1;
+    }
+}
+
+/** Appends lines [begin, end) to out **/
+static void append_lines(const vector<LineRef>& lines, size_t begin, size_t end, string& out) {
+    for (size_t i = begin; i < end; i++) {
+        out.append(lines[i].data, lines[i].length);
+    }
+}
+
+/** Appends a conflict marker line, first ending the preceding line if it lacks a newline **/
+static void append_marker(const string& marker, string& out) {
+    if (!out.empty() && out[out.length() - 1] != '\n') {
+        out += '\n';
+    }
+    out += marker;
+    out += '\n';
+}
+
+/** Helper comparing runs of lines of two texts by content **/
+static bool same_lines(const vector<LineRef>& a, size_t a_begin, size_t a_end, const vector<LineRef>& b, size_t b_begin, size_t b_end) {
+    if (a_end - a_begin != b_end - b_begin) {
+        return false;
+    }
+    for (size_t i = 0; i < a_end - a_begin; i++) {
+        const LineRef& x = a[a_begin + i];
+        const LineRef& y = b[b_begin + i];
+        if (x.length != y.length || memcmp(x.data, y.data, x.length) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t merge_lines(const vector<LineRef>& base, const vector<LineRef>& ours, const vector<LineRef>& theirs,
+                   const string& ours_label, const string& theirs_label, string& merged) {
+    vector<DiffChange> sides[2];
+    diff_lines(base, ours, sides[0]);
+    diff_lines(base, theirs, sides[1]);
+
+    size_t next[2] = {0, 0};    // first change of each side not yet merged
+    long delta[2] = {0, 0};     // lines added minus lines removed by each side's merged changes
+    size_t pos = 0;             // lines of base before pos are merged
+    size_t n_conflicts = 0;
+
+    while (next[0] < sides[0].size() || next[1] < sides[1].size()) {
+        // Start a region at the earliest change, then grow it over changes of either side that overlap or touch it
+        int first = next[1] >= sides[1].size() || (next[0] < sides[0].size() && sides[0][next[0]].a_begin <= sides[1][next[1]].a_begin) ? 0 : 1;
+        size_t lo = sides[first][next[first]].a_begin;
+        size_t hi = sides[first][next[first]].a_end;
+        size_t end[2] = {next[0], next[1]};
+        end[first]++;
+
+        bool grown = true;
+        while (grown) {
+            grown = false;
+            for (int side = 0; side < 2; side++) {
+                while (end[side] < sides[side].size() && sides[side][end[side]].a_begin <= hi) {
+                    hi = max(hi, sides[side][end[side]].a_end);
+                    end[side]++;
+                    grown = true;
+                }
+            }
+        }
+
+        append_lines(base, pos, lo, merged);
+
+        // Each side's version of base lines [lo, hi): lines outside its changes are shifted by its changes before them
+        size_t side_begin[2];
+        size_t side_end[2];
+        for (int side = 0; side < 2; side++) {
+            side_begin[side] = lo + delta[side];
+            for (size_t c = next[side]; c < end[side]; c++) {
+                const DiffChange& change = sides[side][c];
+                delta[side] += (long) (change.b_end - change.b_begin) - (long) (change.a_end - change.a_begin);
+            }
+            side_end[side] = hi + delta[side];
+        }
+
+        bool ours_changed = end[0] > next[0];
+        bool theirs_changed = end[1] > next[1];
+
+        if (!theirs_changed || (ours_changed && same_lines(ours, side_begin[0], side_end[0], theirs, side_begin[1], side_end[1]))) {
+            append_lines(ours, side_begin[0], side_end[0], merged);
+        } else if (!ours_changed) {
+            append_lines(theirs, side_begin[1], side_end[1], merged);
+        } else {
+            append_marker("<<<<<<< " + ours_label, merged);
+            append_lines(ours, side_begin[0], side_end[0], merged);
+            append_marker("=======", merged);
+            append_lines(theirs, side_begin[1], side_end[1], merged);
+            append_marker(">>>>>>> " + theirs_label, merged);
+            n_conflicts++;
+        }
+
+        next[0] = end[0];
+        next[1] = end[1];
+        pos = hi;
+    }
+
+    append_lines(base, pos, base.size(), merged);
+    return n_conflicts;
+}
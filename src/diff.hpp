@@ -0,0 +1,57 @@
+/*
+Line-oriented diff engine used by vms diff, and the three-way line merge used by vms merge
+*/
+#ifndef DIFF_HPP
+#define DIFF_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+/* A line of text referenced in place, including its terminating newline if it has one */
+struct LineRef {
+    const char* data;
+    size_t length;
+};
+
+/* A run of lines [a_begin, a_end) removed from the old text and replaced by [b_begin, b_end) of the new text */
+struct DiffChange {
+    size_t a_begin;
+    size_t a_end;
+    size_t b_begin;
+    size_t b_end;
+};
+
+/* Fast non-cryptographic hash (64-bit FNV-1a) of a line */
+uint64_t hash_line(const char* data, size_t length);
+
+/* Splits text into lines, keeping terminators; the lines reference text, which must outlive them */
+void split_lines(const std::string& text, std::vector<LineRef>& lines);
+
+/* Heuristically detects binary content by looking for a NUL byte near the start of text */
+bool is_binary_content(const std::string& text);
+
+/*
+    Computes a minimal line diff (Myers' algorithm in linear space) between a and b and stores
+    the resulting changes, in order, into changes.
+*/
+void diff_lines(const std::vector<LineRef>& a, const std::vector<LineRef>& b, std::vector<DiffChange>& changes);
+
+/*
+    Three-way line merge (diff3) of the changes made to base by ours and by theirs, appended to merged.
+    Changes to separate regions of base are combined. Changes to the same or adjacent lines are kept
+    if both sides made the same change, and otherwise written between conflict markers naming each
+    side: "<<<<<<< <ours_label>", the lines of ours, "=======", the lines of theirs, ">>>>>>> <theirs_label>".
+    Returns the number of conflicts.
+*/
+size_t merge_lines(const std::vector<LineRef>& base, const std::vector<LineRef>& ours, const std::vector<LineRef>& theirs,
+                   const std::string& ours_label, const std::string& theirs_label, std::string& merged);
+
+/* Writes the hunks of a unified diff of changes between a and b with the given lines of context to os */
+void write_unified_hunks(std::ostream& os, const std::vector<LineRef>& a, const std::vector<LineRef>& b,
+                         const std::vector<DiffChange>& changes, size_t context = 3);
+
+#endif // DIFF_HPP
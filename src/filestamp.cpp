@@ -0,0 +1,33 @@
+#include <sys/stat.h>
+
+#include "filestamp.hpp"
+
+FileStamp::FileStamp() : exists(false), dev(0), ino(0), size(0), mtime_sec(0), mtime_nsec(0) {}
+
+FileStamp FileStamp::of(const char* path) {
+    FileStamp stamp;
+    struct stat s;
+    if (stat(path, &s) == 0) {
+        stamp.exists = true;
+        stamp.dev = s.st_dev;
+        stamp.ino = s.st_ino;
+        stamp.size = s.st_size;
+#ifdef __APPLE__
+        stamp.mtime_sec = s.st_mtimespec.tv_sec;
+        stamp.mtime_nsec = s.st_mtimespec.tv_nsec;
+#else
+        stamp.mtime_sec = s.st_mtim.tv_sec;
+        stamp.mtime_nsec = s.st_mtim.tv_nsec;
+#endif
+    }
+    return stamp;
+}
+
+bool FileStamp::operator==(const FileStamp& other) const {
+    return exists == other.exists && dev == other.dev && ino == other.ino && size == other.size &&
+           mtime_sec == other.mtime_sec && mtime_nsec == other.mtime_nsec;
+}
+
+bool FileStamp::operator!=(const FileStamp& other) const {
+    return !(*this == other);
+}
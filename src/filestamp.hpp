@@ -0,0 +1,21 @@
+#ifndef FILESTAMP_HPP
+#define FILESTAMP_HPP
+
+#include <sys/types.h>
+
+/* Identity of a file on disk, used to tell whether state cached from it is still current */
+struct FileStamp {
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    long mtime_sec;
+    long mtime_nsec;
+
+    FileStamp();
+    static FileStamp of(const char* path);
+    bool operator==(const FileStamp& other) const;
+    bool operator!=(const FileStamp& other) const;
+};
+
+#endif // FILESTAMP_HPP
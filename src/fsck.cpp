@@ -0,0 +1,313 @@
+#include <sys/types.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+#include <boost/serialization/string.hpp>
+
+#include "fsck.hpp"
+#include "access.hpp"
+#include "archive.hpp"
+#include "blob.hpp"
+#include "codec.hpp"
+#include "commit.hpp"
+#include "index.hpp"
+#include "objectstore.hpp"
+#include "parallel.hpp"
+#include "refs.hpp"
+#include "repository.hpp"
+#include "vms.hpp"
+
+using namespace std;
+
+namespace {
+
+struct ObjectFile {
+    ObjectStore* store;
+    ObjectId id;
+    bool cached;    // staged blob in the staging store rather than a committed object
+    string path;    // location of the object, for messages
+};
+
+/* Link from a commit to another object, checked once every object is known */
+struct Reference {
+    ObjectId target;
+    char kind;
+    string description;
+};
+
+struct ObjectResult {
+    char kind;      // 0 if the object could not be read
+    bool legacy;
+    string problem;
+    vector<Reference> references;
+};
+
+struct Problem {
+    string path;
+    string description;
+
+    bool operator<(const Problem& other) const {
+        return path < other.path || (path == other.path && description < other.description);
+    }
+};
+
+/** Records the parents and files of commit as references to check later **/
+void collect_references(const Commit& commit, ObjectResult& result) {
+    pair<ObjectId, ObjectId> parents = commit.parent_ids();
+    if (!parents.first.is_null()) {
+        Reference parent = {parents.first, CODEC_KIND_COMMIT, "parent " + parents.first.hex()};
+        result.references.push_back(parent);
+    }
+    if (!parents.second.is_null()) {
+        Reference parent = {parents.second, CODEC_KIND_COMMIT, "parent " + parents.second.hex()};
+        result.references.push_back(parent);
+    }
+
+    const map<string, ObjectId>& files = commit.get_map();
+    map<string, ObjectId>::const_iterator it;
+    for (it = files.begin(); it != files.end(); ++it) {
+        Reference file = {it->second, CODEC_KIND_BLOB, "blob " + it->second.hex() + " of file " + it->first};
+        result.references.push_back(file);
+    }
+}
+
+/** Verifies one object file in the current format. Legacy archives are only flagged, as boost archives are read on the main thread. **/
+void check_object(const ObjectFile& file, ObjectResult& result) {
+    result.kind = 0;
+    result.legacy = false;
+
+    string buffer;
+    if (file.store->get(file.id, buffer) != 0) {
+        result.problem = "unreadable";
+        return;
+    }
+
+    char kind;
+    const char* data;
+    size_t length;
+    bool checksummed;
+    const char* problem;
+
+    int ret = parse_object_file(buffer, kind, data, length, checksummed, problem);
+    if (ret == 1) {
+        result.legacy = true;
+        return;
+    } else if (ret != 0) {
+        result.problem = problem;
+        return;
+    }
+
+    if (kind == CODEC_KIND_BLOB) {
+        if (ObjectHasher::hash(data, length) != file.id) {
+            result.problem = "id mismatch";
+            return;
+        }
+    } else if (kind == CODEC_KIND_COMMIT && !file.cached) {
+        Commit commit;
+        if (decode_commit(data, length, commit) != 0) {
+            result.problem = "malformed commit";
+            return;
+        }
+        if (commit.id() != file.id) {
+            result.problem = "id mismatch";
+            return;
+        }
+        collect_references(commit, result);
+    } else {
+        result.problem = string("unexpected kind of object '") + kind + "'";
+        return;
+    }
+
+    result.kind = kind;
+}
+
+/** Restores obj from the legacy boost archive held in buffer, throwing boost exceptions if it is malformed **/
+template <class T>
+void restore_legacy(const string& buffer, T& obj) {
+    istringstream iss(buffer);
+    restore_archive<T>(obj, iss);
+}
+
+/** Verifies a legacy boost archive, which does not record whether it holds a commit or a blob **/
+void check_legacy_object(const ObjectFile& file, ObjectResult& result) {
+    string buffer;
+    if (file.store->get(file.id, buffer) != 0) {
+        result.problem = "unreadable";
+        return;
+    }
+
+    if (!file.cached) {
+        try {
+            Commit commit;
+            restore_legacy(buffer, commit);
+            if (commit.id() == file.id) {
+                result.kind = CODEC_KIND_COMMIT;
+                collect_references(commit, result);
+                return;
+            }
+        } catch (exception& e) {
+            // not a commit, so try it as a blob
+        }
+    }
+
+    try {
+        Blob blob;
+        restore_legacy(buffer, blob);
+        if (blob.id() == file.id) {
+            result.kind = CODEC_KIND_BLOB;
+            return;
+        }
+    } catch (exception& e) {
+        result.problem = string("unreadable archive (") + e.what() + ")";
+        return;
+    }
+
+    result.problem = "id mismatch";
+}
+
+/** Lists the objects in store **/
+void list_object_files(ObjectStore& store, bool cached, vector<ObjectFile>& files) {
+    store.for_each([&store, cached, &files](const ObjectId& id) {
+        ObjectFile file = {&store, id, cached, store.location(id)};
+        files.push_back(file);
+    });
+}
+
+void list_all_object_files(ObjectStore& object_store, ObjectStore& staging_store, vector<ObjectFile>& files) {
+    list_object_files(object_store, false, files);
+    list_object_files(staging_store, true, files);
+}
+
+} // namespace
+
+int vms_fsck() {
+    ObjectStore* object_store;
+    ObjectStore* staging_store;
+    int ret = vms_repository().object_stores(object_store, staging_store);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in checking the repository: unable to open the object store: " << repo_strerror(ret) << endl;
+        return -1;
+    }
+
+    vector<ObjectFile> files;
+    list_all_object_files(*object_store, *staging_store, files);
+
+    // Each worker writes only to the result slot of the object it checks
+    vector<ObjectResult> results(files.size());
+    unsigned int n_workers = worker_count(files.size());
+    parallel_for(files.size(), [&files, &results](size_t i) {
+        check_object(files[i], results[i]);
+    });
+
+    vector<Problem> problems;
+    unordered_map<ObjectId, char, ObjectIdHash> objects;
+    unordered_map<ObjectId, char, ObjectIdHash> cached;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (results[i].legacy) {
+            check_legacy_object(files[i], results[i]);
+        }
+
+        if (!results[i].problem.empty()) {
+            Problem problem = {files[i].path, results[i].problem};
+            problems.push_back(problem);
+        }
+        (files[i].cached ? cached : objects)[files[i].id] = results[i].kind;    // kind 0 marks a damaged object
+    }
+
+    // History: commits may only refer to committed objects of the right kind
+    for (size_t i = 0; i < files.size(); i++) {
+        const vector<Reference>& references = results[i].references;
+        for (size_t j = 0; j < references.size(); j++) {
+            unordered_map<ObjectId, char, ObjectIdHash>::const_iterator it = objects.find(references[j].target);
+            if (it == objects.end() && object_store->has(references[j].target)) {
+                continue;   // borrowed from an alternate, which is checked in its own repository
+            } else if (it == objects.end()) {
+                Problem problem = {files[i].path, references[j].description + " is missing"};
+                problems.push_back(problem);
+            } else if (it->second == 0) {
+                Problem problem = {files[i].path, references[j].description + " is damaged"};
+                problems.push_back(problem);
+            } else if (it->second != references[j].kind) {
+                Problem problem = {files[i].path, references[j].description + " is not a " + (references[j].kind == CODEC_KIND_COMMIT ? "commit" : "blob")};
+                problems.push_back(problem);
+            }
+        }
+    }
+
+    // Refs
+    size_t n_refs = 0;
+    map<string, string> refs;
+    if (list_refs(refs) != 0) {
+        Problem problem = {PACKED_REFS_PATH, "malformed or fails its checksum"};
+        problems.push_back(problem);
+    }
+
+    map<string, string>::const_iterator ref_it;
+    for (ref_it = refs.begin(); ref_it != refs.end(); ++ref_it) {
+        n_refs++;
+
+        string path = loose_ref_path(ref_it->first);
+        if (!is_valid_file(path.c_str())) {
+            path = string(PACKED_REFS_PATH) + ": " + ref_it->first;
+        }
+
+        ObjectId id;
+        if (!ObjectId::parse(ref_it->second, id)) {
+            Problem problem = {path, "does not hold a commit id"};
+            problems.push_back(problem);
+        } else {
+            unordered_map<ObjectId, char, ObjectIdHash>::const_iterator it = objects.find(id);
+            if ((it == objects.end() && !object_store->has(id)) || (it != objects.end() && it->second != CODEC_KIND_COMMIT)) {
+                Problem problem = {path, "does not refer to an intact commit: " + ref_it->second};
+                problems.push_back(problem);
+            }
+        }
+    }
+
+    string head;
+    n_refs++;
+    if (get_branch(head) != 0 || !is_valid_branch(head.c_str())) {
+        Problem problem = {".vms/HEAD", "does not name an existing branch"};
+        problems.push_back(problem);
+    }
+
+    // Index
+    map<string, ObjectId> index;
+    if (load_index(index) != 0) {
+        Problem problem = {".vms/index", "malformed or fails its checksum"};
+        problems.push_back(problem);
+    }
+
+    map<string, ObjectId>::const_iterator it;
+    for (it = index.begin(); it != index.end(); ++it) {
+        if (it->second == STAGE_DELETE) {
+            continue;
+        }
+        if (cached.find(it->second) == cached.end() && objects.find(it->second) == objects.end()) {
+            Problem problem = {".vms/index", "blob " + it->second.hex() + " staged for " + it->first + " is missing"};
+            problems.push_back(problem);
+        }
+    }
+
+    sort(problems.begin(), problems.end());
+    for (size_t i = 0; i < problems.size(); i++) {
+        cout << problems[i].path << ": " << problems[i].description << "\n";
+    }
+
+    cout << "Checked " << files.size() << " objects, " << n_refs << " refs and " << index.size() << " index entries with " << n_workers << " workers: ";
+    if (problems.empty()) {
+        cout << "no problems found" << endl;
+        return 0;
+    }
+
+    cout << problems.size() << (problems.size() == 1 ? " problem" : " problems") << " found" << endl;
+    return -1;
+}
@@ -0,0 +1,23 @@
+/*
+Repository consistency check
+
+Verifies, with a pool of worker threads:
+
+    objects       every object in the object and staging stores parses and rehashes to the id it is stored under
+    history       every parent and tracked file of a commit refers to an object of the right kind
+    refs          HEAD names an existing branch, every branch, loose or packed, refers to an existing commit, and
+                  the packed refs pass their checksum
+    index         the staging index passes its checksum, and every staged blob exists
+
+Objects borrowed from alternates of the object store (see objectstore.hpp) are taken to exist, and
+are checked by running fsck in the repository that holds them.
+
+Each problem is reported on standard output as "<path>: <problem>", followed by a summary.
+*/
+#ifndef FSCK_HPP
+#define FSCK_HPP
+
+/* Returns 0 if the repository is consistent, or -1 if any problem was found */
+int vms_fsck();
+
+#endif // FSCK_HPP
@@ -0,0 +1,294 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/dir.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+
+#include "gc.hpp"
+#include "access.hpp"
+#include "codec.hpp"
+#include "commit.hpp"
+#include "index.hpp"
+#include "objectstore.hpp"
+#include "parallel.hpp"
+#include "refs.hpp"
+#include "repository.hpp"
+#include "utils.h"
+#include "vms.hpp"
+
+using namespace std;
+
+namespace {
+
+typedef unordered_set<ObjectId, ObjectIdHash> IdSet;
+
+/* Outcome of loading one commit during the mark phase */
+struct MarkResult {
+    bool loaded;
+    bool legacy;    // boost archive, left for the main thread
+    ObjectId parents[2];
+    vector<ObjectId> blobs;
+};
+
+void collect_links(const Commit& commit, MarkResult& result) {
+    pair<ObjectId, ObjectId> parents = commit.parent_ids();
+    result.parents[0] = parents.first;
+    result.parents[1] = parents.second;
+
+    const map<string, ObjectId>& files = commit.get_map();
+    result.blobs.reserve(files.size());
+    map<string, ObjectId>::const_iterator it;
+    for (it = files.begin(); it != files.end(); ++it) {
+        result.blobs.push_back(it->second);
+    }
+
+    result.loaded = true;
+}
+
+/** Loads the commit with the given id, on a worker thread **/
+void load_links(ObjectStore& objects, const ObjectId& id, MarkResult& result) {
+    result.loaded = false;
+    result.legacy = false;
+
+    string buffer;
+    char kind;
+    const char* data;
+    size_t length;
+    bool checksummed;
+    const char* problem;
+
+    if (objects.get(id, buffer) != 0) {
+        return;
+    }
+
+    int ret = parse_object_file(buffer, kind, data, length, checksummed, problem);
+    if (ret == 1) {
+        result.legacy = true;
+        return;
+    }
+
+    Commit commit;
+    if (ret != 0 || kind != CODEC_KIND_COMMIT || decode_commit(data, length, commit) != 0) {
+        return;
+    }
+    if ((!checksummed || get_verify_policy() == VERIFY_HASH) && commit.id() != id) {
+        return;
+    }
+
+    collect_links(commit, result);
+}
+
+/* Totals of what the sweep removed or kept */
+struct SweepStats {
+    size_t n_reachable;
+    size_t n_objects;
+    size_t n_cache_files;
+    size_t n_temporary_files;
+    size_t n_borrowed;
+    size_t n_kept;
+    unsigned long long n_bytes;
+    unsigned long long n_borrowed_bytes;
+};
+
+/** Removes the object from store if it is older than cutoff, adding its size to bytes. Returns true if it was removed. **/
+bool remove_if_expired(ObjectStore& store, const ObjectId& id, time_t cutoff, unsigned long long& bytes) {
+    ObjectInfo info;
+    if (!store.stat(id, info) || info.mtime > cutoff) {
+        return false;
+    }
+
+    if (store.remove(id) != 0) {
+        cerr << "Error occurred in garbage collection: unable to remove " << store.location(id) << endl;
+        return false;
+    }
+
+    bytes += info.size;
+    return true;
+}
+
+/** Lists every object in store, so objects can be removed without disturbing the iteration **/
+void list_objects(ObjectStore& store, vector<ObjectId>& ids) {
+    store.for_each([&ids](const ObjectId& id) {
+        ids.push_back(id);
+    });
+}
+
+/** Helper for recognizing temporary files of interrupted atomic writes, named <file>.tmp.<pid>[.<n>] **/
+bool is_temporary_file(const char* name) {
+    return strstr(name, ".tmp.") != NULL;
+}
+
+/** Removes expired temporary files directly within directory **/
+void sweep_temporary_files(const string& directory, time_t cutoff, SweepStats& stats) {
+    DIR* dirptr = opendir(directory.c_str());
+    if (dirptr == NULL) {
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dirptr)) != NULL) {
+        if (!is_temporary_file(entry->d_name)) {
+            continue;
+        }
+
+        string filepath = directory + "/" + entry->d_name;
+        struct stat s;
+        if (lstat(filepath.c_str(), &s) == 0 && S_ISREG(s.st_mode) && s.st_mtime <= cutoff && remove_file(filepath.c_str()) == 0) {
+            stats.n_bytes += s.st_size;
+            stats.n_temporary_files++;
+        }
+    }
+    closedir(dirptr);
+}
+
+} // namespace
+
+int vms_gc(long grace_seconds, bool drop_borrowed) {
+    ObjectStore* objects;
+    ObjectStore* staging;
+    int ret = vms_repository().object_stores(objects, staging);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in garbage collection: unable to open the object store: " << repo_strerror(ret) << ". Nothing was removed" << endl;
+        return -1;
+    }
+
+    // Roots: the tip of every branch, and every blob staged in the index
+    vector<ObjectId> frontier;
+    IdSet marked;
+
+    map<string, string> refs;
+    if (list_refs(refs) != 0) {
+        cerr << "Error occurred in garbage collection: unable to read branches. Nothing was removed" << endl;
+        return -1;
+    }
+
+    map<string, string>::const_iterator ref_it;
+    for (ref_it = refs.begin(); ref_it != refs.end(); ++ref_it) {
+        ObjectId id;
+        if (!ObjectId::parse(ref_it->second, id)) {
+            cerr << "Error occurred in garbage collection: branch " << ref_it->first << " does not hold a commit id. Nothing was removed" << endl;
+            return -1;
+        }
+        if (marked.insert(id).second) {
+            frontier.push_back(id);
+        }
+    }
+
+    map<string, ObjectId> index;
+    if (load_index(index) != 0) {
+        cerr << "Error occurred in garbage collection: unable to load index. Nothing was removed" << endl;
+        return -1;
+    }
+
+    IdSet staged;
+    map<string, ObjectId>::const_iterator it;
+    for (it = index.begin(); it != index.end(); ++it) {
+        if (it->second != STAGE_DELETE) {
+            staged.insert(it->second);
+            marked.insert(it->second);
+        }
+    }
+
+    // Mark: load each generation of commits in parallel, then queue the parents not seen before
+    vector<MarkResult> results;
+    vector<ObjectId> next_frontier;
+    while (!frontier.empty()) {
+        results.assign(frontier.size(), MarkResult());
+        parallel_for(frontier.size(), [objects, &frontier, &results](size_t i) {
+            load_links(*objects, frontier[i], results[i]);
+        });
+
+        next_frontier.clear();
+        for (size_t i = 0; i < frontier.size(); i++) {
+            MarkResult& result = results[i];
+
+            if (result.legacy) {
+                Commit commit;
+                if (restore_commit_from_full_id(*objects, frontier[i], commit) == 0) {
+                    collect_links(commit, result);
+                }
+            }
+
+            if (!result.loaded) {
+                cerr << "Error occurred in garbage collection: unable to read reachable commit " << frontier[i].hex()
+                     << ". Nothing was removed (use \"vms fsck\" to check the repository)" << endl;
+                return -1;
+            }
+
+            marked.insert(result.blobs.begin(), result.blobs.end());
+            for (int p = 0; p < 2; p++) {
+                if (!result.parents[p].is_null() && marked.insert(result.parents[p]).second) {
+                    next_frontier.push_back(result.parents[p]);
+                }
+            }
+        }
+        frontier.swap(next_frontier);
+    }
+
+    // Sweep
+    SweepStats stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.n_reachable = marked.size();
+    time_t cutoff = time(NULL) - grace_seconds;
+
+    // Local copies of reachable objects an alternate holds too are only removed if asked, and only once past the grace period
+    AlternatesObjectStore* shared = drop_borrowed ? dynamic_cast<AlternatesObjectStore*>(objects) : NULL;
+
+    vector<ObjectId> ids;
+    list_objects(*objects, ids);
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (marked.find(ids[i]) != marked.end()) {
+            if (shared != NULL && shared->alternate_of(ids[i]) != NULL && remove_if_expired(*objects, ids[i], cutoff, stats.n_borrowed_bytes)) {
+                stats.n_borrowed++;
+            }
+            continue;
+        }
+        if (remove_if_expired(*objects, ids[i], cutoff, stats.n_bytes)) {
+            stats.n_objects++;
+        } else {
+            stats.n_kept++;
+        }
+    }
+
+    // Snapshots in the staging store are only needed while staged
+    ids.clear();
+    list_objects(*staging, ids);
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (staged.find(ids[i]) == staged.end() && remove_if_expired(*staging, ids[i], cutoff, stats.n_bytes)) {
+            stats.n_cache_files++;
+        }
+    }
+
+    stats.n_temporary_files += objects->prune(cutoff, stats.n_bytes);
+    stats.n_temporary_files += staging->prune(cutoff, stats.n_bytes);
+    sweep_temporary_files(".vms", cutoff, stats);
+    sweep_temporary_files(BRANCHES_DIR, cutoff, stats);
+
+    long n_packed = pack_refs();
+    if (n_packed == -1) {
+        cerr << "Error occurred in garbage collection: unable to pack branches into " << PACKED_REFS_PATH << endl;
+    }
+
+    cout << "Marked " << stats.n_reachable << " reachable objects\n";
+    cout << "Removed " << stats.n_objects << " unreachable objects, " << stats.n_cache_files << " stale cache files and "
+         << stats.n_temporary_files << " temporary files, reclaiming " << stats.n_bytes << " bytes\n";
+    if (stats.n_borrowed > 0) {
+        cout << "Removed " << stats.n_borrowed << " local copies of objects held by alternates, reclaiming " << stats.n_borrowed_bytes << " bytes\n";
+    }
+    if (n_packed > 0) {
+        cout << "Packed " << n_packed << " branches into " << PACKED_REFS_PATH << "\n";
+    }
+    if (stats.n_kept > 0) {
+        cout << "Kept " << stats.n_kept << " unreachable objects written within the last " << grace_seconds << " seconds\n";
+    }
+    cout << flush;
+
+    return 0;
+}
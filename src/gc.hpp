@@ -0,0 +1,29 @@
+/*
+Garbage collection of objects no longer reachable from any branch or the staging area
+
+Mark: starting from the commit at the tip of every branch, commits are loaded level by level on a
+pool of worker threads, marking each commit, its parents and the blobs of the files it tracks.
+Blobs staged in the index are marked too.
+
+Sweep: unmarked objects in the object store, snapshots in the staging store that are no longer
+staged, and temporary files left behind by interrupted writes are removed, but only once they are
+older than the grace period. Nothing is removed if any reachable commit cannot be read.
+Reachable objects are kept, even when an alternate of the object store holds them too (see
+objectstore.hpp). Only if asked are those local copies removed, once older than the grace period,
+leaving the alternate as the only copy.
+
+Loose branch refs are then folded into the packed refs (see refs.hpp).
+*/
+#ifndef GC_HPP
+#define GC_HPP
+
+/* Default grace period, in seconds, protecting recently written objects from removal */
+const long GC_DEFAULT_GRACE = 60 * 60;
+
+/*
+    Removes reachable objects an alternate holds as well only if drop_borrowed is set. Returns 0 on success, or -1 if the
+    mark phase could not complete and nothing was removed.
+*/
+int vms_gc(long grace_seconds, bool drop_borrowed);
+
+#endif // GC_HPP
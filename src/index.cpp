@@ -0,0 +1,621 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <boost/serialization/map.hpp>
+
+#include "index.hpp"
+#include "archive.hpp"
+#include "crc32c.hpp"
+#include "pathtable.hpp"
+#include "utils.h"
+
+using namespace std;
+
+// Entry layout of version 1, which stored ids in hex; read when loading, never written
+static const uint32_t INDEX_VERSION_HEX_IDS = 1;
+
+// Version 2, which had no generation in its header; read when loading, never written
+static const uint32_t INDEX_VERSION_NO_GENERATION = 2;
+static const size_t INDEX_HEADER_SIZE_NO_GENERATION = 16;
+
+struct IndexJournalHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t generation;
+};
+
+struct IndexJournalRecordHeader {
+    uint32_t op;
+    uint32_t path_length;
+    unsigned char id[OBJECT_ID_SIZE];
+};
+
+struct IndexJournalRecordFooter {
+    uint32_t path_length;
+    uint32_t crc;
+};
+
+// Longest path a journal record may hold, so a damaged length is never taken for a huge record
+static const uint32_t INDEX_JOURNAL_MAX_PATH = 64 * 1024;
+
+struct IndexEntryV1 {
+    uint32_t path_offset;
+    uint32_t path_length;
+    uint32_t flags;
+    char id[OBJECT_ID_HEX_LENGTH];
+};
+
+/** Validates a complete index image of the given length: its layout, its trailing checksum, and that every entry's path
+ * lies within the string table and is terminated there. Returns 0 if well-formed (setting version), 1 if it does not
+ * carry the index magic (legacy boost archive format), or -1 if malformed or damaged. **/
+static int check_layout(const char* data, size_t length, uint32_t& version) {
+    if (length < INDEX_HEADER_SIZE_NO_GENERATION || memcmp(data, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0) {
+        return 1;
+    }
+
+    const IndexHeader* header = reinterpret_cast<const IndexHeader*>(data);
+    size_t entry_size;
+    size_t header_size = INDEX_HEADER_SIZE_NO_GENERATION;
+    if (header->version == INDEX_VERSION) {
+        entry_size = sizeof(IndexEntry);
+        header_size = sizeof(IndexHeader);
+    } else if (header->version == INDEX_VERSION_NO_GENERATION) {
+        entry_size = sizeof(IndexEntry);
+    } else if (header->version == INDEX_VERSION_HEX_IDS) {
+        entry_size = sizeof(IndexEntryV1);
+    } else {
+        return -1;
+    }
+
+    if (length < header_size) {
+        return -1;
+    }
+
+    size_t expected = header_size + (size_t) header->n_entries * entry_size + header->strtab_size + sizeof(uint32_t);
+    if (expected != length) {
+        return -1;
+    }
+
+    uint32_t stored_crc;
+    memcpy(&stored_crc, data + length - sizeof(uint32_t), sizeof(uint32_t));
+    if (crc32c(data, length - sizeof(uint32_t)) != stored_crc) {
+        return -1;
+    }
+
+    // Entries of every version begin with the offset and length of their path
+    const char* entries = data + header_size;
+    const char* strtab = entries + (size_t) header->n_entries * entry_size;
+    for (uint32_t i = 0; i < header->n_entries; i++) {
+        uint32_t path[2];
+        memcpy(path, entries + i * entry_size, sizeof(path));
+        if ((size_t) path[0] + path[1] >= header->strtab_size || strtab[(size_t) path[0] + path[1]] != '\0') {
+            return -1;
+        }
+    }
+
+    version = header->version;
+    return 0;
+}
+
+IndexView::IndexView() : data(NULL), length(0), header(NULL), entries(NULL), strtab(NULL) {}
+
+IndexView::~IndexView() {
+    close();
+}
+
+int IndexView::open(const char* filepath) {
+    close();
+
+    int fd = ::open(filepath, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) == -1 || s.st_size == 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    void* mapped = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
+
+    uint32_t version = 0;
+    int ret = check_layout(static_cast<const char*>(mapped), s.st_size, version);
+    if (ret != 0 || version != INDEX_VERSION) {
+        munmap(mapped, s.st_size);
+        return ret == 0 ? 1 : ret;  // an earlier version is read in full by load_index instead
+    }
+
+    data = mapped;
+    length = s.st_size;
+    header = static_cast<const IndexHeader*>(data);
+    entries = reinterpret_cast<const IndexEntry*>(header + 1);
+    strtab = reinterpret_cast<const char*>(entries + header->n_entries);
+
+    return 0;
+}
+
+void IndexView::close() {
+    if (data != NULL) {
+        munmap(data, length);
+    }
+    data = NULL;
+    length = 0;
+    header = NULL;
+    entries = NULL;
+    strtab = NULL;
+}
+
+const IndexEntry* IndexView::find(const char* filepath) const {
+    if (header == NULL || filepath == NULL) {
+        return NULL;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = header->n_entries;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(strtab + entries[mid].path_offset, filepath);
+
+        if (cmp == 0) {
+            return &entries[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+bool IndexView::contains(const char* filepath) const {
+    return find(filepath) != NULL;
+}
+
+uint32_t IndexView::size() const {
+    return header == NULL ? 0 : header->n_entries;
+}
+
+uint64_t IndexView::generation() const {
+    return header == NULL ? 0 : header->generation;
+}
+
+const IndexEntry* IndexView::entry(uint32_t i) const {
+    return &entries[i];
+}
+
+const char* IndexView::path_of(const IndexEntry* entry) const {
+    return strtab + entry->path_offset;
+}
+
+ObjectId IndexView::id_of(const IndexEntry* entry) const {
+    return entry->flags & INDEX_ENTRY_DELETED ? STAGE_DELETE : ObjectId::from_bytes(entry->id);
+}
+
+/** Helper for the generation of the index file at filepath: 0 if it is missing or in an earlier format **/
+static uint64_t index_generation(const char* filepath) {
+    IndexHeader header;
+    ifstream ifs(filepath, ios::binary);
+    if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0
+            || header.version != INDEX_VERSION) {
+        return 0;
+    }
+    return header.generation;
+}
+
+/** Helper for checking the journal record at the start of data, of at most length bytes. Returns its size, or 0 if it is torn or damaged. **/
+static size_t check_journal_record(const char* data, size_t length) {
+    IndexJournalRecordHeader header;
+    if (length < sizeof(header) + sizeof(IndexJournalRecordFooter)) {
+        return 0;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if (header.op < INDEX_JOURNAL_STAGE || header.op > INDEX_JOURNAL_CLEAR || header.path_length > INDEX_JOURNAL_MAX_PATH
+            || length - sizeof(header) - sizeof(IndexJournalRecordFooter) < header.path_length) {
+        return 0;
+    }
+
+    IndexJournalRecordFooter footer;
+    memcpy(&footer, data + sizeof(header) + header.path_length, sizeof(footer));
+    if (footer.path_length != header.path_length || crc32c(data, sizeof(header) + header.path_length) != footer.crc) {
+        return 0;
+    }
+
+    return sizeof(header) + header.path_length + sizeof(footer);
+}
+
+/** Helper for reading the journal at path: whether there is one, the generation it applies to, its intact records and their length **/
+struct JournalContents {
+    bool exists;
+    uint64_t generation;
+    vector<IndexJournalRecord> records;
+    size_t valid_length;
+
+    JournalContents() : exists(false), generation(0), valid_length(0) {}
+};
+
+static int read_journal(const string& path, JournalContents& journal) {
+    journal = JournalContents();
+
+    struct stat s;
+    if (stat(path.c_str(), &s) != 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    ifstream ifs(path, ios::binary);
+    if (!ifs.is_open()) {
+        return -1;
+    }
+
+    vector<char> buf((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+    if (ifs.bad()) {
+        return -1;
+    }
+
+    // Anything short of a whole header is a journal being started, which holds nothing yet
+    IndexJournalHeader header;
+    if (buf.size() < sizeof(header)) {
+        return 0;
+    }
+    memcpy(&header, buf.data(), sizeof(header));
+    if (memcmp(header.magic, INDEX_JOURNAL_MAGIC, sizeof(INDEX_JOURNAL_MAGIC)) != 0 || header.version != INDEX_JOURNAL_VERSION) {
+        return 0;
+    }
+
+    journal.exists = true;
+    journal.generation = header.generation;
+
+    size_t offset = sizeof(header);
+    size_t record_size;
+    while ((record_size = check_journal_record(buf.data() + offset, buf.size() - offset)) > 0) {
+        IndexJournalRecordHeader record_header;
+        memcpy(&record_header, buf.data() + offset, sizeof(record_header));
+
+        IndexJournalRecord record;
+        record.op = (IndexJournalOp) record_header.op;
+        record.path.assign(buf.data() + offset + sizeof(record_header), record_header.path_length);
+        record.id = ObjectId::from_bytes(record_header.id);
+        journal.records.push_back(record);
+
+        offset += record_size;
+    }
+
+    journal.valid_length = offset;
+    return 0;
+}
+
+string index_journal_path(const char* filepath) {
+    return string(filepath) + ".journal";
+}
+
+void apply_index_journal(const IndexJournalRecord& record, map<string, ObjectId>& index) {
+    if (record.op == INDEX_JOURNAL_STAGE) {
+        index[record.path] = record.id;
+    } else if (record.op == INDEX_JOURNAL_UNSTAGE) {
+        index.erase(record.path);
+    } else {
+        index.clear();
+    }
+}
+
+/** Loads the index file alone into index, setting generation. Returns -1 if it cannot be read, or -2 if it is malformed. **/
+static int load_index_file(map<string, ObjectId>& index, const char* filepath, uint64_t& generation) {
+    index.clear();
+    generation = 0;
+
+    ifstream ifs(filepath, ios::binary);
+    if (!ifs.is_open()) {
+        return -1;
+    }
+
+    vector<char> buf((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+    ifs.close();
+
+    uint32_t version = 0;
+    int ret = check_layout(buf.data(), buf.size(), version);
+
+    if (ret == 1) { // written by an earlier version as a compressed boost archive of hex ids
+        map<string, string> legacy_index;
+        try {
+            restore< map<string, string> >(legacy_index, filepath);
+        } catch (exception&) {
+            return -2;
+        }
+
+        map<string, string>::const_iterator it;
+        for (it = legacy_index.begin(); it != legacy_index.end(); ++it) {
+            index[it->first] = ObjectId::from_hex(it->second);  // "DELETED" parses to the null id, STAGE_DELETE
+        }
+        return 0;
+    }
+
+    if (ret != 0) {
+        return -2;
+    }
+
+    const IndexHeader* header = reinterpret_cast<const IndexHeader*>(buf.data());
+    const char* entries = buf.data() + (version == INDEX_VERSION ? sizeof(IndexHeader) : INDEX_HEADER_SIZE_NO_GENERATION);
+    size_t entry_size = version == INDEX_VERSION_HEX_IDS ? sizeof(IndexEntryV1) : sizeof(IndexEntry);
+    if (version == INDEX_VERSION) {
+        IndexHeader current_header;
+        memcpy(&current_header, buf.data(), sizeof(current_header));
+        generation = current_header.generation;
+    }
+    const char* strtab = entries + (size_t) header->n_entries * entry_size;
+
+    map<string, ObjectId>::iterator hint = index.end();
+    for (uint32_t i = 0; i < header->n_entries; i++) {
+        ObjectId id;
+        IndexEntry entry;
+
+        if (version != INDEX_VERSION_HEX_IDS) {
+            memcpy(&entry, entries + i * entry_size, sizeof(IndexEntry));
+            id = ObjectId::from_bytes(entry.id);
+        } else {
+            IndexEntryV1 entry_v1;
+            memcpy(&entry_v1, entries + i * entry_size, sizeof(IndexEntryV1));
+            entry.path_offset = entry_v1.path_offset;
+            entry.path_length = entry_v1.path_length;
+            entry.flags = entry_v1.flags;
+            ObjectId::parse(entry_v1.id, OBJECT_ID_HEX_LENGTH, id);
+        }
+
+        if (entry.flags & INDEX_ENTRY_DELETED) {
+            id = STAGE_DELETE;
+        }
+
+        hint = index.insert(hint, make_pair(string(strtab + entry.path_offset, entry.path_length), id));
+    }
+
+    return 0;
+}
+
+int load_index(map<string, ObjectId>& index, const char* filepath) {
+    string journal_path = index_journal_path(filepath);
+    JournalContents journal;
+
+    for (int attempt = 0; ; attempt++) {
+        uint64_t generation;
+        int ret = load_index_file(index, filepath, generation);
+        if (ret != 0) {
+            return ret;
+        }
+
+        if (read_journal(journal_path, journal) != 0) {
+            return -1;
+        }
+
+        if (journal.exists && journal.generation == generation) {
+            for (size_t i = 0; i < journal.records.size(); i++) {
+                apply_index_journal(journal.records[i], index);
+            }
+            return 0;
+        }
+
+        // A journal for an older index is stale, but one for a newer index means it replaced the one just read
+        if (!journal.exists || journal.generation < generation || attempt == 2) {
+            return 0;
+        }
+    }
+}
+
+int load_index(FlatTree& index, const char* filepath) {
+    IndexView view;
+    int ret = view.open(filepath);
+
+    struct stat s;
+    if (ret == 0 && stat(index_journal_path(filepath).c_str(), &s) == 0) {
+        ret = 1;    // updated since it was written, so read in full with the journal applied
+    }
+
+    if (ret != 0) { // legacy format, missing or journaled, so leave the conversion, updates and errors to the full loader
+        map<string, ObjectId> loaded;
+        ret = load_index(loaded, filepath);
+        index.assign(loaded);
+        return ret;
+    }
+
+    index.clear();
+    index.reserve(view.size());
+
+    for (uint32_t i = 0; i < view.size(); i++) {
+        const IndexEntry* entry = view.entry(i);
+        index.push_back(view.path_of(entry), entry->path_length, view.id_of(entry));
+    }
+
+    return 0;
+}
+
+int save_index(const map<string, ObjectId>& index, const char* filepath) {
+    IndexHeader header;
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.n_entries = index.size();
+    header.strtab_size = 0;
+    header.generation = index_generation(filepath) + 1;
+
+    map<string, ObjectId>::const_iterator it;
+    for (it = index.begin(); it != index.end(); ++it) {
+        header.strtab_size += it->first.length() + 1;
+    }
+
+    size_t entries_offset = sizeof(IndexHeader);
+    size_t strtab_offset = entries_offset + index.size() * sizeof(IndexEntry);
+    size_t trailer_offset = strtab_offset + header.strtab_size;
+
+    vector<char> buf(trailer_offset + sizeof(uint32_t), '\0');
+    memcpy(buf.data(), &header, sizeof(IndexHeader));
+
+    IndexEntry* entry = reinterpret_cast<IndexEntry*>(buf.data() + entries_offset);
+    uint32_t path_offset = 0;
+
+    // std::map iterates in byte-wise path order, which is the order lookups binary search in
+    for (it = index.begin(); it != index.end(); ++it, ++entry) {
+        entry->path_offset = path_offset;
+        entry->path_length = it->first.length();
+
+        entry->flags = it->second == STAGE_DELETE ? INDEX_ENTRY_DELETED : 0;
+        memcpy(entry->id, it->second.data(), OBJECT_ID_SIZE);
+
+        memcpy(buf.data() + strtab_offset + path_offset, it->first.c_str(), it->first.length() + 1);
+        path_offset += it->first.length() + 1;
+    }
+
+    uint32_t crc = crc32c(buf.data(), trailer_offset);
+    memcpy(buf.data() + trailer_offset, &crc, sizeof(uint32_t));
+
+    if (replace_file_atomically(filepath, buf.data(), buf.size(), 0644) != 0) {
+        return -1;
+    }
+
+    // The journal is now folded in, or else superseded; if this fails it is left stale, and ignored for the new generation
+    unlink(index_journal_path(filepath).c_str());
+    return 0;
+}
+
+int append_index_journal(const IndexJournalRecord& record, size_t& journal_size, const char* filepath) {
+    string journal_path = index_journal_path(filepath);
+    uint64_t generation = index_generation(filepath);
+
+    IndexJournalRecordHeader record_header;
+    record_header.op = record.op;
+    record_header.path_length = record.path.length();
+    memcpy(record_header.id, record.id.data(), OBJECT_ID_SIZE);
+
+    string encoded(reinterpret_cast<const char*>(&record_header), sizeof(record_header));
+    encoded += record.path;
+
+    IndexJournalRecordFooter footer;
+    footer.path_length = record.path.length();
+    footer.crc = crc32c(encoded.data(), encoded.length());
+    encoded.append(reinterpret_cast<const char*>(&footer), sizeof(footer));
+
+    int fd = open(journal_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // Continue the journal if it belongs to the current index, checking only that its last record is whole
+    off_t end = 0;
+    IndexJournalHeader header;
+    if ((size_t) s.st_size >= sizeof(header) && pread(fd, &header, sizeof(header), 0) == (ssize_t) sizeof(header)
+            && memcmp(header.magic, INDEX_JOURNAL_MAGIC, sizeof(INDEX_JOURNAL_MAGIC)) == 0 && header.version == INDEX_JOURNAL_VERSION
+            && header.generation == generation) {
+        end = s.st_size;
+
+        IndexJournalRecordFooter last;
+        bool intact = end == (off_t) sizeof(header);
+        if (!intact && end - (off_t) sizeof(header) >= (off_t) (sizeof(IndexJournalRecordHeader) + sizeof(last))
+                && pread(fd, &last, sizeof(last), end - sizeof(last)) == (ssize_t) sizeof(last) && last.path_length <= INDEX_JOURNAL_MAX_PATH) {
+            size_t last_size = sizeof(IndexJournalRecordHeader) + last.path_length + sizeof(last);
+            if (end - (off_t) sizeof(header) >= (off_t) last_size) {
+                vector<char> last_record(last_size);
+                intact = pread(fd, last_record.data(), last_size, end - last_size) == (ssize_t) last_size
+                         && check_journal_record(last_record.data(), last_size) == last_size;
+            }
+        }
+
+        if (!intact) {  // torn by a crash, so cut back to the records before the tear
+            JournalContents journal;
+            if (read_journal(journal_path, journal) != 0 || ftruncate(fd, journal.valid_length) != 0) {
+                close(fd);
+                return -1;
+            }
+            end = journal.valid_length;
+        }
+    }
+
+    if (end == 0) { // new or stale, so started afresh
+        memcpy(header.magic, INDEX_JOURNAL_MAGIC, sizeof(INDEX_JOURNAL_MAGIC));
+        header.version = INDEX_JOURNAL_VERSION;
+        header.generation = generation;
+        encoded.insert(0, reinterpret_cast<const char*>(&header), sizeof(header));
+
+        if (ftruncate(fd, 0) != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    // A single write, so readers find either the whole record or a torn one they ignore
+    ssize_t n = pwrite(fd, encoded.data(), encoded.length(), end);
+    if (n != (ssize_t) encoded.length()) {
+        if (n > 0 && ftruncate(fd, end) != 0) {
+            // the torn record is left for readers to ignore and the next append to drop
+        }
+        close(fd);
+        return -1;
+    }
+
+    journal_size = end + encoded.length();
+    return close(fd) == 0 ? 0 : -1;
+}
+
+int find_staged(const char* path, ObjectId& id, const char* filepath) {
+    IndexView view;
+    int ret = view.open(filepath);
+
+    if (ret == 1) { // legacy format cannot be mapped, so fall back to loading it in full
+        map<string, ObjectId> index;
+        if (load_index(index, filepath) != 0) {
+            return -1;
+        }
+
+        map<string, ObjectId>::const_iterator it = index.find(path);
+        if (it == index.end()) {
+            return 1;
+        }
+        id = it->second;
+        return 0;
+    } else if (ret != 0) {
+        return -1;
+    }
+
+    JournalContents journal;
+    if (read_journal(index_journal_path(filepath), journal) != 0) {
+        return -1;
+    }
+
+    // The newest record for the path, if any, decides
+    if (journal.exists && journal.generation == view.generation()) {
+        for (size_t i = journal.records.size(); i > 0; i--) {
+            const IndexJournalRecord& record = journal.records[i - 1];
+            if (record.op == INDEX_JOURNAL_CLEAR || (record.op == INDEX_JOURNAL_UNSTAGE && record.path == path)) {
+                return 1;
+            } else if (record.op == INDEX_JOURNAL_STAGE && record.path == path) {
+                id = record.id;
+                return 0;
+            }
+        }
+    }
+
+    const IndexEntry* entry = view.find(path);
+    if (entry == NULL) {
+        return 1;
+    }
+    id = view.id_of(entry);
+    return 0;
+}
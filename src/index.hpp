@@ -0,0 +1,159 @@
+/*
+Binary staging index stored at .vms/index, with a journal of later updates at .vms/index.journal
+
+On-disk layout of the index (version 3, host byte order):
+
+    header        magic "VMSI", format version, number of entries, size of string table, and the
+                  generation of the index, one more than that of the index it replaced
+    entries       fixed-width records sorted by path, each holding the offset and length of
+                  its path in the string table, flags, and the 20-byte binary id of the staged blob
+    string table  NUL-terminated paths referenced by the entries
+    trailer       CRC-32C of all preceding bytes
+
+The file is never modified in place: writers build a new image and rename it over the old one,
+so readers may map it read-only and binary search the entries without deserializing anything.
+
+Rewriting the whole index to stage one file would cost time in proportion to its size, so staging,
+unstaging and clearing are appended to the journal instead, each as one small record in a single
+write. The journal starts with the magic "VMSJ", its format version and the generation of the index
+it applies to, followed by records, each holding:
+
+    header        operation (stage, unstage or clear), length of the path, the 20-byte id staged
+    path          the path, not NUL-terminated
+    footer        the length of the path again and a CRC-32C of the header and path
+
+Readers apply the records in order on top of the index. A torn record at the end, left by a
+crash, ends the journal and is dropped by the next append, which finds it by checking only the
+last record through its footer. A journal for another generation is stale, left by a crash
+between replacing the index and removing the journal, and is ignored. Writers fold the journal
+into a new index once it outgrows INDEX_JOURNAL_MIN_COMPACT_SIZE and half the index (see
+Repository::stage), so each update costs the same whatever the size of the index.
+
+Versions 1 and 2 lacked the generation, and version 1 stored ids as 40 hex characters. They and
+the older boost archive format are still read by load_index, as generation 0, and are replaced by
+version 3 on the next write.
+*/
+#ifndef INDEX_HPP
+#define INDEX_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "objectid.hpp"
+
+class FlatTree;
+
+// Staged id of a tracked file whose removal is staged
+const ObjectId STAGE_DELETE;
+
+const char INDEX_MAGIC[4] = {'V', 'M', 'S', 'I'};
+const uint32_t INDEX_VERSION = 3;
+
+const uint32_t INDEX_ENTRY_DELETED = 0x1;   // entry stages the removal of a tracked file
+
+struct IndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n_entries;
+    uint32_t strtab_size;
+    uint64_t generation;
+};
+
+struct IndexEntry {
+    uint32_t path_offset;
+    uint32_t path_length;
+    uint32_t flags;
+    unsigned char id[OBJECT_ID_SIZE];
+};
+
+/* Read-only, memory-mapped view of .vms/index supporting allocation-free lookups */
+class IndexView {
+    public:
+        IndexView();
+        ~IndexView();
+
+        /*
+            Maps the index file at filepath. Returns 0 on success, 1 if the file is in a legacy
+            format and cannot be mapped, or -1 if it is missing, malformed or fails its checksum.
+        */
+        int open(const char* filepath = ".vms/index");
+        void close();
+
+        /* Returns entry of the index file for given path, or NULL if it has none. Updates in the journal are not seen (see find_staged). */
+        const IndexEntry* find(const char* filepath) const;
+        bool contains(const char* filepath) const;
+
+        uint32_t size() const;
+        uint64_t generation() const;
+        const IndexEntry* entry(uint32_t i) const;
+        const char* path_of(const IndexEntry* entry) const;
+        ObjectId id_of(const IndexEntry* entry) const;
+
+    private:
+        IndexView(const IndexView&);
+        IndexView& operator=(const IndexView&);
+
+        void* data;
+        size_t length;
+        const IndexHeader* header;
+        const IndexEntry* entries;
+        const char* strtab;
+};
+
+/*
+    Loads the full index into index, mapping paths to staged blob ids (or STAGE_DELETE), and applies its journal.
+    Verifies the trailing checksum and transparently reads the legacy formats. Prints nothing: returns 0 on success,
+    -1 if the index or its journal cannot be read, or -2 if the index is malformed or fails its checksum.
+*/
+int load_index(std::map<std::string, ObjectId>& index, const char* filepath = ".vms/index");
+
+/* Loads the full index into tree, reading the mapped file directly when it is in the current format and has no journal. Returns as above. */
+int load_index(FlatTree& index, const char* filepath = ".vms/index");
+
+/*
+    Serializes index into the binary format and atomically replaces the file at filepath, then removes its journal.
+    Returns 0 on success, or -1 on failure.
+*/
+int save_index(const std::map<std::string, ObjectId>& index, const char* filepath = ".vms/index");
+
+const char INDEX_JOURNAL_MAGIC[4] = {'V', 'M', 'S', 'J'};
+const uint32_t INDEX_JOURNAL_VERSION = 1;
+
+const size_t INDEX_JOURNAL_MIN_COMPACT_SIZE = 64 * 1024;
+
+enum IndexJournalOp {
+    INDEX_JOURNAL_STAGE = 1,    // stage id, or STAGE_DELETE, for path
+    INDEX_JOURNAL_UNSTAGE,      // remove path from the index
+    INDEX_JOURNAL_CLEAR         // remove every path from the index
+};
+
+struct IndexJournalRecord {
+    IndexJournalOp op;
+    std::string path;
+    ObjectId id;
+};
+
+/* Path of the journal of the index at filepath */
+std::string index_journal_path(const char* filepath = ".vms/index");
+
+/* Applies a journal record to index */
+void apply_index_journal(const IndexJournalRecord& record, std::map<std::string, ObjectId>& index);
+
+/*
+    Appends a record to the journal of the index at filepath, starting the journal afresh if there is none or it is stale,
+    and first dropping a torn record at its end. Sets journal_size to the size of the journal afterwards. Must be called
+    under the repository lock. Returns 0 on success, or -1 on failure.
+*/
+int append_index_journal(const IndexJournalRecord& record, size_t& journal_size, const char* filepath = ".vms/index");
+
+/*
+    Looks up the entry staged for path, reading only the journal and the entries of the index it binary searches.
+    Returns 0 and sets id if path is staged, 1 if it is not, or -1 on failure.
+*/
+int find_staged(const char* path, ObjectId& id, const char* filepath = ".vms/index");
+
+#endif // INDEX_HPP
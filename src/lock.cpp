@@ -0,0 +1,192 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <iostream>
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "lock.hpp"
+
+using namespace std;
+
+#ifndef HOST_NAME_MAX
+#define HOST_NAME_MAX 255
+#endif
+
+/** Helper for formatting the owner recorded in the lock file: "<pid> <hostname>" **/
+static string lock_owner_string() {
+    char hostname[HOST_NAME_MAX + 1];
+    if (gethostname(hostname, sizeof(hostname)) != 0) {
+        strcpy(hostname, "unknown");
+    }
+    hostname[HOST_NAME_MAX] = '\0';
+
+    ostringstream oss;
+    oss << getpid() << " " << hostname;
+    return oss.str();
+}
+
+/** Helper for deciding whether the lock file with the given contents and modification time was left behind by a writer that no longer exists **/
+static bool is_stale_lock(const string& owner, time_t mtime) {
+    istringstream iss(owner);
+    long pid = 0;
+    string host;
+    iss >> pid >> host;
+
+    string self = lock_owner_string();
+    string self_host = self.substr(self.find(' ') + 1);
+
+    if (pid > 0 && host == self_host) {
+        return kill((pid_t) pid, 0) == -1 && errno == ESRCH;
+    }
+
+    // Cannot probe processes on other hosts, or the lock file is unreadable: fall back to its age
+    return time(NULL) - mtime > (time_t) LOCK_STALE_SECONDS;
+}
+
+/** Helper for reading the owner recorded in the lock file at path, along with the identity of the very file read.
+ * Returns false if there is no such file. **/
+static bool read_lock_file(const char* path, string& owner, struct stat& s) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+
+    char buf[HOST_NAME_MAX + 32];
+    ssize_t nread = fstat(fd, &s) == 0 ? read(fd, buf, sizeof(buf)) : -1;
+    close(fd);
+    if (nread < 0) {
+        return false;
+    }
+
+    owner.assign(buf, nread);
+    owner.erase(min(owner.find('\n'), owner.length()));
+    return true;
+}
+
+/** Helper for checking whether the lock file at path is still the file found stale, recording the same owner **/
+static bool is_same_lock(const char* path, const struct stat& stale, const string& stale_owner) {
+    string owner;
+    struct stat s;
+    return read_lock_file(path, owner, s) && s.st_dev == stale.st_dev && s.st_ino == stale.st_ino && owner == stale_owner;
+}
+
+/** Helper for breaking the stale lock file identified by stale and stale_owner. Breakers take turns under an flock on
+ * LOCK_BREAK_PATH, which the kernel releases even if a breaker dies, and acquirers only ever create the lock file where
+ * there is none, so once the lock is found unchanged under the guard, only its owner could remove it. It is moved aside
+ * in one rename and removed if it is still the file found stale; otherwise it is linked back, which never replaces a
+ * lock taken meanwhile. **/
+static void break_stale_lock(const struct stat& stale, const string& stale_owner) {
+    int guard = open(LOCK_BREAK_PATH, O_RDWR | O_CREAT, 0644);
+    if (guard == -1) {
+        return;
+    }
+    if (flock(guard, LOCK_EX) != 0) {
+        close(guard);
+        return;
+    }
+
+    ostringstream aside;
+    aside << LOCK_PATH << ".stale." << getpid();
+
+    if (is_same_lock(LOCK_PATH, stale, stale_owner) && rename(LOCK_PATH, aside.str().c_str()) == 0) {
+        if (!is_same_lock(aside.str().c_str(), stale, stale_owner)) {
+            link(aside.str().c_str(), LOCK_PATH);
+        }
+        unlink(aside.str().c_str());
+    }
+
+    close(guard);   // releases the flock
+}
+
+// Number of RepoLock objects on this thread currently holding the lock, so nested writers share it. Per thread, so that
+// other threads of the process wait on the lock file like other processes do, rather than racing on a shared count.
+static thread_local unsigned int lock_depth = 0;
+
+RepoLock::RepoLock() : locked(false) {}
+
+RepoLock::~RepoLock() {
+    release();
+}
+
+int RepoLock::acquire(unsigned int timeout_ms) {
+    if (locked) {
+        return 0;
+    }
+
+    if (lock_depth > 0) {
+        lock_depth++;
+        locked = true;
+        return 0;
+    }
+
+    string owner = lock_owner_string();
+    unsigned int waited_ms = 0;
+    unsigned int backoff_ms = 1;
+
+    while (true) {
+        int fd = open(LOCK_PATH, O_WRONLY | O_CREAT | O_EXCL, 0644);
+
+        if (fd != -1) {
+            string content = owner + "\n";
+            ssize_t nwrite = write(fd, content.c_str(), content.length());
+            close(fd);
+
+            if (nwrite != (ssize_t) content.length()) {
+                unlink(LOCK_PATH);
+                cerr << "Error occurred in acquiring repository lock: unable to write " << LOCK_PATH << endl;
+                return -1;
+            }
+
+            lock_depth = 1;
+            locked = true;
+            return 0;
+        }
+
+        if (errno != EEXIST) {
+            cerr << "Error occurred in acquiring repository lock: " << strerror(errno) << endl;
+            return -1;
+        }
+
+        // Lock is held: break it if its owner is gone, otherwise wait for it to be released
+        struct stat s;
+        string holder;
+        if (read_lock_file(LOCK_PATH, holder, s) && is_stale_lock(holder, s.st_mtime)) {
+            break_stale_lock(s, holder);
+            continue;
+        }
+
+        if (waited_ms >= timeout_ms) {
+            cerr << "Unable to acquire repository lock: " << LOCK_PATH << " is held by process " << holder << "\n"
+                 << "  (another vms command is modifying the repository; if none is running, remove " << LOCK_PATH << ")" << endl;
+            return -1;
+        }
+
+        usleep(backoff_ms * 1000);
+        waited_ms += backoff_ms;
+        backoff_ms = backoff_ms < 100 ? backoff_ms * 2 : 100;
+    }
+}
+
+void RepoLock::release() {
+    if (locked) {
+        if (--lock_depth == 0) {
+            unlink(LOCK_PATH);
+        }
+        locked = false;
+    }
+}
+
+bool RepoLock::held() const {
+    return locked;
+}
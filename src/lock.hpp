@@ -0,0 +1,45 @@
+/*
+Repository lock protocol for running several vms processes against the same repository
+
+Writers (commands that modify .vms) hold an exclusive lock file, .vms/lock, created with O_EXCL and
+recording the owner's pid and host. A lock whose owner has died is detected as stale and broken,
+by one writer at a time under an flock on .vms/lock.break, so a lock taken meanwhile is never lost.
+
+Readers never lock. Objects are immutable once written, and the index, log, HEAD and branch files
+are only ever replaced by atomically renaming a complete new file over the old one, so a reader
+always observes a consistent snapshot. Writers save new objects before moving any ref to them.
+
+Nested locks on one thread share the lock file. Another thread of the same process waits for it as
+another process would, so work handed to parallel_for by a writer must not take the lock itself:
+the writer already holds it for them, and the worker would wait for it until timing out.
+*/
+#ifndef LOCK_HPP
+#define LOCK_HPP
+
+const char* const LOCK_PATH = ".vms/lock";
+const char* const LOCK_BREAK_PATH = ".vms/lock.break";  // serializes breaking stale locks; left in place
+const unsigned int LOCK_TIMEOUT_MS = 10000;         // how long a writer waits for the lock
+const unsigned int LOCK_STALE_SECONDS = 3600;       // age after which a lock held from another host is stale
+
+/* Exclusive writer lock on the repository, released on destruction. Nested locks within one thread share the lock file. */
+class RepoLock {
+    public:
+        RepoLock();
+        ~RepoLock();
+
+        /*
+            Acquires the lock, waiting up to timeout_ms for another writer to release it and
+            breaking stale locks. Returns 0 on success, or -1 on failure.
+        */
+        int acquire(unsigned int timeout_ms = LOCK_TIMEOUT_MS);
+        void release();
+        bool held() const;
+
+    private:
+        RepoLock(const RepoLock&);
+        RepoLock& operator=(const RepoLock&);
+
+        bool locked;
+};
+
+#endif // LOCK_HPP
@@ -0,0 +1,903 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/dir.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "logstore.hpp"
+#include "crc32c.hpp"
+
+using namespace std;
+
+const char DATA_MAGIC[6] = {'v', 'm', 's', 'l', 'o', 'g'};
+const char INDEX_MAGIC[6] = {'v', 'm', 's', 'i', 'd', 'x'};
+const unsigned char LOG_VERSION = 1;
+
+// Magic, version, a reserved byte and the generation
+const uint64_t DATA_HEADER_SIZE = 16;
+
+// Id, type, mtime, length and checksum
+const uint64_t RECORD_HEADER_SIZE = OBJECT_ID_SIZE + 1 + 8 + 4 + 4;
+const size_t RECORD_CHECKED_SIZE = RECORD_HEADER_SIZE - 4;
+
+const unsigned char RECORD_OBJECT = 1;
+const unsigned char RECORD_DELETION = 2;
+
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const unsigned int MIN_INDEX_BITS = 10;
+const unsigned int MAX_INDEX_BITS = 40;
+
+const uint64_t SLOT_EMPTY = 0;              // no record starts within the data file header
+const uint64_t SLOT_DELETED = UINT64_MAX;
+
+/* Start of the index file, in native byte order: the index is a cache of the log and is rebuilt rather than converted */
+struct LogIndexHeader {
+    char magic[6];
+    unsigned char version;
+    unsigned char reserved;
+    uint32_t byte_order;
+    uint32_t bits;              // the table has 2^bits slots, followed by spare slots
+    uint64_t generation;        // of the data file the index belongs to
+    uint64_t n_slots;
+    uint64_t n_entries;         // slots in use, including deleted objects
+    uint64_t indexed_end;       // records before this offset of the data file are in the index
+    uint64_t dead_bytes;        // size of removed and superseded records, reclaimed by compaction
+    uint32_t crc;
+    uint32_t reserved2;
+};
+
+struct LogIndexSlot {
+    unsigned char id[OBJECT_ID_SIZE];
+    uint32_t length;
+    uint64_t offset;            // SLOT_EMPTY or SLOT_DELETED if the slot holds no object
+    uint64_t mtime;
+};
+
+/** Helper for writing v as 8 bytes, least significant first **/
+static void put_le64(unsigned char* out, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+static uint64_t get_le64(const unsigned char* in) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | in[i];
+    }
+    return v;
+}
+
+static void put_le32(unsigned char* out, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        out[i] = (unsigned char) (v >> (8 * i));
+    }
+}
+
+static uint32_t get_le32(const unsigned char* in) {
+    return (uint32_t) in[0] | ((uint32_t) in[1] << 8) | ((uint32_t) in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+/** Helper for reading exactly length bytes at offset, returning false on failure or a short read **/
+static bool pread_full(int fd, void* buf, size_t length, uint64_t offset) {
+    char* out = (char*) buf;
+    while (length > 0) {
+        ssize_t n = pread(fd, out, length, offset);
+        if (n <= 0) {
+            return false;
+        }
+        out += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool pwrite_full(int fd, const void* buf, size_t length, uint64_t offset) {
+    const char* in = (const char*) buf;
+    while (length > 0) {
+        ssize_t n = pwrite(fd, in, length, offset);
+        if (n <= 0) {
+            return false;
+        }
+        in += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/** Home slot of an id: its leading bits, so that slots follow id order **/
+static size_t home_slot(const unsigned char* id, unsigned int bits) {
+    uint64_t lead = 0;
+    for (int i = 0; i < 8; i++) {
+        lead = (lead << 8) | id[i];
+    }
+    return bits == 0 ? 0 : lead >> (64 - bits);
+}
+
+/** Number of slots for a table of 2^bits, including the spare slots probing may run into at the end **/
+static uint64_t slot_count(unsigned int bits) {
+    uint64_t capacity = (uint64_t) 1 << bits;
+    return capacity + capacity / 8 + 16;
+}
+
+static bool is_live(const LogIndexSlot& slot) {
+    return slot.offset != SLOT_EMPTY && slot.offset != SLOT_DELETED;
+}
+
+/** Helper for checking whether the hex form of id begins with the given prefix **/
+static bool has_hex_prefix(const unsigned char* id, const char* hex_prefix, size_t prefix_length) {
+    char hex[OBJECT_ID_HEX_LENGTH];
+    ObjectId::from_bytes(id).write_hex(hex);
+    return memcmp(hex, hex_prefix, prefix_length) == 0;
+}
+
+/** Writes the header of a new data file of the given generation to fd **/
+static bool write_data_header(int fd, uint64_t generation) {
+    unsigned char header[DATA_HEADER_SIZE];
+    memcpy(header, DATA_MAGIC, sizeof(DATA_MAGIC));
+    header[6] = LOG_VERSION;
+    header[7] = 0;
+    put_le64(header + 8, generation);
+    return pwrite_full(fd, header, sizeof(header), 0);
+}
+
+LogObjectStore::LogObjectStore(const string& directory)
+    : data_path(directory + "/objects.log"), index_path(directory + "/objects.idx"), opened(false), writer(false),
+      data_fd(-1), data_writable(false), generation(0), data_end(0), index_map(NULL), index_size(0), index_dev(0),
+      index_ino(0), header(NULL), slots(NULL), tail_end(0) {}
+
+LogObjectStore::~LogObjectStore() {
+    close_files();
+}
+
+int LogObjectStore::open_files() {
+    if (opened) {
+        return 0;
+    }
+
+    data_writable = true;
+    data_fd = open(data_path.c_str(), O_RDWR);
+    if (data_fd == -1 && errno == EACCES) {
+        data_writable = false;
+        data_fd = open(data_path.c_str(), O_RDONLY);
+    }
+
+    if (data_fd == -1) {
+        if (errno != ENOENT) {
+            return -1;
+        }
+        // Nothing written yet: an empty store until the first put creates the files
+        opened = true;
+        return 0;
+    }
+
+    unsigned char data_header[DATA_HEADER_SIZE];
+    if (!pread_full(data_fd, data_header, sizeof(data_header), 0) || memcmp(data_header, DATA_MAGIC, sizeof(DATA_MAGIC)) != 0 || data_header[6] != LOG_VERSION) {
+        close(data_fd);
+        data_fd = -1;
+        return -1;
+    }
+    generation = get_le64(data_header + 8);
+
+    map_index();
+    tail_end = header != NULL ? header->indexed_end : DATA_HEADER_SIZE;
+    data_end = tail_end;
+    opened = true;
+
+    scan_tail();
+    return 0;
+}
+
+void LogObjectStore::close_files() {
+    unmap_index();
+    if (data_fd != -1) {
+        close(data_fd);
+        data_fd = -1;
+    }
+    tail.clear();
+    opened = false;
+    writer = false;
+}
+
+int LogObjectStore::map_index() {
+    unmap_index();
+
+    int fd = open(index_path.c_str(), data_writable ? O_RDWR : O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) == -1 || (size_t) s.st_size < sizeof(LogIndexHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, s.st_size, data_writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // Anything unexpected means the index is damaged or stale, and the log is scanned instead
+    struct stat data_stat;
+    LogIndexHeader* h = (LogIndexHeader*) map;
+    bool valid = memcmp(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && h->version == LOG_VERSION
+        && h->byte_order == BYTE_ORDER_MARK && h->crc == crc32c(h, offsetof(LogIndexHeader, crc))
+        && h->generation == generation && h->bits >= MIN_INDEX_BITS && h->bits <= MAX_INDEX_BITS
+        && h->n_slots == slot_count(h->bits) && (uint64_t) s.st_size == sizeof(LogIndexHeader) + h->n_slots * sizeof(LogIndexSlot)
+        && fstat(data_fd, &data_stat) == 0 && h->indexed_end >= DATA_HEADER_SIZE && h->indexed_end <= (uint64_t) data_stat.st_size;
+
+    if (!valid) {
+        munmap(map, s.st_size);
+        return -1;
+    }
+
+    index_map = map;
+    index_size = s.st_size;
+    index_dev = s.st_dev;
+    index_ino = s.st_ino;
+    header = h;
+    slots = (LogIndexSlot*) ((char*) map + sizeof(LogIndexHeader));
+    return 0;
+}
+
+void LogObjectStore::unmap_index() {
+    if (index_map != NULL) {
+        munmap(index_map, index_size);
+    }
+    index_map = NULL;
+    index_size = 0;
+    header = NULL;
+    slots = NULL;
+}
+
+bool LogObjectStore::read_record(uint64_t offset, uint64_t limit, Record& record, string& scratch) {
+    unsigned char head[RECORD_HEADER_SIZE];
+    if (offset + RECORD_HEADER_SIZE > limit || !pread_full(data_fd, head, sizeof(head), offset)) {
+        return false;
+    }
+
+    unsigned char type = head[OBJECT_ID_SIZE];
+    record.id = ObjectId::from_bytes(head);
+    record.deleted = type == RECORD_DELETION;
+    record.mtime = get_le64(head + OBJECT_ID_SIZE + 1);
+    record.length = get_le32(head + OBJECT_ID_SIZE + 9);
+
+    if ((type != RECORD_OBJECT && type != RECORD_DELETION) || record.length > limit - offset - RECORD_HEADER_SIZE) {
+        return false;
+    }
+
+    scratch.resize(record.length);
+    if (record.length > 0 && !pread_full(data_fd, &scratch[0], record.length, offset + RECORD_HEADER_SIZE)) {
+        return false;
+    }
+
+    uint32_t crc = crc32c(head, RECORD_CHECKED_SIZE);
+    crc = crc32c(scratch.data(), scratch.length(), crc);
+    return crc == get_le32(head + RECORD_CHECKED_SIZE);
+}
+
+int LogObjectStore::append_record(const ObjectId& id, bool deleted, const string& data, uint64_t mtime, uint64_t& offset) {
+    unsigned char head[RECORD_HEADER_SIZE];
+    memcpy(head, id.data(), OBJECT_ID_SIZE);
+    head[OBJECT_ID_SIZE] = deleted ? RECORD_DELETION : RECORD_OBJECT;
+    put_le64(head + OBJECT_ID_SIZE + 1, mtime);
+    put_le32(head + OBJECT_ID_SIZE + 9, data.length());
+
+    uint32_t crc = crc32c(head, RECORD_CHECKED_SIZE);
+    put_le32(head + RECORD_CHECKED_SIZE, crc32c(data.data(), data.length(), crc));
+
+    offset = data_end;
+    if (!pwrite_full(data_fd, head, sizeof(head), offset) || !pwrite_full(data_fd, data.data(), data.length(), offset + RECORD_HEADER_SIZE)) {
+        // drop the torn record, so the next append starts from a clean end
+        if (ftruncate(data_fd, offset) != 0) {
+            close_files();  // recovery truncates it when the store is next opened instead
+        }
+        return -1;
+    }
+
+    data_end = offset + RECORD_HEADER_SIZE + data.length();
+    return 0;
+}
+
+void LogObjectStore::scan_tail() {
+    struct stat s;
+    if (data_fd == -1 || fstat(data_fd, &s) == -1) {
+        return;
+    }
+
+    // Stops at the end of the log, or at a record another process is still appending
+    Record record;
+    string scratch;
+    uint64_t offset = tail_end;
+    while (read_record(offset, s.st_size, record, scratch)) {
+        Entry entry = {offset, record.length, record.mtime, record.deleted};
+        tail[record.id] = entry;
+        offset += RECORD_HEADER_SIZE + record.length;
+    }
+
+    tail_end = offset;
+    data_end = offset;
+}
+
+/**
+    Checks whether the files opened were replaced since, by compaction or a rebuilt index, and for a writer whether
+    another process has appended to the log since this one last wrote. A writer must then start over from the files in place.
+**/
+bool LogObjectStore::is_stale() {
+    struct stat opened_stat;
+    struct stat named_stat;
+    if (fstat(data_fd, &opened_stat) == -1 || ::stat(data_path.c_str(), &named_stat) == -1
+        || opened_stat.st_dev != named_stat.st_dev || opened_stat.st_ino != named_stat.st_ino) {
+        return true;
+    }
+
+    if (header != NULL && (::stat(index_path.c_str(), &named_stat) == -1 || named_stat.st_dev != index_dev || named_stat.st_ino != index_ino)) {
+        return true;
+    }
+
+    // Appends by a writer are in the index once it is done, so both the log and the index cover more
+    return writer && ((uint64_t) opened_stat.st_size != data_end || header->indexed_end != data_end);
+}
+
+void LogObjectStore::refresh() {
+    if (data_fd == -1 || is_stale()) {
+        close_files();
+        open_files();
+    } else if (!writer) {
+        scan_tail();
+    }
+}
+
+bool LogObjectStore::lookup(const ObjectId& id, Entry& entry) {
+    unordered_map<ObjectId, Entry, ObjectIdHash>::const_iterator it = tail.find(id);
+    if (it != tail.end()) {
+        entry = it->second;
+        return !entry.deleted;
+    }
+
+    size_t free_slot;
+    long i = slots != NULL ? find_slot(id, free_slot) : -1;
+    if (i < 0 || !is_live(slots[i])) {
+        return false;
+    }
+
+    entry.offset = slots[i].offset;
+    entry.length = slots[i].length;
+    entry.mtime = slots[i].mtime;
+    entry.deleted = false;
+    return true;
+}
+
+long LogObjectStore::find_slot(const ObjectId& id, size_t& free_slot) const {
+    size_t i = home_slot(id.data(), header->bits);
+    for (; i < header->n_slots; i++) {
+        if (slots[i].offset == SLOT_EMPTY) {
+            free_slot = i;
+            return -1;
+        }
+        if (memcmp(slots[i].id, id.data(), OBJECT_ID_SIZE) == 0) {
+            return i;
+        }
+    }
+
+    free_slot = header->n_slots;
+    return -1;
+}
+
+int LogObjectStore::create_data_file() {
+    data_fd = open(data_path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (data_fd == -1) {
+        return -1;
+    }
+
+    generation = ((uint64_t) time(NULL) << 20) ^ (uint64_t) getpid();
+    if (!write_data_header(data_fd, generation)) {
+        close(data_fd);
+        data_fd = -1;
+        unlink(data_path.c_str());
+        return -1;
+    }
+
+    data_writable = true;
+    data_end = DATA_HEADER_SIZE;
+    tail_end = DATA_HEADER_SIZE;
+    tail.clear();
+    unmap_index();
+    return 0;
+}
+
+int LogObjectStore::become_writer() {
+    if (writer && !is_stale()) {
+        return 0;
+    }
+
+    // Reopen, in case another process created, appended to or compacted the data file since this one looked
+    close_files();
+    if (open_files() != 0) {
+        return -1;
+    }
+    if (data_fd == -1 && create_data_file() != 0) {
+        return -1;
+    }
+    if (!data_writable) {
+        return -1;
+    }
+
+    if (header == NULL) {
+        vector<pair<ObjectId, Entry> > none;
+        if (write_index(none, DATA_HEADER_SIZE, 0, MIN_INDEX_BITS) != 0) {
+            return -1;
+        }
+    }
+
+    // Replay the records appended since the index was last updated
+    struct stat s;
+    if (fstat(data_fd, &s) == -1) {
+        return -1;
+    }
+
+    Record record;
+    string scratch;
+    uint64_t offset = header->indexed_end;
+    while (read_record(offset, s.st_size, record, scratch)) {
+        if (record.deleted) {
+            index_delete(record.id, RECORD_HEADER_SIZE);
+        } else if (index_put(record.id, offset, record.length, record.mtime) != 0) {
+            close_files();
+            return -1;
+        }
+        offset += RECORD_HEADER_SIZE + record.length;
+    }
+
+    // Whatever follows is a record torn by an interrupted append
+    if (offset < (uint64_t) s.st_size && ftruncate(data_fd, offset) != 0) {
+        return -1;
+    }
+
+    data_end = offset;
+    tail_end = offset;
+    tail.clear();
+    header->indexed_end = offset;
+    seal_index();
+
+    writer = true;
+    return 0;
+}
+
+void LogObjectStore::live_entries(vector<pair<ObjectId, Entry> >& entries) const {
+    if (slots == NULL) {
+        return;
+    }
+
+    for (uint64_t i = 0; i < header->n_slots; i++) {
+        if (is_live(slots[i])) {
+            Entry entry = {slots[i].offset, slots[i].length, slots[i].mtime, false};
+            entries.push_back(make_pair(ObjectId::from_bytes(slots[i].id), entry));
+        }
+    }
+}
+
+int LogObjectStore::write_index(const vector<pair<ObjectId, Entry> >& entries, uint64_t indexed_end, uint64_t dead_bytes, unsigned int min_bits) {
+    unsigned int bits = min_bits;
+    while (((uint64_t) 1 << bits) < 2 * entries.size()) {
+        bits++;
+    }
+
+    string tmp_path = index_path + ".tmp." + to_string(getpid());
+
+    // A probe can still run off the end of the table, in which case the next size up is tried
+    for (; bits <= MAX_INDEX_BITS; bits++) {
+        uint64_t n_slots = slot_count(bits);
+        size_t size = sizeof(LogIndexHeader) + n_slots * sizeof(LogIndexSlot);
+
+        int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            return -1;
+        }
+        if (ftruncate(fd, size) != 0) {
+            close(fd);
+            unlink(tmp_path.c_str());
+            return -1;
+        }
+
+        void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            unlink(tmp_path.c_str());
+            return -1;
+        }
+
+        LogIndexHeader* h = (LogIndexHeader*) map;
+        LogIndexSlot* table = (LogIndexSlot*) ((char*) map + sizeof(LogIndexHeader));
+        bool fits = true;
+
+        for (size_t i = 0; i < entries.size() && fits; i++) {
+            size_t slot = home_slot(entries[i].first.data(), bits);
+            while (slot < n_slots && table[slot].offset != SLOT_EMPTY) {
+                slot++;
+            }
+            if (slot == n_slots) {
+                fits = false;
+                break;
+            }
+            memcpy(table[slot].id, entries[i].first.data(), OBJECT_ID_SIZE);
+            table[slot].length = entries[i].second.length;
+            table[slot].mtime = entries[i].second.mtime;
+            table[slot].offset = entries[i].second.offset;
+        }
+
+        if (!fits) {
+            munmap(map, size);
+            continue;
+        }
+
+        memcpy(h->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        h->version = LOG_VERSION;
+        h->byte_order = BYTE_ORDER_MARK;
+        h->bits = bits;
+        h->generation = generation;
+        h->n_slots = n_slots;
+        h->n_entries = entries.size();
+        h->indexed_end = indexed_end;
+        h->dead_bytes = dead_bytes;
+        h->crc = crc32c(h, offsetof(LogIndexHeader, crc));
+        munmap(map, size);
+
+        if (rename(tmp_path.c_str(), index_path.c_str()) != 0) {
+            unlink(tmp_path.c_str());
+            return -1;
+        }
+        return map_index();
+    }
+
+    unlink(tmp_path.c_str());
+    return -1;
+}
+
+int LogObjectStore::index_put(const ObjectId& id, uint64_t offset, uint32_t length, uint64_t mtime) {
+    for (;;) {
+        size_t free_slot;
+        long i = find_slot(id, free_slot);
+
+        if (i >= 0) {
+            if (is_live(slots[i])) {
+                header->dead_bytes += RECORD_HEADER_SIZE + slots[i].length;   // superseded copy
+            }
+            slots[i].length = length;
+            slots[i].mtime = mtime;
+            slots[i].offset = offset;
+            return 0;
+        }
+
+        uint64_t capacity = (uint64_t) 1 << header->bits;
+        if (free_slot < header->n_slots && 2 * (header->n_entries + 1) <= capacity) {
+            // the offset goes in last, as it is what marks the slot as used to readers
+            memcpy(slots[free_slot].id, id.data(), OBJECT_ID_SIZE);
+            slots[free_slot].length = length;
+            slots[free_slot].mtime = mtime;
+            slots[free_slot].offset = offset;
+            header->n_entries++;
+            return 0;
+        }
+
+        // Grow, which also drops the slots of deleted objects
+        vector<pair<ObjectId, Entry> > entries;
+        live_entries(entries);
+        if (write_index(entries, header->indexed_end, header->dead_bytes, header->bits + 1) != 0) {
+            return -1;
+        }
+    }
+}
+
+void LogObjectStore::index_delete(const ObjectId& id, uint64_t deletion_size) {
+    header->dead_bytes += deletion_size;
+
+    size_t free_slot;
+    long i = find_slot(id, free_slot);
+    if (i >= 0 && is_live(slots[i])) {
+        header->dead_bytes += RECORD_HEADER_SIZE + slots[i].length;
+        slots[i].offset = SLOT_DELETED;
+    }
+}
+
+void LogObjectStore::seal_index() {
+    header->crc = crc32c(header, offsetof(LogIndexHeader, crc));
+}
+
+bool LogObjectStore::has(const ObjectId& id) {
+    lock_guard<mutex> guard(state_mutex);
+    if (open_files() != 0) {
+        return false;
+    }
+
+    Entry entry;
+    if (lookup(id, entry)) {
+        return true;
+    }
+    refresh();
+    return lookup(id, entry);
+}
+
+int LogObjectStore::get(const ObjectId& id, string& buffer) {
+    lock_guard<mutex> guard(state_mutex);
+    if (open_files() != 0) {
+        return -1;
+    }
+
+    Entry entry;
+    if (!lookup(id, entry)) {
+        refresh();
+        if (!lookup(id, entry)) {
+            return -1;
+        }
+    }
+
+    // The record's own checksum is left to readers of the object, whose encoding carries one (see codec.hpp)
+    buffer.resize(entry.length);
+    if (entry.length > 0 && !pread_full(data_fd, &buffer[0], entry.length, entry.offset + RECORD_HEADER_SIZE)) {
+        return -1;
+    }
+    return 0;
+}
+
+int LogObjectStore::put(const ObjectId& id, const string& data) {
+    lock_guard<mutex> guard(state_mutex);
+    if (data.length() > UINT32_MAX || become_writer() != 0) {
+        return -1;
+    }
+
+    // A stored copy holding these very bytes is kept; a damaged one is superseded by the record appended
+    Entry entry;
+    if (lookup(id, entry) && entry.length == data.length()) {
+        string stored(entry.length, '\0');
+        if (entry.length == 0 || (pread_full(data_fd, &stored[0], entry.length, entry.offset + RECORD_HEADER_SIZE) && stored == data)) {
+            return 0;
+        }
+    }
+
+    uint64_t offset;
+    uint64_t mtime = time(NULL);
+    if (append_record(id, false, data, mtime, offset) != 0) {
+        return -1;
+    }
+
+    if (index_put(id, offset, data.length(), mtime) != 0) {
+        close_files();  // the record is indexed by recovery when the store is next opened
+        return -1;
+    }
+
+    header->indexed_end = data_end;
+    tail_end = data_end;
+    seal_index();
+    return 0;
+}
+
+int LogObjectStore::remove(const ObjectId& id) {
+    lock_guard<mutex> guard(state_mutex);
+    if (become_writer() != 0) {
+        return -1;
+    }
+
+    Entry entry;
+    uint64_t offset;
+    if (!lookup(id, entry) || append_record(id, true, string(), time(NULL), offset) != 0) {
+        return -1;
+    }
+
+    index_delete(id, RECORD_HEADER_SIZE);
+    header->indexed_end = data_end;
+    tail_end = data_end;
+    seal_index();
+    return 0;
+}
+
+bool LogObjectStore::stat(const ObjectId& id, ObjectInfo& info) {
+    lock_guard<mutex> guard(state_mutex);
+    if (open_files() != 0) {
+        return false;
+    }
+
+    Entry entry;
+    if (!lookup(id, entry)) {
+        refresh();
+        if (!lookup(id, entry)) {
+            return false;
+        }
+    }
+
+    info.size = entry.length;
+    info.mtime = entry.mtime;
+    return true;
+}
+
+void LogObjectStore::resolve_prefix(const char* hex_prefix, size_t max_matches, vector<ObjectId>& matches) {
+    size_t prefix_length = strlen(hex_prefix);
+    char lowest[OBJECT_ID_HEX_LENGTH];
+    char highest[OBJECT_ID_HEX_LENGTH];
+    if (prefix_length > OBJECT_ID_HEX_LENGTH) {
+        return;
+    }
+    memset(lowest, '0', OBJECT_ID_HEX_LENGTH);
+    memset(highest, 'f', OBJECT_ID_HEX_LENGTH);
+    memcpy(lowest, hex_prefix, prefix_length);
+    memcpy(highest, hex_prefix, prefix_length);
+
+    ObjectId first;
+    ObjectId last;
+    if (!ObjectId::parse(lowest, OBJECT_ID_HEX_LENGTH, first) || !ObjectId::parse(highest, OBJECT_ID_HEX_LENGTH, last)) {
+        return;
+    }
+
+    lock_guard<mutex> guard(state_mutex);
+    if (open_files() != 0) {
+        return;
+    }
+    refresh();
+
+    if (slots != NULL) {
+        // Every match is stored at or after the home slot of the lowest matching id, in an unbroken run of used slots
+        // reaching at least as far as the home slot of the highest
+        size_t end = home_slot(last.data(), header->bits);
+        for (size_t i = home_slot(first.data(), header->bits); i < header->n_slots && matches.size() < max_matches; i++) {
+            if (slots[i].offset == SLOT_EMPTY) {
+                if (i > end) {
+                    break;
+                }
+                continue;
+            }
+            if (is_live(slots[i]) && has_hex_prefix(slots[i].id, hex_prefix, prefix_length) && tail.find(ObjectId::from_bytes(slots[i].id)) == tail.end()) {
+                matches.push_back(ObjectId::from_bytes(slots[i].id));
+            }
+        }
+    }
+
+    unordered_map<ObjectId, Entry, ObjectIdHash>::const_iterator it;
+    for (it = tail.begin(); it != tail.end() && matches.size() < max_matches; ++it) {
+        if (!it->second.deleted && has_hex_prefix(it->first.data(), hex_prefix, prefix_length)) {
+            matches.push_back(it->first);
+        }
+    }
+}
+
+void LogObjectStore::for_each(const function<void(const ObjectId&)>& fn) {
+    vector<ObjectId> ids;
+    {
+        lock_guard<mutex> guard(state_mutex);
+        if (open_files() != 0) {
+            return;
+        }
+        refresh();
+
+        vector<pair<ObjectId, Entry> > entries;
+        live_entries(entries);
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (tail.find(entries[i].first) == tail.end()) {
+                ids.push_back(entries[i].first);
+            }
+        }
+
+        unordered_map<ObjectId, Entry, ObjectIdHash>::const_iterator it;
+        for (it = tail.begin(); it != tail.end(); ++it) {
+            if (!it->second.deleted) {
+                ids.push_back(it->first);
+            }
+        }
+    }
+
+    // Visit outside the lock, so fn may use the store
+    for (size_t i = 0; i < ids.size(); i++) {
+        fn(ids[i]);
+    }
+}
+
+string LogObjectStore::location(const ObjectId& id) {
+    return data_path + ":" + id.hex();
+}
+
+bool LogObjectStore::locate(const ObjectId& id, string& path, uint64_t& offset, uint64_t& length) {
+    lock_guard<mutex> guard(state_mutex);
+    if (open_files() != 0) {
+        return false;
+    }
+
+    Entry entry;
+    if (!lookup(id, entry)) {
+        refresh();
+        if (!lookup(id, entry)) {
+            return false;
+        }
+    }
+
+    path = data_path;
+    offset = entry.offset + RECORD_HEADER_SIZE;
+    length = entry.length;
+    return true;
+}
+
+int LogObjectStore::compact() {
+    vector<pair<ObjectId, Entry> > entries;
+    live_entries(entries);
+    sort(entries.begin(), entries.end(), [](const pair<ObjectId, Entry>& a, const pair<ObjectId, Entry>& b) {
+        return a.second.offset < b.second.offset;
+    });
+
+    string tmp_path = data_path + ".tmp." + to_string(getpid());
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    // Copy the live records in their original order, into a data file of the next generation
+    uint64_t next_generation = generation + 1;
+    bool ok = write_data_header(fd, next_generation);
+    uint64_t end = DATA_HEADER_SIZE;
+    string record;
+
+    for (size_t i = 0; i < entries.size() && ok; i++) {
+        record.resize(RECORD_HEADER_SIZE + entries[i].second.length);
+        ok = pread_full(data_fd, &record[0], record.length(), entries[i].second.offset) && pwrite_full(fd, record.data(), record.length(), end);
+        entries[i].second.offset = end;
+        end += record.length();
+    }
+
+    if (!ok || rename(tmp_path.c_str(), data_path.c_str()) != 0) {
+        close(fd);
+        unlink(tmp_path.c_str());
+        return -1;
+    }
+
+    // The old index no longer matches the data file's generation, so a crash from here on only costs a rebuild
+    close(data_fd);
+    data_fd = fd;
+    generation = next_generation;
+    data_end = end;
+    tail_end = end;
+
+    if (write_index(entries, end, 0, MIN_INDEX_BITS) != 0) {
+        close_files();
+        return -1;
+    }
+    return 0;
+}
+
+size_t LogObjectStore::prune(time_t cutoff, unsigned long long& bytes) {
+    lock_guard<mutex> guard(state_mutex);
+
+    // Leftovers of compactions and index rebuilds that were interrupted
+    size_t n_removed = 0;
+    string directory = data_path.substr(0, data_path.rfind('/'));
+    DIR* dirptr = opendir(directory.c_str());
+    if (dirptr != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dirptr)) != NULL) {
+            if (strncmp(entry->d_name, "objects.", 8) != 0 || strstr(entry->d_name, ".tmp.") == NULL) {
+                continue;
+            }
+
+            string filepath = directory + "/" + entry->d_name;
+            struct stat s;
+            if (lstat(filepath.c_str(), &s) == 0 && S_ISREG(s.st_mode) && s.st_mtime <= cutoff && unlink(filepath.c_str()) == 0) {
+                bytes += s.st_size;
+                n_removed++;
+            }
+        }
+        closedir(dirptr);
+    }
+
+    if (open_files() == 0 && data_fd != -1 && become_writer() == 0 && header->dead_bytes > 0) {
+        compact();
+    }
+
+    return n_removed;
+}
@@ -0,0 +1,131 @@
+/*
+Log-structured object store: every object in one append-only data file, found through an on-disk hash index
+
+    <directory>/objects.log     data file: a header (magic, version, generation) followed by records
+    <directory>/objects.idx     index: a header and a table of slots, mapped into memory
+
+Each record is the object's id, a type (object or deletion), the time it was written, the length
+of the object and a CRC-32C of the record, followed by the object's bytes. Objects are only ever
+appended; removing one appends a deletion record and leaves the old record as dead space.
+
+The index is an open-addressing table with linear probing. An id's home slot is taken from its
+leading bits, so slots are in id order apart from collisions, and ids sharing a prefix are found
+by scanning a short run of slots. Probing never wraps around: a few spare slots follow the table,
+and the index is rebuilt at twice the size once it is half full or a probe runs off the end.
+The index header records how much of the log it covers.
+
+Crash recovery: a writer first replays the records past the indexed end of the log into the
+index, and truncates a torn record left by an interrupted append. An index that is missing,
+damaged or from another generation of the data file is rebuilt from the whole log.
+
+Concurrency: only one process writes at a time, under the repository lock (see lock.hpp).
+Readers never modify either file. They look up objects appended since they opened the index by
+scanning the tail of the log themselves. A process stays a writer between writes, so before each
+one it checks that no other process has appended to the log or replaced either file since, and
+starts over from the files in place if one has.
+
+Compaction (prune, run by vms gc) copies the live records into a new data file of a new generation
+and writes its index, then renames both into place. Readers that opened the old files keep
+reading them.
+*/
+#ifndef LOGSTORE_HPP
+#define LOGSTORE_HPP
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <mutex>
+
+#include "objectstore.hpp"
+
+struct LogIndexHeader;
+struct LogIndexSlot;
+
+class LogObjectStore : public ObjectStore {
+    public:
+        /* The data and index files are created in directory on the first write */
+        explicit LogObjectStore(const std::string& directory);
+        ~LogObjectStore();
+
+        bool has(const ObjectId& id);
+        int get(const ObjectId& id, std::string& buffer);
+        int put(const ObjectId& id, const std::string& data);
+        int remove(const ObjectId& id);
+        bool stat(const ObjectId& id, ObjectInfo& info);
+        void resolve_prefix(const char* hex_prefix, size_t max_matches, std::vector<ObjectId>& matches);
+        void for_each(const std::function<void(const ObjectId&)>& fn);
+        std::string location(const ObjectId& id);
+        bool locate(const ObjectId& id, std::string& path, uint64_t& offset, uint64_t& length);
+
+        /* Compacts the data file once it holds dead records. Their size was counted when they were removed, so bytes is left as is. */
+        size_t prune(time_t cutoff, unsigned long long& bytes);
+
+    private:
+        LogObjectStore(const LogObjectStore&);
+        LogObjectStore& operator=(const LogObjectStore&);
+
+        /* Where a record is in the data file */
+        struct Entry {
+            uint64_t offset;    // of the record header
+            uint32_t length;    // of the object
+            uint64_t mtime;
+            bool deleted;
+        };
+
+        /* Fields of a record header, read back from the data file */
+        struct Record {
+            ObjectId id;
+            bool deleted;
+            uint64_t mtime;
+            uint32_t length;
+        };
+
+        std::string data_path;
+        std::string index_path;
+
+        std::mutex state_mutex;
+        bool opened;
+        bool writer;            // index brought up to date with the log, so it may be modified
+        int data_fd;
+        bool data_writable;
+        uint64_t generation;
+        uint64_t data_end;      // end of the last valid record
+
+        void* index_map;        // NULL while there is no usable index
+        size_t index_size;
+        dev_t index_dev;        // of the index file mapped, to tell when it is replaced
+        ino_t index_ino;
+        LogIndexHeader* header;
+        LogIndexSlot* slots;
+
+        uint64_t tail_end;      // records up to here are in the index or in tail
+        std::unordered_map<ObjectId, Entry, ObjectIdHash> tail;
+
+        int open_files();
+        void close_files();
+        int map_index();
+        void unmap_index();
+
+        bool read_record(uint64_t offset, uint64_t limit, Record& record, std::string& scratch);
+        int append_record(const ObjectId& id, bool deleted, const std::string& data, uint64_t mtime, uint64_t& offset);
+        void scan_tail();
+        bool lookup(const ObjectId& id, Entry& entry);
+
+        bool is_stale();
+        void refresh();
+        int become_writer();
+        int create_data_file();
+        int write_index(const std::vector<std::pair<ObjectId, Entry> >& entries, uint64_t indexed_end, uint64_t dead_bytes, unsigned int min_bits);
+        void live_entries(std::vector<std::pair<ObjectId, Entry> >& entries) const;
+        long find_slot(const ObjectId& id, size_t& free_slot) const;
+        int index_put(const ObjectId& id, uint64_t offset, uint32_t length, uint64_t mtime);
+        void index_delete(const ObjectId& id, uint64_t deletion_size);
+        void seal_index();
+        int compact();
+};
+
+#endif // LOGSTORE_HPP
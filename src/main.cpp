@@ -6,9 +6,39 @@
 #include "archive.hpp"
 #include "vms.hpp"
 #include "utils.h"
+#include "lock.hpp"
+#include "batch.hpp"
+#include "clone.hpp"
+#include "fsck.hpp"
+#include "gc.hpp"
+#include "repository.hpp"
 
 using namespace std;
 
+/* Helper to check if given command line modifies the repository and so must hold the repository lock */
+bool is_write_command(const int argc, char* const argv[]) {
+    const char* write_commands[] = {"stage", "unstage", "commit", "checkout", "mkbranch", "rmbranch", "merge", "gc"};
+
+    // checking how branches would merge only reads
+    if (strcmp(argv[1], "merge") == 0 && argc > 2 && strcmp(argv[2], "--check") == 0) {
+        return false;
+    }
+
+    for (size_t i = 0; i < sizeof(write_commands) / sizeof(write_commands[0]); i++) {
+        if (strcmp(argv[1], write_commands[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Helper to check if a shortened commit id matches exactly one object */
+bool is_valid_commit_id(const char* commit_id) {
+    string full_id;
+    return vms_repository().resolve_id(commit_id, full_id) == REPO_OK;
+}
+
 /* Helper to check if given directory path has a trailing slash */
 bool has_trailing_slash(char* dirpath) {
     return (*(dirpath + strlen(dirpath) - 1) ==  '/');
@@ -25,16 +55,22 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "usage: %s <command> [<args>]\n\n"
                         "Here are some commands you might want to consider:\n\n"
                         "    init      Create an empty Vms repository in the current directory\n"
+                        "    clone     Create a repository sharing the history of another on this machine\n"
                         "    status    Display the status of the working tree\n"
                         "    log       Display a log of the commit history\n"
                         "    info      Display info for commit or versioned file\n"
+                        "    blame     Show the commit that introduced each line of a file\n"
+                        "    diff      Show changes between commits, the staging area and the working tree\n"
                         "    stage     Add file contents to the staging area\n"
                         "    unstage   Remove file contents from the staging area\n"
                         "    commit    Save staged changes to the repository\n"
                         "    checkout  Restore files to working directory or switch branches\n"
                         "    mkbranch  Create a new branch\n"
                         "    rmbranch  Remove a branch\n"
-                        "    merge     Merge development histories together\n\n", argv[0]);
+                        "    merge     Merge development histories together\n"
+                        "    batch     Serve commands read from standard input in a single process\n"
+                        "    fsck      Verify the integrity of objects, refs and the staging area\n"
+                        "    gc        Remove objects no longer reachable from any branch\n\n", argv[0]);
         
         return -1;
     }
@@ -46,7 +82,26 @@ int main(int argc, char* argv[]) {
             return -1;
         }
 
-        return vms_init();
+        const char* store = "loose";
+        if (argc == 3 && strcmp(argv[2], "--store=loose") == 0) {
+            store = "loose";
+        } else if (argc == 3 && strcmp(argv[2], "--store=log") == 0) {
+            store = "log";
+        } else if (argc != 2) {
+            fprintf(stderr, "usage: %s %s [--store=loose|log]\n", argv[0], argv[1]);
+            return -1;
+        }
+
+        return vms_init(store);
+
+    } else if (strcmp(argv[1], "clone") == 0) {
+        if (argc != 4) {
+            fprintf(stderr, "Must provide the repository to clone and the directory to clone it into\n"
+                            "usage: %s %s <repository> <directory>\n", argv[0], argv[1]);
+            return -1;
+        }
+
+        return vms_clone(argv[2], argv[3]);
 
     } else {
         if (!is_initialized()) {
@@ -55,6 +110,12 @@ int main(int argc, char* argv[]) {
             return -1;
         }
 
+        // Writers serialize on the repository lock; readers work lock-free on atomically replaced files
+        RepoLock lock;
+        if (is_write_command(argc, argv) && lock.acquire() != 0) {
+            return -1;
+        }
+
         if (strcmp(argv[1], "stage") == 0 || strcmp(argv[1], "unstage") == 0) {
             if (argc < 3) {
                 fprintf(stderr, "Must provide filenames or directories\n"
@@ -103,7 +164,7 @@ int main(int argc, char* argv[]) {
                                 strcpy(norm_dir_filename, dir_filename);
                             }
 
-                            if (is_valid_file(norm_dir_filename) || is_tracked_file(norm_dir_filename) || is_staged_file(norm_dir_filename)) {
+                            if (is_valid_file(norm_dir_filename) || vms_repository().is_tracked(norm_dir_filename) || is_staged_file(norm_dir_filename)) {
 
                                 vms_stage(norm_dir_filename);
 
@@ -113,7 +174,7 @@ int main(int argc, char* argv[]) {
 
                         }
                         // need to normalize before check. How would you do this? The issue is deleted files.
-                    }else if (is_valid_file(norm_filepath) || is_tracked_file(norm_filepath) || is_staged_file(norm_filepath)) {
+                    }else if (is_valid_file(norm_filepath) || vms_repository().is_tracked(norm_filepath) || is_staged_file(norm_filepath)) {
 
                         vms_stage(norm_filepath);
 
@@ -193,18 +254,34 @@ int main(int argc, char* argv[]) {
             return vms_commit(argv[2]);
             
         } else if (strcmp(argv[1], "log") == 0) {
+            if (argc > 2 && strcmp(argv[2], "--") != 0) {
+                fprintf(stderr, "Unexpected argument \"%s\"\n"
+                                "usage: %s %s [-- <paths>]\n", argv[2], argv[0], argv[1]);
+                return -1;
+            }
 
-            return vms_log();
+            if (argc == 3) {
+                fprintf(stderr, "Must provide files or directories to show the history of\n"
+                                "usage: %s %s [-- <paths>]\n", argv[0], argv[1]);
+                return -1;
+            }
+
+            return vms_log(argc > 3 ? argc - 3 : 0, argv + 3);
 
         } else if (strcmp(argv[1], "status") == 0) {
+            if (argc > 2 && strcmp(argv[2], "--") != 0) {
+                fprintf(stderr, "Unexpected argument \"%s\"\n"
+                                "usage: %s %s [-- <pathspec>]\n", argv[2], argv[0], argv[1]);
+                return -1;
+            }
 
-            return vms_status(argv[0]);
+            return vms_status(argv[0], argc > 3 ? argc - 3 : 0, argv + 3);
 
         } else if (strcmp(argv[1], "checkout") == 0) {
             if (argc < 3) {
                 fprintf(stderr, "Must specify whether checkout branch or files\n"
                                 "usage: %s %s branch <branchname>\n"
-                                "usage: %s %s files <commitid> [filenames]\n", argv[0], argv[1], argv[0], argv[1]);
+                                "usage: %s %s files <commitid> [filenames | -- <pathspec>]\n", argv[0], argv[1], argv[0], argv[1]);
                 return -1;
             }
 
@@ -237,7 +314,7 @@ int main(int argc, char* argv[]) {
             } else if (strcmp(argv[2], "files") == 0) {
                 if (argc < 4) {
                     fprintf(stderr, "Must provide id of commit to checkout and optionally files\n"
-                                    "usage: %s %s %s <commitid> [filenames]\n", argv[0], argv[1], argv[2]);
+                                    "usage: %s %s %s <commitid> [filenames | -- <pathspec>]\n", argv[0], argv[1], argv[2]);
                     return -1;
                 }
 
@@ -254,6 +331,15 @@ int main(int argc, char* argv[]) {
 
                     return vms_checkout_files(argv[3]);
 
+                } else if (strcmp(argv[4], "--") == 0) { // pathspec given
+                    if (argc == 5) {
+                        fprintf(stderr, "Must provide files, directories or patterns to checkout after --\n"
+                                        "usage: %s %s %s <commitid> [filenames | -- <pathspec>]\n", argv[0], argv[1], argv[2]);
+                        return -1;
+                    }
+
+                    return vms_checkout_files(argv[3], Pathspec(argc - 5, argv + 5));
+
                 } else { // files given
 
                     return vms_checkout_files(argv[3], argc, argv);
@@ -265,7 +351,7 @@ int main(int argc, char* argv[]) {
             } else {
                 fprintf(stderr, "Must specify whether checkout branch or files\n"
                                 "usage: %s %s branch <branchname>\n"
-                                "usage: %s %s files <commitid> [filenames]\n", argv[0], argv[1], argv[0], argv[1]);
+                                "usage: %s %s files <commitid> [filenames | -- <pathspec>]\n", argv[0], argv[1], argv[0], argv[1]);
                 return -1;
             }
             
@@ -332,7 +418,7 @@ int main(int argc, char* argv[]) {
         } else if (strcmp(argv[1], "info") == 0) {
             if (argc < 3) {
                 fprintf(stderr, "Must provide id of commit to look up and optionally a filename\n"
-                                "usage: %s %s <commitid> [filename]\n", argv[0], argv[1]);
+                                "usage: %s %s <commitid> [filename | -- <pathspec>]\n", argv[0], argv[1]);
                 return -1;
             }
 
@@ -343,21 +429,131 @@ int main(int argc, char* argv[]) {
                 return -1;
             }
             if (argc == 3) {
-                return vms_info(argv[2]);
+                return vms_info(argv[2], 0, NULL);
+
+            } else if (strcmp(argv[3], "--") == 0) { // list only the files selected by the pathspec
+                if (argc == 4) {
+                    fprintf(stderr, "Must provide files, directories or patterns to list after --\n"
+                                    "usage: %s %s <commitid> [filename | -- <pathspec>]\n", argv[0], argv[1]);
+                    return -1;
+                }
+
+                return vms_info(argv[2], argc - 4, argv + 4);
 
             } else if (argc == 4) { // provided file argument as well.
                 return vms_info(argv[2], argv[3]);
             } else {
                 fprintf(stderr, "May only provide a single filename argument\n"
-                                "usage: %s %s <commitid> [filename]\n", argv[0], argv[1]);
+                                "usage: %s %s <commitid> [filename | -- <pathspec>]\n", argv[0], argv[1]);
             }
+        } else if (strcmp(argv[1], "blame") == 0) {
+            if (argc < 3 || argc > 4) {
+                fprintf(stderr, "Must provide a filename and optionally the id of the commit to blame it as of\n"
+                                "usage: %s %s [<commitid>] <filename>\n", argv[0], argv[1]);
+                return -1;
+            }
+
+            if (argc == 4 && !is_valid_commit_id(argv[2])) {
+                fprintf(stderr, "Provided commit id \"%s\" generated ambiguous or no matches\n"
+                                "Please provide more characters or verify the accuracy of your input\n"
+                                "  (use \"%s log\" to see log of commits)\n", argv[2], argv[0]);
+                return -1;
+            }
+
+            return argc == 4 ? vms_blame(argv[2], argv[3]) : vms_blame(NULL, argv[2]);
+
+        } else if (strcmp(argv[1], "diff") == 0) {
+            DiffMode mode = DIFF_PATCH;
+            bool staged = false;
+            const char* commit_ids[2] = {NULL, NULL};
+            int n_ids = 0;
+            int paths_start = argc;
+
+            for (int i = 2; i < argc; i++) {
+                if (strcmp(argv[i], "--") == 0) {
+                    paths_start = i + 1;
+                    break;
+                } else if (strcmp(argv[i], "--stat") == 0) {
+                    mode = DIFF_STAT;
+                } else if (strcmp(argv[i], "--name-only") == 0) {
+                    mode = DIFF_NAME_ONLY;
+                } else if (strcmp(argv[i], "--staged") == 0) {
+                    staged = true;
+                } else if (argv[i][0] == '-' || n_ids == 2) {
+                    fprintf(stderr, "Unexpected argument \"%s\"\n"
+                                    "usage: %s %s [--staged] [--stat | --name-only] [<commitid> [<commitid>]] [-- <paths>]\n", argv[i], argv[0], argv[1]);
+                    return -1;
+                } else {
+                    if (!is_valid_commit_id(argv[i])) {
+                        fprintf(stderr, "Provided commit id \"%s\" generated ambiguous or no matches\n"
+                                        "Please provide more characters or verify the accuracy of your input\n"
+                                        "  (use \"%s log\" to see log of commits)\n", argv[i], argv[0]);
+                        return -1;
+                    }
+                    commit_ids[n_ids++] = argv[i];
+                }
+            }
+
+            if (staged && n_ids == 2) {
+                fprintf(stderr, "May not compare the staging area when two commits are given\n"
+                                "usage: %s %s --staged [<commitid>] [-- <paths>]\n", argv[0], argv[1]);
+                return -1;
+            }
+
+            return vms_diff(commit_ids[0], commit_ids[1], staged, mode, argc - paths_start, argv + paths_start);
+
+        } else if (strcmp(argv[1], "batch") == 0) {
+
+            return vms_batch();
+
+        } else if (strcmp(argv[1], "fsck") == 0) {
+
+            return vms_fsck();
+
+        } else if (strcmp(argv[1], "gc") == 0) {
+            long grace_seconds = GC_DEFAULT_GRACE;
+            bool drop_borrowed = false;
+
+            for (int i = 2; i < argc; i++) {
+                if (strcmp(argv[i], "--drop-borrowed") == 0) {
+                    drop_borrowed = true;
+                } else if (strcmp(argv[i], "--grace") == 0 && i + 1 < argc) {
+                    char* end;
+                    i++;
+                    grace_seconds = strtol(argv[i], &end, 10);
+                    if (*argv[i] == '\0' || *end != '\0' || grace_seconds < 0) {
+                        fprintf(stderr, "Grace period must be a non-negative number of seconds\n"
+                                        "usage: %s %s [--grace <seconds>] [--drop-borrowed]\n", argv[0], argv[1]);
+                        return -1;
+                    }
+                } else {
+                    fprintf(stderr, "usage: %s %s [--grace <seconds>] [--drop-borrowed]\n", argv[0], argv[1]);
+                    return -1;
+                }
+            }
+
+            return vms_gc(grace_seconds, drop_borrowed);
+
         } else if (strcmp(argv[1], "merge") == 0) {
-            if (argc < 3) {
+            bool check = argc > 2 && strcmp(argv[2], "--check") == 0;
+            if (argc < 3 || (check && argc < 4)) {
                 fprintf(stderr, "Must provide name of branch to merge into current branch\n"
-                                "usage: %s %s <branchname>\n", argv[0], argv[1]);
+                                "usage: %s %s <branchname>\n"
+                                "       %s %s --check <branchname>...\n", argv[0], argv[1], argv[0], argv[1]);
                 return -1;
             }
 
+            if (check) {
+                for (int i = 3; i < argc; i++) {
+                    if (!is_valid_branch(argv[i])) {
+                        fprintf(stderr, "No branch named \"%s\"\n"
+                                        "  (use \"%s status\" to see list of available branches)\n", argv[i], argv[0]);
+                        return -1;
+                    }
+                }
+                return vms_merge_check(argc - 3, argv + 3);
+            }
+
             string current_branch;
             if (get_branch(current_branch) != 0) {
                 return -1;
@@ -0,0 +1,279 @@
+#include <iostream>
+#include <queue>
+#include <tuple>
+#include <unordered_set>
+
+#include "merge.hpp"
+#include "access.hpp"
+#include "blob.hpp"
+#include "codec.hpp"
+#include "commit.hpp"
+#include "diff.hpp"
+#include "objectstore.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+
+MergeEngine::MergeEngine() {}
+
+int MergeEngine::get_parents(ObjectStore& objects, const ObjectId& id, pair<ObjectId, ObjectId>& commit_parents) {
+    unordered_map<ObjectId, pair<ObjectId, ObjectId>, ObjectIdHash>::const_iterator it = parents.find(id);
+    if (it != parents.end()) {
+        commit_parents = it->second;
+        return 0;
+    }
+
+    Commit commit;
+    if (restore_commit_from_full_id(objects, id, commit) != 0) {
+        return -1;
+    }
+
+    commit_parents = commit.parent_ids();
+    parents[id] = commit_parents;
+    return 0;
+}
+
+int MergeEngine::get_tree(ObjectStore& objects, const ObjectId& id, const FlatTree*& tree) {
+    unordered_map<ObjectId, FlatTree, ObjectIdHash>::iterator it = trees.find(id);
+    if (it == trees.end()) {
+        it = trees.emplace(piecewise_construct, forward_as_tuple(id), forward_as_tuple(paths)).first;
+        if (restore_tree_from_full_id(objects, id, it->second) != 0) {
+            trees.erase(it);
+            return -1;
+        }
+    }
+
+    tree = &it->second;
+    return 0;
+}
+
+int MergeEngine::find_base(ObjectStore& objects, const ObjectId& a, const ObjectId& b, ObjectId& base) {
+    /** Design notes:
+     * Breadth-first search from both commits at once, ending as soon as a commit is reached from both, which is the split point
+     * closest to both. This does not guarantee that one commit is found to be an ancestor of the other when it is (an opportunity
+     * for a fast-forward merge), which would take a search of the whole commit graph.
+     *
+     * Cases in which the search finds a "suboptimal" split point are expected to be uncommon, and at worst lead to "false positive"
+     * merge conflicts. */
+
+    if (a == b) { // both point to the same commit, so trivially found
+        base = a;
+        return 0;
+    }
+
+    unordered_set<ObjectId, ObjectIdHash> seen_a;
+    unordered_set<ObjectId, ObjectIdHash> seen_b;
+    unordered_set<ObjectId, ObjectIdHash> seen_union;
+    queue<ObjectId> fringe;
+
+    seen_a.insert(a);
+    seen_b.insert(b);
+    seen_union.insert(a);
+    seen_union.insert(b);
+    fringe.push(a);
+    fringe.push(b);
+
+    base = ObjectId();
+    pair<ObjectId, ObjectId> commit_parents;
+
+    while (!fringe.empty()) {
+        ObjectId current_id = fringe.front();
+        fringe.pop();
+
+        if (get_parents(objects, current_id, commit_parents) != 0) {
+            return -1;
+        }
+
+        // Parents are seen from the same side as the commit they were reached from
+        unordered_set<ObjectId, ObjectIdHash>& seen = seen_a.count(current_id) > 0 ? seen_a : seen_b;
+        const ObjectId* next[2] = {&commit_parents.first, &commit_parents.second};
+
+        for (size_t i = 0; i < 2; i++) {
+            if (next[i]->is_null() || !seen.insert(*next[i]).second) {
+                continue;
+            }
+
+            fringe.push(*next[i]);
+            if (!seen_union.insert(*next[i]).second) {  // already reached from the other side, so this is the split point
+                base = *next[i];
+                return 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+size_t merge_file_contents(const string& base, const string& current, const string& given, const MergeOptions& options, string& merged) {
+    string current_label = "version: " + options.current_label;
+    string given_label = "version: " + options.given_label;
+
+    // Lines mean nothing in binary files, so they conflict as a whole
+    if (is_binary_content(base) || is_binary_content(current) || is_binary_content(given)) {
+        merged = "<<<<<<< " + current_label + "\n" + current + "\n=======\n" + given + "\n>>>>>>> " + given_label + "\n";
+        return 1;
+    }
+
+    vector<LineRef> base_lines;
+    vector<LineRef> current_lines;
+    vector<LineRef> given_lines;
+    split_lines(base, base_lines);
+    split_lines(current, current_lines);
+    split_lines(given, given_lines);
+
+    merged.clear();
+    return merge_lines(base_lines, current_lines, given_lines, current_label, given_label, merged);
+}
+
+/** Merges the contents of a file changed on both sides and stores the result if asked, returning the number of conflicting regions, or -1 **/
+static long merge_file(ObjectStore& objects, ObjectStore& staging, MergeConflict& conflict, const MergeOptions& options) {
+    Blob base;
+    Blob current;
+    Blob given;
+    if ((!conflict.base_id.is_null() && restore_blob_from_full_id(objects, staging, conflict.base_id, base) != 0)
+            || restore_blob_from_full_id(objects, staging, conflict.current_id, current) != 0
+            || restore_blob_from_full_id(objects, staging, conflict.given_id, given) != 0) {
+        return -1;
+    }
+
+    string merged;
+    size_t n_conflicts = merge_file_contents(base.get_content(), current.get_content(), given.get_content(), options, merged);
+
+    conflict.merged_id = ObjectHasher::hash(merged.data(), merged.length());
+    if (options.write_objects && store_object(objects, conflict.merged_id, CODEC_KIND_BLOB, merged) != 0) {
+        return -1;
+    }
+    return n_conflicts;
+}
+
+/** Helper classifying the state of a file on one side relative to the split point **/
+enum FileChange {
+    ADDED,
+    CHANGED,
+    UNCHANGED,
+    REMOVED,
+    ABSENT
+};
+
+static FileChange file_change(const TreeEntry* side, const TreeEntry* base) {
+    if (side != NULL && base == NULL) {
+        return ADDED;
+    } else if (side == NULL && base != NULL) {
+        return REMOVED;
+    } else if (side != NULL) {
+        return side->id == base->id ? UNCHANGED : CHANGED;
+    }
+    return ABSENT;
+}
+
+int MergeEngine::merge(ObjectStore& objects, ObjectStore& staging, const ObjectId& current_id, const ObjectId& given_id, const MergeOptions& options,
+                       MergeResult& result) {
+    result.updated.clear();
+    result.removed.clear();
+    result.conflicts.clear();
+    result.commit_id = ObjectId();
+
+    if (find_base(objects, current_id, given_id, result.base_id) != 0) {
+        return -1;
+    }
+
+    if (result.base_id == given_id) {
+        result.outcome = MERGE_UP_TO_DATE;
+        result.commit_id = current_id;
+        return 0;
+    }
+
+    const FlatTree* given_tree;
+    const FlatTree* current_tree;
+    const FlatTree* base_tree;
+    if (get_tree(objects, given_id, given_tree) != 0 || get_tree(objects, current_id, current_tree) != 0 || get_tree(objects, result.base_id, base_tree) != 0) {
+        return -1;
+    }
+
+    PathId path;
+    const TreeEntry* entries[3];
+
+    if (result.base_id == current_id) { // fast forward: the given commit's files, where they differ from the current commit's
+        result.outcome = MERGE_FAST_FORWARD;
+        result.commit_id = given_id;
+
+        const FlatTree* given_and_current[2] = {given_tree, current_tree};
+        TreeWalk walk(given_and_current, 2);
+        while (walk.next(path, entries)) {
+            if (entries[0] != NULL && (entries[1] == NULL || entries[0]->id != entries[1]->id)) {
+                result.updated.push_back(make_pair(string(paths.path(path)), entries[0]->id));
+            } else if (entries[0] == NULL) {
+                result.removed.push_back(paths.path(path));
+            }
+        }
+        return 0;
+    }
+
+    // Walk the files of all three commits together in path order, deciding what becomes of each
+    const FlatTree* all_trees[3] = {given_tree, current_tree, base_tree};
+    TreeWalk walk(all_trees, 3);
+    vector<MergeConflict> candidates;   // files changed on both sides, to be merged line by line
+    vector<size_t> candidate_slots;     // where each goes in updated
+
+    while (walk.next(path, entries)) {
+        FileChange given = file_change(entries[0], entries[2]);
+        FileChange current = file_change(entries[1], entries[2]);
+
+        if ((given == ADDED && current == ABSENT) || (given == CHANGED && (current == REMOVED || current == UNCHANGED))) {
+            // Changed on the given side only, so take the given version
+            result.updated.push_back(make_pair(string(paths.path(path)), entries[0]->id));
+
+        } else if (given == REMOVED && current == UNCHANGED) {
+            result.removed.push_back(paths.path(path));
+
+        } else if (entries[0] != NULL && entries[1] != NULL && (given == CHANGED || given == ADDED) && (current == CHANGED || current == ADDED)
+                   && entries[0]->id != entries[1]->id) {
+            // Changed on both sides to different contents
+            MergeConflict candidate;
+            candidate.path = paths.path(path);
+            candidate.base_id = entries[2] != NULL ? entries[2]->id : ObjectId();
+            candidate.current_id = entries[1]->id;
+            candidate.given_id = entries[0]->id;
+            candidates.push_back(candidate);
+
+            candidate_slots.push_back(result.updated.size());
+            result.updated.push_back(make_pair(candidate.path, ObjectId()));
+        }
+
+        // Anything else is unchanged on the given side, or changed the same way on both, so the current version stands
+    }
+
+    // Merge the contents of files changed on both sides on a pool of workers, each writing only to its own candidate
+    vector<long> rets(candidates.size());
+    parallel_for(candidates.size(), [&objects, &staging, &candidates, &options, &rets](size_t i) {
+        rets[i] = merge_file(objects, staging, candidates[i], options);
+    });
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+        if (rets[i] < 0) {
+            return -1;
+        } else if (rets[i] > 0) {
+            result.conflicts.push_back(candidates[i]);
+        }
+        result.updated[candidate_slots[i]].second = candidates[i].merged_id;
+    }
+
+    // Drop files whose merge left the current version as it was, e.g. when the given side's changes were already made
+    size_t n_updated = 0;
+    size_t c = 0;
+    for (size_t i = 0; i < result.updated.size(); i++) {
+        bool unchanged = false;
+        if (c < candidates.size() && candidate_slots[c] == i) {
+            unchanged = candidates[c].merged_id == candidates[c].current_id;
+            c++;
+        }
+
+        if (!unchanged) {
+            result.updated[n_updated++] = result.updated[i];
+        }
+    }
+    result.updated.resize(n_updated);
+
+    result.outcome = result.conflicts.empty() ? MERGE_CLEAN : MERGE_CONFLICTED;
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+Three-way merge of commits, computed in memory and in the object store
+
+Merging never reads or writes the working directory, the staging area or any ref. The result
+describes the merged files as changes to the current commit, along with a list of conflicts, so
+callers decide whether to commit it, check out its files (see Repository::merge and
+Repository::checkout_merge) or only report whether the branches merge cleanly.
+
+Each file is classified by comparing both sides with the split point, the closest common ancestor
+of the two commits. A file changed on one side only takes that side's version. A file changed on
+both sides to different contents is merged line by line against its split-point version (see
+merge_lines in diff.hpp): changes to separate lines are combined, and only lines both sides changed
+differently conflict, appearing in the merged version between conflict markers. Binary files that
+differ conflict as a whole.
+
+A MergeEngine caches the parents and trees of the commits it reads, so checking many branches
+against one another reads each commit once.
+*/
+#ifndef MERGE_HPP
+#define MERGE_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+
+#include "objectid.hpp"
+#include "pathtable.hpp"
+
+class ObjectStore;
+
+enum MergeOutcome {
+    MERGE_UP_TO_DATE,       // the given commit is already an ancestor of the current one
+    MERGE_FAST_FORWARD,     // the current commit is an ancestor of the given one, which becomes the result
+    MERGE_CLEAN,            // a merge commit is needed, and no file conflicts
+    MERGE_CONFLICTED        // a merge commit is needed, and conflicting files hold both versions between markers
+};
+
+struct MergeConflict {
+    std::string path;
+    ObjectId base_id;       // null where the file is new on both sides
+    ObjectId current_id;
+    ObjectId given_id;
+    ObjectId merged_id;     // the line merge, with the conflicting lines of both versions between conflict markers
+};
+
+struct MergeResult {
+    MergeOutcome outcome;
+    ObjectId base_id;
+
+    /* The new commit of the current branch once committed: the merge commit, or the given commit when fast-forwarding */
+    ObjectId commit_id;
+
+    /* Files whose contents differ from the current commit's, with their merged versions, in path order. Includes conflicts. */
+    std::vector<std::pair<std::string, ObjectId> > updated;
+
+    /* Files of the current commit that the merge removes, in path order */
+    std::vector<std::string> removed;
+
+    std::vector<MergeConflict> conflicts;
+};
+
+struct MergeOptions {
+    std::string current_label;  // how conflict markers name each side
+    std::string given_label;
+    bool write_objects;         // store the merged versions of conflicting files; off to only preview a merge
+
+    MergeOptions() : write_objects(true) {}
+};
+
+class MergeEngine {
+    public:
+        MergeEngine();
+
+        /*
+            Finds the split point of two commits, searching breadth-first from both, in the object store objects. Returns 0
+            on success, or -1 if a commit could not be read.
+        */
+        int find_base(ObjectStore& objects, const ObjectId& a, const ObjectId& b, ObjectId& base);
+
+        /*
+            Merges the commit given_id into current_id, reading and writing objects through the given stores (see access.hpp).
+            The stores must be the same on every call. Returns 0 on success, or -1 if an object could not be read or written.
+        */
+        int merge(ObjectStore& objects, ObjectStore& staging, const ObjectId& current_id, const ObjectId& given_id, const MergeOptions& options,
+                  MergeResult& result);
+
+    private:
+        MergeEngine(const MergeEngine&);
+        MergeEngine& operator=(const MergeEngine&);
+
+        PathTable paths;    // shared by every cached tree
+        std::unordered_map<ObjectId, std::pair<ObjectId, ObjectId>, ObjectIdHash> parents;
+        std::unordered_map<ObjectId, FlatTree, ObjectIdHash> trees;
+
+        int get_parents(ObjectStore& objects, const ObjectId& id, std::pair<ObjectId, ObjectId>& commit_parents);
+        int get_tree(ObjectStore& objects, const ObjectId& id, const FlatTree*& tree);
+};
+
+/*
+    Merges the changes made to the contents of a file since base on both sides into merged, with conflict markers named
+    by the labels in options. Returns the number of conflicting regions.
+*/
+size_t merge_file_contents(const std::string& base, const std::string& current, const std::string& given, const MergeOptions& options, std::string& merged);
+
+#endif // MERGE_HPP
@@ -0,0 +1,113 @@
+#include "objectid.hpp"
+
+using namespace std;
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+/** Helper for converting a hex digit to its value, or -1 if c is not one **/
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+ObjectId::ObjectId() {
+    memset(bytes, 0, OBJECT_ID_SIZE);
+}
+
+bool ObjectId::parse(const char* hex, size_t length, ObjectId& id) {
+    if (length != OBJECT_ID_HEX_LENGTH) {
+        return false;
+    }
+
+    unsigned char parsed[OBJECT_ID_SIZE];
+    for (unsigned int i = 0; i < OBJECT_ID_SIZE; i++) {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hex_value(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        parsed[i] = (unsigned char) (hi << 4 | lo);
+    }
+
+    memcpy(id.bytes, parsed, OBJECT_ID_SIZE);
+    return true;
+}
+
+bool ObjectId::parse(const string& hex, ObjectId& id) {
+    return parse(hex.data(), hex.length(), id);
+}
+
+ObjectId ObjectId::from_hex(const string& hex) {
+    ObjectId id;
+    parse(hex, id);
+    return id;
+}
+
+ObjectId ObjectId::from_bytes(const unsigned char* raw) {
+    ObjectId id;
+    memcpy(id.bytes, raw, OBJECT_ID_SIZE);
+    return id;
+}
+
+string ObjectId::hex() const {
+    char out[OBJECT_ID_HEX_LENGTH];
+    write_hex(out);
+    return string(out, OBJECT_ID_HEX_LENGTH);
+}
+
+void ObjectId::write_hex(char* out) const {
+    for (unsigned int i = 0; i < OBJECT_ID_SIZE; i++) {
+        out[2 * i] = HEX_DIGITS[bytes[i] >> 4];
+        out[2 * i + 1] = HEX_DIGITS[bytes[i] & 0xf];
+    }
+}
+
+bool ObjectId::is_null() const {
+    for (unsigned int i = 0; i < OBJECT_ID_SIZE; i++) {
+        if (bytes[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const unsigned char* ObjectId::data() const {
+    return bytes;
+}
+
+void ObjectHasher::update(const void* data, size_t length) {
+    sha1.process_bytes(data, length);
+}
+
+void ObjectHasher::update(const string& data) {
+    sha1.process_bytes(data.data(), data.length());
+}
+
+ObjectId ObjectHasher::digest() {
+    boost::uuids::detail::sha1::digest_type digest;
+    sha1.get_digest(digest);
+
+    unsigned char raw[OBJECT_ID_SIZE];
+#if BOOST_VERSION >= 108600
+    memcpy(raw, digest, OBJECT_ID_SIZE);
+#else
+    // digest is five 32-bit words, which form the id most significant byte first
+    for (unsigned int i = 0; i < OBJECT_ID_SIZE; i++) {
+        raw[i] = (unsigned char) (digest[i / 4] >> (24 - 8 * (i % 4)));
+    }
+#endif
+
+    return ObjectId::from_bytes(raw);
+}
+
+ObjectId ObjectHasher::hash(const void* data, size_t length) {
+    ObjectHasher hasher;
+    hasher.update(data, length);
+    return hasher.digest();
+}
@@ -0,0 +1,112 @@
+/*
+Fixed-size binary id of a commit or blob: the 20 bytes of its SHA-1 hash
+
+Ids are held and compared in binary everywhere inside vms. They are converted to and from their
+40-character hex form only at the edges: when parsed from user input, refs or object file names,
+and when printed or used to build a path. The all-zero id is the null id, which stands for "no
+object" (e.g. the missing parent of the first commit, or a staged deletion in the index).
+*/
+#ifndef OBJECTID_HPP
+#define OBJECTID_HPP
+
+#include <stddef.h>
+#include <string.h>
+
+#include <string>
+#include <functional>
+
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 106600
+#  include <boost/uuid/detail/sha1.hpp>
+#else
+#  include <boost/uuid/sha1.hpp>
+#endif
+#include <boost/serialization/binary_object.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+
+const unsigned int OBJECT_ID_SIZE = 20;
+const unsigned int OBJECT_ID_HEX_LENGTH = 2 * OBJECT_ID_SIZE;
+
+namespace boost {
+    namespace serialization {
+        class access;
+    }
+}
+
+class ObjectId {
+    public:
+        /* Constructs the null id */
+        ObjectId();
+
+        /* Parses a full 40-character hex id, returning false (and leaving id unchanged) if hex is not one */
+        static bool parse(const char* hex, size_t length, ObjectId& id);
+        static bool parse(const std::string& hex, ObjectId& id);
+
+        /* Returns the id parsed from hex, or the null id if hex is not a full id */
+        static ObjectId from_hex(const std::string& hex);
+        static ObjectId from_bytes(const unsigned char* raw);
+
+        std::string hex() const;
+        /* Writes the 40 hex digits of the id to out, without a terminating NUL */
+        void write_hex(char* out) const;
+
+        bool is_null() const;
+        const unsigned char* data() const;
+
+        bool operator==(const ObjectId& other) const {
+            return memcmp(bytes, other.bytes, OBJECT_ID_SIZE) == 0;
+        }
+
+        bool operator!=(const ObjectId& other) const {
+            return !(*this == other);
+        }
+
+        bool operator<(const ObjectId& other) const {
+            return memcmp(bytes, other.bytes, OBJECT_ID_SIZE) < 0;
+        }
+
+        /* Ids are uniformly distributed hash values, so their leading bytes already make a good hash */
+        size_t hash_value() const {
+            size_t h;
+            memcpy(&h, bytes, sizeof(h));
+            return h;
+        }
+
+    private:
+        unsigned char bytes[OBJECT_ID_SIZE];
+
+        friend class boost::serialization::access;
+
+        template<class Archive>
+        void serialize(Archive& ar, const unsigned int version) {
+            boost::serialization::binary_object raw(bytes, OBJECT_ID_SIZE);
+            ar & raw;
+        }
+};
+
+// Ids are stored as bare bytes, without class information or object tracking in the archive
+BOOST_CLASS_IMPLEMENTATION(ObjectId, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(ObjectId, boost::serialization::track_never)
+
+/* Incrementally computes the id of content fed to it in pieces, without building the content in memory */
+class ObjectHasher {
+    public:
+        void update(const void* data, size_t length);
+        void update(const std::string& data);
+        ObjectId digest();
+
+        /* Returns the id of the given content in one step */
+        static ObjectId hash(const void* data, size_t length);
+
+    private:
+        boost::uuids::detail::sha1 sha1;
+};
+
+struct ObjectIdHash {
+    size_t operator()(const ObjectId& id) const {
+        return id.hash_value();
+    }
+};
+
+#endif // OBJECTID_HPP
@@ -0,0 +1,542 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/dir.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <algorithm>
+
+#include "objectstore.hpp"
+#include "access.hpp"
+#include "codec.hpp"
+#include "config.hpp"
+#include "logstore.hpp"
+#include "utils.h"
+
+using namespace std;
+
+ObjectStore::~ObjectStore() {}
+
+int ObjectStore::adopt(ObjectStore& source, const ObjectId& id) {
+    string data;
+    if (source.get(id, data) != 0 || put(id, data) != 0) {
+        return -1;
+    }
+    return source.remove(id);
+}
+
+size_t ObjectStore::prune(time_t cutoff, unsigned long long& bytes) {
+    return 0;
+}
+
+bool ObjectStore::locate(const ObjectId& id, string& path, uint64_t& offset, uint64_t& length) {
+    return false;
+}
+
+/** Helper for checking that prefix only holds lowercase hex digits, the form of object file names **/
+static bool is_hex_prefix(const char* prefix) {
+    for (const char* c = prefix; *c != '\0'; c++) {
+        if (!((*c >= '0' && *c <= '9') || (*c >= 'a' && *c <= 'f'))) {
+            return false;
+        }
+    }
+    return strlen(prefix) <= OBJECT_ID_HEX_LENGTH;
+}
+
+LooseObjectStore::LooseObjectStore(const string& directory, bool fanout, mode_t mode) : directory(directory), fanout(fanout), mode(mode) {}
+
+void LooseObjectStore::path_of(const ObjectId& id, char* out) const {
+    char hex[OBJECT_ID_HEX_LENGTH + 1];
+    id.write_hex(hex);
+    hex[OBJECT_ID_HEX_LENGTH] = '\0';
+
+    if (fanout) {
+        snprintf(out, PATH_MAX, "%s/%.*s/%s", directory.c_str(), (int) PREFIX_LENGTH, hex, hex + PREFIX_LENGTH);
+    } else {
+        snprintf(out, PATH_MAX, "%s/%s", directory.c_str(), hex);
+    }
+}
+
+bool LooseObjectStore::has(const ObjectId& id) {
+    char path[PATH_MAX];
+    path_of(id, path);
+    return is_valid_file(path);
+}
+
+int LooseObjectStore::get(const ObjectId& id, string& buffer) {
+    char path[PATH_MAX];
+    path_of(id, path);
+    return read_whole_file(path, buffer);
+}
+
+int LooseObjectStore::put(const ObjectId& id, const string& data) {
+    char path[PATH_MAX];
+    path_of(id, path);
+
+    // A copy already stored, perhaps by another worker, is kept if it holds these very bytes, and replaced if it is damaged
+    struct stat s;
+    if (lstat(path, &s) == 0 && S_ISREG(s.st_mode) && (size_t)s.st_size == data.length()) {
+        string stored;
+        if (read_whole_file(path, stored) == 0 && stored == data) {
+            return 0;
+        }
+    }
+
+    if (fanout) {
+        create_directory_path(path);
+    }
+
+    return replace_file_atomically(path, data.data(), data.length(), mode) == 0 ? 0 : -1;
+}
+
+int LooseObjectStore::remove(const ObjectId& id) {
+    char path[PATH_MAX];
+    path_of(id, path);
+    return unlink(path) == 0 ? 0 : -1;
+}
+
+bool LooseObjectStore::stat(const ObjectId& id, ObjectInfo& info) {
+    char path[PATH_MAX];
+    path_of(id, path);
+
+    struct stat s;
+    if (lstat(path, &s) == -1 || !S_ISREG(s.st_mode)) {
+        return false;
+    }
+
+    info.size = s.st_size;
+    info.mtime = s.st_mtime;
+    return true;
+}
+
+const LooseObjectStore::Listing& LooseObjectStore::listing(const string& subdirectory) {
+    string dirpath = subdirectory.empty() ? directory : directory + "/" + subdirectory;
+    Listing& cached = listings[subdirectory];
+    FileStamp stamp = FileStamp::of(dirpath.c_str());
+
+    if (stamp != cached.stamp) {
+        cached.stamp = stamp;
+        cached.names.clear();
+
+        DIR* dirptr = opendir(dirpath.c_str());
+        if (dirptr != NULL) {
+            struct dirent* entry;
+            while ((entry = readdir(dirptr)) != NULL) {
+                // object names are plain hex, which excludes "." and ".." as well as temporary files of in-progress writes
+                if (strchr(entry->d_name, '.') == NULL) {
+                    cached.names.push_back(entry->d_name);
+                }
+            }
+            closedir(dirptr);
+        }
+        sort(cached.names.begin(), cached.names.end());
+    }
+
+    return cached;
+}
+
+void LooseObjectStore::subdirectories(vector<string>& names) const {
+    DIR* dirptr = opendir(directory.c_str());
+    if (dirptr == NULL) {
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dirptr)) != NULL) {
+        if (strlen(entry->d_name) == PREFIX_LENGTH && strchr(entry->d_name, '.') == NULL) {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dirptr);
+}
+
+void LooseObjectStore::resolve_prefix(const char* hex_prefix, size_t max_matches, vector<ObjectId>& matches) {
+    if (!is_hex_prefix(hex_prefix)) {
+        return;
+    }
+
+    size_t prefix_length = strlen(hex_prefix);
+    vector<string> searched;
+
+    // With a fan-out, only the subdirectories that can hold matches are listed
+    if (!fanout) {
+        searched.push_back("");
+    } else if (prefix_length >= PREFIX_LENGTH) {
+        searched.push_back(string(hex_prefix, PREFIX_LENGTH));
+    } else {
+        subdirectories(searched);
+        sort(searched.begin(), searched.end());
+    }
+
+    lock_guard<mutex> guard(listings_mutex);
+
+    for (size_t i = 0; i < searched.size() && matches.size() < max_matches; i++) {
+        const string& subdirectory = searched[i];
+        if (subdirectory.compare(0, prefix_length, hex_prefix, min(prefix_length, subdirectory.length())) != 0) {
+            continue;
+        }
+
+        // Part of the prefix still to be matched against the names in the subdirectory
+        string rest = prefix_length > subdirectory.length() ? string(hex_prefix + subdirectory.length()) : string();
+        const vector<string>& names = listing(subdirectory).names;
+
+        vector<string>::const_iterator it = lower_bound(names.begin(), names.end(), rest);
+        for (; it != names.end() && it->compare(0, rest.length(), rest) == 0 && matches.size() < max_matches; ++it) {
+            ObjectId id;
+            if (ObjectId::parse(subdirectory + *it, id)) {
+                matches.push_back(id);
+            }
+        }
+    }
+}
+
+void LooseObjectStore::for_each(const function<void(const ObjectId&)>& fn) {
+    vector<string> searched;
+    if (fanout) {
+        subdirectories(searched);
+    } else {
+        searched.push_back("");
+    }
+
+    for (size_t i = 0; i < searched.size(); i++) {
+        string dirpath = searched[i].empty() ? directory : directory + "/" + searched[i];
+        DIR* dirptr = opendir(dirpath.c_str());
+        if (dirptr == NULL) {
+            continue;
+        }
+
+        struct dirent* entry;
+        while ((entry = readdir(dirptr)) != NULL) {
+            ObjectId id;
+            if (ObjectId::parse(searched[i] + entry->d_name, id)) {
+                fn(id);
+            }
+        }
+        closedir(dirptr);
+    }
+}
+
+string LooseObjectStore::location(const ObjectId& id) {
+    char path[PATH_MAX];
+    path_of(id, path);
+    return path;
+}
+
+bool LooseObjectStore::locate(const ObjectId& id, string& path, uint64_t& offset, uint64_t& length) {
+    ObjectInfo info;
+    if (!stat(id, info)) {
+        return false;
+    }
+
+    path = location(id);
+    offset = 0;
+    length = info.size;
+    return true;
+}
+
+int LooseObjectStore::adopt(ObjectStore& source, const ObjectId& id) {
+    LooseObjectStore* loose = dynamic_cast<LooseObjectStore*>(&source);
+    if (loose == NULL) {
+        return ObjectStore::adopt(source, id);
+    }
+
+    // Between loose stores the file is renamed into place rather than copied
+    char source_path[PATH_MAX];
+    char path[PATH_MAX];
+    loose->path_of(id, source_path);
+    path_of(id, path);
+
+    if (fanout) {
+        create_directory_path(path);
+    }
+
+    if (move_file(source_path, path) != 0) {
+        return -1;
+    }
+
+    return chmod(path, mode) == 0 ? 0 : -1;
+}
+
+size_t LooseObjectStore::prune(time_t cutoff, unsigned long long& bytes) {
+    vector<string> searched;
+    searched.push_back("");
+    if (fanout) {
+        subdirectories(searched);
+    }
+
+    size_t n_removed = 0;
+    for (size_t i = 0; i < searched.size(); i++) {
+        string dirpath = searched[i].empty() ? directory : directory + "/" + searched[i];
+        DIR* dirptr = opendir(dirpath.c_str());
+        if (dirptr == NULL) {
+            continue;
+        }
+
+        struct dirent* entry;
+        while ((entry = readdir(dirptr)) != NULL) {
+            // temporary files of interrupted atomic writes are named <file>.tmp.<pid>[.<n>]
+            if (strstr(entry->d_name, ".tmp.") == NULL) {
+                continue;
+            }
+
+            string filepath = dirpath + "/" + entry->d_name;
+            struct stat s;
+            if (lstat(filepath.c_str(), &s) == 0 && S_ISREG(s.st_mode) && s.st_mtime <= cutoff && unlink(filepath.c_str()) == 0) {
+                bytes += s.st_size;
+                n_removed++;
+            }
+        }
+        closedir(dirptr);
+
+        // Drop emptied fan-out subdirectories; fails harmlessly for those still in use
+        if (!searched[i].empty()) {
+            rmdir(dirpath.c_str());
+        }
+    }
+
+    return n_removed;
+}
+
+bool MemoryObjectStore::has(const ObjectId& id) {
+    lock_guard<mutex> guard(objects_mutex);
+    return objects.find(id) != objects.end();
+}
+
+int MemoryObjectStore::get(const ObjectId& id, string& buffer) {
+    lock_guard<mutex> guard(objects_mutex);
+    map<ObjectId, Entry>::const_iterator it = objects.find(id);
+    if (it == objects.end()) {
+        return -1;
+    }
+    buffer = it->second.data;
+    return 0;
+}
+
+int MemoryObjectStore::put(const ObjectId& id, const string& data) {
+    lock_guard<mutex> guard(objects_mutex);
+    Entry& entry = objects[id];
+    entry.data = data;
+    entry.mtime = time(NULL);
+    return 0;
+}
+
+int MemoryObjectStore::remove(const ObjectId& id) {
+    lock_guard<mutex> guard(objects_mutex);
+    return objects.erase(id) > 0 ? 0 : -1;
+}
+
+bool MemoryObjectStore::stat(const ObjectId& id, ObjectInfo& info) {
+    lock_guard<mutex> guard(objects_mutex);
+    map<ObjectId, Entry>::const_iterator it = objects.find(id);
+    if (it == objects.end()) {
+        return false;
+    }
+    info.size = it->second.data.length();
+    info.mtime = it->second.mtime;
+    return true;
+}
+
+void MemoryObjectStore::resolve_prefix(const char* hex_prefix, size_t max_matches, vector<ObjectId>& matches) {
+    if (!is_hex_prefix(hex_prefix)) {
+        return;
+    }
+
+    // The smallest id with the prefix is the prefix padded with zeros
+    size_t prefix_length = strlen(hex_prefix);
+    char padded[OBJECT_ID_HEX_LENGTH];
+    memset(padded, '0', OBJECT_ID_HEX_LENGTH);
+    memcpy(padded, hex_prefix, prefix_length);
+
+    ObjectId first;
+    ObjectId::parse(padded, OBJECT_ID_HEX_LENGTH, first);
+
+    lock_guard<mutex> guard(objects_mutex);
+    map<ObjectId, Entry>::const_iterator it;
+    for (it = objects.lower_bound(first); it != objects.end() && matches.size() < max_matches; ++it) {
+        char hex[OBJECT_ID_HEX_LENGTH];
+        it->first.write_hex(hex);
+        if (memcmp(hex, hex_prefix, prefix_length) != 0) {
+            break;
+        }
+        matches.push_back(it->first);
+    }
+}
+
+void MemoryObjectStore::for_each(const function<void(const ObjectId&)>& fn) {
+    // Visit a snapshot of the ids, so fn may modify the store
+    vector<ObjectId> ids;
+    {
+        lock_guard<mutex> guard(objects_mutex);
+        ids.reserve(objects.size());
+        map<ObjectId, Entry>::const_iterator it;
+        for (it = objects.begin(); it != objects.end(); ++it) {
+            ids.push_back(it->first);
+        }
+    }
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        fn(ids[i]);
+    }
+}
+
+string MemoryObjectStore::location(const ObjectId& id) {
+    return "memory:" + id.hex();
+}
+
+AlternatesObjectStore::AlternatesObjectStore(ObjectStore* local, const vector<ObjectStore*>& alternates) : local(local), alternates(alternates) {}
+
+AlternatesObjectStore::~AlternatesObjectStore() {
+    delete local;
+    for (size_t i = 0; i < alternates.size(); i++) {
+        delete alternates[i];
+    }
+}
+
+ObjectStore* AlternatesObjectStore::alternate_of(const ObjectId& id) {
+    for (size_t i = 0; i < alternates.size(); i++) {
+        if (alternates[i]->has(id)) {
+            return alternates[i];
+        }
+    }
+    return NULL;
+}
+
+bool AlternatesObjectStore::has(const ObjectId& id) {
+    return local->has(id) || alternate_of(id) != NULL;
+}
+
+int AlternatesObjectStore::get(const ObjectId& id, string& buffer) {
+    if (local->get(id, buffer) == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < alternates.size(); i++) {
+        if (alternates[i]->get(id, buffer) == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int AlternatesObjectStore::put(const ObjectId& id, const string& data) {
+    if (alternate_of(id) != NULL) {
+        return 0;
+    }
+    return local->put(id, data);
+}
+
+int AlternatesObjectStore::remove(const ObjectId& id) {
+    return local->remove(id);
+}
+
+bool AlternatesObjectStore::stat(const ObjectId& id, ObjectInfo& info) {
+    if (local->stat(id, info)) {
+        return true;
+    }
+
+    ObjectStore* alternate = alternate_of(id);
+    return alternate != NULL && alternate->stat(id, info);
+}
+
+void AlternatesObjectStore::resolve_prefix(const char* hex_prefix, size_t max_matches, vector<ObjectId>& matches) {
+    // An object may be held both locally and by alternates, so each is counted once
+    vector<ObjectId> found;
+    local->resolve_prefix(hex_prefix, max_matches, found);
+
+    for (size_t i = 0; i < alternates.size() && found.size() < max_matches; i++) {
+        vector<ObjectId> more;
+        alternates[i]->resolve_prefix(hex_prefix, max_matches, more);
+        for (size_t j = 0; j < more.size() && found.size() < max_matches; j++) {
+            if (find(found.begin(), found.end(), more[j]) == found.end()) {
+                found.push_back(more[j]);
+            }
+        }
+    }
+
+    matches.insert(matches.end(), found.begin(), found.end());
+}
+
+void AlternatesObjectStore::for_each(const function<void(const ObjectId&)>& fn) {
+    local->for_each(fn);
+}
+
+string AlternatesObjectStore::location(const ObjectId& id) {
+    ObjectStore* alternate = local->has(id) ? NULL : alternate_of(id);
+    return alternate != NULL ? alternate->location(id) : local->location(id);
+}
+
+bool AlternatesObjectStore::locate(const ObjectId& id, string& path, uint64_t& offset, uint64_t& length) {
+    if (local->locate(id, path, offset, length)) {
+        return true;
+    }
+
+    ObjectStore* alternate = alternate_of(id);
+    return alternate != NULL && alternate->locate(id, path, offset, length);
+}
+
+int AlternatesObjectStore::adopt(ObjectStore& source, const ObjectId& id) {
+    if (!local->has(id) && alternate_of(id) != NULL) {
+        return source.remove(id);
+    }
+    return local->adopt(source, id);
+}
+
+size_t AlternatesObjectStore::prune(time_t cutoff, unsigned long long& bytes) {
+    return local->prune(cutoff, bytes);
+}
+
+/** Opens the object directory at path, or that of the repository at path, as whichever backend its files show it uses **/
+static ObjectStore* open_alternate(const string& path) {
+    string directory = is_valid_dir((path + "/.vms/objects").c_str()) ? path + "/.vms/objects" : path;
+    if (!is_valid_dir(directory.c_str())) {
+        return NULL;
+    }
+
+    if (is_valid_file((directory + "/objects.log").c_str())) {
+        return new LogObjectStore(directory);
+    }
+    return new LooseObjectStore(directory, true, 0444);
+}
+
+int open_configured_store(ObjectStore*& store) {
+    string backend;
+    vector<string> paths;
+    if (get_config("store", "loose", backend) != 0 || load_alternates(paths) != 0) {
+        return -1;
+    }
+
+    ObjectStore* local;
+    if (backend == "loose") {
+        local = new LooseObjectStore(".vms/objects", true, 0444);
+    } else if (backend == "log") {
+        local = new LogObjectStore(".vms/objects");
+    } else {
+        return -1;
+    }
+
+    if (paths.empty()) {
+        store = local;
+        return 0;
+    }
+
+    vector<ObjectStore*> alternates;
+    for (size_t i = 0; i < paths.size(); i++) {
+        ObjectStore* alternate = open_alternate(paths[i]);
+        if (alternate == NULL) {
+            for (size_t j = 0; j < alternates.size(); j++) {
+                delete alternates[j];
+            }
+            delete local;
+            return -1;
+        }
+        alternates.push_back(alternate);
+    }
+
+    store = new AlternatesObjectStore(local, alternates);
+    return 0;
+}
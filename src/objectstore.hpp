@@ -0,0 +1,208 @@
+/*
+Storage of commits and blobs, addressed by id
+
+Every read and write of an object goes through an ObjectStore, which holds each object as the
+bytes of its encoded object file (see codec.hpp) and knows nothing of their contents. Parsing,
+verification and the choice of store are left to the callers in access.hpp and codec.hpp.
+
+A repository uses two stores: the object store (.vms/objects) holding committed objects, and the
+staging store (.vms/cache) holding snapshots of staged files until they are committed. Both are
+owned by the Repository using them (see repository.hpp), which opens them on first use.
+
+    LooseObjectStore    one file per object in a directory, the layout vms has always used
+    LogObjectStore      every object in one append-only file with a hash index (see logstore.hpp)
+    MemoryObjectStore   objects held in memory, so benchmarks of merge and status measure the
+                        algorithms rather than the filesystem
+
+    AlternatesObjectStore
+                        the configured backend, falling back to read-only stores of other
+                        repositories on the same machine, its alternates, for objects it lacks
+
+The object store's backend is chosen when the repository is created (see config.hpp). Staged
+snapshots are short-lived, so the staging store is always loose.
+
+Alternates let repositories with mostly the same history share one copy of it, stored and page
+cached once. They are named by the alternates setting, and only ever read: objects are written to
+the local store, unless an alternate already holds them, and vms gc --drop-borrowed removes local
+copies of objects an alternate holds. A repository serving as an alternate must therefore never
+remove objects that are reachable only from the repositories borrowing them, e.g. by deleting
+branches and running gc.
+
+Implementations must be safe to read from several threads at once, as fsck and gc do.
+*/
+#ifndef OBJECTSTORE_HPP
+#define OBJECTSTORE_HPP
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+
+#include "objectid.hpp"
+#include "filestamp.hpp"
+
+struct ObjectInfo {
+    uint64_t size;      // bytes of the encoded object
+    time_t mtime;       // when the object was last written
+};
+
+class ObjectStore {
+    public:
+        virtual ~ObjectStore();
+
+        virtual bool has(const ObjectId& id) = 0;
+
+        /* Reads the encoded object into buffer. Returns 0 on success, or -1 if it is missing or unreadable. */
+        virtual int get(const ObjectId& id, std::string& buffer) = 0;
+
+        /*
+            Stores the encoded object under id, replacing any copy that differs atomically, so a damaged copy is repaired.
+            Returns 0 on success, or -1 on failure.
+        */
+        virtual int put(const ObjectId& id, const std::string& data) = 0;
+
+        /* Returns 0 on success, or -1 if the object is missing or could not be removed */
+        virtual int remove(const ObjectId& id) = 0;
+
+        /* Returns false if the object is missing */
+        virtual bool stat(const ObjectId& id, ObjectInfo& info) = 0;
+
+        /* Appends to matches the ids whose hex form begins with hex_prefix, stopping once there are max_matches */
+        virtual void resolve_prefix(const char* hex_prefix, size_t max_matches, std::vector<ObjectId>& matches) = 0;
+
+        /* Calls fn with the id of every stored object */
+        virtual void for_each(const std::function<void(const ObjectId&)>& fn) = 0;
+
+        /* Describes where the object is kept, for messages */
+        virtual std::string location(const ObjectId& id) = 0;
+
+        /*
+            Finds the encoded object as a range of a file, so it can be copied without reading it into memory.
+            Returns false if the object is missing or this store does not keep objects in files.
+        */
+        virtual bool locate(const ObjectId& id, std::string& path, uint64_t& offset, uint64_t& length);
+
+        /* Moves the object with the given id from source into this store. Returns 0 on success, or -1 on failure. */
+        virtual int adopt(ObjectStore& source, const ObjectId& id);
+
+        /*
+            Removes leftovers of interrupted writes last modified before cutoff, adding their size to bytes,
+            and reclaims space left by removed objects. Returns the number of files removed.
+        */
+        virtual size_t prune(time_t cutoff, unsigned long long& bytes);
+};
+
+/* Objects as files in a directory, optionally fanned out into subdirectories named by the first digits of the id */
+class LooseObjectStore : public ObjectStore {
+    public:
+        /* Objects are written with the given permissions, e.g. read-only for committed objects */
+        LooseObjectStore(const std::string& directory, bool fanout, mode_t mode);
+
+        bool has(const ObjectId& id);
+        int get(const ObjectId& id, std::string& buffer);
+        int put(const ObjectId& id, const std::string& data);
+        int remove(const ObjectId& id);
+        bool stat(const ObjectId& id, ObjectInfo& info);
+        void resolve_prefix(const char* hex_prefix, size_t max_matches, std::vector<ObjectId>& matches);
+        void for_each(const std::function<void(const ObjectId&)>& fn);
+        std::string location(const ObjectId& id);
+        bool locate(const ObjectId& id, std::string& path, uint64_t& offset, uint64_t& length);
+        int adopt(ObjectStore& source, const ObjectId& id);
+        size_t prune(time_t cutoff, unsigned long long& bytes);
+
+        /* Writes the NUL-terminated path of the object's file to out, which must hold PATH_MAX bytes */
+        void path_of(const ObjectId& id, char* out) const;
+
+    private:
+        LooseObjectStore(const LooseObjectStore&);
+        LooseObjectStore& operator=(const LooseObjectStore&);
+
+        /* Sorted names in one directory, revalidated by the directory's identity, which changes whenever a file is added or removed */
+        struct Listing {
+            FileStamp stamp;
+            std::vector<std::string> names;
+        };
+
+        std::string directory;
+        bool fanout;
+        mode_t mode;
+
+        std::mutex listings_mutex;
+        std::unordered_map<std::string, Listing> listings;
+
+        const Listing& listing(const std::string& subdirectory);
+        void subdirectories(std::vector<std::string>& names) const;
+};
+
+/* Objects held in memory for the lifetime of the store */
+class MemoryObjectStore : public ObjectStore {
+    public:
+        bool has(const ObjectId& id);
+        int get(const ObjectId& id, std::string& buffer);
+        int put(const ObjectId& id, const std::string& data);
+        int remove(const ObjectId& id);
+        bool stat(const ObjectId& id, ObjectInfo& info);
+        void resolve_prefix(const char* hex_prefix, size_t max_matches, std::vector<ObjectId>& matches);
+        void for_each(const std::function<void(const ObjectId&)>& fn);
+        std::string location(const ObjectId& id);
+
+    private:
+        struct Entry {
+            std::string data;
+            time_t mtime;
+        };
+
+        std::mutex objects_mutex;
+        std::map<ObjectId, Entry> objects;  // ordered, so ids sharing a prefix are adjacent
+};
+
+/*
+    A local store backed by alternates, consulted in order for objects the local store lacks. Objects are only ever written
+    to or removed from the local store, and for_each, prune and the sizes reported by stat only cover it.
+*/
+class AlternatesObjectStore : public ObjectStore {
+    public:
+        /* Takes ownership of the stores */
+        AlternatesObjectStore(ObjectStore* local, const std::vector<ObjectStore*>& alternates);
+        ~AlternatesObjectStore();
+
+        bool has(const ObjectId& id);
+        int get(const ObjectId& id, std::string& buffer);
+        /* Writes nothing if an alternate holds the object already */
+        int put(const ObjectId& id, const std::string& data);
+        int remove(const ObjectId& id);
+        bool stat(const ObjectId& id, ObjectInfo& info);
+        void resolve_prefix(const char* hex_prefix, size_t max_matches, std::vector<ObjectId>& matches);
+        void for_each(const std::function<void(const ObjectId&)>& fn);
+        std::string location(const ObjectId& id);
+        bool locate(const ObjectId& id, std::string& path, uint64_t& offset, uint64_t& length);
+        /* Only removes the object from source if an alternate holds it already */
+        int adopt(ObjectStore& source, const ObjectId& id);
+        size_t prune(time_t cutoff, unsigned long long& bytes);
+
+        /* Returns the first alternate holding the object, or NULL if none does */
+        ObjectStore* alternate_of(const ObjectId& id);
+
+    private:
+        AlternatesObjectStore(const AlternatesObjectStore&);
+        AlternatesObjectStore& operator=(const AlternatesObjectStore&);
+
+        ObjectStore* local;
+        std::vector<ObjectStore*> alternates;
+};
+
+/*
+    Opens the object store backend .vms/config names for .vms/objects, with the alternates it names, setting store to a
+    new store owned by the caller. Returns 0, or -1 if .vms/config cannot be read or names an unknown backend or an
+    alternate that is neither an object directory nor a repository. A Repository opens its stores this way.
+*/
+int open_configured_store(ObjectStore*& store);
+
+#endif // OBJECTSTORE_HPP
@@ -0,0 +1,45 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "parallel.hpp"
+
+using namespace std;
+
+unsigned int worker_count(size_t n_items) {
+    unsigned int n_workers = thread::hardware_concurrency();
+    if (n_workers == 0) {
+        n_workers = 4;
+    }
+    if (n_workers > n_items) {
+        n_workers = n_items;
+    }
+    return n_workers;
+}
+
+void parallel_for(size_t n_items, const function<void(size_t)>& body) {
+    unsigned int n_workers = worker_count(n_items);
+
+    // A single item or a single hardware thread gains nothing from spawning threads
+    if (n_workers <= 1) {
+        for (size_t i = 0; i < n_items; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    atomic<size_t> next(0);
+    vector<thread> workers;
+    for (unsigned int w = 0; w < n_workers; w++) {
+        workers.push_back(thread([&next, n_items, &body]() {
+            size_t i;
+            while ((i = next++) < n_items) {
+                body(i);
+            }
+        }));
+    }
+
+    for (size_t w = 0; w < workers.size(); w++) {
+        workers[w].join();
+    }
+}
@@ -0,0 +1,21 @@
+/*
+Minimal data parallelism for independent per-item work, such as checking or loading many objects
+*/
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <stddef.h>
+
+#include <functional>
+
+/* Number of worker threads used for n_items items: one per hardware thread, but never more than there are items */
+unsigned int worker_count(size_t n_items);
+
+/*
+    Calls body(i) for every i in [0, n_items) on a pool of worker_count(n_items) threads, returning once all
+    calls have finished. Items are handed out one at a time, so body must be safe to run concurrently with
+    itself, and should write its results only to per-item slots.
+*/
+void parallel_for(size_t n_items, const std::function<void(size_t)>& body);
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,154 @@
+#include <fnmatch.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "pathspec.hpp"
+
+using namespace std;
+
+bool glob_matches(const string& pattern, const string& path) {
+    if (pattern.find('/') != string::npos) {
+        return fnmatch(pattern.c_str(), path.c_str(), 0) == 0;
+    }
+
+    size_t slash = path.rfind('/');
+    return fnmatch(pattern.c_str(), path.c_str() + (slash == string::npos ? 0 : slash + 1), 0) == 0;
+}
+
+Pathspec::Pathspec() {}
+
+Pathspec::Pathspec(int n_specs, char* const specs[]) {
+    for (int i = 0; i < n_specs; i++) {
+        add(specs[i]);
+    }
+}
+
+void Pathspec::add(const string& spec) {
+    bool exclude = !spec.empty() && spec[0] == '!';
+    size_t begin = exclude ? 1 : 0;
+    while (spec.compare(begin, 2, "./") == 0) {
+        begin += 2;
+    }
+
+    Spec compiled;
+    compiled.pattern = spec.substr(begin);
+    compiled.is_glob = compiled.pattern.find_first_of("*?[") != string::npos;
+
+    // Paths are files or directories alike, so trailing slashes are dropped, and "." is the root
+    if (!compiled.is_glob) {
+        size_t end = compiled.pattern.find_last_not_of('/');
+        compiled.pattern.resize(end == string::npos ? 0 : end + 1);
+        if (compiled.pattern == ".") {
+            compiled.pattern.clear();
+        }
+    }
+
+    if (exclude) {
+        excludes.push_back(compiled);
+        return;
+    }
+    includes.push_back(compiled);
+
+    // Only the literal part before the first glob character narrows the scan, and a glob on file names does not narrow it at all
+    if (!compiled.is_glob) {
+        add_prefix(compiled.pattern);
+    } else if (compiled.pattern.find('/') == string::npos) {
+        add_prefix("");
+    } else {
+        add_prefix(compiled.pattern.substr(0, compiled.pattern.find_first_of("*?[")));
+    }
+}
+
+void Pathspec::add_prefix(const string& prefix) {
+    for (size_t i = 0; i < prefixes.size(); i++) {
+        if (prefix.compare(0, prefixes[i].length(), prefixes[i]) == 0) {
+            return; // already scanned as part of a shorter prefix
+        }
+    }
+
+    // Drop the prefixes this one covers, keeping the rest sorted
+    size_t n_kept = 0;
+    for (size_t i = 0; i < prefixes.size(); i++) {
+        if (prefixes[i].compare(0, prefix.length(), prefix) != 0) {
+            prefixes[n_kept++] = prefixes[i];
+        }
+    }
+    prefixes.resize(n_kept);
+    prefixes.insert(lower_bound(prefixes.begin(), prefixes.end(), prefix), prefix);
+}
+
+bool Pathspec::spec_matches(const Spec& spec, const string& path) {
+    if (spec.is_glob) {
+        return glob_matches(spec.pattern, path);
+    }
+
+    return spec.pattern.empty() || (path.compare(0, spec.pattern.length(), spec.pattern) == 0
+                                    && (path.length() == spec.pattern.length() || path[spec.pattern.length()] == '/'));
+}
+
+bool Pathspec::matches(const string& path) const {
+    for (size_t i = 0; i < excludes.size(); i++) {
+        if (spec_matches(excludes[i], path)) {
+            return false;
+        }
+    }
+
+    if (includes.empty()) {
+        return true;
+    }
+
+    for (size_t i = 0; i < includes.size(); i++) {
+        if (spec_matches(includes[i], path)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Pathspec::may_match_under(const string& dir) const {
+    if (includes.empty()) {
+        return true;
+    }
+
+    string dir_prefix = dir + "/";
+    for (size_t i = 0; i < prefixes.size(); i++) {
+        if (dir_prefix.compare(0, prefixes[i].length(), prefixes[i]) == 0 || prefixes[i].compare(0, dir_prefix.length(), dir_prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Pathspec::select(const map<string, ObjectId>& files, vector<map<string, ObjectId>::const_iterator>& selected) const {
+    // Prefixes are sorted and none starts with another, so their ranges of keys are disjoint and in order
+    vector<string> scanned = includes.empty() ? vector<string>(1, "") : prefixes;
+
+    for (size_t i = 0; i < scanned.size(); i++) {
+        const string& prefix = scanned[i];
+        map<string, ObjectId>::const_iterator it;
+        for (it = files.lower_bound(prefix); it != files.end() && it->first.compare(0, prefix.length(), prefix) == 0; ++it) {
+            if (matches(it->first)) {
+                selected.push_back(it);
+            }
+        }
+    }
+}
+
+void Pathspec::select(const FlatTree& tree, FlatTree& selected) const {
+    vector<string> scanned = includes.empty() ? vector<string>(1, "") : prefixes;
+
+    for (size_t i = 0; i < scanned.size(); i++) {
+        const string& prefix = scanned[i];
+        for (size_t e = tree.lower_bound(prefix.c_str()); e < tree.size(); e++) {
+            const char* path = tree.path_of(tree[e]);
+            if (strncmp(path, prefix.data(), prefix.length()) != 0) {
+                break;
+            }
+
+            if (matches(path)) {
+                selected.push_back(path, tree.path_table().length(tree[e].path), tree[e].id);
+            }
+        }
+    }
+}
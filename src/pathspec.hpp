@@ -0,0 +1,69 @@
+/*
+Compiled pathspecs: which paths of a commit or the working directory a command applies to
+
+A pathspec is a list of specs, each one of:
+
+    <path>      the file or directory at path, and everything under it. "." is the root
+    <glob>      a pattern with any of the characters *?[, matched with fnmatch against the file
+                name if it has no '/', else against the whole path. '*' matches '/' too, so a
+                '*' following a directory and its '/' selects everything under the directory
+    !<spec>     excludes what spec selects, whatever else selects it
+
+A path is selected if some spec that is not an exclusion selects it, or if there are only
+exclusions, and no exclusion does. An empty pathspec selects every path.
+
+Every path a pathspec may select starts with the literal part of one of its specs (up to the
+first glob character), so select() looks up each such prefix in sorted keys and scans only the
+entries that start with it, rather than testing every entry.
+*/
+#ifndef PATHSPEC_HPP
+#define PATHSPEC_HPP
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "objectid.hpp"
+#include "pathtable.hpp"
+
+/* Whether path matches the glob pattern, against the file name if pattern has no '/', else against the whole path */
+bool glob_matches(const std::string& pattern, const std::string& path);
+
+class Pathspec {
+    public:
+        Pathspec();
+        Pathspec(int n_specs, char* const specs[]);
+
+        void add(const std::string& spec);
+
+        /* Whether no spec was added, so that every path is selected */
+        bool empty() const { return includes.empty() && excludes.empty(); }
+
+        bool matches(const std::string& path) const;
+
+        /* Whether a path under the directory dir may be selected */
+        bool may_match_under(const std::string& dir) const;
+
+        /* Appends to selected the entries of files whose paths are selected, in path order */
+        void select(const std::map<std::string, ObjectId>& files, std::vector<std::map<std::string, ObjectId>::const_iterator>& selected) const;
+
+        /* Appends to selected the entries of tree whose paths are selected, in path order */
+        void select(const FlatTree& tree, FlatTree& selected) const;
+
+    private:
+        struct Spec {
+            std::string pattern;
+            bool is_glob;
+        };
+
+        std::vector<Spec> includes;
+        std::vector<Spec> excludes;
+        std::vector<std::string> prefixes;  // sorted, none starting with another, and "" alone if any path may be selected
+
+        static bool spec_matches(const Spec& spec, const std::string& path);
+        void add_prefix(const std::string& prefix);
+};
+
+#endif // PATHSPEC_HPP
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+#include "pathtable.hpp"
+
+using namespace std;
+
+Arena::Arena(size_t block_size) : block_size(block_size), cursor(NULL), remaining(0) {}
+
+Arena::~Arena() {
+    clear();
+}
+
+void* Arena::allocate(size_t n, size_t align) {
+    size_t padding = (align - (size_t) cursor % align) % align;
+
+    if (cursor == NULL || padding + n > remaining) {
+        // Oversized requests get a block of their own so the current block keeps serving small ones
+        size_t size = n + align > block_size ? n + align : block_size;
+        char* block = static_cast<char*>(malloc(size));
+        if (block == NULL) {
+            throw bad_alloc();
+        }
+        blocks.push_back(block);
+
+        if (size > block_size) {
+            return block + (align - (size_t) block % align) % align;
+        }
+
+        cursor = block;
+        remaining = size;
+        padding = (align - (size_t) cursor % align) % align;
+    }
+
+    char* p = cursor + padding;
+    cursor = p + n;
+    remaining -= padding + n;
+    return p;
+}
+
+void Arena::clear() {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        free(blocks[i]);
+    }
+    blocks.clear();
+    cursor = NULL;
+    remaining = 0;
+}
+
+/** Helper for hashing a path with 32-bit FNV-1a **/
+static uint32_t hash_path(const char* path, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char) path[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+PathTable::PathTable() : slots(64, 0) {}
+
+PathId PathTable::intern(const char* path, size_t length) {
+    uint32_t h = hash_path(path, length);
+    size_t mask = slots.size() - 1;
+
+    for (size_t i = h & mask; ; i = (i + 1) & mask) {
+        uint32_t slot = slots[i];
+
+        if (slot == 0) {
+            char* data = static_cast<char*>(arena.allocate(length + 1));
+            memcpy(data, path, length);
+            data[length] = '\0';
+
+            Entry entry = {data, (uint32_t) length, h};
+            entries.push_back(entry);
+            slots[i] = entries.size();
+
+            if (entries.size() * 2 > slots.size()) {
+                grow();
+            }
+            return entries.size() - 1;
+        }
+
+        const Entry& entry = entries[slot - 1];
+        if (entry.hash == h && entry.length == length && memcmp(entry.data, path, length) == 0) {
+            return slot - 1;
+        }
+    }
+}
+
+PathId PathTable::intern(const string& path) {
+    return intern(path.data(), path.length());
+}
+
+const char* PathTable::path(PathId id) const {
+    return entries[id].data;
+}
+
+size_t PathTable::length(PathId id) const {
+    return entries[id].length;
+}
+
+size_t PathTable::size() const {
+    return entries.size();
+}
+
+void PathTable::grow() {
+    vector<uint32_t> grown(slots.size() * 2, 0);
+    size_t mask = grown.size() - 1;
+
+    for (size_t id = 0; id < entries.size(); id++) {
+        size_t i = entries[id].hash & mask;
+        while (grown[i] != 0) {
+            i = (i + 1) & mask;
+        }
+        grown[i] = id + 1;
+    }
+
+    slots.swap(grown);
+}
+
+FlatTree::FlatTree(PathTable& paths) : paths(&paths) {}
+
+void FlatTree::assign(const map<string, ObjectId>& map) {
+    entries.clear();
+    entries.reserve(map.size());
+
+    std::map<string, ObjectId>::const_iterator it;
+    for (it = map.begin(); it != map.end(); ++it) {
+        push_back(it->first.data(), it->first.length(), it->second);
+    }
+}
+
+void FlatTree::push_back(const char* path, size_t length, const ObjectId& id) {
+    TreeEntry entry;
+    entry.path = paths->intern(path, length);
+    entry.id = id;
+    entries.push_back(entry);
+}
+
+void FlatTree::clear() {
+    entries.clear();
+}
+
+void FlatTree::reserve(size_t n) {
+    entries.reserve(n);
+}
+
+size_t FlatTree::lower_bound(const char* path) const {
+    size_t lo = 0;
+    size_t hi = entries.size();
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(paths->path(entries[mid].path), path) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+const TreeEntry* FlatTree::find(const char* path) const {
+    size_t i = lower_bound(path);
+    if (i < entries.size() && strcmp(paths->path(entries[i].path), path) == 0) {
+        return &entries[i];
+    }
+
+    return NULL;
+}
+
+TreeWalk::TreeWalk(const FlatTree* const* trees, size_t n_trees) : trees(trees), n_trees(n_trees), positions(n_trees, 0) {}
+
+bool TreeWalk::next(PathId& path, const TreeEntry** entries) {
+    const char* smallest = NULL;
+
+    for (size_t t = 0; t < n_trees; t++) {
+        if (positions[t] < trees[t]->size()) {
+            const TreeEntry& head = (*trees[t])[positions[t]];
+            const char* head_path = trees[t]->path_of(head);
+
+            if (smallest == NULL || strcmp(head_path, smallest) < 0) {
+                smallest = head_path;
+                path = head.path;
+            }
+        }
+    }
+
+    if (smallest == NULL) {
+        return false;
+    }
+
+    // Trees share a table, so the heads holding the smallest path all carry its id
+    for (size_t t = 0; t < n_trees; t++) {
+        entries[t] = NULL;
+        if (positions[t] < trees[t]->size() && (*trees[t])[positions[t]].path == path) {
+            entries[t] = &(*trees[t])[positions[t]];
+            positions[t]++;
+        }
+    }
+
+    return true;
+}
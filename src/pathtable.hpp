@@ -0,0 +1,123 @@
+/*
+Interned paths and flat, sorted views of commit trees for bulk operations
+
+A PathTable stores each distinct path once, in an arena that is released all at once when the
+table is destroyed, and hands out small integer PathIds for them. FlatTrees are sorted vectors of
+(PathId, ObjectId) entries referencing a shared table, so loading several commits for a merge or
+status stores every path a single time and costs no per-entry heap allocations.
+*/
+#ifndef PATHTABLE_HPP
+#define PATHTABLE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "objectid.hpp"
+
+/* Monotonic allocator: hands out memory from large blocks and frees it only when cleared or destroyed */
+class Arena {
+    public:
+        Arena(size_t block_size = 64 * 1024);
+        ~Arena();
+
+        void* allocate(size_t n, size_t align = 1);
+        void clear();
+
+    private:
+        Arena(const Arena&);
+        Arena& operator=(const Arena&);
+
+        size_t block_size;
+        std::vector<char*> blocks;
+        char* cursor;
+        size_t remaining;
+};
+
+typedef uint32_t PathId;
+
+class PathTable {
+    public:
+        PathTable();
+
+        /* Returns the id of the given path, copying it into the table if it is new */
+        PathId intern(const char* path, size_t length);
+        PathId intern(const std::string& path);
+
+        /* Returns the NUL-terminated path with the given id */
+        const char* path(PathId id) const;
+        size_t length(PathId id) const;
+        size_t size() const;
+
+    private:
+        PathTable(const PathTable&);
+        PathTable& operator=(const PathTable&);
+
+        struct Entry {
+            const char* data;
+            uint32_t length;
+            uint32_t hash;
+        };
+
+        Arena arena;
+        std::vector<Entry> entries;
+        std::vector<uint32_t> slots;    // open-addressed hash of entries, holding id + 1 (0 marks an empty slot)
+
+        void grow();
+};
+
+struct TreeEntry {
+    PathId path;
+    ObjectId id;
+};
+
+/* Mapping of paths to object ids, held as a vector of entries sorted by path */
+class FlatTree {
+    public:
+        FlatTree(PathTable& paths);
+
+        /* Replaces the contents of the tree with those of map */
+        void assign(const std::map<std::string, ObjectId>& map);
+
+        /* Appends an entry, which must sort after every entry already in the tree */
+        void push_back(const char* path, size_t length, const ObjectId& id);
+        void clear();
+        void reserve(size_t n);
+
+        /* Returns entry for given path, or NULL if the path is not in the tree */
+        const TreeEntry* find(const char* path) const;
+
+        /* Returns the index of the first entry whose path does not sort before the given one */
+        size_t lower_bound(const char* path) const;
+
+        size_t size() const { return entries.size(); }
+        bool empty() const { return entries.empty(); }
+        const TreeEntry& operator[](size_t i) const { return entries[i]; }
+        const char* path_of(const TreeEntry& entry) const { return paths->path(entry.path); }
+        PathTable& path_table() const { return *paths; }
+
+    private:
+        PathTable* paths;
+        std::vector<TreeEntry> entries;
+};
+
+/*
+    Walks several trees sharing one PathTable together in path order. Each call to next yields the
+    next path present in any of the trees, along with its entry in each tree (NULL where absent).
+*/
+class TreeWalk {
+    public:
+        TreeWalk(const FlatTree* const* trees, size_t n_trees);
+
+        bool next(PathId& path, const TreeEntry** entries);
+
+    private:
+        const FlatTree* const* trees;
+        size_t n_trees;
+        std::vector<size_t> positions;
+};
+
+#endif // PATHTABLE_HPP
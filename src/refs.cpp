@@ -0,0 +1,314 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/dir.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fstream>
+#include <vector>
+
+#include "refs.hpp"
+#include "access.hpp"
+#include "crc32c.hpp"
+#include "utils.h"
+
+using namespace std;
+
+PackedRefs::PackedRefs() : data(NULL), length(0), header(NULL), refs(NULL), strtab(NULL) {}
+
+PackedRefs::~PackedRefs() {
+    close();
+}
+
+int PackedRefs::open(const char* filepath) {
+    close();
+
+    int fd = ::open(filepath, O_RDONLY);
+    if (fd == -1) {
+        return errno == ENOENT ? 1 : -1;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) == -1 || (size_t) s.st_size < sizeof(PackedRefsHeader) + sizeof(uint32_t)) {
+        ::close(fd);
+        return -1;
+    }
+
+    void* mapped = mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
+
+    const PackedRefsHeader* mapped_header = static_cast<const PackedRefsHeader*>(mapped);
+    const char* bytes = static_cast<const char*>(mapped);
+    size_t expected = sizeof(PackedRefsHeader) + (size_t) mapped_header->n_refs * sizeof(PackedRef) + mapped_header->strtab_size + sizeof(uint32_t);
+
+    uint32_t stored_crc;
+    memcpy(&stored_crc, bytes + s.st_size - sizeof(uint32_t), sizeof(uint32_t));
+    if (memcmp(mapped_header->magic, PACKED_REFS_MAGIC, sizeof(PACKED_REFS_MAGIC)) != 0 || mapped_header->version != PACKED_REFS_VERSION
+            || expected != (size_t) s.st_size || crc32c(bytes, s.st_size - sizeof(uint32_t)) != stored_crc) {
+        munmap(mapped, s.st_size);
+        return -1;
+    }
+
+    data = mapped;
+    length = s.st_size;
+    header = mapped_header;
+    refs = reinterpret_cast<const PackedRef*>(header + 1);
+    strtab = reinterpret_cast<const char*>(refs + header->n_refs);
+
+    return 0;
+}
+
+void PackedRefs::close() {
+    if (data != NULL) {
+        munmap(data, length);
+    }
+    data = NULL;
+    length = 0;
+    header = NULL;
+    refs = NULL;
+    strtab = NULL;
+}
+
+const PackedRef* PackedRefs::find(const char* name) const {
+    if (header == NULL || name == NULL) {
+        return NULL;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = header->n_refs;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(strtab + refs[mid].name_offset, name);
+
+        if (cmp == 0) {
+            return &refs[mid];
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return NULL;
+}
+
+uint32_t PackedRefs::size() const {
+    return header == NULL ? 0 : header->n_refs;
+}
+
+const PackedRef* PackedRefs::ref(uint32_t i) const {
+    return &refs[i];
+}
+
+const char* PackedRefs::name_of(const PackedRef* ref) const {
+    return strtab + ref->name_offset;
+}
+
+ObjectId PackedRefs::id_of(const PackedRef* ref) const {
+    return ObjectId::from_bytes(ref->id);
+}
+
+/** Helper for telling loose refs from hidden files and temporary files of interrupted writes in the branches directory **/
+static bool is_loose_ref_name(const char* name) {
+    return name[0] != '.' && strstr(name, ".tmp.") == NULL;
+}
+
+/** Helper for reading the first line of a loose ref, returning false if it has no loose file **/
+static bool read_loose_ref(const string& branch, string& commit_id) {
+    ifstream ifs(loose_ref_path(branch));
+    if (!ifs.is_open()) {
+        return false;
+    }
+    getline(ifs, commit_id);
+    return true;
+}
+
+/** Atomically replaces the packed refs file with the given refs **/
+static int write_packed_refs(const map<string, ObjectId>& packed) {
+    size_t strtab_size = 0;
+    map<string, ObjectId>::const_iterator it;
+    for (it = packed.begin(); it != packed.end(); ++it) {
+        strtab_size += it->first.length() + 1;
+    }
+
+    string image(sizeof(PackedRefsHeader) + packed.size() * sizeof(PackedRef) + strtab_size + sizeof(uint32_t), '\0');
+    PackedRefsHeader* header = reinterpret_cast<PackedRefsHeader*>(&image[0]);
+    memcpy(header->magic, PACKED_REFS_MAGIC, sizeof(PACKED_REFS_MAGIC));
+    header->version = PACKED_REFS_VERSION;
+    header->n_refs = packed.size();
+    header->strtab_size = strtab_size;
+
+    // Maps are ordered by name, so the refs come out sorted for binary search
+    PackedRef* refs = reinterpret_cast<PackedRef*>(header + 1);
+    char* strtab = reinterpret_cast<char*>(refs + packed.size());
+    uint32_t offset = 0;
+    for (it = packed.begin(); it != packed.end(); ++it, ++refs) {
+        refs->name_offset = offset;
+        refs->name_length = it->first.length();
+        memcpy(refs->id, it->second.data(), OBJECT_ID_SIZE);
+
+        memcpy(strtab + offset, it->first.c_str(), it->first.length() + 1);
+        offset += it->first.length() + 1;
+    }
+
+    uint32_t crc = crc32c(image.data(), image.length() - sizeof(uint32_t));
+    memcpy(&image[image.length() - sizeof(uint32_t)], &crc, sizeof(uint32_t));
+
+    return replace_file_atomically(PACKED_REFS_PATH, image.data(), image.length(), 0644) == 0 ? 0 : -1;
+}
+
+/** Helper for reading every packed ref. Returns 0 on success, including when there are none, or -1 if they are unreadable. **/
+static int read_packed_refs(map<string, ObjectId>& packed) {
+    PackedRefs view;
+    int ret = view.open();
+    if (ret != 0) {
+        return ret == 1 ? 0 : -1;
+    }
+
+    for (uint32_t i = 0; i < view.size(); i++) {
+        packed[view.name_of(view.ref(i))] = view.id_of(view.ref(i));
+    }
+    return 0;
+}
+
+string loose_ref_path(const string& branch) {
+    return string(BRANCHES_DIR) + "/" + branch;
+}
+
+int read_ref(const string& branch, string& commit_id) {
+    if (read_loose_ref(branch, commit_id)) {
+        return 0;
+    }
+
+    PackedRefs view;
+    int ret = view.open();
+    if (ret != 0) {
+        return ret;
+    }
+
+    const PackedRef* ref = view.find(branch.c_str());
+    if (ref == NULL) {
+        return 1;
+    }
+
+    commit_id = view.id_of(ref).hex();
+    return 0;
+}
+
+bool ref_exists(const string& branch) {
+    string commit_id;
+    return read_ref(branch, commit_id) == 0;
+}
+
+int list_refs(map<string, string>& refs) {
+    refs.clear();
+
+    map<string, ObjectId> packed;
+    if (read_packed_refs(packed) != 0) {
+        return -1;
+    }
+
+    map<string, ObjectId>::const_iterator it;
+    for (it = packed.begin(); it != packed.end(); ++it) {
+        refs[it->first] = it->second.hex();
+    }
+
+    DIR* dirptr = opendir(BRANCHES_DIR);
+    if (dirptr == NULL) {
+        return -1;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dirptr)) != NULL) {
+        string commit_id;
+        if (is_loose_ref_name(entry->d_name) && read_loose_ref(entry->d_name, commit_id)) {
+            refs[entry->d_name] = commit_id;
+        }
+    }
+    closedir(dirptr);
+
+    return 0;
+}
+
+size_t count_loose_refs() {
+    DIR* dirptr = opendir(BRANCHES_DIR);
+    if (dirptr == NULL) {
+        return 0;
+    }
+
+    size_t n_loose = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dirptr)) != NULL) {
+        if (is_loose_ref_name(entry->d_name)) {
+            n_loose++;
+        }
+    }
+    closedir(dirptr);
+
+    return n_loose;
+}
+
+long pack_refs() {
+    map<string, ObjectId> packed;
+    if (read_packed_refs(packed) != 0) {
+        return -1;
+    }
+
+    DIR* dirptr = opendir(BRANCHES_DIR);
+    if (dirptr == NULL) {
+        return -1;
+    }
+
+    // Loose refs not holding an id are left as they are, for fsck to report
+    vector<string> loose;
+    struct dirent* entry;
+    while ((entry = readdir(dirptr)) != NULL) {
+        string commit_id;
+        ObjectId id;
+        if (is_loose_ref_name(entry->d_name) && read_loose_ref(entry->d_name, commit_id) && ObjectId::parse(commit_id, id)) {
+            packed[entry->d_name] = id;
+            loose.push_back(entry->d_name);
+        }
+    }
+    closedir(dirptr);
+
+    if (loose.empty()) {
+        return 0;
+    }
+
+    if (write_packed_refs(packed) != 0) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < loose.size(); i++) {
+        remove_file(loose_ref_path(loose[i]).c_str());
+    }
+
+    return loose.size();
+}
+
+int delete_ref(const string& branch) {
+    map<string, ObjectId> packed;
+    if (read_packed_refs(packed) != 0) {
+        return -1;
+    }
+
+    if (packed.erase(branch) > 0 && write_packed_refs(packed) != 0) {
+        return -1;
+    }
+
+    string loose_path = loose_ref_path(branch);
+    if (is_valid_file(loose_path.c_str()) && remove_file(loose_path.c_str()) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+Branch refs: loose files in .vms/branches, and packed refs in .vms/packed-refs
+
+A branch is first written as a loose file, .vms/branches/<name>, holding the hex id of its commit.
+Opening one file per branch makes listing thousands of branches slow, so loose refs are folded
+into a single packed refs file once there are more than MAX_LOOSE_REFS of them (see
+Repository::create_branch), and whenever garbage is collected. A loose file overrides the packed
+ref of the same name, so moving a branch only ever writes its loose file.
+
+On-disk layout of the packed refs file (version 1, host byte order):
+
+    header        magic "VMSR", format version, number of refs and size of string table
+    refs          fixed-width records sorted by name, each holding the offset and length of its
+                  name in the string table and the 20-byte binary id of its commit
+    string table  NUL-terminated names referenced by the refs
+    trailer       CRC-32C of all preceding bytes
+
+Like the index, the file is only ever replaced atomically, so readers map it and binary search the
+refs. Packing writes the packed refs before removing the loose files they replace, and removing a
+branch drops its packed ref before its loose file, so a reader racing either sees every branch
+with the id it has in one or the other.
+*/
+#ifndef REFS_HPP
+#define REFS_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <map>
+
+#include "objectid.hpp"
+
+const char* const BRANCHES_DIR = ".vms/branches";
+const char* const PACKED_REFS_PATH = ".vms/packed-refs";
+
+const char PACKED_REFS_MAGIC[4] = {'V', 'M', 'S', 'R'};
+const uint32_t PACKED_REFS_VERSION = 1;
+
+const size_t MAX_LOOSE_REFS = 256;
+
+struct PackedRefsHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t n_refs;
+    uint32_t strtab_size;
+};
+
+struct PackedRef {
+    uint32_t name_offset;
+    uint32_t name_length;
+    unsigned char id[OBJECT_ID_SIZE];
+};
+
+/* Read-only, memory-mapped view of the packed refs file */
+class PackedRefs {
+    public:
+        PackedRefs();
+        ~PackedRefs();
+
+        /* Maps and verifies the packed refs file. Returns 0 on success, 1 if there is none, or -1 if it is malformed. */
+        int open(const char* filepath = PACKED_REFS_PATH);
+        void close();
+
+        /* Returns the packed ref of the given name, or NULL if it has none */
+        const PackedRef* find(const char* name) const;
+
+        uint32_t size() const;
+        const PackedRef* ref(uint32_t i) const;
+        const char* name_of(const PackedRef* ref) const;
+        ObjectId id_of(const PackedRef* ref) const;
+
+    private:
+        PackedRefs(const PackedRefs&);
+        PackedRefs& operator=(const PackedRefs&);
+
+        void* data;
+        size_t length;
+        const PackedRefsHeader* header;
+        const PackedRef* refs;
+        const char* strtab;
+};
+
+/* Path of the loose file of branch */
+std::string loose_ref_path(const std::string& branch);
+
+/*
+    Reads the hex id of the commit branch refers to, from its loose file if it has one, else from the packed refs.
+    Returns 0 on success, 1 if there is no such branch, or -1 if the packed refs are unreadable.
+*/
+int read_ref(const std::string& branch, std::string& commit_id);
+
+bool ref_exists(const std::string& branch);
+
+/* Lists every branch with the hex id of its commit, loose files overriding packed refs. Returns 0 on success, or -1 on failure. */
+int list_refs(std::map<std::string, std::string>& refs);
+
+/* Counts the loose refs, without opening them */
+size_t count_loose_refs();
+
+/*
+    Folds every loose ref holding a valid id into the packed refs and removes its loose file. Must be called under the
+    repository lock. Returns the number of refs packed, or -1 on failure, leaving the loose files in place.
+*/
+long pack_refs();
+
+/* Removes branch from the packed refs and its loose file. Must be called under the repository lock. Returns 0 on success, or -1 on failure. */
+int delete_ref(const std::string& branch);
+
+#endif // REFS_HPP
@@ -0,0 +1,1280 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <stack>
+#include <unordered_set>
+#include <utility>
+
+#include <boost/serialization/deque.hpp>
+#include <boost/serialization/stack.hpp>
+
+#include "repository.hpp"
+#include "access.hpp"
+#include "archive.hpp"
+#include "blob.hpp"
+#include "codec.hpp"
+#include "index.hpp"
+#include "objectstore.hpp"
+#include "lock.hpp"
+#include "parallel.hpp"
+#include "refs.hpp"
+#include "utils.h"
+
+using namespace std;
+
+static const size_t MAX_CACHED_COMMITS = 4096;
+static const size_t MAX_CACHED_BLOB_BYTES = 64 * 1024 * 1024;
+
+const char* repo_strerror(int error) {
+    switch (error) {
+        case REPO_OK: return "success";
+        case REPO_NOT_INITIALIZED: return "repository is not initialized";
+        case REPO_NOT_FOUND: return "no such commit, branch or file";
+        case REPO_AMBIGUOUS_ID: return "id is ambiguous";
+        case REPO_INVALID_ARGUMENT: return "invalid argument";
+        case REPO_EXISTS: return "already exists";
+        case REPO_NO_CHANGES: return "no changes staged to commit";
+        case REPO_LOCKED: return "unable to acquire repository lock";
+        case REPO_CORRUPT: return "repository contents are corrupted";
+        case REPO_IO_ERROR: return "unable to read or write repository files";
+        default: return "unknown error";
+    }
+}
+
+/** Helper mapping the failure of restoring or checking out an object (see access.hpp) to a RepoError **/
+static int restore_error(int ret) {
+    return ret == -1 ? REPO_IO_ERROR : REPO_CORRUPT;
+}
+
+/** Helper for reading the first line of a small file such as HEAD or a branch ref, without reporting errors **/
+static bool read_first_line(const string& filepath, string& line) {
+    ifstream ifs(filepath);
+    if (!ifs.is_open()) {
+        return false;
+    }
+    getline(ifs, line);
+    return true;
+}
+
+/** Branch names become file names in .vms/branches, so they may not contain path separators or start with a dot **/
+static bool is_valid_branch_name(const string& branch) {
+    return !branch.empty() && branch[0] != '.' && branch.find('/') == string::npos;
+}
+
+/** Helper for reading the ids of the commits in the log, oldest first. Entries start with "commit  <id>" (see Commit::log_string). **/
+static void logged_commit_ids(vector<ObjectId>& ids) {
+    stack<string> log_entries;
+    restore< stack<string> >(log_entries, ".vms/log");
+
+    ids.assign(log_entries.size(), ObjectId());
+    for (size_t i = ids.size(); i-- > 0; log_entries.pop()) {
+        const string& entry = log_entries.top();
+        size_t begin = entry.find_first_not_of(' ', strlen("commit"));
+        if (begin != string::npos && entry.length() - begin >= OBJECT_ID_HEX_LENGTH) {
+            ObjectId::parse(entry.c_str() + begin, OBJECT_ID_HEX_LENGTH, ids[i]);
+        }
+    }
+}
+
+/** Helper for listing the paths whose entries differ between the files of two commits **/
+static void changed_paths(const map<string, ObjectId>& a, const map<string, ObjectId>& b, vector<string>& changed) {
+    map<string, ObjectId>::const_iterator ia = a.begin();
+    map<string, ObjectId>::const_iterator ib = b.begin();
+
+    while (ia != a.end() || ib != b.end()) {
+        if (ib == b.end() || (ia != a.end() && ia->first < ib->first)) {
+            changed.push_back(ia->first);
+            ++ia;
+        } else if (ia == a.end() || ib->first < ia->first) {
+            changed.push_back(ib->first);
+            ++ib;
+        } else {
+            if (ia->second != ib->second) {
+                changed.push_back(ia->first);
+            }
+            ++ia;
+            ++ib;
+        }
+    }
+}
+
+/** Helper for removing the directories leading to filename that are left empty, deepest first; rmdir leaves any others **/
+static void remove_empty_directories(const string& filename) {
+    for (size_t slash = filename.rfind('/'); slash != string::npos && slash > 0; slash = filename.rfind('/', slash - 1)) {
+        if (rmdir(filename.substr(0, slash).c_str()) != 0) {
+            break;
+        }
+    }
+}
+
+/** Helper for checking if filename is path, or inside path as a directory. The empty path is the root of the working directory. **/
+static bool is_under(const string& filename, const string& path) {
+    return filename.compare(0, path.length(), path) == 0 && (path.empty() || filename.length() == path.length() || filename[path.length()] == '/');
+}
+
+/** Helper for checking whether the files of two commits differ at path or anywhere under it **/
+static bool changes_under(const map<string, ObjectId>& a, const map<string, ObjectId>& b, const string& path) {
+    map<string, ObjectId>::const_iterator ia = a.lower_bound(path);
+    map<string, ObjectId>::const_iterator ib = b.lower_bound(path);
+
+    // Files sharing the prefix without being under path, such as "dir.txt" for "dir", are skipped
+    while (true) {
+        while (ia != a.end() && ia->first.compare(0, path.length(), path) == 0 && !is_under(ia->first, path)) {
+            ++ia;
+        }
+        while (ib != b.end() && ib->first.compare(0, path.length(), path) == 0 && !is_under(ib->first, path)) {
+            ++ib;
+        }
+
+        bool in_a = ia != a.end() && is_under(ia->first, path);
+        bool in_b = ib != b.end() && is_under(ib->first, path);
+        if (!in_a || !in_b) {
+            return in_a != in_b;
+        }
+
+        if (ia->first != ib->first || ia->second != ib->second) {
+            return true;
+        }
+        ++ia;
+        ++ib;
+    }
+}
+
+Repository::Repository() : objects(NULL), staging(NULL), blob_bytes(0) {}
+
+Repository::~Repository() {}
+
+int Repository::open() {
+    return is_initialized() ? REPO_OK : REPO_NOT_INITIALIZED;
+}
+
+int Repository::open_stores() {
+    if (objects == NULL) {
+        ObjectStore* store;
+        if (open_configured_store(store) != 0) {
+            return REPO_CORRUPT;
+        }
+        configured_objects.reset(store);
+        objects = store;
+    }
+
+    if (staging == NULL) {
+        configured_staging.reset(new LooseObjectStore(".vms/cache", false, 0644));
+        staging = configured_staging.get();
+    }
+
+    return REPO_OK;
+}
+
+int Repository::object_stores(ObjectStore*& object_store, ObjectStore*& staging_store) {
+    int ret = open_stores();
+    object_store = objects;
+    staging_store = staging;
+    return ret;
+}
+
+void Repository::use_object_stores(ObjectStore* object_store, ObjectStore* staging_store) {
+    objects = object_store != NULL ? object_store : configured_objects.get();
+    staging = staging_store != NULL ? staging_store : configured_staging.get();
+}
+
+int Repository::refresh_head() {
+    FileStamp stamp = FileStamp::of(".vms/HEAD");
+    if (stamp != head_stamp || !stamp.exists) {
+        if (!read_first_line(".vms/HEAD", head)) {
+            return REPO_NOT_INITIALIZED;
+        }
+        head_stamp = stamp;
+        head_ref_stamp = FileStamp();
+        packed_refs_stamp = FileStamp();
+    }
+
+    // The branch's loose file overrides its packed ref, so either changing may move it
+    stamp = FileStamp::of(loose_ref_path(head).c_str());
+    FileStamp packed_stamp = FileStamp::of(PACKED_REFS_PATH);
+    if (stamp != head_ref_stamp || packed_stamp != packed_refs_stamp || (!stamp.exists && !packed_stamp.exists)) {
+        if (read_ref(head, head_ref) != 0) {
+            return REPO_CORRUPT;
+        }
+        head_ref_stamp = stamp;
+        packed_refs_stamp = packed_stamp;
+    }
+
+    return REPO_OK;
+}
+
+int Repository::refresh_index() {
+    FileStamp stamp = FileStamp::of(".vms/index");
+    FileStamp journal = FileStamp::of(index_journal_path().c_str());
+    if (stamp != index_stamp || journal != journal_stamp || !stamp.exists) {
+        int ret = load_index(index);
+        if (ret != 0) {
+            return ret == -1 ? REPO_IO_ERROR : REPO_CORRUPT;
+        }
+        index_stamp = stamp;
+        journal_stamp = journal;
+    }
+
+    return REPO_OK;
+}
+
+int Repository::refresh_config() {
+    FileStamp stamp = FileStamp::of(CONFIG_PATH);
+    if (stamp != config_stamp || !stamp.exists) {
+        if (load_raw_blob_policy(raw_policy) != 0 || load_sparse_checkout(sparse) != 0) {
+            return REPO_CORRUPT;
+        }
+        config_stamp = stamp;
+    }
+
+    return REPO_OK;
+}
+
+int Repository::refresh_commit_index(bool locked) {
+    FileStamp stamp = FileStamp::of(COMMIT_INDEX_PATH);
+    if (stamp == commit_index_stamp && stamp.exists) {
+        return REPO_OK;
+    }
+
+    commit_index_stamp = FileStamp();
+    if (commit_index.load() == 0) {
+        commit_index_stamp = stamp;
+        return REPO_OK;
+    }
+
+    // Missing in repositories made before the index, or damaged: rebuilt from the log, and saved unless another writer is busy
+    RepoLock lock;
+    bool may_save = locked || (!is_valid_file(LOCK_PATH) && lock.acquire(0) == 0);
+
+    int ret = rebuild_commit_index();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    if (may_save && commit_index.save() == 0) {
+        commit_index_stamp = FileStamp::of(COMMIT_INDEX_PATH);
+    }
+    return REPO_OK;
+}
+
+int Repository::rebuild_commit_index() {
+    int ret = open_stores();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    vector<ObjectId> ids;
+    logged_commit_ids(ids);
+
+    commit_index.clear();
+    vector<string> changed;
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        changed.clear();
+        ObjectId parent_id;
+
+        // Commits removed by vms gc along with their branch get a record that matches no path
+        if (!ids[i].is_null() && objects->has(ids[i])) {
+            const Commit* commit;
+            const map<string, ObjectId>* parent_files;
+            ret = get_commit_and_parent_files(ids[i], commit, parent_files);
+            if (ret != REPO_OK) {
+                return ret;
+            }
+
+            changed_paths(commit->get_map(), *parent_files, changed);
+            parent_id = commit->parent_ids().first;
+        }
+
+        commit_index.add(ids[i], parent_id, changed);
+    }
+
+    return REPO_OK;
+}
+
+size_t Repository::append_log(const Commit& commit) {
+    stack<string> log_entries;
+    restore< stack<string> >(log_entries, ".vms/log");
+    log_entries.push(commit.log_string());
+    save< stack<string> >(log_entries, ".vms/log");
+    return log_entries.size();
+}
+
+void Repository::index_commit(const ObjectId& commit_id, const ObjectId& parent_id, const vector<string>& changed_paths, size_t n_logged) {
+    // Like the log, the index is not essential to the commit: one that cannot be read is rebuilt when next read
+    if (refresh_commit_index(true) != REPO_OK) {
+        return;
+    }
+
+    // The index holds a record for each entry of the log, so the commit's record follows the others, unless the
+    // index was just rebuilt from the log, which already holds the commit
+    if (commit_index.size() == n_logged) {
+        return;
+    }
+
+    if (commit_index.size() + 1 == n_logged && commit_index.append(commit_id, parent_id, changed_paths) == 0) {
+        commit_index_stamp = FileStamp::of(COMMIT_INDEX_PATH);
+        return;
+    }
+
+    // Out of step with the log, such as after a failed append
+    commit_index_stamp = FileStamp();
+    if (rebuild_commit_index() == REPO_OK && commit_index.save() == 0) {
+        commit_index_stamp = FileStamp::of(COMMIT_INDEX_PATH);
+    }
+}
+
+int Repository::write_index() {
+    if (save_index(index) != 0) {
+        index_stamp = FileStamp();
+        return REPO_IO_ERROR;
+    }
+    index_stamp = FileStamp::of(".vms/index");
+    journal_stamp = FileStamp::of(index_journal_path().c_str());
+    return REPO_OK;
+}
+
+int Repository::update_index(const IndexJournalRecord& record) {
+    // The cached index takes the update too if it was current, and is otherwise reloaded when next used
+    string journal_path = index_journal_path();
+    bool current = index_stamp.exists && index_stamp == FileStamp::of(".vms/index") && journal_stamp == FileStamp::of(journal_path.c_str());
+
+    size_t journal_size;
+    if (append_index_journal(record, journal_size) != 0) {
+        index_stamp = FileStamp();
+        return REPO_IO_ERROR;
+    }
+
+    if (current) {
+        apply_index_journal(record, index);
+        journal_stamp = FileStamp::of(journal_path.c_str());
+    } else {
+        index_stamp = FileStamp();
+    }
+
+    // Folding the journal in only once it outgrows half the index keeps the cost of rewriting the index constant per update
+    if (journal_size > INDEX_JOURNAL_MIN_COMPACT_SIZE && journal_size > (size_t) FileStamp::of(".vms/index").size / 2) {
+        int ret = refresh_index();
+        if (ret != REPO_OK) {
+            return ret;
+        }
+        return write_index();
+    }
+
+    return REPO_OK;
+}
+
+int Repository::head_branch(const string*& branch) {
+    int ret = refresh_head();
+    branch = &head;
+    return ret;
+}
+
+int Repository::head_id(const string*& commit_id) {
+    int ret = refresh_head();
+    commit_id = &head_ref;
+    return ret;
+}
+
+int Repository::branch_id(const string& branch, string& commit_id) {
+    if (!is_valid_branch_name(branch)) {
+        return REPO_INVALID_ARGUMENT;
+    }
+
+    int ret = read_ref(branch, commit_id);
+    if (ret != 0) {
+        return ret == 1 ? REPO_NOT_FOUND : REPO_CORRUPT;
+    }
+
+    return REPO_OK;
+}
+
+int Repository::list_branches(map<string, string>& branches) {
+    if (list_refs(branches) != 0) {
+        return is_initialized() ? REPO_CORRUPT : REPO_NOT_INITIALIZED;
+    }
+
+    return REPO_OK;
+}
+
+int Repository::create_branch(const string& branch, const string& commit_id) {
+    if (!is_valid_branch_name(branch)) {
+        return REPO_INVALID_ARGUMENT;
+    }
+
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    if (ref_exists(branch)) {
+        return REPO_EXISTS;
+    }
+
+    string full_id;
+    int ret;
+    if (commit_id.empty()) {
+        ret = refresh_head();
+        full_id = head_ref;
+    } else {
+        ret = resolve_id(commit_id, full_id);
+    }
+
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    if (create_and_write_file(loose_ref_path(branch).c_str(), full_id.c_str(), 0644) != 0) {
+        return REPO_IO_ERROR;
+    }
+
+    // Branches made in bulk are packed as they accumulate, so listing them opens a bounded number of files
+    if (count_loose_refs() > MAX_LOOSE_REFS) {
+        pack_refs();
+    }
+
+    return REPO_OK;
+}
+
+int Repository::remove_branch(const string& branch) {
+    if (!is_valid_branch_name(branch)) {
+        return REPO_INVALID_ARGUMENT;
+    }
+
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    int ret = refresh_head();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    if (branch == head) {   // cannot remove the branch HEAD is on
+        return REPO_INVALID_ARGUMENT;
+    }
+
+    if (!ref_exists(branch)) {
+        return REPO_NOT_FOUND;
+    }
+
+    if (delete_ref(branch) != 0) {
+        return REPO_IO_ERROR;
+    }
+
+    return REPO_OK;
+}
+
+int Repository::resolve_id(const string& id, string& full_id) {
+    if (id.length() <= PREFIX_LENGTH) {
+        return REPO_AMBIGUOUS_ID;
+    }
+
+    int ret = open_stores();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    // Two matches are enough to tell an ambiguous id from a unique one
+    vector<ObjectId> matches;
+    objects->resolve_prefix(id.c_str(), 2, matches);
+
+    if (matches.empty()) {
+        return REPO_NOT_FOUND;
+    }
+    if (matches.size() > 1) {
+        return REPO_AMBIGUOUS_ID;
+    }
+
+    full_id = matches[0].hex();
+    return REPO_OK;
+}
+
+int Repository::get_commit(const string& commit_id, const Commit*& commit) {
+    string full_id;
+    int ret = resolve_id(commit_id, full_id);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    return get_commit(ObjectId::from_hex(full_id), commit);
+}
+
+int Repository::get_commit(const ObjectId& full_id, const Commit*& commit) {
+    unordered_map<ObjectId, Commit, ObjectIdHash>::iterator it = commits.find(full_id);
+    if (it != commits.end()) {
+        commit = &it->second;
+        return REPO_OK;
+    }
+
+    int ret = open_stores();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    if (commits.size() >= MAX_CACHED_COMMITS) {
+        commits.clear();
+    }
+
+    Commit restored;
+    ret = restore_commit_from_full_id(*objects, full_id, restored);
+    if (ret != 0) {
+        return restore_error(ret);
+    }
+
+    commit = &(commits[full_id] = std::move(restored));
+    return REPO_OK;
+}
+
+int Repository::get_commit_and_parent_files(const ObjectId& commit_id, const Commit*& commit, const map<string, ObjectId>*& parent_files) {
+    static const map<string, ObjectId> no_files;
+
+    int ret = get_commit(commit_id, commit);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    ObjectId parent_id = commit->parent_ids().first;
+    if (parent_id.is_null()) {
+        parent_files = &no_files;
+        return REPO_OK;
+    }
+
+    const Commit* parent;
+    ret = get_commit(parent_id, parent);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+    parent_files = &parent->get_map();
+
+    // Restoring the parent may have emptied the cache, leaving the parent as its only commit
+    return get_commit(commit_id, commit);
+}
+
+int Repository::get_head_commit(const Commit*& commit) {
+    int ret = refresh_head();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    return get_commit(head_ref, commit);
+}
+
+int Repository::get_blob(const ObjectId& blob_id, const string*& content) {
+    unordered_map<ObjectId, string, ObjectIdHash>::iterator it = blobs.find(blob_id);
+    if (it != blobs.end()) {
+        content = &it->second;
+        return REPO_OK;
+    }
+
+    int ret = open_stores();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    Blob blob;
+    ret = restore_blob_from_full_id(*objects, *staging, blob_id, blob);
+    if (ret != 0) {
+        return restore_error(ret);
+    }
+
+    if (blob_bytes + blob.get_content().length() > MAX_CACHED_BLOB_BYTES) {
+        blobs.clear();
+        blob_bytes = 0;
+    }
+
+    string& cached = blobs[blob_id];
+    cached = blob.release_content();
+    blob_bytes += cached.length();
+
+    content = &cached;
+    return REPO_OK;
+}
+
+int Repository::file_at(const string& commit_id, const string& filename, const string*& content) {
+    const Commit* commit;
+    int ret = get_commit(commit_id, commit);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    const map<string, ObjectId>& commit_map = commit->get_map();
+    map<string, ObjectId>::const_iterator it = commit_map.find(filename);
+    if (it == commit_map.end()) {
+        return REPO_NOT_FOUND;
+    }
+
+    return get_blob(it->second, content);
+}
+
+int Repository::get_index(const map<string, ObjectId>*& staged) {
+    int ret = refresh_index();
+    staged = &index;
+    return ret;
+}
+
+bool Repository::is_staged(const string& filename) {
+    return refresh_index() == REPO_OK && index.find(filename) != index.end();
+}
+
+bool Repository::is_tracked(const string& filename) {
+    const Commit* commit;
+    return get_head_commit(commit) == REPO_OK && commit->map_contains(filename);
+}
+
+int Repository::stage(const string& filename) {
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    // Only the journal is appended to, so staging a file costs the same whatever the size of the index
+    int ret = refresh_config();
+    if (ret == REPO_OK) {
+        ret = open_stores();
+    }
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    IndexJournalRecord record;
+    record.op = INDEX_JOURNAL_STAGE;
+    record.path = filename;
+
+    if (!is_valid_file(filename.c_str())) {
+        if (is_tracked(filename)) { // file was previously being tracked but is now deleted
+            record.id = STAGE_DELETE;
+            return update_index(record);
+        }
+
+        ObjectId staged_id;
+        ret = find_staged(filename.c_str(), staged_id);
+        if (ret == 0) { // file was previously staged but is now deleted
+            record.op = INDEX_JOURNAL_UNSTAGE;
+            return update_index(record);
+        }
+
+        return ret == 1 ? REPO_NOT_FOUND : REPO_CORRUPT;
+    }
+
+    // Blob the file's contents, save it in the staging store, and only then reference it from the index
+    ifstream ifs(filename);
+    if (!ifs.is_open()) {
+        return REPO_IO_ERROR;
+    }
+    Blob file(ifs);
+
+    ObjectId file_id = file.id();
+    string object;
+    encode_object_file(CODEC_KIND_BLOB, file.get_content(), object, raw_policy.applies(filename, file.get_content().length()));
+    if (staging->put(file_id, object) != 0) {
+        return REPO_IO_ERROR;
+    }
+
+    record.id = file_id;
+    return update_index(record);
+}
+
+int Repository::unstage(const string& filename) {
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    ObjectId staged_id;
+    int ret = find_staged(filename.c_str(), staged_id);
+    if (ret == 1) {
+        return REPO_NOT_FOUND;
+    } else if (ret != 0) {
+        return REPO_CORRUPT;
+    }
+
+    // Note: cached snapshot is not removed; the cache is cleared after commits
+    IndexJournalRecord record;
+    record.op = INDEX_JOURNAL_UNSTAGE;
+    record.path = filename;
+    return update_index(record);
+}
+
+int Repository::clear_index() {
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    index.clear();
+    return write_index();
+}
+
+int Repository::commit(const string& message, string& commit_id) {
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    int ret = refresh_index();
+    if (ret == REPO_OK) {
+        ret = open_stores();
+    }
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    const Commit* parent;
+    ret = get_head_commit(parent);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    // Find the staged changes relative to the parent, which the commit index records
+    vector<string> changed;
+    const map<string, ObjectId>& parent_map = parent->get_map();
+    map<string, ObjectId>::iterator it;
+    for (it = index.begin(); it != index.end(); ++it) {
+        map<string, ObjectId>::const_iterator tracked = parent_map.find(it->first);
+        if (tracked == parent_map.end() || tracked->second != it->second) {
+            changed.push_back(it->first);
+        }
+    }
+
+    if (changed.empty()) {
+        return REPO_NO_CHANGES;
+    }
+
+    // Create new commit from parent, update its map, and move blobs from cache to objects directory.
+    // The child starts out with the parent's files, so the cached parent hands its map over instead of copying it.
+    ObjectId parent_id = ObjectId::from_hex(head_ref);
+    Commit child(message, parent_id, std::move(commits[parent_id]));
+    commits.erase(parent_id);
+    set<ObjectId> moved_ids;
+
+    for (it = index.begin(); it != index.end(); ++it) {
+        if (it->second == STAGE_DELETE) {
+            child.remove_from_map(it->first);
+        } else {
+            child.put_to_map(it->first, it->second);
+            if (moved_ids.insert(it->second).second && move_from_cache_to_objects(*objects, *staging, it->second) != 0) {
+                return REPO_IO_ERROR;
+            }
+        }
+    }
+
+    // Save commit before the branch points to it, then move the branch and clear the staging area
+    ObjectId child_id = child.id();
+    commit_id = child_id.hex();
+    if (save_commit_object(*objects, child, child_id) != 0) {
+        return REPO_IO_ERROR;
+    }
+
+    if (create_and_write_file(loose_ref_path(head).c_str(), commit_id.c_str(), 0644) != 0) {
+        return REPO_IO_ERROR;
+    }
+
+    index.clear();
+    ret = write_index();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    size_t n_logged = append_log(child);
+    index_commit(child_id, parent_id, changed, n_logged);
+
+    commits[child_id] = std::move(child);
+
+    // Clear the staging store of snapshots that were staged
+    ObjectStore* staged = staging;
+    staged->for_each([staged](const ObjectId& id) {
+        staged->remove(id);
+    });
+
+    return REPO_OK;
+}
+
+int Repository::log(vector<string>& entries) {
+    entries.clear();
+
+    stack<string> log_entries;
+    restore< stack<string> >(log_entries, ".vms/log");
+
+    while (!log_entries.empty()) {
+        entries.push_back(log_entries.top());
+        log_entries.pop();
+    }
+
+    return REPO_OK;
+}
+
+int Repository::file_history(const vector<string>& paths, vector<ObjectId>& commit_ids) {
+    commit_ids.clear();
+
+    int ret = refresh_commit_index(false);
+    if (ret == REPO_OK) {
+        ret = open_stores();
+    }
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    // Paths name files or directories, with any trailing '/' dropped. The root of the working directory selects every change.
+    vector<string> selected;
+    vector<uint64_t> hashes;
+    bool whole_tree = false;
+    for (size_t i = 0; i < paths.size(); i++) {
+        string path = paths[i];
+        while (!path.empty() && path[path.length() - 1] == '/') {
+            path.erase(path.length() - 1);
+        }
+
+        if (path.empty() || path == ".") {
+            whole_tree = true;
+        }
+        selected.push_back(path);
+        hashes.push_back(CommitIndex::path_hash(path.data(), path.length()));
+    }
+
+    if (whole_tree) {
+        selected.assign(1, "");
+    }
+
+    for (size_t i = commit_index.size(); i-- > 0;) {
+        bool may_change = whole_tree;
+        for (size_t j = 0; j < hashes.size() && !may_change; j++) {
+            may_change = commit_index.may_change(i, hashes[j]);
+        }
+
+        // Commits removed by vms gc along with their branch are left out, as they cannot be shown
+        const ObjectId& id = commit_index.id(i);
+        if (!may_change || id.is_null() || !objects->has(id)) {
+            continue;
+        }
+
+        // The filter only rules commits out, so the others are compared with their first parent
+        const Commit* commit;
+        const map<string, ObjectId>* parent_files;
+        ret = get_commit_and_parent_files(id, commit, parent_files);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+
+        for (size_t j = 0; j < selected.size(); j++) {
+            if (changes_under(commit->get_map(), *parent_files, selected[j])) {
+                commit_ids.push_back(id);
+                break;
+            }
+        }
+    }
+
+    return REPO_OK;
+}
+
+int Repository::blame(const string& commit_id, const string& filename, Blame& result, const string*& content) {
+    string full_id;
+    int ret = resolve_id(commit_id, full_id);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    ObjectId id = ObjectId::from_hex(full_id);
+    const Commit* start;
+    ret = get_commit(id, start);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    map<string, ObjectId>::const_iterator file = start->get_map().find(filename);
+    if (file == start->get_map().end()) {
+        return REPO_NOT_FOUND;
+    }
+    ObjectId blob_id = file->second;
+
+    ret = refresh_commit_index(false);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    return blame_version(id, blob_id, filename, result, content);
+}
+
+int Repository::blame_version(ObjectId id, ObjectId version_id, const string& filename, Blame& result, const string*& content) {
+    uint64_t hash = CommitIndex::path_hash(filename.data(), filename.length());
+    ObjectId blob_id = version_id;
+
+    // Walk back along first parents, noting each commit that gave the file a new version, until the commit that added
+    // the file or a version whose blame is cached. Each commit visited holds the version blob_id. A merge that took
+    // that version from its second parent is passed along the second parent instead.
+    vector<pair<ObjectId, ObjectId> > versions;     // the commit and the version it made, newest first
+    bool cached = false;
+
+    while (true) {
+        long record = commit_index.find(id);
+        if (record >= 0 && !commit_index.may_change(record, hash)) {
+            id = commit_index.parent_id(record);
+            continue;
+        }
+
+        const Commit* commit;
+        const map<string, ObjectId>* parent_files;
+        int ret = get_commit_and_parent_files(id, commit, parent_files);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+
+        ObjectId parent_id = commit->parent_ids().first;
+        ObjectId second_parent_id = commit->parent_ids().second;
+        map<string, ObjectId>::const_iterator file = parent_files->find(filename);
+        if (file != parent_files->end() && file->second == blob_id) {
+            id = parent_id;
+            continue;
+        }
+        bool added = file == parent_files->end();
+        ObjectId parent_blob_id = added ? ObjectId() : file->second;
+
+        bool from_second_parent;
+        ret = holds_version(second_parent_id, filename, blob_id, from_second_parent);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+        if (from_second_parent) {
+            id = second_parent_id;
+            continue;
+        }
+
+        if (load_cached_blame(id, blob_id, filename, result) == 0) {
+            cached = true;
+            break;
+        }
+
+        versions.push_back(make_pair(id, blob_id));
+        if (added) {  // id added the file, on this side of any merge
+            break;
+        }
+
+        blob_id = parent_blob_id;
+        id = parent_id;
+    }
+
+    // Then replay the versions oldest first, from the cached blame or from the commit that added the file, taking the
+    // lines a merge brought in from the blame of its second parent's version. Blaming that version, like the blob
+    // cache, may drop a version once the next is restored, so the previous one is copied.
+    int ret = get_blob(blob_id, content);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    size_t next = versions.size();
+    string previous = *content;
+    if (!cached) {
+        next--;
+        start_blame(previous, versions[next].first, result);
+        ret = blame_second_parent(versions[next].first, filename, previous, result);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+    }
+
+    while (next-- > 0) {
+        ret = get_blob(versions[next].second, content);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+        advance_blame(previous, *content, versions[next].first, result);
+        previous = *content;
+
+        ret = blame_second_parent(versions[next].first, filename, previous, result);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+    }
+
+    // Cache the version asked about, so blaming it again after later commits replays only theirs
+    if (!versions.empty()) {
+        save_cached_blame(versions[0].first, versions[0].second, filename, result);
+    }
+
+    return get_blob(version_id, content);
+}
+
+int Repository::holds_version(const ObjectId& commit_id, const string& filename, const ObjectId& blob_id, bool& holds) {
+    holds = false;
+    if (commit_id.is_null()) {
+        return REPO_OK;
+    }
+
+    const Commit* commit;
+    int ret = get_commit(commit_id, commit);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    map<string, ObjectId>::const_iterator file = commit->get_map().find(filename);
+    holds = file != commit->get_map().end() && file->second == blob_id;
+    return REPO_OK;
+}
+
+int Repository::blame_second_parent(const ObjectId& commit_id, const string& filename, const string& content, Blame& result) {
+    const Commit* commit;
+    int ret = get_commit(commit_id, commit);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    ObjectId second_parent_id = commit->parent_ids().second;
+    if (second_parent_id.is_null()) {
+        return REPO_OK;
+    }
+
+    const Commit* second_parent;
+    ret = get_commit(second_parent_id, second_parent);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    map<string, ObjectId>::const_iterator file = second_parent->get_map().find(filename);
+    if (file == second_parent->get_map().end()) {
+        return REPO_OK;
+    }
+
+    // Blaming it may restore other commits, which can drop second_parent from the cache
+    ObjectId other_id = file->second;
+    Blame other;
+    const string* other_content;
+    ret = blame_version(second_parent_id, other_id, filename, other, other_content);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    merge_blame(*other_content, other, content, commit_id, result);
+    return REPO_OK;
+}
+
+int Repository::get_sparse_checkout(const SparseCheckout*& sparse_checkout) {
+    int ret = refresh_config();
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    sparse_checkout = &sparse;
+    return REPO_OK;
+}
+
+int Repository::checkout_files(const string& commit_id, const vector<string>* filenames) {
+    const Commit* commit;
+    int ret = get_commit(commit_id, commit);
+    if (ret == REPO_OK && filenames == NULL) {
+        ret = refresh_config();
+    }
+    if (ret == REPO_OK) {
+        ret = open_stores();
+    }
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    const map<string, ObjectId>& commit_map = commit->get_map();
+    vector<map<string, ObjectId>::const_iterator> selected;
+
+    if (filenames == NULL) {
+        sparse.paths.select(commit_map, selected);
+    } else {
+        for (size_t i = 0; i < filenames->size(); i++) {
+            map<string, ObjectId>::const_iterator it = commit_map.find((*filenames)[i]);
+            if (it != commit_map.end()) {
+                selected.push_back(it);
+            }
+        }
+
+        if (selected.empty()) {
+            return REPO_NOT_FOUND;
+        }
+    }
+
+    // Files are written on a pool of worker threads, bypassing the blob cache, each worker writing only its own file and result slot
+    vector<int> rets(selected.size());
+    parallel_for(selected.size(), [this, &selected, &rets](size_t i) {
+        create_directory_path(selected[i]->first);
+        rets[i] = checkout_blob(*objects, *staging, selected[i]->second, selected[i]->first);
+    });
+
+    for (size_t i = 0; i < rets.size(); i++) {
+        if (rets[i] != 0) {
+            return restore_error(rets[i]);
+        }
+    }
+
+    return REPO_OK;
+}
+
+int Repository::checkout_branch(const string& branch) {
+    RepoLock lock;
+    if (lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    string commit_id;
+    int ret = branch_id(branch, commit_id);
+    if (ret == REPO_OK) {
+        ret = refresh_config();
+    }
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    // Narrowing the sparse set takes effect here: files of the branch being left that are now outside it go, unless changed
+    if (sparse.is_sparse()) {
+        const Commit* current;
+        ret = get_head_commit(current);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+
+        const map<string, ObjectId>& current_map = current->get_map();
+        map<string, ObjectId>::const_iterator it;
+        for (it = current_map.begin(); it != current_map.end(); ++it) {
+            if (!sparse.selects(it->first) && is_valid_file(it->first.c_str()) && file_hash_equal_to_working_copy(it->first.c_str(), it->second)) {
+                if (unlink(it->first.c_str()) != 0) {
+                    return REPO_IO_ERROR;
+                }
+                remove_empty_directories(it->first);
+            }
+        }
+    }
+
+    ret = checkout_files(commit_id);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    // Point HEAD to this branch and clear staging area
+    if (create_and_write_file(".vms/HEAD", branch.c_str(), 0644) != 0) {
+        return REPO_IO_ERROR;
+    }
+
+    return clear_index();
+}
+
+int Repository::merge(const string& branch, bool check_only, MergeResult& result) {
+    RepoLock lock;
+    if (!check_only && lock.acquire() != 0) {
+        return REPO_LOCKED;
+    }
+
+    int ret = refresh_head();
+    if (ret == REPO_OK) {
+        ret = open_stores();
+    }
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    string given_hex;
+    ret = branch_id(branch, given_hex);
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    ObjectId current_id;
+    ObjectId given_id;
+    if (!ObjectId::parse(head_ref, current_id) || !ObjectId::parse(given_hex, given_id)) {
+        return REPO_CORRUPT;
+    }
+
+    MergeOptions options;
+    options.current_label = head;
+    options.given_label = branch;
+    options.write_objects = !check_only;
+    if (merge_engine.merge(*objects, *staging, current_id, given_id, options, result) != 0) {
+        return REPO_CORRUPT;
+    }
+
+    if (check_only || result.outcome == MERGE_UP_TO_DATE) {
+        return REPO_OK;
+    }
+
+    if (result.outcome != MERGE_FAST_FORWARD) {
+        // The merge commit starts out with the current commit's files, so the cached commit hands its map over instead of copying it
+        const Commit* current;
+        ret = get_commit(current_id, current);
+        if (ret != REPO_OK) {
+            return ret;
+        }
+
+        Commit child("Merge branch " + branch + " into branch " + head, current_id, std::move(commits[current_id]));
+        commits.erase(current_id);
+        child.set_second_parent(given_id);
+
+        for (size_t i = 0; i < result.updated.size(); i++) {
+            child.put_to_map(result.updated[i].first, result.updated[i].second);
+        }
+        for (size_t i = 0; i < result.removed.size(); i++) {
+            child.remove_from_map(result.removed[i]);
+        }
+
+        // Save the commit before the branch points to it
+        result.commit_id = child.id();
+        if (save_commit_object(*objects, child, result.commit_id) != 0) {
+            return REPO_IO_ERROR;
+        }
+
+        // The merge commit changes what the merge updated and removed relative to its first parent, the current commit
+        vector<string> changed;
+        for (size_t i = 0; i < result.updated.size(); i++) {
+            changed.push_back(result.updated[i].first);
+        }
+        changed.insert(changed.end(), result.removed.begin(), result.removed.end());
+
+        size_t n_logged = append_log(child);
+        index_commit(result.commit_id, current_id, changed, n_logged);
+        commits[result.commit_id] = std::move(child);
+    }
+
+    if (create_and_write_file(loose_ref_path(head).c_str(), result.commit_id.hex().c_str(), 0644) != 0) {
+        return REPO_IO_ERROR;
+    }
+
+    index.clear();
+    return write_index();
+}
+
+int Repository::checkout_merge(const MergeResult& result) {
+    int ret = refresh_config();
+    if (ret == REPO_OK) {
+        ret = open_stores();
+    }
+    if (ret != REPO_OK) {
+        return ret;
+    }
+
+    // Files outside the sparse set stay out, except conflicting ones, which must be resolved in the working directory
+    unordered_set<string> conflicting;
+    for (size_t i = 0; i < result.conflicts.size(); i++) {
+        conflicting.insert(result.conflicts[i].path);
+    }
+
+    vector<const pair<string, ObjectId>*> selected;
+    for (size_t i = 0; i < result.updated.size(); i++) {
+        if (sparse.selects(result.updated[i].first) || conflicting.count(result.updated[i].first) > 0) {
+            selected.push_back(&result.updated[i]);
+        }
+    }
+
+    // Each worker writes only its own file and result slot
+    vector<int> rets(selected.size());
+    parallel_for(selected.size(), [this, &selected, &rets](size_t i) {
+        create_directory_path(selected[i]->first);
+        rets[i] = checkout_blob(*objects, *staging, selected[i]->second, selected[i]->first);
+    });
+
+    for (size_t i = 0; i < rets.size(); i++) {
+        if (rets[i] != 0) {
+            return restore_error(rets[i]);
+        }
+    }
+
+    return REPO_OK;
+}
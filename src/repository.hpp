@@ -0,0 +1,172 @@
+/*
+Embeddable handle on the vms repository in the current working directory
+
+A Repository caches HEAD, branch refs, the index, restored commits and blob contents for its
+lifetime, revalidating mutable state against the files in .vms before each use, so another
+process modifying the repository is picked up. It owns the object stores, opened on first use. Methods never print or prompt: they return
+REPO_OK or one of the RepoError codes below (describe them with repo_strerror). Methods that
+modify the repository take the repository lock for their duration.
+
+Pointers handed out by the getters stay valid until the next call on the same Repository.
+*/
+#ifndef REPOSITORY_HPP
+#define REPOSITORY_HPP
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <memory>
+
+#include "blame.hpp"
+#include "commit.hpp"
+#include "commitindex.hpp"
+#include "config.hpp"
+#include "filestamp.hpp"
+#include "index.hpp"
+#include "merge.hpp"
+
+class ObjectStore;
+
+enum RepoError {
+    REPO_OK = 0,
+    REPO_NOT_INITIALIZED,
+    REPO_NOT_FOUND,         // no such commit, branch or file
+    REPO_AMBIGUOUS_ID,
+    REPO_INVALID_ARGUMENT,
+    REPO_EXISTS,
+    REPO_NO_CHANGES,
+    REPO_LOCKED,
+    REPO_CORRUPT,
+    REPO_IO_ERROR
+};
+
+const char* repo_strerror(int error);
+
+class Repository {
+    public:
+        Repository();
+        ~Repository();
+
+        /* Checks that the current working directory holds a repository */
+        int open();
+
+        // Refs
+        int head_branch(const std::string*& branch);
+        int head_id(const std::string*& commit_id);
+        int branch_id(const std::string& branch, std::string& commit_id);
+        int list_branches(std::map<std::string, std::string>& branches);
+        int create_branch(const std::string& branch, const std::string& commit_id = "");
+        int remove_branch(const std::string& branch);
+
+        // Objects
+        /*
+            The object store, the backend .vms/config names with any alternates, and the staging store in .vms/cache (see
+            objectstore.hpp), opened on first use and owned by the Repository
+        */
+        int object_stores(ObjectStore*& object_store, ObjectStore*& staging_store);
+        /* Replaces the stores, e.g. with memory stores; NULL restores those configured. The stores given are not owned. */
+        void use_object_stores(ObjectStore* object_store, ObjectStore* staging_store);
+        int resolve_id(const std::string& id, std::string& full_id);
+        int get_commit(const std::string& commit_id, const Commit*& commit);
+        int get_commit(const ObjectId& commit_id, const Commit*& commit);
+        int get_head_commit(const Commit*& commit);
+        int get_blob(const ObjectId& blob_id, const std::string*& content);
+        int file_at(const std::string& commit_id, const std::string& filename, const std::string*& content);
+
+        // Staging area
+        int get_index(const std::map<std::string, ObjectId>*& index);
+        bool is_staged(const std::string& filename);
+        bool is_tracked(const std::string& filename);
+        int stage(const std::string& filename);
+        int unstage(const std::string& filename);
+        int clear_index();
+
+        // History
+        int commit(const std::string& message, std::string& commit_id);
+        int log(std::vector<std::string>& entries);
+        /*
+            Finds the commits of the log that change any of the given files or directories relative to their first parent,
+            newest first. Commits the commit index shows do not touch them are skipped without being read.
+        */
+        int file_history(const std::vector<std::string>& paths, std::vector<ObjectId>& commit_ids);
+        /*
+            Attributes each line of filename as of commit_id to the commit that introduced it (see blame.hpp), and points
+            content to the file's contents. Commits the commit index shows did not change the file are passed without being read.
+        */
+        int blame(const std::string& commit_id, const std::string& filename, Blame& result, const std::string*& content);
+
+        // Working directory
+        /* Which files checkouts write, from the sparse.paths setting (see config.hpp) */
+        int get_sparse_checkout(const SparseCheckout*& sparse_checkout);
+        /* Writes the given files of a commit into the working directory, or else those in the sparse set, on a pool of worker threads */
+        int checkout_files(const std::string& commit_id, const std::vector<std::string>* filenames = NULL);
+        /* Checks out the sparse set of the branch's commit, first removing unchanged files of HEAD's commit outside it */
+        int checkout_branch(const std::string& branch);
+
+        // Merging (see merge.hpp)
+        /*
+            Merges branch into the current branch without touching the working directory. Unless check_only, the result is
+            then recorded: the current branch moves to the merge commit, or fast-forwards, and the staging area is cleared.
+        */
+        int merge(const std::string& branch, bool check_only, MergeResult& result);
+        /* Writes the files a merge updated in the sparse set, and any conflicting ones, into the working directory */
+        int checkout_merge(const MergeResult& result);
+
+    private:
+        Repository(const Repository&);
+        Repository& operator=(const Repository&);
+
+        FileStamp head_stamp;
+        std::string head;
+
+        FileStamp head_ref_stamp;
+        FileStamp packed_refs_stamp;
+        std::string head_ref;
+
+        FileStamp index_stamp;
+        FileStamp journal_stamp;
+        std::map<std::string, ObjectId> index;
+
+        FileStamp config_stamp;
+        RawBlobPolicy raw_policy;
+        SparseCheckout sparse;
+
+        FileStamp commit_index_stamp;
+        CommitIndex commit_index;
+
+        std::unique_ptr<ObjectStore> configured_objects;
+        std::unique_ptr<ObjectStore> configured_staging;
+        ObjectStore* objects;   // the stores in use, configured or given
+        ObjectStore* staging;
+
+        std::unordered_map<ObjectId, Commit, ObjectIdHash> commits;    // objects are immutable, so entries never go stale
+        std::unordered_map<ObjectId, std::string, ObjectIdHash> blobs;
+        size_t blob_bytes;
+
+        MergeEngine merge_engine;   // caches commit parents and trees across merges
+
+        int open_stores();
+        int refresh_head();
+        int refresh_index();
+        int refresh_config();
+        /* Restores a commit along with the files of its first parent, none for the first commit, both valid until the next restore */
+        int get_commit_and_parent_files(const ObjectId& commit_id, const Commit*& commit, const std::map<std::string, ObjectId>*& parent_files);
+        int refresh_commit_index(bool locked);
+        /* Blames the version version_id of filename that commit id holds, following merges into their second parents */
+        int blame_version(ObjectId id, ObjectId version_id, const std::string& filename, Blame& result, const std::string*& content);
+        /* Sets holds to whether commit_id, which may be null, holds the version blob_id of filename */
+        int holds_version(const ObjectId& commit_id, const std::string& filename, const ObjectId& blob_id, bool& holds);
+        /* Credits the lines of content, the version of filename made by commit_id, that its second parent's version has to their commits there */
+        int blame_second_parent(const ObjectId& commit_id, const std::string& filename, const std::string& content, Blame& result);
+        int rebuild_commit_index();
+        int write_index();
+        /* Appends an update to the index journal (see index.hpp), folding the journal into the index once it grows large */
+        int update_index(const IndexJournalRecord& record);
+        size_t append_log(const Commit& commit);
+        void index_commit(const ObjectId& commit_id, const ObjectId& parent_id, const std::vector<std::string>& changed_paths, size_t n_logged);
+};
+
+#endif // REPOSITORY_HPP
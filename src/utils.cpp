@@ -11,6 +11,13 @@
 #include <limits.h> // for realpath
 #include <stdlib.h> // for realpath
 
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/ioctl.h> // for FICLONERANGE
+#include <linux/fs.h>
+#endif
+
 
 #include "utils.h"
 
@@ -56,27 +63,58 @@ int create_and_write_file(const char* filepath, const char* content, mode_t mode
         return 1;
     }
 
-    int ofd = creat(filepath, mode);
-    
+    // Files created here are HEAD and branch refs, which concurrent readers rely on never seeing half-written
+    return replace_file_atomically(filepath, content, content == NULL ? 0 : strlen(content), mode);
+}
+
+int replace_file_atomically(const char* filepath, const char* data, size_t len, mode_t mode) {
+    if (filepath == NULL) {
+        cerr << "ERROR: Unable to replace file. Provided name is not a valid string." << endl;
+        return 1;
+    }
+
+    if (!is_valid_path(filepath)) {
+        cerr << "ERROR: Unable to replace file. Provided name is not a valid path within .vms directory." << endl;
+        return 1;
+    }
+
+    // Unique per call, not just per process, as worker threads may replace the same file at once (e.g. equal merged blobs)
+    static atomic<unsigned long> n_replaced(0);
+    char tmp_filepath[PATH_MAX];
+    snprintf(tmp_filepath, PATH_MAX, "%s.tmp.%d.%lu", filepath, (int) getpid(), n_replaced++);
+
+    int ofd = open(tmp_filepath, O_WRONLY | O_CREAT | O_EXCL, mode);
+
     if (ofd == -1) {
         cerr << "ERROR: Unable to open/create file. " << strerror(errno) << endl;
-        close(ofd);
         return -1;
     }
 
-    if (content != NULL) {
+    while (len > 0) {
+        ssize_t nwrite = write(ofd, data, len);
 
-        ssize_t nwrite = write(ofd, content, strlen(content));
-
-        if(nwrite == -1) {
+        if (nwrite == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
             cerr << "ERROR: Unable to write to file. " << strerror(errno) << endl;
             close(ofd);
+            unlink(tmp_filepath);
             return -1;
         }
 
+        data += nwrite;
+        len -= nwrite;
     }
 
     close(ofd);
+
+    if (rename(tmp_filepath, filepath) == -1) {
+        cerr << "ERROR: Unable to replace file. " << strerror(errno) << endl;
+        unlink(tmp_filepath);
+        return -1;
+    }
+
     return 0;
 }
 
@@ -158,3 +196,56 @@ int normalize_relative_filepath(const char* filepath, char* buf) {
     
     return 0;
 }
+
+/** Copies length bytes at src_offset to dst_fd's current position through a buffer, the portable fallback **/
+static int copy_file_data_by_reading(int src_fd, off_t src_offset, off_t length, int dst_fd) {
+    char buf[64 * 1024];
+    while (length > 0) {
+        ssize_t nread = pread(src_fd, buf, length < (off_t) sizeof(buf) ? length : sizeof(buf), src_offset);
+        if (nread <= 0) {
+            if (nread == 0) {
+                errno = EIO;    // source ended early
+            }
+            return -1;
+        }
+
+        for (ssize_t done = 0; done < nread; ) {
+            ssize_t nwritten = write(dst_fd, buf + done, nread - done);
+            if (nwritten == -1) {
+                return -1;
+            }
+            done += nwritten;
+        }
+        src_offset += nread;
+        length -= nread;
+    }
+    return 0;
+}
+
+int copy_file_data(int src_fd, off_t src_offset, off_t length, int dst_fd) {
+#ifdef FICLONERANGE
+    // A clone shares the source's blocks until either file is written; offsets must be block aligned
+    struct file_clone_range range;
+    range.src_fd = src_fd;
+    range.src_offset = src_offset;
+    range.src_length = length;
+    range.dest_offset = 0;
+    if (length > 0 && ioctl(dst_fd, FICLONERANGE, &range) == 0) {
+        return 0;
+    }
+#endif
+
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    loff_t in_offset = src_offset;
+    while (length > 0) {
+        ssize_t ncopied = copy_file_range(src_fd, &in_offset, dst_fd, NULL, length, 0);
+        if (ncopied <= 0) {
+            break;  // e.g. unsupported across filesystems; the rest is copied by reading
+        }
+        length -= ncopied;
+    }
+    src_offset = in_offset;
+#endif
+
+    return copy_file_data_by_reading(src_fd, src_offset, length, dst_fd);
+}
@@ -2,6 +2,7 @@
 #define UTILS_H
 
 #include <sys/stat.h>
+#include <stddef.h>
 
 /* 
     Utility function to create a new directory named dirpath.
@@ -14,7 +15,7 @@
 int make_dir(const char* dirpath);
 
 /* 
-    Utility function to create (or overwrite if already exists) a new file named filepath with provided contents and permissions.
+    Utility function to create (or atomically replace if already exists) a new file named filepath with provided contents and permissions.
     May create (or overwrite) file with no contents by passing NULL to "content" function parameter
     May only create files with .vms as the prefix.
     Returns 0 on success, or non-zero integer error code on failure.
@@ -23,6 +24,17 @@ int make_dir(const char* dirpath);
 */
 int create_and_write_file(const char* filepath, const char* content, mode_t mode);
 
+/* 
+    Utility function to atomically replace (or create) the file named filepath with len bytes of data and given permissions.
+    Data is written to a temporary file next to filepath that is then renamed into place, so concurrent readers
+    observe either the old or the new contents, never a partial write.
+    May only replace files with .vms as the prefix.
+    Returns 0 on success, or non-zero integer error code on failure.
+
+    Examples: .vms/index
+*/
+int replace_file_atomically(const char* filepath, const char* data, size_t len, mode_t mode);
+
 /* 
     Utility function to remove file named filepath.
     May only remove files with .vms as the prefix.
@@ -41,4 +53,12 @@ int move_file(const char* src, const char* dst);
 
 int normalize_relative_filepath(const char* filepath, char* buf);
 
+/* 
+    Utility function to copy length bytes starting at src_offset in the file open as src_fd to the start of dst_fd,
+    which must be empty. Shares the source's blocks with a reflink where the filesystem supports it (Linux), and
+    otherwise copies within the kernel with copy_file_range, falling back to read and write.
+    Returns 0 on success, or -1 on failure with errno set.
+*/
+int copy_file_data(int src_fd, off_t src_offset, off_t length, int dst_fd);
+
 #endif // UTILS_H
\ No newline at end of file
@@ -6,28 +6,34 @@
 #include <boost/serialization/map.hpp>
 
 #include <set>
-#include <unordered_set>
-#include <list>
 #include <stack>
-#include <queue>
 #include <boost/serialization/deque.hpp>
 #include <boost/serialization/stack.hpp>
 
 #include <sstream>
+#include <iomanip>
 #include <fstream>
 
 #include "vms.hpp"
 #include "utils.h"
 #include "archive.hpp"
 #include "commit.hpp"
+#include "commitindex.hpp"
 #include "blob.hpp"
 #include "access.hpp"
+#include "codec.hpp"
+#include "config.hpp"
+#include "index.hpp"
+#include "objectstore.hpp"
+#include "diff.hpp"
+#include "repository.hpp"
+#include "pathtable.hpp"
+#include "refs.hpp"
+#include "merge.hpp"
 
 
 using namespace std;
 
-const string STAGE_DELETE = "DELETED";
-
 enum RelativeFileStatus {
     NEW,
     MODIFIED,
@@ -36,277 +42,103 @@ enum RelativeFileStatus {
     NOT_FOUND
 };
 
-int move_from_cache_to_objects(const string& id) {
-    ostringstream cache_path;
-    cache_path << ".vms/cache/" << id;
-
-    // Create subdirectory if it does not already exist and move
-    ostringstream objects_path;
-
-    string id_prefix;
-    string id_suffix;
-    split_prefix_suffix(id, id_prefix, id_suffix, PREFIX_LENGTH);
-
-    objects_path << ".vms/objects/" << id_prefix;
-    mkdir(objects_path.str().c_str(), 0755);
-    
-    objects_path << "/" << id_suffix;
-    int ret = move_file(cache_path.str().c_str(), objects_path.str().c_str());
+/** Helper for classifying a file given its entries in tree x and in reference tree ref, either of which may be NULL if absent **/
+RelativeFileStatus find_relative_file_status(const TreeEntry* x_entry, const TreeEntry* ref_entry) {
+    bool present_in_x = x_entry != NULL;
+    bool present_in_ref = ref_entry != NULL;
 
-    if (ret != 0) {
-        cerr << "Error occurred: unable to move staged changes from cache to objects directory" << endl;
-        return -1;
+    if (present_in_x && !present_in_ref) {
+        return NEW;
     }
 
-    ret = chmod(objects_path.str().c_str(), 0444);
-    if (ret != 0) {
-        cerr << "Error occurred: unable to change permissions of blob file." << objects_path.str() << endl;
-        return -1;
+    if (!present_in_x && present_in_ref) {
+        return DELETED;
     }
 
-    return 0;
-}
-
-/** Helper method for restoring a commit from a shortened commit id
- * Utilization assumes prior validation that shortened id is valid, meaning:
- * - it is longer than the defined PREFIX_LENGTH
- * - its prefix matches a subdirectory in the .vms/objects directory
- * - its suffix matches exactly one file in the .vms/objects/<prefix> subdirectory **/
-int restore_commit_from_shortened_id(const char* commit_id, Commit& commit) {
-    string id_prefix;
-    string id_suffix;
-    split_prefix_suffix(string(commit_id), id_prefix, id_suffix, PREFIX_LENGTH);
-    
-    ostringstream full_id;
-    full_id << id_prefix;
-
-    ostringstream obj_path;
-    obj_path << ".vms/objects/" << id_prefix;
-
-    const char* dirpath = obj_path.str().c_str();
-
-    if (is_valid_dir(dirpath)) {
-    
-        DIR *dirptr = opendir(dirpath);
-        struct dirent *entry = readdir(dirptr);
-
-        while (entry != NULL) {
-            if (strcmp(".", entry->d_name) != 0 && strcmp("..", entry->d_name) != 0) {
-                if (strncmp(id_suffix.c_str(), entry->d_name, id_suffix.length()) == 0) {
-
-                    obj_path << "/" << entry->d_name;
-                    full_id << entry->d_name;
-
-                }
-            }
-            entry = readdir(dirptr);
+    if (present_in_x && present_in_ref) {
+        if (x_entry->id == ref_entry->id) {
+            return UNMODIFIED;
         }
-    }
-    restore<Commit>(commit, obj_path.str());
 
-    // verify no tampering or corruption of restored object
-    if (commit.hash() != full_id.str()) {
-        cerr << "Fatal error has occurred in retrieval of commit: uuid mismatch. Archived object may have been corrupted. Exiting..." << endl;
-        return -1;
-    }
-
-    return 0;
-}
-
-int restore_blob_from_full_id(const string& blob_id, Blob& blob) {
-    string blob_id_prefix;
-    string blob_id_suffix;
-    split_prefix_suffix(blob_id, blob_id_prefix, blob_id_suffix, PREFIX_LENGTH);
-
-    ostringstream blob_path;
-    blob_path << ".vms/objects/" << blob_id_prefix << "/" << blob_id_suffix;
-
-    restore<Blob>(blob, blob_path.str());
+        return MODIFIED;
 
-    // verify no tampering or corruption of restored object
-    if (blob.hash() != blob_id) {
-        cerr << "Fatal error has occurred in retrieval of file contents: uuid mismatch. Archived object may have been corrupted. Exiting..." << endl;
-        return -1;
     }
 
-    return 0;
+    return NOT_FOUND;
 }
 
-/** Creates directory path to file if it doesn't already exist and returns position of the end slash, or 0 if given file is not in a subdirectory.
- * Input: .vms/objects/de/<file> 
- * Output: 15
- * 
- * Input: foo
- * Output: 0 **/
-int create_directory_path(string filepath) {
-    int pos = 0;
-    size_t ret = 0;
-    while(ret != string::npos) {
-        pos = ret;
-        ret = filepath.find("/", pos+1);
-        if (pos != 0) {
-            mkdir(filepath.substr(0, pos+1).c_str(), 0755);
+/** Helper for updating a commit's map with the contents of the staging area, yielding the files as they would be committed **/
+void apply_index(map<string, ObjectId>& tree, const map<string, ObjectId>& index) {
+    map<string, ObjectId>::const_iterator it;
+    for (it = index.begin(); it != index.end(); ++it) {
+        if (it->second == STAGE_DELETE) {
+            tree.erase(it->first);
+        } else {
+            tree[it->first] = it->second;
         }
     }
-    return pos;
 }
 
- 
-int find_split_point(const string& branch_A, const string& branch_B, string& strbuf) {
-    /** Design notes:
-     * Algorithm using breadth-first search to find split point, ending as soon as common ancestor is found. Finds split point closest relative to both sources.
-     * This algorithm does not guarantee it will identify one source as a direct ancestor of the other (e.g. opportunity for fast-forward merge).
-     * To achieve this alternative result, may implement algorithm that searches the entire commit graph which is considerably more costly.
-     * 
-     * Cases in which this algorithm will find "suboptimal" split point are expected to be relatively uncommon, so this partial search is sufficient in most cases.
-     * In cases for which "suboptimal" split points are found, it may result in "false positive" merge conflicts.
-    */
-
-    string id_A;
-    string id_B;
-
-    if (get_id_from_branch(branch_A, id_A) != 0) {
-        return -1;
-    }
+Repository& vms_repository() {
+    static Repository repo;
+    return repo;
+}
 
-    if (get_id_from_branch(branch_B, id_B) != 0) {
+/** Helper for opening the object stores of the repository for a command, reporting failure on stderr **/
+static int command_stores(ObjectStore*& objects, ObjectStore*& staging) {
+    int ret = vms_repository().object_stores(objects, staging);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in opening the object store: " << repo_strerror(ret) << " (see " << CONFIG_PATH << ")" << endl;
         return -1;
     }
-
-    if (id_A == id_B) { // both branches point to same commit, so trivially found
-        strbuf = id_A;
-        return 0;
-    }
-
-    unordered_set<string> seen_A;
-    unordered_set<string> seen_B;
-    unordered_set<string> seen_union;
-    queue<string> fringe;
-    pair<unordered_set<string>::iterator,bool> ret;
-
-    seen_A.insert(id_A);
-    seen_B.insert(id_B);
-    seen_union.insert(id_A);
-    seen_union.insert(id_B);
-    fringe.push(id_A);
-    fringe.push(id_B);
-
-    string current_id;
-    Commit current_commit;
-    pair<string, string> parents;
-
-    while (!fringe.empty()) {
-        current_id = fringe.front();
-        fringe.pop();
-
-        restore_commit_from_shortened_id(current_id.c_str(), current_commit);
-        
-        parents = current_commit.parent_ids();
-
-        if (seen_A.find(current_id) != seen_A.end()) {  // if current id was first seen from source A
-
-            if (!parents.first.empty() && seen_A.insert(parents.first).second) { // if first parent is not empty string and has not been seen before from source A (side effect: adds to seem_A if true: not seen before, does nothing if has seen before)
-
-                fringe.push(parents.first);
-                ret = seen_union.insert(parents.first);
-
-                if (!ret.second) {  // if ret.second == false, then insertion failed. Found split point. break and return.
-                    strbuf = parents.first;
-                    break;
-                }
-
-            } 
-            
-            if (!parents.second.empty() && seen_A.insert(parents.second).second) {
-
-                fringe.push(parents.second);
-                ret = seen_union.insert(parents.second);
-
-                if (!ret.second) {
-                    strbuf = parents.second;
-                    break;
-                }
-            }
-
-        } else {  // current id was first seen from source B
-
-            if (!parents.first.empty() && seen_B.insert(parents.first).second) { // if first parent is not empty string and has not been seen before from source B (side effect: adds to seem_B if true: not seen before, does nothing if has seen before)
-
-                fringe.push(parents.first);
-                ret = seen_union.insert(parents.first);
-
-                if (!ret.second) {  // if ret.second == false, then insertion failed. Found split point. break and return.
-                    strbuf = parents.first;
-                    break;
-                }
-
-            } 
-            
-            if (!parents.second.empty() && seen_B.insert(parents.second).second) {
-
-                fringe.push(parents.second);
-                ret = seen_union.insert(parents.second);
-
-                if (!ret.second) {
-                    strbuf = parents.second;
-                    break;
-                }
-            }
-
-
-        }
-    }
-
     return 0;
-
 }
 
-RelativeFileStatus find_relative_file_status(string filename, const map<string, string>& x, const map<string, string>& ref) {
-    map<string, string>::const_iterator x_entry = x.find(filename);
-    map<string, string>::const_iterator ref_entry = ref.find(filename);
-
-    bool present_in_x = x_entry != x.end();
-    bool present_in_ref = ref_entry != ref.end();
+/** Helper for describing the failure of restoring an object (see access.hpp) or loading the index: -1 for I/O errors, -2 for corruption **/
+static const char* restore_strerror(int ret) {
+    return repo_strerror(ret == -1 ? REPO_IO_ERROR : REPO_CORRUPT);
+}
 
-    if (present_in_x && !present_in_ref) {
-        return NEW;
+/** Helper for restoring the commit a shortened id names, or the current commit if it is NULL, reporting failure on stderr **/
+static int restore_command_commit(ObjectStore& objects, const char* commit_id, Commit& commit) {
+    string full_id;
+    const string* head;
+    int ret = commit_id != NULL ? vms_repository().resolve_id(commit_id, full_id) : vms_repository().head_id(head);
+    if (ret == REPO_OK && commit_id == NULL) {
+        full_id = *head;
     }
 
-    if (!present_in_x && present_in_ref) {
-        return DELETED;
+    ObjectId id;
+    if (ret == REPO_OK && !ObjectId::parse(full_id, id)) {
+        ret = REPO_CORRUPT;
     }
-
-    if (present_in_x && present_in_ref) {
-        if (x_entry->second == ref_entry->second) {
-            return UNMODIFIED;
-        }
-
-        return MODIFIED;
-
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in retrieval of commit " << (commit_id != NULL ? commit_id : "HEAD") << ": " << repo_strerror(ret) << endl;
+        return -1;
     }
 
-    return NOT_FOUND;
-}
-
-bool has_relative_changes(const map<string, string>& x, const map<string, string>& ref) {
-    if (x.empty()) {
-        return false;
+    ret = restore_commit_from_full_id(objects, id, commit);
+    if (ret != 0) {
+        cerr << "Error occurred in retrieval of commit " << full_id << ": " << restore_strerror(ret) << endl;
+        return -1;
     }
+    return 0;
+}
 
-    map<string, string>::const_iterator x_entry;
+/** Helper for asking the user to confirm an operation after the given warning, treating end of input as a no **/
+static bool confirm(const char* warning) {
+    string input;
+    cout << warning;
+    cout << "Confirm checkout (y/n):";
 
-    for (x_entry = x.begin(); x_entry != x.end(); x_entry++) {
-        if (find_relative_file_status(x_entry->first, x, ref) != UNMODIFIED) {
-            return true;
-        }
+    while (getline(cin, input) && input != "y" && input != "n") {
+        cout << "Please enter y or n:";
     }
 
-    return false;
-    
+    return input == "y";
 }
 
-
-int vms_init() {
+int vms_init(const char* store) {
 
     char cwd_buf[PATH_MAX];
 
@@ -336,13 +168,25 @@ int vms_init() {
         return -1;
     }
 
-    // Initialize files
-    map<string, string> index;
-    save< map<string, string> >(index, ".vms/index");
+    // Initialize files, starting with the configuration that selects the object store
+    map<string, string> config;
+    config["store"] = store;
+    if (save_config(config) != 0) {
+        return -1;
+    }
+
+    map<string, ObjectId> index;
+    if (save_index(index) != 0) {
+        cerr << "Error occurred in writing .vms/index" << endl;
+        return -1;
+    }
 
     stack<string> log;
     save< stack<string> >(log, ".vms/log");
 
+    CommitIndex commit_index;
+    commit_index.save();
+
     // Initialize initial commit
     Commit sentinal;
     string sentinal_id = sentinal.hash();
@@ -350,17 +194,15 @@ int vms_init() {
     create_and_write_file(".vms/HEAD", "master", 0644);
     create_and_write_file(".vms/branches/master", sentinal_id.c_str(), 0644);
 
-    ostringstream obj_path;
-
-    string sentinal_id_prefix;
-    string sentinal_id_suffix;
-    split_prefix_suffix(sentinal_id, sentinal_id_prefix, sentinal_id_suffix, PREFIX_LENGTH);
-
-    obj_path << ".vms/objects/" << sentinal_id_prefix;
-    make_dir(obj_path.str().c_str());
-    obj_path << "/" << sentinal_id_suffix;
-
-    save<Commit>(sentinal, obj_path.str());
+    ObjectStore* objects;
+    ObjectStore* staging;
+    if (command_stores(objects, staging) != 0) {
+        return -1;
+    }
+    if (save_commit_object(*objects, sentinal, ObjectId::from_hex(sentinal_id)) != 0) {
+        cerr << "Error occurred in writing the initial commit " << sentinal_id << endl;
+        return -1;
+    }
 
     cout << "Repository initialized at " << cwd_buf << "\n";
 
@@ -368,169 +210,69 @@ int vms_init() {
 }
 
 int vms_stage(const char* filepath) {
-
-    // Load index
-    map<string, string> index;  
-    restore< map<string, string> >(index, ".vms/index");
-
-    // if file was previously being tracked but is now deleted
-    if(is_tracked_file(filepath) && !is_valid_file(filepath)) {
-        // Puts filepath into index map with special string, save the updated index, and return
-        index[filepath] = STAGE_DELETE;
-        save< map<string, string> >(index, ".vms/index");
-        return 0;
-        
-    } else if (is_staged_file(filepath) && !is_valid_file(filepath)) { // if file was previously staged but is now deleted
-        // Remove the file from index, save the updated index, and return
-        index.erase(string(filepath));
-        save< map<string, string> >(index, ".vms/index");
-        return 0;
-
-    } 
-
-    // Blob the file's contents and get its id
-    ifstream ifs(filepath);
-    if (!ifs.is_open()) {
-        cerr << "Error occurred: unable to open file " << filepath << " for staging" << endl;
+    int ret = vms_repository().stage(filepath);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in staging " << filepath << ": " << repo_strerror(ret) << endl;
         return -1;
     }
-    Blob file(ifs);
-
-    string file_id = file.hash();
-
-    // Puts filepath and id into the index map and save the updated index
-    index[filepath] = file_id;
-    save< map<string, string> >(index, ".vms/index");
-
-    // Save blob in cache
-    ostringstream cache_path;
-    cache_path << ".vms/cache/" << file_id;
-    save<Blob>(file, cache_path.str());
 
     return 0;
 }
 
 int vms_unstage(const char* filepath) {
-    // Load index
-    map<string, string> index;  
-    restore< map<string, string> >(index, ".vms/index");
-
-    // remove entry from the index map and save the updated index
-    index.erase(string(filepath));
-    save< map<string, string> >(index, ".vms/index");
+    int ret = vms_repository().unstage(filepath);
+    if (ret != REPO_OK && ret != REPO_NOT_FOUND) {
+        cerr << "Error occurred in unstaging " << filepath << ": " << repo_strerror(ret) << endl;
+        return -1;
+    }
 
-    // Note: decide to not remove cache because unnecessary: will clear cache after commits
-    
     return 0;
 }
 
 int vms_commit(const char* msg) {
-    // Load index
-    map<string, string> index;  
-    restore< map<string, string> >(index, ".vms/index");
-
-    // Create new commit and get its map, which is currently identical to its parent's map
-    Commit commit(msg);
+    string commit_id;
+    int ret = vms_repository().commit(msg, commit_id);
 
-    map<string, string> commit_map = commit.get_map();
-    
-    // Check if any tracked changes to commit, if not print and return, otherwise continue
-    if (!has_relative_changes(index, commit_map)) {
+    if (ret == REPO_NO_CHANGES) {
         cerr << "No changes staged to commit" << endl;
         return -1;
-    }
-
-    // Update commit's internal map, and move files from cache to objects directory
-
-    set<string> uuid_set;     // Create set to track which uuids have been seen before so don't try to move twice
-    pair<set<string>::iterator,bool> insert_ret;
-
-    map<string,string>::iterator it;
-    for (it=index.begin(); it!=index.end(); ++it) {
-        // if staged is file mapped to STAGE_DELETE string, remove it from commit tree
-        if (it->second == STAGE_DELETE) {
-            commit.remove_from_map(it->first);
-        } else { // puts entry to commit map and move files from cache to objects directory
-            commit.put_to_map(it->first, it->second);
-            insert_ret = uuid_set.insert(it->second);
-            if (insert_ret.second) { // if insert succeed, then uuid has not been seen yet and can be moved.
-                move_from_cache_to_objects(it->second);
-            }
-        }
-    }
-
-    // Iterate through cache directory, clearing it
-    DIR *dirptr = opendir(".vms/cache");
-    struct dirent *entry = readdir(dirptr);
-    
-    char cache_path[BUFSIZ];
-    
-    while (entry != NULL) {
-
-        sprintf(cache_path, "%s/%s", ".vms/cache", entry->d_name);
-
-        if (is_valid_file(cache_path)) {
-            remove_file(cache_path);
-        }
-
-        entry = readdir(dirptr);
-
-    }
-
-    // Clear index and save it
-    index.clear();
-    save< map<string, string> >(index, ".vms/index");
-
-    // Change position of branch pointed to by HEAD
-    string commit_id = commit.hash();
-    
-    string branch_path;
-    if (get_branch_path(branch_path) != 0) {
-        return -1;
-    }
-    
-    create_and_write_file(branch_path.c_str(), commit_id.c_str(), 0644);
-
-    //Push formatted commit string to log and save
-    stack<string> log;
-    restore< stack<string> >(log, ".vms/log");
-
-    log.push(commit.log_string());
-    save< stack<string> >(log, ".vms/log");
-
-    // Serialize and save your commit.
-    ostringstream obj_path;
-
-    string commit_id_prefix;
-    string commit_id_suffix;
-    split_prefix_suffix(commit_id, commit_id_prefix, commit_id_suffix, PREFIX_LENGTH);
-
-    obj_path << ".vms/objects/" << commit_id_prefix;
-    make_dir(obj_path.str().c_str());
-    obj_path << "/" << commit_id_suffix;
-
-    save<Commit>(commit, obj_path.str());
-
-    // Change permissions of generated file.
-    int ret = chmod(obj_path.str().c_str(), 0444);
-    if (ret != 0) {
-        cerr << "Error occurred: failed to change permissions of commit file." << obj_path.str() << endl;
+    } else if (ret != REPO_OK) {
+        cerr << "Error occurred in committing staged changes: " << repo_strerror(ret) << endl;
         return -1;
     }
 
     return 0;
 }
 
-int vms_log() {
+int vms_log(const int n_paths, char* const paths[]) {
 
     stringstream log_output;
 
-    stack<string> log;
-    restore< stack<string> >(log, ".vms/log");
-    while (!log.empty()) {
+    vector<string> log;
+    if (n_paths == 0) {
+        vms_repository().log(log);
+    } else {
+        vector<ObjectId> commit_ids;
+        int ret = vms_repository().file_history(vector<string>(paths, paths + n_paths), commit_ids);
+        if (ret != REPO_OK) {
+            cerr << "Error occurred in finding commits changing the given paths: " << repo_strerror(ret) << endl;
+            return -1;
+        }
+
+        for (size_t i = 0; i < commit_ids.size(); i++) {
+            const Commit* commit;
+            ret = vms_repository().get_commit(commit_ids[i], commit);
+            if (ret != REPO_OK) {
+                cerr << "Error occurred in restoring commit " << commit_ids[i].hex() << ": " << repo_strerror(ret) << endl;
+                return -1;
+            }
+            log.push_back(commit->log_string());
+        }
+    }
+
+    for (size_t i = 0; i < log.size(); i++) {
         log_output << "===\n";
-        log_output << log.top() << endl;
-        log.pop();
+        log_output << log[i] << endl;
     }
 
     cout << log_output.rdbuf();
@@ -538,7 +280,7 @@ int vms_log() {
     return 0;
 }
 
-int vms_status(const char* arg0) {
+int vms_status(const char* arg0, const int n_specs, char* const specs[]) {
 
     string parent_id; 
 
@@ -559,72 +301,83 @@ int vms_status(const char* arg0) {
         return -1;
     }
 
-    // Load parent commit
-    Commit parent_commit;
-
-    ostringstream parent_path;
+    ObjectStore* objects;
+    ObjectStore* staging;
+    if (command_stores(objects, staging) != 0) {
+        return -1;
+    }
 
-    string parent_id_prefix;
-    string parent_id_suffix;
-    split_prefix_suffix(parent_id, parent_id_prefix, parent_id_suffix, PREFIX_LENGTH);
+    // Load files tracked by parent commit and the staging area as flat trees sharing one path table, keeping only those selected
+    Pathspec pathspec(n_specs, specs);
+    PathTable paths;
+    FlatTree tracked(paths);
+    FlatTree index(paths);
+    FlatTree all_tracked(paths);
+    FlatTree all_index(paths);
+    bool selecting = !pathspec.empty();
 
-    parent_path << ".vms/objects/" << parent_id_prefix << "/" << parent_id_suffix;
+    int ret = restore_tree_from_full_id(*objects, ObjectId::from_hex(parent_id), selecting ? all_tracked : tracked);
+    if (ret != 0) {
+        cerr << "Error occurred in restoring commit " << parent_id << ": " << restore_strerror(ret) << endl;
+        return -1;
+    }
 
-    restore<Commit>(parent_commit, parent_path.str());
-    if (parent_commit.hash() != parent_id) {
-        std::cerr << "Fatal error has occurred in retrieval of commit: uuid mismatch. Archived object may have been corrupted. Exiting..." << std::endl;
+    ret = load_index(selecting ? all_index : index);
+    if (ret != 0) {
+        cerr << "Error occurred in loading index: " << restore_strerror(ret) << endl;
         return -1;
     }
 
+    if (selecting) {
+        pathspec.select(all_tracked, tracked);
+        pathspec.select(all_index, index);
+    }
 
-    // Get copy of map of parent commit
-    map<string, string> parent_map = parent_commit.get_map();
+    const SparseCheckout* sparse;
+    if (vms_repository().get_sparse_checkout(sparse) != REPO_OK) {
+        cerr << "Error occurred in reading " << CONFIG_PATH << endl;
+        return -1;
+    }
+
+    const FlatTree* staged_and_tracked[2] = {&index, &tracked};
+    const TreeEntry* entries[2];
+    PathId path;
 
 
     stringstream status_stream;
     status_stream << "On branch " << current_branch.c_str() << "  [" << branch_id.substr(0,6) << "]\n";
 
-    DIR *branch_dirptr = opendir(".vms/branches");
-    struct dirent *branch_entry = readdir(branch_dirptr);
-
-    set<string> branches;
-
-    while (branch_entry != NULL) {
-
-        if (strcmp(".", branch_entry->d_name) != 0 && strcmp("..", branch_entry->d_name) != 0) {
-
-            if (strcmp(current_branch.c_str(), branch_entry->d_name) != 0) {
-                branches.insert(string(branch_entry->d_name));
-            }
-
-        }
-        branch_entry = readdir(branch_dirptr);
+    map<string, string> branches;
+    if (list_refs(branches) != 0) {
+        cerr << "Error occurred in listing branches: unable to read " << PACKED_REFS_PATH << endl;
+        return -1;
     }
+    branches.erase(current_branch);
 
+    map<string, string>::iterator branch_iter;
     set<string>::iterator ss_iter;
     
     if (!branches.empty()) {
         status_stream << "\nOther branches\n";
-        for (ss_iter = branches.begin(); ss_iter != branches.end(); ss_iter++) {
-            get_id_from_branch(*ss_iter, branch_id);
-            status_stream << "    " << *ss_iter << "  [" << branch_id.substr(0,6) << "]\n";
+        for (branch_iter = branches.begin(); branch_iter != branches.end(); branch_iter++) {
+            status_stream << "    " << branch_iter->first << "  [" << branch_iter->second.substr(0,6) << "]\n";
         }
         status_stream << endl;
     }
 
     // List all files currently staged. (and list type of modification: modified, deleted)
-    map<string, string> index;  
-    restore< map<string, string> >(index, ".vms/index");
-    map<string,string>::iterator it;
-
     bool staged_changes = false;
     RelativeFileStatus rf_status;
 
-    for (it = index.begin(); it != index.end(); ++it) {
+    TreeWalk staged_walk(staged_and_tracked, 2);
+    while (staged_walk.next(path, entries)) {
+        if (entries[0] == NULL) {
+            continue;
+        }
 
-        rf_status = find_relative_file_status(it->first, index, parent_map);
+        rf_status = find_relative_file_status(entries[0], entries[1]);
 
-        if (it->second == STAGE_DELETE) {
+        if (entries[0]->id == STAGE_DELETE) {
             if (!staged_changes) {
                 staged_changes = true;
                 status_stream << "Changes staged for commit\n";
@@ -632,7 +385,7 @@ int vms_status(const char* arg0) {
                 status_stream << "  (use \"" << arg0 << " commit <message>\" to commit all staged changes)\n\n";
             }
 
-            status_stream << "    deleted:    " << it->first << "\n";
+            status_stream << "    deleted:    " << paths.path(path) << "\n";
 
         } else if (rf_status == NEW) {
             if (!staged_changes) {
@@ -642,7 +395,7 @@ int vms_status(const char* arg0) {
                 status_stream << "  (use \"" << arg0 << " commit <message>\" to commit all staged changes)\n\n";
             }
 
-            status_stream << "    new file:    " << it->first << "\n";
+            status_stream << "    new file:    " << paths.path(path) << "\n";
 
         } else if (rf_status == MODIFIED) {
             if (!staged_changes) {
@@ -652,7 +405,7 @@ int vms_status(const char* arg0) {
                 status_stream << "  (use \"" << arg0 << " commit <message>\" to commit all staged changes)\n\n";
             }
 
-            status_stream << "    modified:     " << it->first << "\n";
+            status_stream << "    modified:     " << paths.path(path) << "\n";
 
         }
         
@@ -664,63 +417,68 @@ int vms_status(const char* arg0) {
     // List all files that have been staged and have been modified since staging (and the type of modification)
 
     bool unstaged_changes = false;
-    for (it = index.begin(); it != index.end(); ++it) {
+    for (size_t i = 0; i < index.size(); i++) {
+        const char* filename = index.path_of(index[i]);
 
-        if (it->second != STAGE_DELETE) {
+        if (index[i].id != STAGE_DELETE) {
 
-            if (!is_valid_file(it->first.c_str())) {    // if previously staged file has been deleted, list it as deleted
+            if (!is_valid_file(filename)) {    // if previously staged file has been deleted, list it as deleted
                 if (!unstaged_changes) {
                     unstaged_changes = true;
                     status_stream << "Changes not yet staged for commit\n";
                     status_stream << "  (use \"" << arg0 << " stage <file>\" to update or stage changes to be committed)\n\n";
                 }
 
-                status_stream << "    deleted:     " << it->first << "\n";
-            } else if (!file_hash_equal_to_working_copy(it->first, it->second)) {    // if tracked file has been modified, list it as modified
+                status_stream << "    deleted:     " << filename << "\n";
+            } else if (!file_hash_equal_to_working_copy(filename, index[i].id)) {    // if tracked file has been modified, list it as modified
                 if (!unstaged_changes) {
                     unstaged_changes = true;
                     status_stream << "Changes not yet staged for commit\n";
                     status_stream << "  (use \"" << arg0 << " stage <file>\" to update or stage changes to be committed)\n\n";
                 }
 
-                status_stream << "    modified:    " << it->first << "\n";
+                status_stream << "    modified:    " << filename << "\n";
             }
 
         } else { // File staged as deleted
-            if (is_valid_file(it->first.c_str())) { // if file is no longer deleted and can be staged to be added again, should notify user. By definition, file staged to be deleted from tracking is already tracked, so check if it has changes. If so, then list it as modified
+            if (is_valid_file(filename)) { // if file is no longer deleted and can be staged to be added again, should notify user. By definition, file staged to be deleted from tracking is already tracked, so check if it has changes. If so, then list it as modified
                 if (!unstaged_changes) {
                     unstaged_changes = true;
                     status_stream << "Changes not yet staged for commit\n";
                     status_stream << "  (use \"" << arg0 << " stage <file>\" to update or stage changes to be committed)\n\n";
                 }
 
-                status_stream << "    modified:    " << it->first << "\n";
+                status_stream << "    modified:    " << filename << "\n";
             }
         }
     }
 
     // list all tracked files that have not been staged and have been modified (and the type of modification)
+    // Files outside the sparse set are not checked out, so they are neither read nor listed as deleted.
+    // Most checkouts are not sparse, and testing a path would copy it into a string.
 
+    TreeWalk tracked_walk(staged_and_tracked, 2);
+    while (tracked_walk.next(path, entries)) {
+        const char* filename = paths.path(path);
 
-    for (it = parent_map.begin(); it != parent_map.end(); ++it) {
-        if (!is_staged_file(it->first.c_str())) {
-            if (!is_valid_file(it->first.c_str())) { // unstaged tracked file has been deleted from working directory
+        if (entries[0] == NULL && entries[1] != NULL && (!sparse->is_sparse() || sparse->selects(filename))) {
+            if (!is_valid_file(filename)) { // unstaged tracked file has been deleted from working directory
                 if (!unstaged_changes) {
                     unstaged_changes = true;
                     status_stream << "Changes not yet staged for commit\n";
                     status_stream << "  (use \"" << arg0 << " stage <file>\" to update or stage changes to be committed)\n\n";
                 }
 
-                status_stream << "    deleted:     " << it->first << "\n";
+                status_stream << "    deleted:     " << filename << "\n";
             
-            } else if (is_modified_tracked_file(it->first.c_str())) {
+            } else if (!file_hash_equal_to_working_copy(filename, entries[1]->id)) {
                 if (!unstaged_changes) {
                     unstaged_changes = true;
                     status_stream << "Changes not yet staged for commit\n";
                     status_stream << "  (use \"" << arg0 << " stage <file>\" to update or stage changes to be committed)\n\n";
                 }
 
-                status_stream << "    modified:    " << it->first << "\n";
+                status_stream << "    modified:    " << filename << "\n";
             
             }
         }
@@ -743,9 +501,12 @@ int vms_status(const char* arg0) {
     while (root_entry != NULL) {
         if (is_valid_dir(root_entry->d_name) && strcmp(".", root_entry->d_name) != 0 && strcmp("..", root_entry->d_name) != 0 && strcmp(".vms", root_entry->d_name) != 0) {
 
-            dirs.insert(string(root_entry->d_name));
+            if (pathspec.may_match_under(root_entry->d_name)) {
+                dirs.insert(string(root_entry->d_name));
+            }
         
-        } else if (is_valid_file(root_entry->d_name) && !is_tracked_file(root_entry->d_name) && !is_staged_file(root_entry->d_name)) {
+        } else if (is_valid_file(root_entry->d_name) && tracked.find(root_entry->d_name) == NULL && index.find(root_entry->d_name) == NULL
+                   && pathspec.matches(root_entry->d_name)) {
         
             untracked_files.insert(string(root_entry->d_name));
         
@@ -753,6 +514,7 @@ int vms_status(const char* arg0) {
         root_entry = readdir(root_dirptr);
 
     }
+    closedir(root_dirptr);
 
     if (!untracked_files.empty()) {
         status_stream << "Untracked files\n";
@@ -778,544 +540,577 @@ int vms_status(const char* arg0) {
 
 
 int vms_mkbranch(const char* branchname) {
-    string src_path;
-
-    if (get_branch_path(src_path) != 0) {
+    int ret = vms_repository().create_branch(branchname);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in creating branch " << branchname << ": " << repo_strerror(ret) << endl;
         return -1;
     }
 
-    ostringstream branch_path_stream;
-    branch_path_stream << ".vms/branches/" << branchname;
-
-    ifstream src(src_path);
-    ofstream dst(branch_path_stream.str());
-
-    dst << src.rdbuf();
-    
-    src.close();
-    dst.close();
-
     cout << "New branch " << branchname << " created at current location " << endl;
 
     return 0;
 }
 
 int vms_mkbranch(const char* branchname, const char* commit_id) {
-    ostringstream branch_path_stream;
-    branch_path_stream << ".vms/branches/" << branchname;
-
-
-    // get the full commit_id and write it to dst
-    std::string id_prefix;
-    std::string id_suffix;
-    split_prefix_suffix(std::string(commit_id), id_prefix, id_suffix, PREFIX_LENGTH);
-    
-    ostringstream full_id;
-    full_id << id_prefix;
-
-    ostringstream dirpath_stream;
-    dirpath_stream << ".vms/objects/" << id_prefix;
-
-    const char* dirpath = dirpath_stream.str().c_str();
-
-    if (is_valid_dir(dirpath)) {
-    
-        DIR *dirptr = opendir(dirpath);
-        struct dirent *entry = readdir(dirptr);
-
-        while (entry != NULL) {
-            if (strcmp(".", entry->d_name) != 0 && strcmp("..", entry->d_name) != 0) {
-                if (strncmp(id_suffix.c_str(), entry->d_name, id_suffix.length()) == 0) {
-
-                    full_id << entry->d_name;
+    string full_id;
+    int ret = vms_repository().resolve_id(commit_id, full_id);
+    if (ret == REPO_OK) {
+        ret = vms_repository().create_branch(branchname, full_id);
+    }
 
-                }
-            }
-            entry = readdir(dirptr);
-        }
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in creating branch " << branchname << " at commit " << commit_id << ": " << repo_strerror(ret) << endl;
+        return -1;
     }
-    
-    create_and_write_file(branch_path_stream.str().c_str(), full_id.str().c_str(), 0644);
 
-    cout << "New branch " << branchname << " created at commit " << full_id.str() << endl;
+    cout << "New branch " << branchname << " created at commit " << full_id << endl;
 
     return 0;
 }
 
 int vms_rmbranch(const char* branchname) {
-    ostringstream branch_path;
-    branch_path << ".vms/branches/" << branchname;
-
-    remove_file(branch_path.str().c_str());
-
-    return 0;
-}
+    int ret = vms_repository().remove_branch(branchname);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in removing branch " << branchname << ": " << repo_strerror(ret) << endl;
+        return -1;
+    }
 
-int vms_info(const char* commit_id) {
-    Commit commit;
-    restore_commit_from_shortened_id(commit_id, commit);
-    cout << commit.log_string() << "\n";
-    cout << commit.tracked_files_string() << "\n";
     return 0;
-
 }
 
-int vms_info(const char* commit_id, const char* filename) {
-    Commit commit;
-    restore_commit_from_shortened_id(commit_id, commit);
-
-    // verify file is tracked in this commit and load its blob if it is.
-    map<string, string>::iterator it;
-    
-    if (!commit.find_in_map_and_get_iter(string(filename), it)) {
-        cerr << "File not found in commit " << commit_id << endl;
+int vms_info(const char* commit_id, const int n_specs, char* const specs[]) {
+    const Commit* commit;
+    int ret = vms_repository().get_commit(commit_id, commit);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in restoring commit " << commit_id << ": " << repo_strerror(ret) << endl;
         return -1;
     }
 
-    Blob file;
-    restore_blob_from_full_id(it->second, file);
+    cout << commit->log_string() << "\n";
+    if (n_specs == 0) {
+        cout << commit->tracked_files_string() << "\n";
+        return 0;
+    }
 
-    cout << file.get_content() << endl;
+    vector<map<string, ObjectId>::const_iterator> selected;
+    Pathspec(n_specs, specs).select(commit->get_map(), selected);
 
+    stringstream files;
+    files << "Files tracked in this commit\n\n";
+    for (size_t i = 0; i < selected.size(); i++) {
+        files << "    " << selected[i]->first << "\n";
+    }
+    cout << files.rdbuf() << endl;
     return 0;
 
 }
 
-int vms_checkout_branch(const char* branchname) {
-    // Ask user to verify thay want to checkout the branch.
-    string input;
-    cout << "Checking out branch " << branchname << "...\n";
-    cout << "Warning: checking out branch will overwrite all uncommitted changes in the current branch.\n"; 
-    cout << "Confirm checkout (y/n):";
-    getline(cin, input);
-
-    while (input != "y" && input != "n") {
-        cout << "Please enter y or n:";
-        getline(cin, input);
-    }
+int vms_info(const char* commit_id, const char* filename) {
+    // verify file is tracked in this commit and load its blob if it is.
+    const string* content;
+    int ret = vms_repository().file_at(commit_id, filename, content);
 
-    if (input == "n") {
-        cout << "Aborting checkout..." << endl;
-        return -1;
-    }
-    string commit_id;
-    if (get_id_from_branch(branchname, commit_id) != 0) {
+    if (ret == REPO_NOT_FOUND) {
+        cerr << "File not found in commit " << commit_id << endl;
         return -1;
-    }
-
-    if (vms_checkout_files(commit_id.c_str()) != 0) {
+    } else if (ret != REPO_OK) {
+        cerr << "Error occurred in restoring " << filename << " from commit " << commit_id << ": " << repo_strerror(ret) << endl;
         return -1;
     }
 
-    // check HEAD to point to this branch
-    create_and_write_file(".vms/HEAD", branchname, 0644);
-
-    // clear staging area
-    map<string, string> index;  
-    restore< map<string, string> >(index, ".vms/index");
-    index.clear();
-    save< map<string, string> >(index, ".vms/index");
+    cout << *content << endl;
 
     return 0;
 
 }
 
-int vms_checkout_files(const char* commit_id) {
-    Commit commit;
-    restore_commit_from_shortened_id(commit_id, commit);
-
-    map<string, string>::iterator m_elem;
-    map<string, string> commit_map = commit.get_map();
-
-    // Ask user to verify they want to checkout these files.
-    cout << commit.log_string() << "\n";
-    cout << "Checking out files\n";
-    for (m_elem = commit_map.begin(); m_elem != commit_map.end(); m_elem++) {
-        cout << "    " << m_elem->first << "\n";
+int vms_blame(const char* commit_id, const char* filename) {
+    string start_id;
+    if (commit_id != NULL) {
+        start_id = commit_id;
+    } else {
+        const string* head;
+        int ret = vms_repository().head_id(head);
+        if (ret != REPO_OK) {
+            cerr << "Error occurred in finding the current commit: " << repo_strerror(ret) << endl;
+            return -1;
+        }
+        start_id = *head;
     }
-    cout << endl;
 
-    string input;
-    cout << "Warning: checking out files may overwrite uncommitted changes for these files in the working directory.\n";
-    cout << "Confirm checkout (y/n):";
-    getline(cin, input);
+    // Lines mean nothing in binary files
+    const string* content;
+    int ret = vms_repository().file_at(start_id, filename, content);
+    if (ret == REPO_OK && is_binary_content(*content)) {
+        cerr << "Cannot blame binary file " << filename << endl;
+        return -1;
+    }
 
-    while (input != "y" && input != "n") {
-        cout << "Please enter y or n:";
-        getline(cin, input);
+    Blame blame;
+    if (ret == REPO_OK) {
+        ret = vms_repository().blame(start_id, filename, blame, content);
     }
 
-    if (input == "n") {
-        cout << "Aborting checkout..." << endl;
+    if (ret == REPO_NOT_FOUND) {
+        cerr << "File not found in commit " << start_id << endl;
+        return -1;
+    } else if (ret != REPO_OK) {
+        cerr << "Error occurred in blaming " << filename << ": " << repo_strerror(ret) << endl;
         return -1;
     }
 
-    // User answered "y", so checkout files.
-    for (m_elem = commit_map.begin(); m_elem != commit_map.end(); m_elem++) {
-        
-        create_directory_path(m_elem->first);
+    // Each line is shown with the short id and date of its commit, and its line number
+    vector<string> labels(blame.commits.size());
+    for (size_t i = 0; i < blame.commits.size(); i++) {
+        const Commit* commit;
+        ret = vms_repository().get_commit(blame.commits[i], commit);
+        if (ret != REPO_OK) {
+            cerr << "Error occurred in restoring commit " << blame.commits[i].hex() << ": " << repo_strerror(ret) << endl;
+            return -1;
+        }
 
-        Blob file;
-        restore_blob_from_full_id(m_elem->second, file);
+        char date[16];
+        time_t datetime = commit->get_datetime();
+        strftime(date, sizeof(date), "%Y-%m-%d", localtime(&datetime));
+        labels[i] = blame.commits[i].hex().substr(0, 8) + " " + date + " ";
+    }
 
-        ofstream ofs(m_elem->first);
-        ofs << file.get_content();
-        ofs.close();
+    vector<LineRef> lines;
+    split_lines(*content, lines);
+    int width = to_string(lines.size()).length();
+
+    stringstream blame_output;
+    for (size_t i = 0; i < lines.size() && i < blame.lines.size(); i++) {
+        blame_output << labels[blame.lines[i]] << setw(width) << i + 1 << ") ";
+        blame_output.write(lines[i].data, lines[i].length);
+        if (lines[i].length == 0 || lines[i].data[lines[i].length - 1] != '\n') {
+            blame_output << '\n';
+        }
     }
 
+    cout << blame_output.rdbuf();
     return 0;
-
 }
 
-int vms_checkout_files(const char* commit_id, const int argc, char* const argv[]) {
-    Commit commit;
-    restore_commit_from_shortened_id(commit_id, commit);
+/** Helper for writing the patch of a single file for vms_diff. Missing ids stand for files absent from that side, and
+ * the new version is read from the working directory instead of the objects directory if from_working_tree is set. **/
+int write_file_diff(ObjectStore& objects, ObjectStore& staging, const string& filename, const ObjectId* from_id, const ObjectId* to_id, bool from_working_tree) {
+    string from_content;
+    string to_content;
 
-    // Validate all files to find ones that exist
-    map<string, string>::iterator m_elem;
-    list<string> found_files;
-    for (int i = 4; i < argc; i++) {
-        if (commit.find_in_map_and_get_iter(string(argv[i]), m_elem)) {
-            found_files.push_back(m_elem->first);
+    if (from_id != NULL) {
+        Blob file;
+        int ret = restore_blob_from_full_id(objects, staging, *from_id, file);
+        if (ret != 0) {
+            cerr << "Error occurred in restoring " << filename << ": " << restore_strerror(ret) << endl;
+            return -1;
         }
+        from_content = file.release_content();
     }
 
-    if (found_files.empty()) {
-        cout << "No files match those provided. Exiting..." << endl;
-        return -1;
-    }
-
-    // Ask user to verify that they want to checkout these files.
-    list<string>::iterator l_elem;
-    cout << commit.log_string() << "\n";
-    cout << "Checking out files\n";
-    for (l_elem = found_files.begin(); l_elem != found_files.end(); l_elem++) {
-        cout << "    " << *l_elem << "\n";
+    if (to_id != NULL) {
+        Blob file;
+        if (from_working_tree) {
+            ifstream ifs(filename);
+            if (!ifs.is_open()) {
+                cerr << "Error occurred: unable to open file " << filename << " for diff" << endl;
+                return -1;
+            }
+            file.set_content(ifs);
+        } else {
+            int ret = restore_blob_from_full_id(objects, staging, *to_id, file);
+            if (ret != 0) {
+                cerr << "Error occurred in restoring " << filename << ": " << restore_strerror(ret) << endl;
+                return -1;
+            }
+        }
+        to_content = file.release_content();
     }
-    cout << endl;
 
-    string input;
-    cout << "Warning: checking out files may overwrite uncommitted changes for these files in the working directory.\n";
-    cout << "Confirm checkout (y/n):";
-    getline(cin, input);
-
-    while (input != "y" && input != "n") {
-        cout << "Please enter y or n:";
-        getline(cin, input);
+    cout << "diff --vms a/" << filename << " b/" << filename << "\n";
+    if (from_id == NULL) {
+        cout << "new file\n";
+    } else if (to_id == NULL) {
+        cout << "deleted file\n";
     }
 
-    if (input == "n") {
-        cout << "Aborting checkout..." << endl;
-        return -1;
+    if (is_binary_content(from_content) || is_binary_content(to_content)) {
+        cout << "Binary files " << (from_id != NULL ? "a/" + filename : "/dev/null") << " and " << (to_id != NULL ? "b/" + filename : "/dev/null") << " differ\n";
+        return 0;
     }
 
-    // User answered "y", so checkout files.
-    for (l_elem = found_files.begin(); l_elem != found_files.end(); l_elem++) {
-        
-        commit.find_in_map_and_get_iter(*l_elem, m_elem);
-        create_directory_path(m_elem->first);
+    vector<LineRef> from_lines;
+    vector<LineRef> to_lines;
+    split_lines(from_content, from_lines);
+    split_lines(to_content, to_lines);
 
-        Blob file;
-        restore_blob_from_full_id(m_elem->second, file);
+    vector<DiffChange> changes;
+    diff_lines(from_lines, to_lines, changes);
 
-        ofstream ofs(m_elem->first);
-        ofs << file.get_content();
-        ofs.close();
-    }
+    cout << "--- " << (from_id != NULL ? "a/" + filename : "/dev/null") << "\n";
+    cout << "+++ " << (to_id != NULL ? "b/" + filename : "/dev/null") << "\n";
+    write_unified_hunks(cout, from_lines, to_lines, changes);
 
     return 0;
-
 }
 
-int vms_merge(const char* given_branch, const char* current_branch) {
-
-    // Ask user confirmation before merging
-    string input;
-    cout << "Merging branch " << given_branch << " into branch " << current_branch << "...\n\n";
-
-    cout << "Warning: merging will clear the staging area and may overwrite uncommitted changes for files in the working directory\n";
-    cout << "If you have uncommitted changes you would like to keep, please commit before proceeding with merge\n\n";
-    cout << "Confirm merge (y/n):";
-    getline(cin, input);
-
-    while (input != "y" && input != "n") {
-        cout << "Please enter y or n:";
-        getline(cin, input);
-    }
+int vms_diff(const char* from_commit_id, const char* to_commit_id, bool staged, DiffMode mode, const int n_paths, char* const paths[]) {
+    Pathspec pathspec(n_paths, paths);
 
-    if (input == "n") {
-        cout << "Aborting merge..." << endl;
+    ObjectStore* objects;
+    ObjectStore* staging;
+    if (command_stores(objects, staging) != 0) {
         return -1;
     }
 
-
-    string split_id;
-    string given_branch_id;
-    string current_branch_id;
-
-    find_split_point(string(given_branch), string(current_branch), split_id);
-
-    get_id_from_branch(given_branch, given_branch_id);
-    get_id_from_branch(current_branch, current_branch_id);
-
-    if (split_id == given_branch_id) { // Given branch is a direct ancestor of current branch, so do nothing
-        cout << "\nNot necessary to merge. Given branch is direct ancestor of current branch" << endl;
-        return 0;
+    // Files as they would be committed: the current commit updated with the staging area
+    Commit parent_commit;
+    if (restore_command_commit(*objects, NULL, parent_commit) != 0) {
+        return -1;
     }
 
-    string current_branch_fpath;
-    if (get_branch_path(current_branch_fpath) != 0) {
+    map<string, ObjectId> index;
+    int ret = load_index(index);
+    if (ret != 0) {
+        cerr << "Error occurred in loading index: " << restore_strerror(ret) << endl;
         return -1;
     }
 
-    // Otherwise, perform merge
-
-    // Load all commits:
-    Commit given_commit;
-    Commit current_commit;
-    Commit split_commit;
+    map<string, ObjectId> staged_map = parent_commit.get_map();
+    apply_index(staged_map, index);
 
-    restore_commit_from_shortened_id(given_branch_id.c_str(), given_commit);
-    restore_commit_from_shortened_id(current_branch_id.c_str(), current_commit);
-    restore_commit_from_shortened_id(split_id.c_str(), split_commit);
+    // Old side: given commit, otherwise the current commit (for --staged) or the staged files
+    Commit from_commit;
+    const map<string, ObjectId>* from_map;
 
-    map<string, string> given_map = given_commit.get_map();
-    map<string, string> current_map = current_commit.get_map();
-    map<string, string> split_map = split_commit.get_map();
-
-    map<string, string>::iterator map_it;
-
-    stringstream updated_files;
-    updated_files << "Updated files\n";
+    if (from_commit_id != NULL) {
+        if (restore_command_commit(*objects, from_commit_id, from_commit) != 0) {
+            return -1;
+        }
+        from_map = &from_commit.get_map();
+    } else if (staged) {
+        from_map = &parent_commit.get_map();
+    } else {
+        from_map = &staged_map;
+    }
+
+    // New side: given commit, otherwise the staged files (for --staged) or the working directory
+    Commit to_commit;
+    map<string, ObjectId> working_map;
+    const map<string, ObjectId>* to_map = &working_map;
+    bool to_working_tree = false;
+
+    if (to_commit_id != NULL) {
+        if (restore_command_commit(*objects, to_commit_id, to_commit) != 0) {
+            return -1;
+        }
+        to_map = &to_commit.get_map();
+    } else if (staged) {
+        to_map = &staged_map;
+    } else {
+        // Hash the working copies of the selected files known to either side; files missing from disk are deleted
+        to_working_tree = true;
+
+        vector<map<string, ObjectId>::const_iterator> selected;
+        pathspec.select(*from_map, selected);
+        pathspec.select(staged_map, selected);
+
+        set<string> candidates;
+        for (size_t i = 0; i < selected.size(); i++) {
+            candidates.insert(selected[i]->first);
+        }
 
-    if (split_id == current_branch_id) { // Current branch is a direct ancestor of given branch, so fast forward merge
-        cout << "\nCurrent branch " << current_branch << " is a direct ancestor of given branch " << given_branch << "\n";
-        cout << "Fast-forward merging branch " << current_branch <<  " into branch " << given_branch << endl;
-        
-        // Update files in current working directory with versions in given commit if modified or new, relative to current commit's version.
+        set<string>::iterator c_it;
+        for (c_it = candidates.begin(); c_it != candidates.end(); ++c_it) {
+            if (is_valid_file(c_it->c_str())) {
+                ifstream ifs(*c_it);
+                Blob file(ifs);
+                working_map.insert(working_map.end(), make_pair(*c_it, file.id()));
+            }
+        }
+    }
 
-        for (map_it = given_map.begin(); map_it != given_map.end(); map_it++) {
+    // Walk both sorted maps together, skipping files whose blob ids are identical without loading them
+    int n_new = 0;
+    int n_modified = 0;
+    int n_deleted = 0;
+
+    map<string, ObjectId>::const_iterator from_it = from_map->begin();
+    map<string, ObjectId>::const_iterator to_it = to_map->begin();
+
+    while (from_it != from_map->end() || to_it != to_map->end()) {
+        const string* filename;
+        const ObjectId* from_id = NULL;
+        const ObjectId* to_id = NULL;
+
+        if (to_it == to_map->end() || (from_it != from_map->end() && from_it->first < to_it->first)) {
+            filename = &from_it->first;
+            from_id = &from_it->second;
+            ++from_it;
+        } else if (from_it == from_map->end() || to_it->first < from_it->first) {
+            filename = &to_it->first;
+            to_id = &to_it->second;
+            ++to_it;
+        } else {
+            filename = &from_it->first;
+            from_id = &from_it->second;
+            to_id = &to_it->second;
+            ++from_it;
+            ++to_it;
+        }
 
-            RelativeFileStatus rfs = find_relative_file_status(map_it->first, given_map, current_map);
-            
-            if (rfs == NEW || rfs == MODIFIED) {
-                create_directory_path(map_it->first);
+        if ((from_id != NULL && to_id != NULL && *from_id == *to_id) || !pathspec.matches(*filename)) {
+            continue;
+        }
 
-                Blob file;
-                restore_blob_from_full_id(map_it->second, file);
+        if (from_id == NULL) {
+            n_new++;
+        } else if (to_id == NULL) {
+            n_deleted++;
+        } else {
+            n_modified++;
+        }
 
-                ofstream ofs(map_it->first);
-                ofs << file.get_content();
-                ofs.close();
+        if (mode == DIFF_NAME_ONLY) {
+            cout << *filename << "\n";
 
-                updated_files << "    " << map_it->first << "\n";
+        } else if (mode == DIFF_STAT) {
+            if (from_id == NULL) {
+                cout << "    new file:    " << *filename << "\n";
+            } else if (to_id == NULL) {
+                cout << "    deleted:     " << *filename << "\n";
+            } else {
+                cout << "    modified:    " << *filename << "\n";
             }
-            
 
+        } else if (write_file_diff(*objects, *staging, *filename, from_id, to_id, to_working_tree) != 0) {
+            return -1;
         }
-
-        // Update current branch to point to commit pointed to by given branch (fast forward)   
-        create_and_write_file(current_branch_fpath.c_str(), given_branch_id.c_str(), 0644);
-
-        // Load index, clear it, and save it back
-        map<string, string> index;  
-        restore< map<string, string> >(index, ".vms/index");
-        index.clear();
-        save< map<string, string> >(index, ".vms/index");
-
-        cout << updated_files.rdbuf() << endl;
-
-        return 0;
     }
 
-    // Otherwise, standard merge
-
-    // add all tracked files to a iterable set
-    set<string> files_union;
-    set<string>::iterator files_it;
-
-    for (map_it = given_map.begin(); map_it != given_map.end(); map_it++) {
-        files_union.insert(map_it->first);
+    if (mode == DIFF_STAT) {
+        cout << "\n" << n_new + n_modified + n_deleted << " files changed (" << n_new << " new, " << n_modified << " modified, " << n_deleted << " deleted)\n";
     }
 
-    for (map_it = current_map.begin(); map_it != current_map.end(); map_it++) {
-        files_union.insert(map_it->first);
-    }
+    cout << flush;
+    return 0;
+}
 
-    for (map_it = split_map.begin(); map_it != split_map.end(); map_it++) {
-        files_union.insert(map_it->first);
+int vms_checkout_branch(const char* branchname) {
+    string commit_id;
+    const Commit* commit;
+    if (vms_repository().branch_id(branchname, commit_id) != REPO_OK || vms_repository().get_commit(commit_id, commit) != REPO_OK) {
+        cerr << "Error occurred: unable to read branch " << branchname << endl;
+        return -1;
     }
 
-    // load index and clear it
-    map<string, string> index;  
-    restore< map<string, string> >(index, ".vms/index");
-    index.clear();
-
-    RelativeFileStatus given_status;
-    RelativeFileStatus current_status;
+    // Ask user to verify thay want to checkout the branch.
+    cout << "Checking out branch " << branchname << "...\n";
+    cout << commit->log_string() << "\n";
+    cout << commit->tracked_files_string() << "\n";
 
-    for (files_it = files_union.begin(); files_it != files_union.end(); files_it++) {
-        given_status = find_relative_file_status(*files_it, given_map, split_map);
-        current_status = find_relative_file_status(*files_it, current_map, split_map);
+    if (!confirm("Warning: checking out branch will overwrite all uncommitted changes in the current branch.\n")) {
+        cout << "Aborting checkout..." << endl;
+        return -1;
+    }
 
-        if ( (given_status == NEW && current_status == NOT_FOUND) || 
-             (given_status == MODIFIED && current_status == DELETED) || 
-             (given_status == MODIFIED && current_status == UNMODIFIED) ) {
-            
-            // Case 1: Check out file into current directory and add file to staging area (for commit at end)
-            map_it = given_map.find(*files_it);
-            create_directory_path(map_it->first);
+    int ret = vms_repository().checkout_branch(branchname);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in checking out branch " << branchname << ": " << repo_strerror(ret) << endl;
+        return -1;
+    }
 
-            Blob file;
-            restore_blob_from_full_id(map_it->second, file);
+    return 0;
 
-            ofstream ofs(map_it->first);
-            ofs << file.get_content();
-            ofs.close();
+}
 
-            index[map_it->first] = map_it->second;
+/** Helper for confirming and checking out the given files of a commit for the vms_checkout_files commands **/
+static int checkout_commit_files(const string& commit_id, const Commit& commit, const vector<string>& filenames) {
+    // Ask user to verify they want to checkout these files.
+    cout << commit.log_string() << "\n";
+    cout << "Checking out files\n";
+    for (size_t i = 0; i < filenames.size(); i++) {
+        cout << "    " << filenames[i] << "\n";
+    }
+    cout << endl;
 
-            updated_files << "    " << map_it-> first << "\n";
+    if (!confirm("Warning: checking out files may overwrite uncommitted changes for these files in the working directory.\n")) {
+        cout << "Aborting checkout..." << endl;
+        return -1;
+    }
 
-        } else if ( (current_status == NEW && given_status == NOT_FOUND) ||
-                    (current_status == MODIFIED && given_status == DELETED) ||
-                    (current_status == MODIFIED && given_status == UNMODIFIED) ) {
+    // User answered "y", so checkout files.
+    int ret = vms_repository().checkout_files(commit_id, &filenames);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in checking out files: " << repo_strerror(ret) << endl;
+        return -1;
+    }
 
-            // Case 2: Do nothing: no need to check out or update because already in current directory and tracking
+    return 0;
+}
 
-        } else {  // Case 3
+int vms_checkout_files(const char* commit_id) {
+    const Commit* commit;
+    if (vms_repository().get_commit(commit_id, commit) != REPO_OK) {
+        cerr << "Error occurred: unable to restore commit " << commit_id << endl;
+        return -1;
+    }
 
-            if (given_status == DELETED && current_status == UNMODIFIED) {
-                // Change in given branch and no change in current branch
-                // Stage file to be deleted in current branch
-                index[*files_it] = STAGE_DELETE;
+    const SparseCheckout* sparse;
+    if (vms_repository().get_sparse_checkout(sparse) != REPO_OK) {
+        cerr << "Error occurred in reading " << CONFIG_PATH << endl;
+        return -1;
+    }
 
-            } else if (current_status == DELETED && given_status == UNMODIFIED) {
-                // Change in current branch and no change in given branch
-                // Do nothing
+    vector<map<string, ObjectId>::const_iterator> selected;
+    sparse->paths.select(commit->get_map(), selected);
 
-            } else if (given_status == DELETED && current_status == DELETED) {
-                // Both deleted
-                // Do nothing
+    vector<string> filenames;
+    for (size_t i = 0; i < selected.size(); i++) {
+        filenames.push_back(selected[i]->first);
+    }
 
-            } else if (given_status == UNMODIFIED && current_status == UNMODIFIED) {
-                // Both unmodified
-                // Do nothing
+    if (filenames.empty() && sparse->is_sparse()) {
+        cout << "No files of the commit are in the sparse set (sparse.paths in " << CONFIG_PATH << "). Exiting..." << endl;
+        return -1;
+    }
 
-            } else {  // otherwise, exist in both: either modified/modified or new/new: check equality and merge if not equal
-                // Check equality: if equal, then do nothing. Move on to next file. If not, then merge conflict.
-                map_it = given_map.find(*files_it);
-                string given_ver_id = map_it->second;
+    return checkout_commit_files(commit_id, *commit, filenames);
 
-                map_it = current_map.find(*files_it);
-                string current_ver_id = map_it->second;
+}
 
-                if (given_ver_id != current_ver_id) {
-                    cout << "\nMerge conflict for file " << *files_it << ": please resolve and commit resolved changes" << endl;
-                    // Overwrite file in current directory with formatted and add file to staging area (for commit at end)
+int vms_checkout_files(const char* commit_id, const int argc, char* const argv[]) {
+    const Commit* commit;
+    if (vms_repository().get_commit(commit_id, commit) != REPO_OK) {
+        cerr << "Error occurred: unable to restore commit " << commit_id << endl;
+        return -1;
+    }
 
-                    create_directory_path(*files_it);
+    // Validate all files to find ones that exist
+    vector<string> found_files;
+    for (int i = 4; i < argc; i++) {
+        if (commit->map_contains(argv[i])) {
+            found_files.push_back(argv[i]);
+        }
+    }
 
-                    Blob given_ver_file;
-                    restore_blob_from_full_id(given_ver_id, given_ver_file);
+    if (found_files.empty()) {
+        cout << "No files match those provided. Exiting..." << endl;
+        return -1;
+    }
 
-                    Blob current_ver_file;
-                    restore_blob_from_full_id(current_ver_id, current_ver_file);
+    return checkout_commit_files(commit_id, *commit, found_files);
 
-                    ofstream ofs(*files_it);
-                    ofs << "<<<<<<< version: " << current_branch << "\n";
-                    ofs << current_ver_file.get_content() << "\n";
-                    ofs << "=======\n";
-                    ofs << given_ver_file.get_content() << "\n";
-                    ofs << ">>>>>>> version: " << given_branch << endl;
+}
 
-                    ofs.close();
+int vms_checkout_files(const char* commit_id, const Pathspec& pathspec) {
+    const Commit* commit;
+    if (vms_repository().get_commit(commit_id, commit) != REPO_OK) {
+        cerr << "Error occurred: unable to restore commit " << commit_id << endl;
+        return -1;
+    }
 
-                    // blob the new file contents and save it.
-                    ifstream ifs(*files_it);
-                    if (!ifs.is_open()) {
-                        cerr << "Error occurred: unable to open file " << *files_it << " for staging" << endl;
-                        return -1;
-                    }
-                    Blob merged_file(ifs);
+    vector<map<string, ObjectId>::const_iterator> selected;
+    pathspec.select(commit->get_map(), selected);
 
-                    string merged_file_id = merged_file.hash();
+    vector<string> filenames;
+    for (size_t i = 0; i < selected.size(); i++) {
+        filenames.push_back(selected[i]->first);
+    }
 
-                    // Puts filepath and hash into the index map and save the updated index
-                    index[*files_it] = merged_file_id;
+    if (filenames.empty()) {
+        cout << "No files match those provided. Exiting..." << endl;
+        return -1;
+    }
 
-                    string merged_file_id_prefix;
-                    string merged_file_id_suffix;
+    return checkout_commit_files(commit_id, *commit, filenames);
+}
 
-                    split_prefix_suffix(merged_file_id, merged_file_id_prefix, merged_file_id_suffix, PREFIX_LENGTH);
-                    // Save blob in objects
-                    ostringstream obj_path;
-                    obj_path << ".vms/objects/" << merged_file_id_prefix;
-                    mkdir(obj_path.str().c_str(), 0755);
-                    obj_path << "/" << merged_file_id_suffix;
-                    save<Blob>(merged_file, obj_path.str());
+int vms_merge(const char* given_branch, const char* current_branch) {
 
-                    updated_files << "    " << map_it->first << "\n";
+    // Ask user confirmation before merging
+    string input;
+    cout << "Merging branch " << given_branch << " into branch " << current_branch << "...\n\n";
 
-                }
-            }
+    cout << "Warning: merging will clear the staging area and may overwrite uncommitted changes for files in the working directory\n";
+    cout << "If you have uncommitted changes you would like to keep, please commit before proceeding with merge\n\n";
+    cout << "Confirm merge (y/n):";
+    getline(cin, input);
 
-        }
+    while (input != "y" && input != "n") {
+        cout << "Please enter y or n:";
+        getline(cin, input);
     }
 
-
-    // Create new child commit using current branch as first parent and template
-    ostringstream message;
-    message << "Merge branch " << given_branch << " into branch " << current_branch;
-    Commit child_commit(message.str());
-    child_commit.set_second_parent(given_branch_id);
-
-    // Update with index.
-    for (map_it=index.begin(); map_it!=index.end(); map_it++) {
-        // if staged is file mapped to STAGE_DELETE string, remove it from commit tree
-        if (map_it->second == STAGE_DELETE) {
-            child_commit.remove_from_map(map_it->first);
-        } else { // puts entry to commit map
-            child_commit.put_to_map(map_it->first, map_it->second);
-        }
+    if (input == "n") {
+        cout << "Aborting merge..." << endl;
+        return -1;
     }
 
-    // Clear index and save it back;
-    index.clear();
-    save< map<string, string> >(index, ".vms/index");
-
-    // Update commit pointed to by current branch
-    string child_commit_id = child_commit.hash();
-    create_and_write_file(current_branch_fpath.c_str(), child_commit_id.c_str(), 0644);
-
-    //Push formatted commit string to log and save
-    stack<string> log;
-    restore< stack<string> >(log, ".vms/log");
-
-    log.push(child_commit.log_string());
-    save< stack<string> >(log, ".vms/log");
-
-    // Serialize and save your commit.
-    ostringstream obj_path;
+    // Compute and commit the merge, then bring the working directory up to date with it
+    MergeResult result;
+    int ret = vms_repository().merge(given_branch, false, result);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in merging branch " << given_branch << ": " << repo_strerror(ret) << endl;
+        return -1;
+    }
 
-    string child_commit_id_prefix;
-    string child_commit_id_suffix;
-    split_prefix_suffix(child_commit_id, child_commit_id_prefix, child_commit_id_suffix, PREFIX_LENGTH);
+    if (result.outcome == MERGE_UP_TO_DATE) { // Given branch is a direct ancestor of current branch, so do nothing
+        cout << "\nNot necessary to merge. Given branch is direct ancestor of current branch" << endl;
+        return 0;
+    }
 
-    obj_path << ".vms/objects/" << child_commit_id_prefix;
-    make_dir(obj_path.str().c_str());
-    obj_path << "/" << child_commit_id_suffix;
+    if (result.outcome == MERGE_FAST_FORWARD) {
+        cout << "\nCurrent branch " << current_branch << " is a direct ancestor of given branch " << given_branch << "\n";
+        cout << "Fast-forward merging branch " << current_branch <<  " into branch " << given_branch << endl;
+    }
 
-    save<Commit>(child_commit, obj_path.str());
+    for (size_t i = 0; i < result.conflicts.size(); i++) {
+        cout << "\nMerge conflict for file " << result.conflicts[i].path << ": please resolve and commit resolved changes" << endl;
+    }
 
-    // Change permissions of generated file.
-    int ret = chmod(obj_path.str().c_str(), 0444);
-    if (ret != 0) {
-        cerr << "Error occurred: failed to change permissions of commit file." << obj_path.str() << endl;
+    ret = vms_repository().checkout_merge(result);
+    if (ret != REPO_OK) {
+        cerr << "Error occurred in updating the working directory: " << repo_strerror(ret) << endl;
         return -1;
     }
 
+    stringstream updated_files;
+    updated_files << "Updated files\n";
+    for (size_t i = 0; i < result.updated.size(); i++) {
+        updated_files << "    " << result.updated[i].first << "\n";
+    }
     cout << updated_files.rdbuf() << endl;
 
     return 0;
-}
\ No newline at end of file
+}
+
+int vms_merge_check(const int n_branches, char* const branches[]) {
+    int status = 0;
+    for (int i = 0; i < n_branches; i++) {
+        MergeResult result;
+        int ret = vms_repository().merge(branches[i], true, result);
+        if (ret != REPO_OK) {
+            cerr << "Error occurred in checking merge of branch " << branches[i] << ": " << repo_strerror(ret) << endl;
+            return -1;
+        }
+
+        cout << branches[i] << ": ";
+        if (result.outcome == MERGE_UP_TO_DATE) {
+            cout << "up to date\n";
+        } else if (result.outcome == MERGE_FAST_FORWARD) {
+            cout << "fast-forward\n";
+        } else if (result.outcome == MERGE_CLEAN) {
+            cout << "merges cleanly\n";
+        } else {
+            cout << result.conflicts.size() << (result.conflicts.size() == 1 ? " conflict\n" : " conflicts\n");
+            for (size_t j = 0; j < result.conflicts.size(); j++) {
+                cout << "    " << result.conflicts[j].path << "\n";
+            }
+            status = 1;
+        }
+    }
+
+    cout << flush;
+    return status;
+}
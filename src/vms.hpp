@@ -1,7 +1,15 @@
 #ifndef VMS_HPP
 #define VMS_HPP
 
-int vms_init();
+#include "pathspec.hpp"
+
+class Repository;
+
+/* The Repository the commands operate through, shared for the lifetime of the process */
+Repository& vms_repository();
+
+/* store names the object store backend, "loose" or "log" (see config.hpp) */
+int vms_init(const char* store);
 
 int vms_stage(const char* filepath);
 
@@ -9,9 +17,11 @@ int vms_unstage(const char* filepath);
 
 int vms_commit(const char* msg);
 
-int vms_log();
+/* Displays the whole log, or only the commits changing any of the given files or directories relative to their first parent */
+int vms_log(const int n_paths, char* const paths[]);
 
-int vms_status(const char* arg0);
+/* Displays the status of the working tree, limited to the paths the given pathspec selects (see pathspec.hpp) */
+int vms_status(const char* arg0, const int n_specs, char* const specs[]);
 
 int vms_mkbranch(const char* branchname);
 
@@ -19,16 +29,34 @@ int vms_mkbranch(const char* branchname, const char* commit_id);
 
 int vms_rmbranch(const char* branchname);
 
-int vms_info(const char* commit_id);
+/* Displays a commit and the files it tracks that the given pathspec selects (see pathspec.hpp) */
+int vms_info(const char* commit_id, const int n_specs, char* const specs[]);
 
 int vms_info(const char* commit_id, const char* filename);
 
+/* Shows the commit that introduced each line of filename as of commit_id, or of the current commit if it is NULL */
+int vms_blame(const char* commit_id, const char* filename);
+
+enum DiffMode {
+    DIFF_PATCH,
+    DIFF_STAT,
+    DIFF_NAME_ONLY
+};
+
+int vms_diff(const char* from_commit_id, const char* to_commit_id, bool staged, DiffMode mode, const int n_paths, char* const paths[]);
+
 int vms_checkout_branch(const char* branchname);
 
 int vms_checkout_files(const char* commit_id);
 
 int vms_checkout_files(const char* commit_id, const int argc, char* const argv[]);
 
+/* Checks out the files of a commit that the given pathspec selects (see pathspec.hpp), whether or not they are in the sparse set */
+int vms_checkout_files(const char* commit_id, const Pathspec& pathspec);
+
 int vms_merge(const char* given_branch, const char* current_branch);
 
+/* Reports how each branch would merge into the current branch without changing anything. Returns 1 if any of them conflicts. */
+int vms_merge_check(const int n_branches, char* const branches[]);
+
 #endif // VMS_HPP
\ No newline at end of file
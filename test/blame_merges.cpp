@@ -0,0 +1,166 @@
+/*
+Blame across a merge
+
+Two branches change different lines of a file, one of them adds a file, and they are merged. Blaming
+the merge, and a commit after it, must credit each line to the commit on either branch that wrote
+it, and a file the merge took from the branch merged in to the commit there that added it, rather
+than crediting the merge with everything it brought in. Each blame is run twice, the second time
+from the cache in .vms/blame.
+
+Build and run with make check, or run bin/test_blame_merges <path to vms> once built.
+*/
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "repository.hpp"
+
+using namespace std;
+
+static string vms;
+
+/** Runs a vms command in the current directory, answering yes to any confirmation and discarding its output. Returns its exit status. **/
+static int run(const string& args) {
+    string command = "echo y | " + vms + " " + args + " >/dev/null 2>&1";
+    int status = system(command.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void write_file(const char* filename, const char* contents) {
+    ofstream ofs(filename);
+    ofs << contents;
+}
+
+/** Stages and commits the given file, setting commit_id to the new head. Returns false on failure. **/
+static bool commit_file(const char* filename, const char* contents, const char* message, string& commit_id) {
+    write_file(filename, contents);
+    if (run(string("stage ") + filename) != 0 || run(string("commit ") + message) != 0) {
+        fprintf(stderr, "Unable to commit %s\n", filename);
+        return false;
+    }
+
+    Repository repository;
+    const string* head;
+    if (repository.head_id(head) != REPO_OK) {
+        fprintf(stderr, "Unable to read the head commit\n");
+        return false;
+    }
+    commit_id = *head;
+    return true;
+}
+
+/** Checks that blaming filename as of commit_id credits its lines to the given commits, in order, printing any difference **/
+static bool check_blame(const string& commit_id, const char* filename, const vector<string>& expected) {
+    for (int pass = 0; pass < 2; pass++) {
+        Repository repository;
+        Blame blame;
+        const string* content;
+        int ret = repository.blame(commit_id, filename, blame, content);
+        if (ret != REPO_OK) {
+            fprintf(stderr, "Unable to blame %s: %s\n", filename, repo_strerror(ret));
+            return false;
+        }
+
+        bool same = blame.lines.size() == expected.size();
+        for (size_t i = 0; same && i < expected.size(); i++) {
+            same = blame.commits[blame.lines[i]].hex() == expected[i];
+        }
+        if (!same) {
+            fprintf(stderr, "Blame of %s as of %s%s:\n", filename, commit_id.c_str(), pass == 1 ? ", from the cache" : "");
+            for (size_t i = 0; i < blame.lines.size() || i < expected.size(); i++) {
+                fprintf(stderr, "    line %zu: %s, expected %s\n", i + 1,
+                    i < blame.lines.size() ? blame.commits[blame.lines[i]].hex().c_str() : "none", i < expected.size() ? expected[i].c_str() : "none");
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool blame_merge() {
+    if (run("init") != 0) {
+        fprintf(stderr, "Unable to initialize a repository\n");
+        return false;
+    }
+
+    string base, side, side_file, master, after;
+    if (!commit_file("f.txt", "one\ntwo\nthree\nfour\nfive\n", "base", base)) {
+        return false;
+    }
+
+    if (run("mkbranch side") != 0 || run("checkout branch side") != 0) {
+        fprintf(stderr, "Unable to create and check out branch side\n");
+        return false;
+    }
+    if (!commit_file("f.txt", "one\ntwo on side\nthree\nfour\nfive\n", "side", side) || !commit_file("g.txt", "from side\n", "side-file", side_file)) {
+        return false;
+    }
+
+    if (run("checkout branch master") != 0) {
+        fprintf(stderr, "Unable to check out branch master\n");
+        return false;
+    }
+    if (!commit_file("f.txt", "one\ntwo\nthree\nfour\nfive on master\n", "master", master)) {
+        return false;
+    }
+
+    if (run("merge side") != 0) {
+        fprintf(stderr, "Unable to merge side into master\n");
+        return false;
+    }
+    Repository repository;
+    const string* head;
+    if (repository.head_id(head) != REPO_OK) {
+        fprintf(stderr, "Unable to read the merge commit\n");
+        return false;
+    }
+    string merge = *head;
+
+    bool ok = check_blame(merge, "f.txt", {base, side, base, base, master});
+    ok = check_blame(merge, "g.txt", {side_file}) && ok;
+
+    // A later version is replayed from the merge's, which is cached by now
+    if (!commit_file("f.txt", "one after\ntwo on side\nthree\nfour\nfive on master\n", "after", after)) {
+        return false;
+    }
+    ok = check_blame(after, "f.txt", {after, side, base, base, master}) && ok;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <path to vms>\n", argv[0]);
+        return 2;
+    }
+
+    char resolved[PATH_MAX];
+    if (realpath(argv[1], resolved) == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    vms = resolved;
+
+    char directory[] = "/tmp/vms-test.XXXXXX";
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        perror("Unable to create a scratch directory");
+        return 2;
+    }
+
+    if (!blame_merge()) {
+        fprintf(stderr, "Repository kept in %s\n", directory);
+        return 1;
+    }
+
+    string command = string("rm -rf ") + directory;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "Unable to remove %s\n", directory);
+    }
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+Reading a damaged index
+
+An index is saved and then damaged: one byte of a path is flipped, and an entry is pointed past the
+end of the string table or at a path with no terminator there, with the checksum recomputed so only
+the entry is wrong. Both the mapped view and the full loader must reject each damaged file rather
+than return wrong paths or read beyond the file.
+
+Build and run with make check, or run bin/test_index_damage <path to vms> once built. Only the
+library is exercised, so the path to vms is not used.
+*/
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "crc32c.hpp"
+#include "index.hpp"
+
+using namespace std;
+
+static const char* const INDEX_PATH = ".vms/index";
+
+static vector<char> read_file(const char* filename) {
+    ifstream ifs(filename, ios::binary);
+    return vector<char>((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+}
+
+static void write_file(const char* filename, const vector<char>& contents) {
+    ofstream ofs(filename, ios::binary | ios::trunc);
+    ofs.write(contents.data(), contents.size());
+}
+
+/** Sets the checksum trailing an index image to match its contents **/
+static void reseal(vector<char>& image) {
+    uint32_t crc = crc32c(image.data(), image.size() - sizeof(uint32_t));
+    memcpy(image.data() + image.size() - sizeof(uint32_t), &crc, sizeof(uint32_t));
+}
+
+/** Checks that the index image, written out, is rejected by both readers, printing what accepted it otherwise **/
+static bool check_rejected(const char* damage, const vector<char>& image) {
+    write_file(INDEX_PATH, image);
+
+    bool ok = true;
+    IndexView view;
+    if (view.open(INDEX_PATH) != -1) {
+        fprintf(stderr, "The index view accepted an index with %s\n", damage);
+        ok = false;
+    }
+
+    map<string, ObjectId> index;
+    if (load_index(index, INDEX_PATH) != -2) {
+        fprintf(stderr, "The index loader accepted an index with %s\n", damage);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool damage_index() {
+    map<string, ObjectId> index;
+    index["a.txt"] = ObjectId::from_hex(string(OBJECT_ID_HEX_LENGTH, 'a'));
+    index["dir/b.txt"] = ObjectId::from_hex(string(OBJECT_ID_HEX_LENGTH, 'b'));
+    if (save_index(index, INDEX_PATH) != 0) {
+        fprintf(stderr, "Unable to save an index\n");
+        return false;
+    }
+
+    vector<char> saved = read_file(INDEX_PATH);
+    IndexHeader header;
+    memcpy(&header, saved.data(), sizeof(header));
+    size_t last_entry = sizeof(IndexHeader) + (header.n_entries - 1) * sizeof(IndexEntry);
+    size_t strtab = sizeof(IndexHeader) + header.n_entries * sizeof(IndexEntry);
+
+    IndexView view;
+    if (view.open(INDEX_PATH) != 0 || view.find("dir/b.txt") == NULL) {
+        fprintf(stderr, "Unable to read back the saved index\n");
+        return false;
+    }
+    view.close();
+
+    bool ok = true;
+
+    vector<char> image = saved;
+    image[strtab] ^= 1;
+    ok = check_rejected("a damaged path", image) && ok;
+
+    IndexEntry entry;
+    image = saved;
+    memcpy(&entry, image.data() + last_entry, sizeof(entry));
+    entry.path_offset = header.strtab_size;
+    memcpy(image.data() + last_entry, &entry, sizeof(entry));
+    reseal(image);
+    ok = check_rejected("a path beyond the string table", image) && ok;
+
+    image = saved;
+    memcpy(&entry, image.data() + last_entry, sizeof(entry));
+    entry.path_length--;
+    memcpy(image.data() + last_entry, &entry, sizeof(entry));
+    reseal(image);
+    ok = check_rejected("an unterminated path", image) && ok;
+
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <path to vms>\n", argv[0]);
+        return 2;
+    }
+
+    char directory[] = "/tmp/vms-test.XXXXXX";
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0 || mkdir(".vms", 0755) != 0) {
+        perror("Unable to create a scratch directory");
+        return 2;
+    }
+
+    if (!damage_index()) {
+        fprintf(stderr, "Repository kept in %s\n", directory);
+        return 1;
+    }
+
+    string command = string("rm -rf ") + directory;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "Unable to remove %s\n", directory);
+    }
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+Writers breaking stale repository locks at the same time
+
+Many processes start at once, each taking the repository lock and then dying while holding it, as
+a writer that crashed would, so every lock but the first is taken by breaking a stale one while
+the other processes try to break it too. Two writers must never hold the lock at once: each
+creates a marker file exclusively while it holds the lock, and finding the marker already there
+means a lock taken in between was lost to a process breaking a stale one.
+
+Build and run with make check, or run bin/test_lock_breakers <path to vms> once built. Only the
+library is exercised, so the path to vms is not used.
+*/
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "lock.hpp"
+
+using namespace std;
+
+static const int N_ROUNDS = 6;
+static const int N_WRITERS = 64;
+static const char* const MARKER_PATH = "holder";
+static const char* const SHARED_PATH = "shared";    // a byte for each writer that found the lock held by another
+static const char* const FAILED_PATH = "failed";    // a byte for each writer that could not take the lock
+
+/** Appends a byte to the file at path, counting an outcome the parent cannot collect from reaped children **/
+static void count(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd != -1) {
+        if (write(fd, "x", 1) != 1) {
+            perror(path);
+        }
+        close(fd);
+    }
+}
+
+/** Takes the lock in a child process once told to start, and dies holding it **/
+static void take_and_crash(int start_fd) {
+    char go;
+    RepoLock lock;
+    if (read(start_fd, &go, 1) != 1 || lock.acquire() != 0) {
+        count(FAILED_PATH);
+        _exit(1);
+    }
+
+    int fd = open(MARKER_PATH, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd == -1) {
+        count(SHARED_PATH);
+        _exit(1);
+    }
+    close(fd);
+    usleep(100);
+    unlink(MARKER_PATH);
+
+    _exit(0);   // without releasing the lock
+}
+
+/** Starts the writers of one round together, and waits for all of them **/
+static bool run_round() {
+    int start[2];
+    if (pipe(start) != 0) {
+        return false;
+    }
+
+    for (int i = 0; i < N_WRITERS; i++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            return false;
+        }
+        if (pid == 0) {
+            close(start[1]);
+            take_and_crash(start[0]);
+        }
+    }
+    close(start[0]);
+
+    // Children are reaped as they exit, so the stale locks they leave are seen as such at once
+    char go[N_WRITERS] = {0};
+    bool ok = write(start[1], go, sizeof(go)) == (ssize_t) sizeof(go);
+    close(start[1]);
+
+    while (wait(NULL) > 0 || errno == EINTR) {
+    }
+    return ok && errno == ECHILD;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <path to vms>\n", argv[0]);
+        return 2;
+    }
+
+    char directory[] = "/tmp/vms-test.XXXXXX";
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0 || mkdir(".vms", 0755) != 0) {
+        perror("Unable to create a scratch directory");
+        return 2;
+    }
+
+    signal(SIGCHLD, SIG_IGN);
+
+    bool ok = true;
+    for (int round = 0; round < N_ROUNDS && ok; round++) {
+        if (!run_round()) {
+            fprintf(stderr, "Unable to run the writers of round %d\n", round + 1);
+            ok = false;
+        }
+    }
+
+    signal(SIGCHLD, SIG_DFL);
+
+    struct stat s;
+    if (stat(SHARED_PATH, &s) == 0) {
+        fprintf(stderr, "%ld writers took the lock while another held it\n", (long) s.st_size);
+        ok = false;
+    }
+    if (stat(FAILED_PATH, &s) == 0) {
+        fprintf(stderr, "%ld writers could not take the lock\n", (long) s.st_size);
+        ok = false;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Repository kept in %s\n", directory);
+        return 1;
+    }
+
+    string command = string("rm -rf ") + directory;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "Unable to remove %s\n", directory);
+    }
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*
+Two processes taking turns writing to one log-structured object store
+
+A long-lived vms batch process commits, then the vms command line commits, then the batch process
+commits again. The batch process must notice the records the command line appended in between,
+rather than appending over them at the end of the log it last wrote, so vms fsck finds the store
+intact and the last commit has the file committed in between.
+
+Build and run with make check, or run bin/test_logstore_writers <path to vms> once built.
+*/
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <string>
+
+using namespace std;
+
+static string vms;
+
+/** Runs a vms command in the current directory, discarding its output. Returns its exit status. **/
+static int run(const string& args) {
+    string command = vms + " " + args + " >/dev/null 2>&1";
+    int status = system(command.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void write_file(const char* filename, const char* contents) {
+    ofstream ofs(filename);
+    ofs << contents;
+}
+
+/** A vms batch process, with pipes to its standard input and output **/
+struct Batch {
+    pid_t pid;
+    FILE* in;
+    FILE* out;
+};
+
+static bool start_batch(Batch& batch) {
+    int to_child[2];
+    int from_child[2];
+    if (pipe(to_child) != 0 || pipe(from_child) != 0) {
+        return false;
+    }
+
+    batch.pid = fork();
+    if (batch.pid == -1) {
+        return false;
+    }
+    if (batch.pid == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[1]);
+        close(from_child[0]);
+        execl(vms.c_str(), vms.c_str(), "batch", (char*) NULL);
+        _exit(127);
+    }
+
+    close(to_child[0]);
+    close(from_child[1]);
+    batch.in = fdopen(to_child[1], "w");
+    batch.out = fdopen(from_child[0], "r");
+    return batch.in != NULL && batch.out != NULL;
+}
+
+/** Sends a request to the batch process and reads its response. Returns false unless it is "ok". **/
+static bool request(Batch& batch, const string& line, string& payload) {
+    fprintf(batch.in, "%s\n", line.c_str());
+    fflush(batch.in);
+
+    char status[16];
+    unsigned long length;
+    if (fscanf(batch.out, "%15s %lu", status, &length) != 2 || fgetc(batch.out) != '\n') {
+        return false;
+    }
+
+    payload.resize(length);
+    if ((length > 0 && fread(&payload[0], 1, length, batch.out) != length) || fgetc(batch.out) != '\n') {
+        return false;
+    }
+    return strcmp(status, "ok") == 0;
+}
+
+static bool stop_batch(Batch& batch) {
+    fclose(batch.in);
+    fclose(batch.out);
+    int status;
+    return waitpid(batch.pid, &status, 0) == batch.pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/** Prints what went wrong and returns false, so checks read as conditions **/
+static bool fail(const char* what, const string& detail) {
+    fprintf(stderr, "%s: %s\n", what, detail.c_str());
+    return false;
+}
+
+static bool take_turns() {
+    if (run("init --store=log") != 0) {
+        return fail("Unable to initialize a repository", "vms init --store=log");
+    }
+
+    Batch batch;
+    if (!start_batch(batch)) {
+        return fail("Unable to start", vms + " batch");
+    }
+
+    bool ok = true;
+    string payload;
+
+    write_file("a.txt", "first\n");
+    if (!request(batch, "stage a.txt", payload) || !request(batch, "commit first", payload)) {
+        ok = fail("The batch process could not commit a.txt", payload);
+    }
+
+    write_file("b.txt", "second\n");
+    if (ok && (run("stage b.txt") != 0 || run("commit second") != 0)) {
+        ok = fail("The command line could not commit", "b.txt");
+    }
+
+    write_file("c.txt", "third\n");
+    string commit_id;
+    if (ok && (!request(batch, "stage c.txt", payload) || !request(batch, "commit third", commit_id))) {
+        ok = fail("The batch process could not commit c.txt", commit_id);
+    }
+
+    if (ok && (!request(batch, "info " + commit_id + " b.txt", payload) || payload != "second\n")) {
+        ok = fail("The last commit lost b.txt", payload);
+    }
+
+    if (!stop_batch(batch)) {
+        ok = fail("The batch process failed", vms + " batch");
+    }
+
+    if (ok && run("fsck") != 0) {
+        ok = fail("vms fsck found problems with the object store", "run it in the repository kept for details");
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <path to vms>\n", argv[0]);
+        return 2;
+    }
+
+    char resolved[PATH_MAX];
+    if (realpath(argv[1], resolved) == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    vms = resolved;
+
+    char directory[] = "/tmp/vms-test.XXXXXX";
+    if (mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        perror("Unable to create a scratch directory");
+        return 2;
+    }
+
+    if (!take_turns()) {
+        fprintf(stderr, "Repository kept in %s\n", directory);
+        return 1;
+    }
+
+    string command = string("rm -rf ") + directory;
+    if (system(command.c_str()) != 0) {
+        fprintf(stderr, "Unable to remove %s\n", directory);
+    }
+    return 0;
+}